@@ -0,0 +1,72 @@
+-- | A sampling profiler of native (cpp) stacks, see cbits/hs_profiler.cpp.
+--
+-- The output is in the folded format which can be fed to flamegraph.pl
+-- directly. Haskell code only shows up as frames of the RTS.
+module HStream.Base.Profiler
+  ( Profile (..)
+  , startProfiler
+  , stopProfiler
+  , isProfilerRunning
+  , profileFor
+  ) where
+
+import           Control.Concurrent (threadDelay)
+import           Control.Exception  (finally, onException)
+import           Control.Monad      (when)
+import           Data.Word          (Word64)
+import           Foreign.C.Types    (CBool (..), CInt (..))
+import           Foreign.Ptr        (Ptr, nullPtr)
+import           Z.Data.CBytes      (CBytes)
+import qualified Z.Foreign          as Z
+
+import           HStream.Foreign    (c_delete_string, peekStdStringToCBytesIdx)
+
+data Profile = Profile
+  { profileFolded  :: !CBytes
+    -- ^ One "root;...;leaf count" line per unique stack
+  , profileSamples :: !Word64
+  , profileDropped :: !Word64
+    -- ^ Samples dropped since the ring buffer was full
+  } deriving (Show)
+
+-- | Start sampling at the given frequency (Hz), throw if a profile is already
+-- running.
+startProfiler :: Int -> IO ()
+startProfiler frequency = do
+  ret <- hs_profiler_start (fromIntegral frequency)
+  when (ret /= 0) $
+    ioError $ userError "Start profiler failed, there may be a running one."
+
+-- | Stop sampling and return the profile, or Nothing if no profile is running.
+stopProfiler :: IO (Maybe Profile)
+stopProfiler = do
+  (str, (samples, (dropped, _))) <-
+    Z.withPrimSafe nullPtr $ \str' ->
+    Z.withPrimSafe 0 $ \samples' ->
+    Z.withPrimSafe 0 $ \dropped' ->
+      hs_profiler_stop str' samples' dropped'
+  if str == nullPtr
+     then pure Nothing
+     else do folded <- peekStdStringToCBytesIdx str 0 `finally` c_delete_string str
+             pure $ Just $ Profile folded samples dropped
+
+isProfilerRunning :: IO Bool
+isProfilerRunning = (/= 0) <$> hs_profiler_is_running
+
+-- | Profile for the given seconds.
+profileFor :: Int -> Int -> IO Profile
+profileFor seconds frequency = do
+  startProfiler frequency
+  threadDelay (seconds * 1000000) `onException` stopProfiler
+  maybe (ioError $ userError "Profiler was stopped by others") pure =<< stopProfiler
+
+foreign import ccall unsafe "hs_common.h hs_profiler_start"
+  hs_profiler_start :: CInt -> IO CInt
+
+-- It joins the drainer thread and symbolizes all the stacks, which may take
+-- a while.
+foreign import ccall safe "hs_profiler_stop"
+  hs_profiler_stop :: Ptr (Ptr Z.StdString) -> Ptr Word64 -> Ptr Word64 -> IO ()
+
+foreign import ccall unsafe "hs_common.h hs_profiler_is_running"
+  hs_profiler_is_running :: IO CBool
@@ -0,0 +1,118 @@
+{-# LANGUAGE MagicHash #-}
+
+-- | Lightweight sampled request tracing, see cbits/hs_tracing.cpp.
+--
+-- Spans recorded here share the per-thread ring buffers with the spans
+-- recorded by the cpp code, and all of them can be dumped as Chrome trace
+-- JSON (load it in chrome://tracing or ui.perfetto.dev).
+module HStream.Base.Tracing
+  ( TraceId
+  , SpanId
+  , traceBegin
+  , newSpanId
+  , withSpan
+  , withSpan'
+  , recordSpan
+  , setTraceSampleEvery
+  , getTraceSampleEvery
+  , clearTrace
+  , dumpChromeTrace
+  ) where
+
+import           Control.Exception (finally)
+import           Data.Word         (Word64, Word8)
+import           Foreign.Ptr       (Ptr)
+import           Z.Data.CBytes     (CBytes)
+import qualified Z.Data.Text       as ZT
+import qualified Z.Foreign         as Z
+
+import           HStream.Foreign   (BA#, c_delete_string,
+                                    peekStdStringToCBytesIdx)
+
+-- | 0 means the trace is not sampled.
+type TraceId = Word64
+type SpanId = Word64
+
+-- | Start a new trace, return 0 if the trace is not sampled.
+traceBegin :: IO TraceId
+traceBegin = hs_trace_begin
+{-# INLINE traceBegin #-}
+
+newSpanId :: IO SpanId
+newSpanId = hs_trace_new_span_id
+
+-- | Run the action in a span, which is a no-op if the trace is not sampled.
+withSpan :: TraceId -> SpanId -> ZT.Text -> IO a -> IO a
+withSpan traceId parentId name action =
+  withSpan' traceId parentId name "" (const action)
+{-# INLINE withSpan #-}
+
+-- | Like 'withSpan', with tags ("k1=v1,k2=v2") and the id of the new span,
+-- which can be used as the parent of child spans.
+withSpan' :: TraceId -> SpanId -> ZT.Text -> ZT.Text -> (SpanId -> IO a) -> IO a
+withSpan' 0 _ _ _ action = action 0
+withSpan' traceId parentId name tags action = do
+  spanId <- hs_trace_new_span_id
+  start <- hs_trace_now_us
+  action spanId `finally` do
+    end <- hs_trace_now_us
+    recordSpan traceId spanId parentId name tags start end
+
+-- | Record a span with explicit start and end time (monotonic microseconds).
+recordSpan
+  :: TraceId -> SpanId -> SpanId -> ZT.Text -> ZT.Text -> Word64 -> Word64
+  -> IO ()
+recordSpan 0 _ _ _ _ _ _ = pure ()
+recordSpan traceId spanId parentId name tags start end =
+  Z.withPrimVectorUnsafe (ZT.getUTF8Bytes name) $ \name' nameOff nameLen ->
+  Z.withPrimVectorUnsafe (ZT.getUTF8Bytes tags) $ \tags' tagsOff tagsLen ->
+    hs_trace_record traceId spanId parentId
+                    name' nameOff nameLen start end tags' tagsOff tagsLen
+
+-- | Sample one in every n requests, 0 disables tracing.
+setTraceSampleEvery :: Word64 -> IO ()
+setTraceSampleEvery = hs_trace_set_sample_every
+
+getTraceSampleEvery :: IO Word64
+getTraceSampleEvery = hs_trace_get_sample_every
+
+-- | Drop all the recorded spans.
+clearTrace :: IO ()
+clearTrace = hs_trace_clear
+
+dumpChromeTrace :: IO CBytes
+dumpChromeTrace = do
+  str <- hs_trace_dump
+  peekStdStringToCBytesIdx str 0 `finally` c_delete_string str
+
+-------------------------------------------------------------------------------
+
+foreign import ccall unsafe "hs_tracing.h hs_trace_begin"
+  hs_trace_begin :: IO Word64
+
+foreign import ccall unsafe "hs_tracing.h hs_trace_new_span_id"
+  hs_trace_new_span_id :: IO Word64
+
+foreign import ccall unsafe "hs_tracing.h hs_trace_now_us"
+  hs_trace_now_us :: IO Word64
+
+foreign import ccall unsafe "hs_tracing.h hs_trace_record"
+  hs_trace_record
+    :: Word64 -> Word64 -> Word64
+    -> BA# Word8 -> Int -> Int
+    -> Word64 -> Word64
+    -> BA# Word8 -> Int -> Int
+    -> IO ()
+
+foreign import ccall unsafe "hs_tracing.h hs_trace_set_sample_every"
+  hs_trace_set_sample_every :: Word64 -> IO ()
+
+foreign import ccall unsafe "hs_tracing.h hs_trace_get_sample_every"
+  hs_trace_get_sample_every :: IO Word64
+
+foreign import ccall unsafe "hs_tracing.h hs_trace_clear"
+  hs_trace_clear :: IO ()
+
+-- It walks all the buffers and formats the spans, which may take a while.
+foreign import ccall safe "hs_trace_dump"
+  hs_trace_dump :: IO (Ptr Z.StdString)
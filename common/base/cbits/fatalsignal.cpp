@@ -1,4 +1,5 @@
 #include "hs_common.h"
+#include "hs_coredump.h"
 
 #include <algorithm>
 #include <atomic>
@@ -65,6 +66,16 @@ static void unmap_callback(void* entry, size_t charge) {
   ++s_index;
 }
 
+// Regions registered by hs_coredump_exclude, they are already page aligned.
+static void add_excluded_region(uintptr_t start, size_t len) {
+  if (s_index >= max_num_segs) {
+    return;
+  }
+  sarray[s_index].start = start;
+  sarray[s_index].end = start + len;
+  ++s_index;
+}
+
 static void safe_print(const char msg[]) {
   auto _ = write(2, msg, std::strlen(msg));
 }
@@ -89,40 +100,19 @@ static void safe_print_unsigned(size_t num) {
   safe_print(buf);
 }
 
-// Construct this on startup, since it allocates on the heap and we don't want
-// to do that in a signal handler.  Leak it so we don't have to worry about
-// destruction order.
-folly::symbolizer::SafeStackTracePrinter* gStackTrace =
-    new folly::symbolizer::SafeStackTracePrinter();
-
-static void handle_fatal_signal(int sig) {
-  static std::atomic<pthread_t> insegv(0);
-  pthread_t old_val(0);
-
-  if (!insegv.compare_exchange_strong(old_val, pthread_self())) {
-    /* another thread is in the handler, suspend this one forever */
-    if (pthread_self() != old_val) {
-      pause();
-      _exit(EXIT_FAILURE);
-    }
-    /* recursive call from the same thread, give up and dump core*/
-    raise(SIGTRAP);
-    _exit(EXIT_FAILURE);
-  }
-
-  safe_print("handle_fatal_signal(): Caught coredump signal ");
-  safe_print_unsigned(sig);
-  safe_print("\n");
-
-  gStackTrace->printStackTrace(true);
+// Unmap the RocksDB cache entries and the regions registered by
+// hs_coredump_exclude, return false if the seg array can not be allocated.
+static bool unmap_segments() {
+  s_index = 0;
+  unmap_count = 0;
+  page_count = 0;
 
   // allocate a big enough VM to hold all segments
   sarray = (Segment*)mmap(nullptr, SEGMAP_SIZE, PROT_READ | PROT_WRITE,
                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
   if (sarray == (Segment*)MAP_FAILED) {
     safe_print("handle_fatal_signal(): allocate seg array failed.\n");
-    raise(SIGTRAP);
-    _exit(EXIT_FAILURE);
+    return false;
   }
 
   for (auto cache_weak_ptr :
@@ -133,12 +123,14 @@ static void handle_fatal_signal(int sig) {
       cache->ApplyToAllCacheEntries(unmap_callback, false);
     }
   }
+  // Large buffers (e.g. kafka requests) which are excluded by MADV_DONTDUMP,
+  // unmap them as well in case the advice did not take effect.
+  hstream::coredump::forEachExcluded(add_excluded_region);
 
   if (s_index == 0) {
-    // safe_print("handle_fatal_signal(): No rocksdb caches found.\n");
+    // safe_print("handle_fatal_signal(): Nothing to unmap.\n");
     munmap((void*)sarray, SEGMAP_SIZE);
-    raise(SIGTRAP);
-    return;
+    return true;
   }
 
   safe_print("handle_fatal_signal(): processed segments: ");
@@ -177,7 +169,40 @@ static void handle_fatal_signal(int sig) {
 
   // unmap the seg array
   munmap((void*)sarray, SEGMAP_SIZE);
+  return true;
+}
+
+// Construct this on startup, since it allocates on the heap and we don't want
+// to do that in a signal handler.  Leak it so we don't have to worry about
+// destruction order.
+folly::symbolizer::SafeStackTracePrinter* gStackTrace =
+    new folly::symbolizer::SafeStackTracePrinter();
+
+static void handle_fatal_signal(int sig) {
+  static std::atomic<pthread_t> insegv(0);
+  pthread_t old_val(0);
+
+  if (!insegv.compare_exchange_strong(old_val, pthread_self())) {
+    /* another thread is in the handler, suspend this one forever */
+    if (pthread_self() != old_val) {
+      pause();
+      _exit(EXIT_FAILURE);
+    }
+    /* recursive call from the same thread, give up and dump core*/
+    raise(SIGTRAP);
+    _exit(EXIT_FAILURE);
+  }
 
+  safe_print("handle_fatal_signal(): Caught coredump signal ");
+  safe_print_unsigned(sig);
+  safe_print("\n");
+
+  gStackTrace->printStackTrace(true);
+
+  if (!unmap_segments()) {
+    raise(SIGTRAP);
+    _exit(EXIT_FAILURE);
+  }
   raise(SIGTRAP);
 }
 
@@ -200,5 +225,9 @@ void setup_fatal_signal_handler() {
   }
 }
 
+size_t hs_coredump_unmap_excluded() {
+  return unmap_segments() ? page_count : 0;
+}
+
 // ----------------------------------------------------------------------------
 }
@@ -0,0 +1,208 @@
+#include "hs_alloc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <string>
+
+#include <folly/memory/JemallocNodumpAllocator.h>
+#include <folly/memory/Malloc.h>
+
+#ifndef MALLOCX_ARENA
+#define MALLOCX_ARENA(a) ((((int)(a)) + 1) << 20)
+#endif
+#ifndef MALLOCX_TCACHE_NONE
+#define MALLOCX_TCACHE_NONE (((int)(-1 + 2)) << 8)
+#endif
+
+// ----------------------------------------------------------------------------
+// Per-subsystem allocation arenas, see hs_alloc.h
+//
+// The jemalloc functions are weak symbols declared by folly, so this works
+// (and falls back to malloc) whether jemalloc is linked or not.
+
+namespace {
+
+struct alignas(64) ArenaCounters {
+  std::atomic<uint64_t> num_allocs{0};
+  std::atomic<uint64_t> alloc_bytes{0};
+};
+
+struct Arenas {
+  Arenas() {
+    jemalloc = folly::usingJEMalloc();
+    for (int i = HS_ARENA_DEFAULT + 1; jemalloc && i < HS_ARENA_COUNT; ++i) {
+#ifdef FOLLY_JEMALLOC_NODUMP_ALLOCATOR_SUPPORTED
+      // The read arena only holds the copies of record payloads, which are
+      // useless in a core dump, see also hs_coredump.h. Index 0 means the
+      // nodump arena can not be created, use a plain one instead.
+      if (i == HS_ARENA_READ) {
+        read_nodump = new folly::JemallocNodumpAllocator();
+        if (read_nodump->getArenaIndex() != 0) {
+          je_index[i] = read_nodump->getArenaIndex();
+          continue;
+        }
+      }
+#endif
+      unsigned idx;
+      size_t len = sizeof(idx);
+      if (mallctl("arenas.create", &idx, &len, nullptr, 0) != 0) {
+        jemalloc = false;
+        break;
+      }
+      je_index[i] = idx;
+    }
+    // Switching arenas is on the hot path, so skip the name lookup.
+    if (jemalloc && mallctlnametomib("thread.arena", thread_arena_mib,
+                                     &thread_arena_miblen) != 0) {
+      jemalloc = false;
+    }
+  }
+
+  int set_thread_arena(unsigned idx, unsigned* prev) {
+    size_t len = sizeof(unsigned);
+    return mallctlbymib(thread_arena_mib, thread_arena_miblen, prev,
+                        prev ? &len : nullptr, &idx, sizeof(idx));
+  }
+
+  bool jemalloc;
+  // Index of the jemalloc arena, the default one is unused since it means
+  // the automatic arena of each thread.
+  unsigned je_index[HS_ARENA_COUNT] = {0};
+  size_t thread_arena_mib[2];
+  size_t thread_arena_miblen = 2;
+  ArenaCounters counters[HS_ARENA_COUNT];
+#ifdef FOLLY_JEMALLOC_NODUMP_ALLOCATOR_SUPPORTED
+  folly::JemallocNodumpAllocator* read_nodump = nullptr;
+#endif
+};
+
+Arenas& arenas() {
+  // Leaked, it may still be used by other threads during exit.
+  static Arenas* a = new Arenas();
+  return *a;
+}
+
+bool valid_arena(int64_t arena) {
+  return arena >= HS_ARENA_DEFAULT && arena < HS_ARENA_COUNT;
+}
+
+template <typename T> T read_mallctl(const std::string& name) {
+  T value = 0;
+  size_t len = sizeof(value);
+  if (mallctl(name.c_str(), &value, &len, nullptr, 0) != 0) {
+    return 0;
+  }
+  return value;
+}
+
+// Read the allocated and resident bytes of a jemalloc arena.
+void read_arena(unsigned idx, uint64_t* allocated, uint64_t* resident) {
+  auto prefix = "stats.arenas." + std::to_string(idx);
+  *allocated = read_mallctl<size_t>(prefix + ".small.allocated") +
+               read_mallctl<size_t>(prefix + ".large.allocated");
+  *resident = read_mallctl<size_t>(prefix + ".resident");
+}
+
+} // namespace
+
+namespace hstream { namespace alloc {
+
+ArenaScope::ArenaScope(hs_arena_t arena) : prev_(-1) {
+  auto& a = arenas();
+  if (!a.jemalloc || arena == HS_ARENA_DEFAULT || !valid_arena(arena)) {
+    return;
+  }
+  unsigned prev;
+  if (a.set_thread_arena(a.je_index[arena], &prev) == 0) {
+    prev_ = prev;
+  }
+}
+
+ArenaScope::~ArenaScope() {
+  if (prev_ >= 0) {
+    arenas().set_thread_arena(prev_, nullptr);
+  }
+}
+
+void bindThreadArena(hs_arena_t arena) {
+  auto& a = arenas();
+  if (!a.jemalloc || arena == HS_ARENA_DEFAULT || !valid_arena(arena)) {
+    return;
+  }
+  a.set_thread_arena(a.je_index[arena], nullptr);
+}
+
+}} // namespace hstream::alloc
+
+extern "C" {
+// ----------------------------------------------------------------------------
+
+void* hs_arena_malloc(HsInt arena, size_t size) {
+  auto& a = arenas();
+  if (!valid_arena(arena)) {
+    arena = HS_ARENA_DEFAULT;
+  }
+  a.counters[arena].num_allocs.fetch_add(1, std::memory_order_relaxed);
+  a.counters[arena].alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (a.jemalloc && arena != HS_ARENA_DEFAULT && size > 0) {
+    // Bypass the thread cache, which may hold memory of other arenas.
+    return mallocx(size,
+                   MALLOCX_ARENA(a.je_index[arena]) | MALLOCX_TCACHE_NONE);
+  }
+  return malloc(size);
+}
+
+void hs_arena_free(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  if (arenas().jemalloc) {
+    // Return it to its own arena instead of the thread cache.
+    dallocx(ptr, MALLOCX_TCACHE_NONE);
+    return;
+  }
+  free(ptr);
+}
+
+bool hs_arena_stats(HsInt arena, uint64_t* allocated, uint64_t* resident,
+                    uint64_t* num_allocs, uint64_t* alloc_bytes) {
+  auto& a = arenas();
+  *allocated = 0;
+  *resident = 0;
+  *num_allocs = 0;
+  *alloc_bytes = 0;
+  if (!valid_arena(arena)) {
+    return false;
+  }
+  *num_allocs = a.counters[arena].num_allocs.load(std::memory_order_relaxed);
+  *alloc_bytes = a.counters[arena].alloc_bytes.load(std::memory_order_relaxed);
+  if (!a.jemalloc) {
+    return false;
+  }
+
+  // Refresh the cached stats of jemalloc
+  uint64_t epoch = 1;
+  size_t len = sizeof(epoch);
+  mallctl("epoch", &epoch, &len, &epoch, len);
+
+  if (arena != HS_ARENA_DEFAULT) {
+    read_arena(a.je_index[arena], allocated, resident);
+    return true;
+  }
+  // The default arena accounts for everything not in the other arenas.
+  uint64_t total_allocated = read_mallctl<size_t>("stats.allocated");
+  uint64_t total_resident = read_mallctl<size_t>("stats.resident");
+  for (int i = HS_ARENA_DEFAULT + 1; i < HS_ARENA_COUNT; ++i) {
+    uint64_t x, y;
+    read_arena(a.je_index[i], &x, &y);
+    total_allocated -= std::min(total_allocated, x);
+    total_resident -= std::min(total_resident, y);
+  }
+  *allocated = total_allocated;
+  *resident = total_resident;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+}
@@ -0,0 +1,151 @@
+#include "hs_coredump.h"
+
+#include <atomic>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------
+// Core dump exclusion registry, see hs_coredump.h
+//
+// The registry is read by the fatal signal handler, so it is a fixed table
+// of atomics instead of a container: a slot is taken by a CAS on its start
+// address, and the handler skips slots whose length is not set yet.
+
+namespace {
+
+constexpr size_t kMaxRegions = 4096;
+
+struct Region {
+  std::atomic<uintptr_t> start{0};
+  std::atomic<size_t> len{0};
+};
+
+Region gRegions[kMaxRegions];
+
+uintptr_t page_size() {
+  static const uintptr_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+// The whole pages inside [addr, addr + len), false if there is none.
+bool inner_pages(void* addr, size_t len, uintptr_t* start, size_t* pages_len) {
+  uintptr_t mask = ~(page_size() - 1);
+  uintptr_t begin = ((uintptr_t)addr + page_size() - 1) & mask;
+  uintptr_t end = ((uintptr_t)addr + len) & mask;
+  if (!addr || end <= begin) {
+    return false;
+  }
+  *start = begin;
+  *pages_len = end - begin;
+  return true;
+}
+
+bool register_region(uintptr_t start, size_t len) {
+  for (auto& region : gRegions) {
+    uintptr_t expected = 0;
+    if (region.start.compare_exchange_strong(expected, start)) {
+      region.len.store(len, std::memory_order_release);
+      return true;
+    }
+  }
+  return false;
+}
+
+void unregister_region(uintptr_t start, size_t len) {
+  for (auto& region : gRegions) {
+    if (region.start.load(std::memory_order_acquire) == start &&
+        region.len.load(std::memory_order_acquire) == len) {
+      region.len.store(0, std::memory_order_release);
+      region.start.store(0, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+} // namespace
+
+namespace hstream { namespace coredump {
+
+void forEachExcluded(void (*f)(uintptr_t start, size_t len)) {
+  for (auto& region : gRegions) {
+    uintptr_t start = region.start.load(std::memory_order_acquire);
+    size_t len = region.len.load(std::memory_order_acquire);
+    if (start && len) {
+      f(start, len);
+    }
+  }
+}
+
+NoDumpBuffer::NoDumpBuffer(size_t size) : data_(nullptr), size_(size) {
+  mapped_ = (size + page_size() - 1) & ~(page_size() - 1);
+  if (mapped_ == 0) {
+    mapped_ = page_size();
+  }
+  void* p = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  data_ = static_cast<uint8_t*>(p);
+  hs_coredump_exclude(data_, mapped_);
+}
+
+NoDumpBuffer::~NoDumpBuffer() { release(); }
+
+NoDumpBuffer::NoDumpBuffer(NoDumpBuffer&& other) noexcept
+    : data_(other.data_), size_(other.size_), mapped_(other.mapped_) {
+  other.data_ = nullptr;
+}
+
+NoDumpBuffer& NoDumpBuffer::operator=(NoDumpBuffer&& other) noexcept {
+  if (this != &other) {
+    release();
+    data_ = other.data_;
+    size_ = other.size_;
+    mapped_ = other.mapped_;
+    other.data_ = nullptr;
+  }
+  return *this;
+}
+
+void NoDumpBuffer::release() {
+  if (data_) {
+    // No need to MADV_DODUMP since the pages are unmapped.
+    uintptr_t start;
+    size_t len;
+    if (inner_pages(data_, mapped_, &start, &len)) {
+      unregister_region(start, len);
+    }
+    munmap(data_, mapped_);
+    data_ = nullptr;
+  }
+}
+
+}} // namespace hstream::coredump
+
+extern "C" {
+// ----------------------------------------------------------------------------
+
+bool hs_coredump_exclude(void* addr, size_t len) {
+  uintptr_t start;
+  size_t pages_len;
+  if (!inner_pages(addr, len, &start, &pages_len)) {
+    return false;
+  }
+  madvise((void*)start, pages_len, MADV_DONTDUMP);
+  return register_region(start, pages_len);
+}
+
+void hs_coredump_include(void* addr, size_t len) {
+  uintptr_t start;
+  size_t pages_len;
+  if (!inner_pages(addr, len, &start, &pages_len)) {
+    return;
+  }
+  unregister_region(start, pages_len);
+  madvise((void*)start, pages_len, MADV_DODUMP);
+}
+
+// ----------------------------------------------------------------------------
+}
@@ -0,0 +1,235 @@
+#include "hs_common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <signal.h>
+#include <string>
+#include <sys/time.h>
+#include <thread>
+#include <vector>
+
+#include <folly/Demangle.h>
+#include <folly/Format.h>
+#include <folly/experimental/symbolizer/StackTrace.h>
+#include <folly/experimental/symbolizer/Symbolizer.h>
+
+// ----------------------------------------------------------------------------
+// Sampling CPU profiler
+//
+// A SIGPROF timer (ITIMER_PROF, which counts the cpu time of the whole
+// process) interrupts the running thread, and the signal handler captures
+// the native stack into a lock-free ring buffer. A background thread drains
+// the ring buffer and aggregates the stacks, which are only symbolized when
+// the profile is stopped. So nothing in the signal handler allocates or
+// takes a lock.
+//
+// Similar to fatalsignal.cpp, this works on native frames only, haskell
+// code shows up as frames of the RTS.
+
+namespace {
+
+constexpr size_t kMaxDepth = 64;
+constexpr size_t kNumSlots = 8192;
+// Frames of the signal handler itself and the signal trampoline.
+constexpr size_t kSkipFrames = 2;
+
+enum SlotState : int { SLOT_EMPTY = 0, SLOT_WRITING = 1, SLOT_FULL = 2 };
+
+struct Slot {
+  std::atomic<int> state{SLOT_EMPTY};
+  size_t depth{0};
+  uintptr_t addrs[kMaxDepth];
+};
+
+struct Profiler {
+  std::atomic<bool> enabled{false};
+  std::atomic<size_t> write_pos{0};
+  std::atomic<uint64_t> samples{0};
+  std::atomic<uint64_t> dropped{0};
+  Slot slots[kNumSlots];
+
+  // Serializes start and stop.
+  std::mutex control_mutex;
+  bool running{false};
+  bool handler_installed{false};
+  std::thread drainer;
+
+  // Protects the following, which are shared with the drainer.
+  std::mutex mutex;
+  std::condition_variable drainer_cv;
+  bool stop_drainer{false};
+  std::map<std::vector<uintptr_t>, uint64_t> stacks;
+};
+
+// Leak it like fatalsignal.cpp, a signal may still be delivered during exit.
+Profiler* gProfiler = new Profiler();
+
+void handle_sigprof(int) {
+  auto* p = gProfiler;
+  if (!p->enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  int saved_errno = errno;
+  size_t idx = p->write_pos.fetch_add(1, std::memory_order_relaxed) % kNumSlots;
+  Slot& slot = p->slots[idx];
+  int expected = SLOT_EMPTY;
+  if (!slot.state.compare_exchange_strong(expected, SLOT_WRITING,
+                                          std::memory_order_acquire)) {
+    // The drainer is behind, drop this sample.
+    p->dropped.fetch_add(1, std::memory_order_relaxed);
+    errno = saved_errno;
+    return;
+  }
+  ssize_t n = folly::symbolizer::getStackTraceSafe(slot.addrs, kMaxDepth);
+  slot.depth = n > 0 ? n : 0;
+  slot.state.store(SLOT_FULL, std::memory_order_release);
+  p->samples.fetch_add(1, std::memory_order_relaxed);
+  errno = saved_errno;
+}
+
+// Must be called with the mutex held or after the drainer exits.
+void drain(Profiler* p) {
+  for (size_t i = 0; i < kNumSlots; ++i) {
+    Slot& slot = p->slots[i];
+    if (slot.state.load(std::memory_order_acquire) != SLOT_FULL) {
+      continue;
+    }
+    if (slot.depth > kSkipFrames) {
+      std::vector<uintptr_t> stack(slot.addrs + kSkipFrames,
+                                   slot.addrs + slot.depth);
+      p->stacks[std::move(stack)]++;
+    }
+    slot.state.store(SLOT_EMPTY, std::memory_order_release);
+  }
+}
+
+bool set_timer(int frequency) {
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = frequency > 0 ? 1000000 / frequency : 0;
+  timer.it_value = timer.it_interval;
+  return setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+}
+
+// Symbolize the aggregated stacks into the folded format used by
+// flamegraph.pl: "root;...;leaf count" per line.
+std::string fold(const std::map<std::vector<uintptr_t>, uint64_t>& stacks) {
+  folly::symbolizer::Symbolizer symbolizer(
+      folly::symbolizer::LocationInfoMode::DISABLED);
+  std::map<uintptr_t, std::string> names;
+  auto name_of = [&](uintptr_t addr) -> const std::string& {
+    auto it = names.find(addr);
+    if (it != names.end()) {
+      return it->second;
+    }
+    folly::symbolizer::SymbolizedFrame frame;
+    uintptr_t addrs[1] = {addr};
+    symbolizer.symbolize(addrs, &frame, 1);
+    std::string name = frame.found && frame.name
+                           ? folly::demangle(frame.name).toStdString()
+                           : folly::sformat("{:#x}", addr);
+    // ';' is the frame separator in the folded format
+    std::replace(name.begin(), name.end(), ';', ':');
+    return names.emplace(addr, std::move(name)).first->second;
+  };
+
+  std::string out;
+  for (const auto& [stack, count] : stacks) {
+    for (size_t i = stack.size(); i > 0; --i) {
+      // Return addresses point to the instruction after the call, except
+      // the innermost frame which is the interrupted pc.
+      uintptr_t addr = i == 1 ? stack[i - 1] : stack[i - 1] - 1;
+      out += name_of(addr);
+      out += i == 1 ? ' ' : ';';
+    }
+    out += std::to_string(count);
+    out += '\n';
+  }
+  return out;
+}
+
+} // namespace
+
+extern "C" {
+// ----------------------------------------------------------------------------
+
+// Start sampling at the given frequency (Hz). Return 0 on success, -1 if a
+// profile is already running or the timer can not be set.
+int hs_profiler_start(int frequency) {
+  auto* p = gProfiler;
+  std::lock_guard<std::mutex> guard(p->control_mutex);
+  if (p->running || frequency <= 0 || frequency > 1000000) {
+    return -1;
+  }
+  if (!p->handler_installed) {
+    // The handler is never uninstalled, since a pending SIGPROF may still be
+    // delivered after the timer is disarmed.
+    struct sigaction sa;
+    sa.sa_handler = handle_sigprof;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+      return -1;
+    }
+    p->handler_installed = true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(p->mutex);
+    p->stacks.clear();
+    p->stop_drainer = false;
+  }
+  p->samples.store(0);
+  p->dropped.store(0);
+  p->enabled.store(true);
+  if (!set_timer(frequency)) {
+    p->enabled.store(false);
+    return -1;
+  }
+  p->running = true;
+  p->drainer = std::thread([p] {
+    std::unique_lock<std::mutex> lock(p->mutex);
+    while (!p->stop_drainer) {
+      drain(p);
+      p->drainer_cv.wait_for(lock, std::chrono::milliseconds(50));
+    }
+  });
+  return 0;
+}
+
+// Stop sampling and return the folded stacks, which must be freed by the
+// caller. Nothing is returned if no profile is running.
+void hs_profiler_stop(std::string** folded_out, uint64_t* samples_out,
+                      uint64_t* dropped_out) {
+  auto* p = gProfiler;
+  std::lock_guard<std::mutex> guard(p->control_mutex);
+  if (!p->running) {
+    return;
+  }
+  set_timer(0);
+  p->enabled.store(false);
+  {
+    std::lock_guard<std::mutex> lock(p->mutex);
+    p->stop_drainer = true;
+  }
+  p->drainer_cv.notify_all();
+  p->drainer.join();
+  p->running = false;
+
+  drain(p);
+  *folded_out = new std::string(fold(p->stacks));
+  *samples_out = p->samples.load();
+  *dropped_out = p->dropped.load();
+  p->stacks.clear();
+}
+
+bool hs_profiler_is_running() {
+  return gProfiler->enabled.load(std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+}
@@ -0,0 +1,284 @@
+#include "hs_tracing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Request tracing
+//
+// Each thread owns a fixed size ring buffer of spans, so recording a span is
+// a few stores into memory only touched by that thread. The slots are
+// seqlocks: the dumper copies a slot and retries nothing, a slot which is
+// being overwritten is simply skipped. Old spans are overwritten once the
+// ring is full, which is fine for tracing.
+//
+// The buffer of a thread is retired when the thread exits (e.g. a worker of
+// the safe foreign calls of the RTS), and only the last kMaxRetiredBuffers
+// retired buffers are kept, so threads coming and going do not grow the
+// memory of the tracer.
+
+namespace {
+
+constexpr size_t kSlotsPerThread = 4096;
+constexpr size_t kMaxNameLen = 64;
+constexpr size_t kMaxTagsLen = 128;
+constexpr size_t kMaxRetiredBuffers = 64;
+
+struct SpanRecord {
+  // Odd while the slot is being written.
+  std::atomic<uint64_t> seq{0};
+  uint64_t trace_id;
+  uint64_t span_id;
+  uint64_t parent_id;
+  uint64_t start_us;
+  uint64_t end_us;
+  uint8_t name_len;
+  uint8_t tags_len;
+  char name[kMaxNameLen];
+  char tags[kMaxTagsLen];
+};
+
+struct SpanCopy {
+  uint64_t trace_id, span_id, parent_id, start_us, end_us;
+  std::string name;
+  std::string tags;
+};
+
+struct ThreadBuffer {
+  explicit ThreadBuffer(long tid) : tid(tid) {}
+
+  const long tid;
+  // Only written by the owner thread.
+  std::atomic<uint64_t> pos{0};
+  // Spans before this are cleared, only written by hs_trace_clear.
+  std::atomic<uint64_t> start{0};
+  SpanRecord slots[kSlotsPerThread];
+};
+
+struct Tracer {
+  std::atomic<uint64_t> sample_every{0};
+  std::atomic<uint64_t> sample_counter{0};
+  std::atomic<uint64_t> next_trace_id{1};
+  std::atomic<uint64_t> next_span_id{1};
+
+  std::mutex mutex;
+  // Buffers of the running threads.
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  // Buffers of exited threads, oldest first, so that the spans of short
+  // lived threads can still be dumped.
+  std::deque<std::shared_ptr<ThreadBuffer>> retired;
+};
+
+Tracer* gTracer = new Tracer();
+
+// Registers the buffer of a thread, and retires it when the thread exits.
+struct LocalBuffer {
+  LocalBuffer() : buffer(std::make_shared<ThreadBuffer>(syscall(SYS_gettid))) {
+    std::lock_guard<std::mutex> lock(gTracer->mutex);
+    gTracer->buffers.push_back(buffer);
+  }
+
+  ~LocalBuffer() {
+    std::lock_guard<std::mutex> lock(gTracer->mutex);
+    auto& buffers = gTracer->buffers;
+    buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer),
+                  buffers.end());
+    gTracer->retired.push_back(std::move(buffer));
+    // A dump holding a dropped buffer keeps it alive until it is done.
+    if (gTracer->retired.size() > kMaxRetiredBuffers) {
+      gTracer->retired.pop_front();
+    }
+  }
+
+  std::shared_ptr<ThreadBuffer> buffer;
+};
+
+ThreadBuffer* local_buffer() {
+  thread_local LocalBuffer local;
+  return local.buffer.get();
+}
+
+bool read_slot(const SpanRecord& slot, SpanCopy& out) {
+  uint64_t seq1 = slot.seq.load(std::memory_order_acquire);
+  if (seq1 == 0 || seq1 & 1) {
+    return false;
+  }
+  out.trace_id = slot.trace_id;
+  out.span_id = slot.span_id;
+  out.parent_id = slot.parent_id;
+  out.start_us = slot.start_us;
+  out.end_us = slot.end_us;
+  out.name.assign(slot.name, std::min<size_t>(slot.name_len, kMaxNameLen));
+  out.tags.assign(slot.tags, std::min<size_t>(slot.tags_len, kMaxTagsLen));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.seq.load(std::memory_order_relaxed) == seq1;
+}
+
+void append_json_string(std::string& out, const std::string& s) {
+  out += '"';
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  out += '"';
+}
+
+void append_span(std::string& out, long pid, long tid, const SpanCopy& span) {
+  out += "{\"name\":";
+  append_json_string(out, span.name);
+  out += ",\"ph\":\"X\",\"ts\":" + std::to_string(span.start_us) +
+         ",\"dur\":" +
+         std::to_string(span.end_us > span.start_us
+                            ? span.end_us - span.start_us
+                            : 0) +
+         ",\"pid\":" + std::to_string(pid) + ",\"tid\":" +
+         std::to_string(tid) + ",\"args\":{\"trace_id\":" +
+         std::to_string(span.trace_id) +
+         ",\"span_id\":" + std::to_string(span.span_id) +
+         ",\"parent_id\":" + std::to_string(span.parent_id);
+  // "k1=v1,k2=v2" -> "k1":"v1","k2":"v2"
+  size_t begin = 0;
+  while (begin < span.tags.size()) {
+    size_t end = span.tags.find(',', begin);
+    if (end == std::string::npos) {
+      end = span.tags.size();
+    }
+    std::string kv = span.tags.substr(begin, end - begin);
+    size_t eq = kv.find('=');
+    if (eq != std::string::npos && eq > 0) {
+      out += ',';
+      append_json_string(out, kv.substr(0, eq));
+      out += ':';
+      append_json_string(out, kv.substr(eq + 1));
+    }
+    begin = end + 1;
+  }
+  out += "}}";
+}
+
+} // namespace
+
+extern "C" {
+// ----------------------------------------------------------------------------
+
+uint64_t hs_trace_begin() {
+  auto* t = gTracer;
+  uint64_t every = t->sample_every.load(std::memory_order_relaxed);
+  if (every == 0) {
+    return 0;
+  }
+  if (t->sample_counter.fetch_add(1, std::memory_order_relaxed) % every != 0) {
+    return 0;
+  }
+  return t->next_trace_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t hs_trace_new_span_id() {
+  return gTracer->next_span_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t hs_trace_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void hs_trace_record(uint64_t trace_id, uint64_t span_id, uint64_t parent_id,
+                     const char* name, HsInt name_off, HsInt name_len,
+                     uint64_t start_us, uint64_t end_us, const char* tags,
+                     HsInt tags_off, HsInt tags_len) {
+  if (trace_id == 0) {
+    return;
+  }
+  auto* buffer = local_buffer();
+  uint64_t pos = buffer->pos.load(std::memory_order_relaxed);
+  SpanRecord& slot = buffer->slots[pos % kSlotsPerThread];
+  uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.trace_id = trace_id;
+  slot.span_id = span_id;
+  slot.parent_id = parent_id;
+  slot.start_us = start_us;
+  slot.end_us = end_us;
+  slot.name_len = std::min<size_t>(name_len > 0 ? name_len : 0, kMaxNameLen);
+  memcpy(slot.name, name + name_off, slot.name_len);
+  slot.tags_len = std::min<size_t>(tags_len > 0 ? tags_len : 0, kMaxTagsLen);
+  memcpy(slot.tags, tags + tags_off, slot.tags_len);
+  slot.seq.store(seq + 2, std::memory_order_release);
+  buffer->pos.store(pos + 1, std::memory_order_release);
+}
+
+void hs_trace_set_sample_every(uint64_t n) {
+  gTracer->sample_every.store(n, std::memory_order_relaxed);
+}
+
+uint64_t hs_trace_get_sample_every() {
+  return gTracer->sample_every.load(std::memory_order_relaxed);
+}
+
+void hs_trace_clear() {
+  std::lock_guard<std::mutex> lock(gTracer->mutex);
+  for (auto& buffer : gTracer->buffers) {
+    buffer->start.store(buffer->pos.load(std::memory_order_acquire),
+                        std::memory_order_relaxed);
+  }
+  // Nothing is recorded into them any more.
+  gTracer->retired.clear();
+}
+
+std::string* hs_trace_dump() {
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(gTracer->mutex);
+    buffers = gTracer->buffers;
+    buffers.insert(buffers.end(), gTracer->retired.begin(),
+                   gTracer->retired.end());
+  }
+  long pid = getpid();
+  auto* out = new std::string("{\"traceEvents\":[");
+  bool first = true;
+  SpanCopy span;
+  for (auto& buffer : buffers) {
+    uint64_t end = buffer->pos.load(std::memory_order_acquire);
+    uint64_t begin = buffer->start.load(std::memory_order_relaxed);
+    if (end - begin > kSlotsPerThread) {
+      begin = end - kSlotsPerThread;
+    }
+    for (uint64_t i = begin; i < end; ++i) {
+      if (!read_slot(buffer->slots[i % kSlotsPerThread], span)) {
+        continue;
+      }
+      if (!first) {
+        *out += ',';
+      }
+      first = false;
+      append_span(*out, pid, buffer->tid, span);
+    }
+  }
+  *out += "],\"displayTimeUnit\":\"ms\"}";
+  return out;
+}
+
+// ----------------------------------------------------------------------------
+}
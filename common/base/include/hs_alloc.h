@@ -0,0 +1,71 @@
+#pragma once
+
+#include <HsFFI.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ----------------------------------------------------------------------------
+// Per-subsystem allocation arenas
+//
+// If the process runs with jemalloc (linked, or LD_PRELOAD), each subsystem
+// gets its own arena so that its allocated and resident memory can be told
+// apart. Otherwise everything falls back to malloc, and only the counters of
+// hs_arena_malloc are available.
+//
+// Memory from hs_arena_malloc must be freed by hs_arena_free (e.g. as a
+// ForeignPtr with p_hs_arena_free), since the plain free() would put it into
+// the thread cache, from which it is reused by allocations of other arenas.
+
+typedef enum {
+  HS_ARENA_DEFAULT = 0,
+  HS_ARENA_READ = 1,
+  HS_ARENA_WRITE = 2,
+  HS_ARENA_KAFKA_NET = 3,
+  HS_ARENA_COUNT
+} hs_arena_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Like malloc, return NULL on failure.
+void* hs_arena_malloc(HsInt arena, size_t size);
+
+// Free the memory returned by hs_arena_malloc, of any arena.
+void hs_arena_free(void* ptr);
+
+// Return true if the allocated and resident bytes are available, i.e. the
+// process is running with jemalloc. The counters are always available.
+bool hs_arena_stats(HsInt arena, uint64_t* allocated, uint64_t* resident,
+                    uint64_t* num_allocs, uint64_t* alloc_bytes);
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
+
+#ifdef __cplusplus
+namespace hstream { namespace alloc {
+
+// Bind the current thread to the arena until the scope exits, so that all
+// allocations in between (including the ones inside folly and LogDevice) are
+// accounted to it. A no-op without jemalloc.
+class ArenaScope {
+public:
+  explicit ArenaScope(hs_arena_t arena);
+  ~ArenaScope();
+
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+  // The arena index of jemalloc to restore, -1 if nothing to restore.
+  int64_t prev_;
+};
+
+// Bind the current thread to the arena for the rest of its life, for threads
+// which only serve one subsystem.
+void bindThreadArena(hs_arena_t arena);
+
+}} // namespace hstream::alloc
+#endif
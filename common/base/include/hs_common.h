@@ -1,6 +1,7 @@
 #pragma once
 
 #include <HsFFI.h>
+#include <stdbool.h>
 
 // ----------------------------------------------------------------------------
 
@@ -12,6 +13,12 @@ extern "C" {
 
 void setup_sigsegv_handler();
 
+// ----------------------------------------------------------------------------
+// Profiler
+
+int hs_profiler_start(int frequency);
+bool hs_profiler_is_running();
+
 // ----------------------------------------------------------------------------
 #ifdef __cplusplus
 } /* end extern "C" */
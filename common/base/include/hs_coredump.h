@@ -0,0 +1,69 @@
+#pragma once
+
+#include <HsFFI.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ----------------------------------------------------------------------------
+// Exclude large buffers from core dumps
+//
+// The excluded regions are marked by MADV_DONTDUMP when they are registered,
+// and as a fallback they are also unmapped by the fatal signal handler (see
+// fatalsignal.cpp) before the core is dumped. Only the whole pages inside a
+// region are excluded, so that nothing sharing a page with it is lost.
+//
+// A region must be removed before it is freed, otherwise the memory reused
+// by others may be missing from the dump.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Return false if the region is too small to exclude any page, or if the
+// registry is full (in which case it is still marked by MADV_DONTDUMP).
+bool hs_coredump_exclude(void* addr, size_t len);
+void hs_coredump_include(void* addr, size_t len);
+
+// Unmap the registered regions (and the RocksDB cache entries), which is
+// what the fatal signal handler does before dumping core. Return the number
+// of 4KiB pages unmapped. Only for the handler and the tests.
+size_t hs_coredump_unmap_excluded();
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
+
+#ifdef __cplusplus
+namespace hstream { namespace coredump {
+
+// Call f(start, len) for each registered region (page aligned). It neither
+// allocates nor locks, so it can be used in a signal handler.
+void forEachExcluded(void (*f)(uintptr_t start, size_t len));
+
+// A page aligned buffer which is excluded from core dumps while alive, for
+// large buffers of data (e.g. kafka requests) which is useless in a dump.
+class NoDumpBuffer {
+public:
+  // Throw std::bad_alloc on failure.
+  explicit NoDumpBuffer(size_t size);
+  ~NoDumpBuffer();
+
+  NoDumpBuffer(NoDumpBuffer&& other) noexcept;
+  NoDumpBuffer& operator=(NoDumpBuffer&& other) noexcept;
+  NoDumpBuffer(const NoDumpBuffer&) = delete;
+  NoDumpBuffer& operator=(const NoDumpBuffer&) = delete;
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  void release();
+
+  uint8_t* data_;
+  size_t size_;
+  size_t mapped_;
+};
+
+}} // namespace hstream::coredump
+#endif
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <HsFFI.h>
+#include <stdint.h>
+
+// ----------------------------------------------------------------------------
+// Request tracing
+//
+// Spans are written to per-thread ring buffers without locks or allocation,
+// and can be dumped as Chrome trace JSON (chrome://tracing or perfetto).
+// Tracing is sampled per trace: hs_trace_begin returns 0 for requests which
+// are not sampled, and all the record functions are no-ops for trace id 0.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Return a new trace id if this request is sampled, otherwise 0.
+uint64_t hs_trace_begin();
+uint64_t hs_trace_new_span_id();
+// Monotonic clock in microseconds.
+uint64_t hs_trace_now_us();
+
+// Tags are "key=value" pairs separated by ',', both name and tags are
+// truncated if they are too long. The offsets make it possible to pass
+// unpinned haskell bytes directly.
+void hs_trace_record(uint64_t trace_id, uint64_t span_id, uint64_t parent_id,
+                     const char* name, HsInt name_off, HsInt name_len,
+                     uint64_t start_us, uint64_t end_us, const char* tags,
+                     HsInt tags_off, HsInt tags_len);
+
+// Sample one in every n traces, 0 disables tracing.
+void hs_trace_set_sample_every(uint64_t n);
+uint64_t hs_trace_get_sample_every();
+void hs_trace_clear();
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
+
+#ifdef __cplusplus
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Dump all the recorded spans as Chrome trace JSON, the result must be freed
+// by the caller.
+extern "C" std::string* hs_trace_dump();
+
+namespace hstream { namespace tracing {
+
+// Record a span from construction to destruction, e.g.
+//
+//   hstream::tracing::Span span(trace_id, parent_id, "ld.read");
+//   span.tag("count", n);
+class Span {
+public:
+  Span(uint64_t trace_id, uint64_t parent_id, const char* name)
+      : trace_id_(trace_id), parent_id_(parent_id), name_(name) {
+    if (trace_id_) {
+      span_id_ = hs_trace_new_span_id();
+      start_us_ = hs_trace_now_us();
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+  ~Span() { finish(); }
+
+  // Record the span now instead of on destruction, e.g. in the callback of
+  // an asynchronous request.
+  void finish() {
+    if (trace_id_) {
+      hs_trace_record(trace_id_, span_id_, parent_id_, name_, 0,
+                      std::strlen(name_), start_us_, hs_trace_now_us(), tags_,
+                      0, tags_len_);
+      trace_id_ = 0;
+    }
+  }
+
+  void tag(const char* key, int64_t value) {
+    if (trace_id_ && tags_len_ < sizeof(tags_)) {
+      int n = std::snprintf(tags_ + tags_len_, sizeof(tags_) - tags_len_,
+                            "%s%s=%lld", tags_len_ ? "," : "", key,
+                            static_cast<long long>(value));
+      tags_len_ = std::min(sizeof(tags_) - 1, tags_len_ + (n > 0 ? n : 0));
+    }
+  }
+
+  bool sampled() const { return trace_id_ != 0; }
+  uint64_t traceId() const { return trace_id_; }
+  uint64_t spanId() const { return span_id_; }
+
+private:
+  uint64_t trace_id_;
+  uint64_t parent_id_;
+  uint64_t span_id_ = 0;
+  uint64_t start_us_ = 0;
+  const char* name_;
+  char tags_[128];
+  size_t tags_len_ = 0;
+};
+
+}} // namespace hstream::tracing
+#endif
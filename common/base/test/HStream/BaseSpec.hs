@@ -1,9 +1,12 @@
 module HStream.BaseSpec (spec) where
 
 import           Control.Concurrent
+import           Control.Exception                    (evaluate)
 import           Control.Monad
 import qualified Data.ByteString.Short                as B.Short
 import           Data.Either
+import           Data.List                            (isInfixOf)
+import           Data.Maybe                           (isNothing)
 import qualified Data.Set                             as Set
 import           Test.Hspec
 import           Test.Hspec.QuickCheck
@@ -13,10 +16,14 @@ import qualified Z.Data.CBytes                        as CBytes
 
 import           HStream.Base
 import           HStream.Base.Bytes
+import qualified HStream.Base.Profiler                as Profiler
+import qualified HStream.Base.Tracing                 as Tracing
 
 spec :: Spec
 spec = parallel $ do
   baseSpec
+  profilerSpec
+  tracingSpec
 
 baseSpec :: Spec
 baseSpec = describe "HStream.Base" $ do
@@ -41,3 +48,41 @@ baseSpec = describe "HStream.Base" $ do
 
   -- TODO
   it "setupFatalSignalHandler" $ setupFatalSignalHandler `shouldReturn` ()
+
+profilerSpec :: Spec
+profilerSpec = describe "HStream.Base.Profiler" $ do
+  it "sample native stacks into folded output" $ do
+    Profiler.startProfiler 999
+    Profiler.isProfilerRunning `shouldReturn` True
+    Profiler.startProfiler 999 `shouldThrow` anyIOException
+    -- burn some cpu time
+    void $ evaluate $ sum [CBytes.length (CBytes.pack (show i)) | i <- [1..1000000 :: Int]]
+    Just Profiler.Profile{..} <- Profiler.stopProfiler
+    Profiler.isProfilerRunning `shouldReturn` False
+    profileSamples `shouldSatisfy` (> 0)
+    let ls = lines (CBytes.unpack profileFolded)
+    ls `shouldSatisfy` (not . null)
+    -- "frame;...;frame count"
+    forM_ ls $ \l -> (read (last (words l)) :: Int) `shouldSatisfy` (> 0)
+    Profiler.stopProfiler >>= (`shouldSatisfy` isNothing)
+
+tracingSpec :: Spec
+tracingSpec = describe "HStream.Base.Tracing" $ do
+  it "record spans and dump as chrome trace" $ do
+    Tracing.setTraceSampleEvery 1
+    traceId <- Tracing.traceBegin
+    traceId `shouldSatisfy` (/= 0)
+    Tracing.withSpan' traceId 0 "test.outer" "key=value" $ \spanId ->
+      Tracing.withSpan traceId spanId "test.inner" $ pure ()
+    out <- CBytes.unpack <$> Tracing.dumpChromeTrace
+    out `shouldSatisfy` ("{\"traceEvents\":[" `isInfixOf`)
+    out `shouldSatisfy` ("\"name\":\"test.outer\"" `isInfixOf`)
+    out `shouldSatisfy` ("\"name\":\"test.inner\"" `isInfixOf`)
+    out `shouldSatisfy` ("\"key\":\"value\"" `isInfixOf`)
+
+    Tracing.clearTrace
+    out' <- CBytes.unpack <$> Tracing.dumpChromeTrace
+    out' `shouldSatisfy` (not . ("test.outer" `isInfixOf`))
+
+    Tracing.setTraceSampleEvery 0
+    Tracing.traceBegin `shouldReturn` 0
@@ -0,0 +1,70 @@
+{-# LANGUAGE CApiFFI #-}
+
+module HStream.CoredumpSpec (spec) where
+
+import           Control.Monad    (void, when)
+import           Data.Word        (Word8)
+import           Foreign.C.Types
+import           Foreign.Ptr
+import           Foreign.Storable (poke)
+import           Test.Hspec
+
+spec :: Spec
+spec = describe "HStream.Coredump" $ do
+  it "excludes and unmaps the whole pages of a region" $ do
+    ps <- fromIntegral <$> c_getpagesize
+    let size = fromIntegral :: Int -> CSize
+    p <- mmapPages (size $ 4 * ps)
+    -- there is no whole page inside
+    hs_coredump_exclude (p `plusPtr` 100) (size $ ps - 100) `shouldReturn` False
+    -- only the pages 1 and 2
+    hs_coredump_exclude (p `plusPtr` 100) (size $ 3 * ps) `shouldReturn` True
+
+    hs_coredump_unmap_excluded `shouldReturn` size (2 * ps `div` 4096)
+    isMapped (p `plusPtr` ps) (size $ 2 * ps) `shouldReturn` False
+    isMapped p (size ps) `shouldReturn` True
+    isMapped (p `plusPtr` (3 * ps)) (size ps) `shouldReturn` True
+    poke (p `plusPtr` (3 * ps) :: Ptr Word8) 1
+
+    hs_coredump_include (p `plusPtr` 100) (size $ 3 * ps)
+    hs_coredump_unmap_excluded `shouldReturn` 0
+    void $ c_munmap p (size $ 4 * ps)
+
+mmapPages :: CSize -> IO (Ptr ())
+mmapPages len = do
+  p <- c_mmap nullPtr len (c_PROT_READ + c_PROT_WRITE)
+                          (c_MAP_PRIVATE + c_MAP_ANONYMOUS) (-1) 0
+  when (p == c_MAP_FAILED) $ expectationFailure "mmap failed"
+  pure p
+
+-- msync fails with ENOMEM on unmapped pages
+isMapped :: Ptr () -> CSize -> IO Bool
+isMapped p len = (== 0) <$> c_msync p len c_MS_ASYNC
+
+foreign import ccall unsafe "hs_coredump.h hs_coredump_exclude"
+  hs_coredump_exclude :: Ptr () -> CSize -> IO Bool
+
+foreign import ccall unsafe "hs_coredump.h hs_coredump_include"
+  hs_coredump_include :: Ptr () -> CSize -> IO ()
+
+foreign import ccall unsafe "hs_coredump.h hs_coredump_unmap_excluded"
+  hs_coredump_unmap_excluded :: IO CSize
+
+foreign import ccall unsafe "unistd.h getpagesize"
+  c_getpagesize :: IO CInt
+
+foreign import ccall unsafe "sys/mman.h mmap"
+  c_mmap :: Ptr () -> CSize -> CInt -> CInt -> CInt -> CLong -> IO (Ptr ())
+
+foreign import ccall unsafe "sys/mman.h munmap"
+  c_munmap :: Ptr () -> CSize -> IO CInt
+
+foreign import ccall unsafe "sys/mman.h msync"
+  c_msync :: Ptr () -> CSize -> CInt -> IO CInt
+
+foreign import capi "sys/mman.h value PROT_READ" c_PROT_READ :: CInt
+foreign import capi "sys/mman.h value PROT_WRITE" c_PROT_WRITE :: CInt
+foreign import capi "sys/mman.h value MAP_PRIVATE" c_MAP_PRIVATE :: CInt
+foreign import capi "sys/mman.h value MAP_ANONYMOUS" c_MAP_ANONYMOUS :: CInt
+foreign import capi "sys/mman.h value MAP_FAILED" c_MAP_FAILED :: Ptr ()
+foreign import capi "sys/mman.h value MS_ASYNC" c_MS_ASYNC :: CInt
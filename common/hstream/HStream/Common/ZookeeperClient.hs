@@ -1,16 +1,46 @@
+{-# LANGUAGE MagicHash #-}
+
 module HStream.Common.ZookeeperClient
   ( ZookeeperClient
   , withZookeeperClient
   , unsafeGetZHandle
+
+    -- * Read cache
+  , ZkCacheStats (..)
+  , zkCachedGet
+  , zkCachedGetChildren
+  , zkCacheInvalidate
+  , getZkCacheStats
+
+    -- * Pipelined writes
+  , ZkWriteOp (..)
+  , zkPipelinedWrite
   ) where
 
+import           Control.Concurrent      (forkIO, myThreadId, newEmptyMVar,
+                                          takeMVar, threadCapability)
+import           Control.Exception       (finally, mask_, onException)
+import           Control.Monad           (forM, void)
+import           Control.Monad.Primitive (touch)
+import           Data.Int
+import           Data.Maybe              (fromMaybe)
 import           Data.Word
 import           Foreign.C.Types
 import           Foreign.ForeignPtr
 import           Foreign.Ptr
-import           Unsafe.Coerce      (unsafeCoerce)
-import           Z.Data.CBytes      (CBytes, withCBytes)
-import           ZooKeeper.Types    (ZHandle)
+import           Foreign.StablePtr       (StablePtr)
+import           GHC.Conc                (PrimMVar, newStablePtrPrimMVar)
+import           GHC.Stack               (HasCallStack)
+import           Unsafe.Coerce           (unsafeCoerce)
+import qualified Z.Data.CBytes           as CBytes
+import           Z.Data.CBytes           (CBytes, withCBytes)
+import           Z.Data.Vector           (Bytes)
+import qualified Z.Data.Vector           as ZV
+import qualified Z.Foreign               as Z
+import qualified ZooKeeper.Exception     as ZE
+import           ZooKeeper.Types         (ZHandle)
+
+import           HStream.Foreign
 
 newtype ZookeeperClient = ZookeeperClient (Ptr CZookeeperClient)
 
@@ -34,6 +64,138 @@ unsafeGetZHandle (ZookeeperClient ptr) =
   -- It's safe to use unsafeCoerce here because the ZHandle is a newtype.
   unsafeCoerce <$> get_underlying_handle ptr
 
+-------------------------------------------------------------------------------
+-- Read cache
+--
+-- Reads below are served from a local cache in the cpp side, which is kept
+-- coherent by zookeeper watches and dropped on session expiry. Writes should
+-- call 'zkCacheInvalidate' afterwards to read their own writes immediately.
+
+data ZkCacheStats = ZkCacheStats
+  { zkCacheHits          :: !Word64
+  , zkCacheMisses        :: !Word64
+  , zkCacheInvalidations :: !Word64
+  , zkCacheSize          :: !Int
+  } deriving (Show, Eq)
+
+-- | Get the data and version of a znode, return Nothing if the znode does
+-- not exist.
+zkCachedGet :: HasCallStack => ZookeeperClient -> CBytes -> IO (Maybe (Bytes, Int))
+zkCachedGet (ZookeeperClient ptr) path =
+  withCBytes path $ \path' -> do
+    (str', (version, rc)) <-
+      Z.withPrimSafe nullPtr $ \str'' ->
+      Z.withPrimSafe (0 :: Int32) $ \version' ->
+        zookeeper_client_cached_get ptr path' str'' version'
+    case rc of
+      ZE.CZNONODE -> pure Nothing
+      _ -> do
+        void $ ZE.throwZooErrorIfNotOK rc
+        val <- finally (peekStdStringToCBytesIdx str' 0) (c_delete_string str')
+        pure $ Just (CBytes.toBytes val, fromIntegral version)
+
+zkCachedGetChildren :: HasCallStack => ZookeeperClient -> CBytes -> IO [CBytes]
+zkCachedGetChildren (ZookeeperClient ptr) path =
+  withCBytes path $ \path' -> do
+    (len, (val, (vec, rc))) <-
+      Z.withPrimSafe (0 :: Int) $ \len' ->
+      Z.withPrimSafe nullPtr $ \val' ->
+      Z.withPrimSafe nullPtr $ \vec' ->
+        zookeeper_client_cached_get_children ptr path' len' val' vec'
+    void $ ZE.throwZooErrorIfNotOK rc
+    finally (peekStdStringToCBytesN len val) (c_delete_vector_of_string vec)
+
+-- | Drop the path, all paths under it and the children list of its parent.
+zkCacheInvalidate :: ZookeeperClient -> CBytes -> IO ()
+zkCacheInvalidate (ZookeeperClient ptr) path =
+  withCBytes path $ zookeeper_client_cache_invalidate ptr
+
+getZkCacheStats :: ZookeeperClient -> IO ZkCacheStats
+getZkCacheStats (ZookeeperClient ptr) = do
+  (hits, (misses, (invalidations, (size, _)))) <-
+    Z.withPrimUnsafe 0 $ \hits' ->
+    Z.withPrimUnsafe 0 $ \misses' ->
+    Z.withPrimUnsafe 0 $ \invalidations' ->
+    Z.withPrimUnsafe 0 $ \size' ->
+      zookeeper_client_cache_stats ptr (MBA# hits') (MBA# misses')
+                                   (MBA# invalidations') (MBA# size')
+  pure $ ZkCacheStats hits misses invalidations size
+
+-------------------------------------------------------------------------------
+-- Pipelined writes
+
+data ZkWriteOp
+  = ZkCreateOp !CBytes !(Maybe Bytes)
+  | ZkSetOp    !CBytes !(Maybe Bytes) !(Maybe Int32)
+    -- ^ Nothing version means any version
+  | ZkDeleteOp !CBytes !(Maybe Int32)
+  | ZkCheckOp  !CBytes !Int32
+  deriving (Show, Eq)
+
+-- | Submit all the groups at once without waiting for each other, and
+-- return the zookeeper result code of each group in order.
+--
+-- A group with more than one op runs atomically (zoo_amulti). Written paths
+-- are also dropped from the read cache.
+zkPipelinedWrite :: ZookeeperClient -> [[ZkWriteOp]] -> IO [CInt]
+zkPipelinedWrite (ZookeeperClient ptr) groups = do
+  let ops = concat groups
+      numGroups = length groups
+      groupSizes = Z.primArrayFromList $ map length groups
+      types = Z.primArrayFromList $ map opType ops
+      versions = Z.primArrayFromList $ map opVersion ops
+      (pathsArr, pathsOff, _) =
+        ZV.toArr $ ZV.concat [CBytes.toBytes (opPath op) <> ZV.singleton 0 | op <- ops]
+      pathOffs = Z.primArrayFromList $ map (+ pathsOff) $ init $
+        scanl (+) 0 [CBytes.length (opPath op) + 1 | op <- ops]
+      values = map opValue ops
+      (valuesArr, valuesOff, _) = ZV.toArr $ ZV.concat $ map (fromMaybe ZV.empty) values
+      valueLens = map (maybe (-1) ZV.length) values
+      valueOffs = Z.primArrayFromList $ map (+ valuesOff) $ init $
+        scanl (+) 0 (map (max 0) valueLens)
+  rcs <- Z.newPinnedPrimArray numGroups
+  mask_ $ do
+    mvar <- newEmptyMVar
+    sp <- newStablePtrPrimMVar mvar
+    (cap, _) <- threadCapability =<< myThreadId
+    Z.withPrimArrayUnsafe groupSizes $ \groupSizes' _ ->
+      Z.withPrimArrayUnsafe types $ \types' _ ->
+      Z.withPrimArrayUnsafe pathsArr $ \paths' _ ->
+      Z.withPrimArrayUnsafe pathOffs $ \pathOffs' _ ->
+      Z.withPrimArrayUnsafe valuesArr $ \values' _ ->
+      Z.withPrimArrayUnsafe valueOffs $ \valueOffs' _ ->
+      Z.withPrimArrayUnsafe (Z.primArrayFromList valueLens) $ \valueLens' _ ->
+      Z.withPrimArrayUnsafe versions $ \versions' _ ->
+        zookeeper_client_pipelined_write
+          ptr numGroups (BA# groupSizes') (BA# types') (BA# paths') (BA# pathOffs')
+          (BA# values') (BA# valueOffs') (BA# valueLens') (BA# versions')
+          sp cap (Z.mutablePrimArrayContents rcs)
+    takeMVar mvar `onException` forkIO (do takeMVar mvar; touch rcs)
+    touch rcs
+  forM [0..numGroups-1] $ Z.readPrimArray rcs
+  where
+    opType :: ZkWriteOp -> CInt
+    opType ZkCreateOp{} = 0
+    opType ZkSetOp{}    = 1
+    opType ZkDeleteOp{} = 2
+    opType ZkCheckOp{}  = 3
+
+    opPath (ZkCreateOp p _)  = p
+    opPath (ZkSetOp p _ _)   = p
+    opPath (ZkDeleteOp p _)  = p
+    opPath (ZkCheckOp p _)   = p
+
+    opValue (ZkCreateOp _ v)  = v
+    opValue (ZkSetOp _ v _)   = v
+    opValue _                 = Nothing
+
+    opVersion (ZkSetOp _ _ v)  = fromMaybe (-1) v
+    opVersion (ZkDeleteOp _ v) = fromMaybe (-1) v
+    opVersion (ZkCheckOp _ v)  = v
+    opVersion _                = -1
+
+-------------------------------------------------------------------------------
+
 data CZookeeperClient
 
 foreign import ccall safe "new_zookeeper_client"
@@ -44,3 +206,36 @@ foreign import ccall unsafe "&delete_zookeeper_client"
 
 foreign import ccall unsafe "get_underlying_handle"
   get_underlying_handle :: Ptr CZookeeperClient -> IO (Ptr ())
+
+-- The following two may block on zookeeper, so they are safe calls.
+foreign import ccall safe "zookeeper_client_cached_get"
+  zookeeper_client_cached_get
+    :: Ptr CZookeeperClient -> Ptr Word8
+    -> Ptr (Ptr Z.StdString) -> Ptr Int32
+    -> IO CInt
+
+foreign import ccall safe "zookeeper_client_cached_get_children"
+  zookeeper_client_cached_get_children
+    :: Ptr CZookeeperClient -> Ptr Word8
+    -> Ptr Int -> Ptr (Ptr Z.StdString) -> Ptr (Ptr (StdVector Z.StdString))
+    -> IO CInt
+
+foreign import ccall unsafe "zookeeper_client_cache_invalidate"
+  zookeeper_client_cache_invalidate :: Ptr CZookeeperClient -> Ptr Word8 -> IO ()
+
+foreign import ccall unsafe "zookeeper_client_cache_stats"
+  zookeeper_client_cache_stats
+    :: Ptr CZookeeperClient
+    -> MBA# Word64 -> MBA# Word64 -> MBA# Word64 -> MBA# Int
+    -> IO ()
+
+foreign import ccall unsafe "zookeeper_client_pipelined_write"
+  zookeeper_client_pipelined_write
+    :: Ptr CZookeeperClient
+    -> Int
+    -> BA# Int -> BA# CInt
+    -> BA# Word8 -> BA# Int
+    -> BA# Word8 -> BA# Int -> BA# Int
+    -> BA# Int32
+    -> StablePtr PrimMVar -> Int -> Ptr CInt
+    -> IO ()
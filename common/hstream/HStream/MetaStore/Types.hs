@@ -12,8 +12,10 @@
 
 module HStream.MetaStore.Types where
 
-import           Control.Exception                (Handler (..), catches, try)
-import           Control.Monad                    (void)
+import           Control.Exception                (Handler (..),
+                                                   SomeException, catches,
+                                                   finally, try)
+import           Control.Monad                    (forM, void)
 import           Data.Aeson                       (FromJSON, ToJSON)
 import qualified Data.Aeson                       as A
 import qualified Data.ByteString                  as BS
@@ -27,18 +29,21 @@ import           GHC.Stack                        (HasCallStack)
 import           Network.HTTP.Client              (Manager)
 import qualified Z.Foreign                        as ZF
 import qualified ZooKeeper                        as Z
-import           ZooKeeper.Exception              (ZooException)
+import qualified ZooKeeper.Exception              as ZE
 import qualified ZooKeeper.Types                  as Z
 
-import           HStream.Common.ZookeeperClient   (ZookeeperClient,
-                                                   unsafeGetZHandle)
+import           HStream.Common.ZookeeperClient   (ZkWriteOp (..),
+                                                   ZookeeperClient,
+                                                   unsafeGetZHandle,
+                                                   zkCacheInvalidate,
+                                                   zkCachedGetChildren,
+                                                   zkPipelinedWrite)
 import qualified HStream.MetaStore.FileUtils      as File
 import           HStream.MetaStore.RqliteUtils    (ROp (..), transaction)
 import qualified HStream.MetaStore.RqliteUtils    as RQ
 import           HStream.MetaStore.ZookeeperUtils (createInsertZK,
-                                                   decodeDataCompletion,
-                                                   decodeZNodeValue,
-                                                   deleteZkChildren,
+                                                   decodeCachedZNodeValue,
+                                                   deleteZkChildrenPipelined,
                                                    deleteZkPath, setZkData,
                                                    upsertZkData)
 import           HStream.Utils                    (cBytesToText, textToCBytes)
@@ -105,34 +110,35 @@ class MetaStore value handle where
 class MetaMulti handle where
   metaMulti :: [MetaOp] -> handle -> IO ()
 
+  -- | Run several independent 'metaMulti's and return the result of each in
+  -- order. Handles which support it submit all of them at once instead of
+  -- waiting for each one.
+  metaMultiBatch :: [[MetaOp]] -> handle -> IO [Either SomeException ()]
+  metaMultiBatch opss h = forM opss $ \ops -> try (metaMulti ops h)
+
 instance MetaStore value ZookeeperClient where
   myPath mid = myRootPath @value @ZookeeperClient <> "/" <> mid
-  insertMeta mid x zk    = RETHROW(do zk' <- unsafeGetZHandle zk; createInsertZK zk' (myPath @value @ZookeeperClient mid) x   ,ZookeeperClient)
-  updateMeta mid x mv zk = RETHROW(do zk' <- unsafeGetZHandle zk; setZkData      zk' (myPath @value @ZookeeperClient mid) x mv,ZookeeperClient)
-  upsertMeta mid x    zk = RETHROW(do zk' <- unsafeGetZHandle zk; upsertZkData   zk' (myPath @value @ZookeeperClient mid) x   ,ZookeeperClient)
-  deleteMeta mid   mv zk = RETHROW(do zk' <- unsafeGetZHandle zk; deleteZkPath   zk' (myPath @value @ZookeeperClient mid) mv  ,ZookeeperClient)
-  deleteAllMeta       zk = RETHROW(do zk' <- unsafeGetZHandle zk; deleteZkChildren zk' (myRootPath @value @ZookeeperClient)   ,ZookeeperClient)
+  insertMeta mid x zk    = RETHROW(withZkWrite zk (myPath @value @ZookeeperClient mid) $ \zk' -> createInsertZK zk' (myPath @value @ZookeeperClient mid) x   ,ZookeeperClient)
+  updateMeta mid x mv zk = RETHROW(withZkWrite zk (myPath @value @ZookeeperClient mid) $ \zk' -> setZkData      zk' (myPath @value @ZookeeperClient mid) x mv,ZookeeperClient)
+  upsertMeta mid x    zk = RETHROW(withZkWrite zk (myPath @value @ZookeeperClient mid) $ \zk' -> upsertZkData   zk' (myPath @value @ZookeeperClient mid) x   ,ZookeeperClient)
+  deleteMeta mid   mv zk = RETHROW(withZkWrite zk (myPath @value @ZookeeperClient mid) $ \zk' -> deleteZkPath   zk' (myPath @value @ZookeeperClient mid) mv  ,ZookeeperClient)
+  deleteAllMeta       zk = RETHROW(withZkWrite zk (myRootPath @value @ZookeeperClient) $ \zk' -> deleteZkChildrenPipelined zk zk' (myRootPath @value @ZookeeperClient) ,ZookeeperClient)
     where
       mid = "some of the meta when deleting"
 
   checkMetaExists mid zk = RETHROW(do zk' <- unsafeGetZHandle zk; isJust <$> Z.zooExists zk' (textToCBytes (myPath @value @ZookeeperClient mid)),ZookeeperClient)
-  getMeta         mid zk = RETHROW(do zk' <- unsafeGetZHandle zk; decodeZNodeValue zk' (myPath @value @ZookeeperClient mid),ZookeeperClient)
-  getMetaWithVer  mid zkclient = RETHROW(action,ZookeeperClient)
-    where
-      action = do
-        zk <- unsafeGetZHandle zkclient
-        e_a <- try $ Z.zooGet zk (textToCBytes $ myPath @value @ZookeeperClient mid)
-        case e_a of
-          Left (_ :: ZooException) -> return Nothing
-          Right a                  -> return $ (, fromIntegral . Z.statVersion . Z.dataCompletionStat $ a) <$> decodeDataCompletion a
+  -- Reads are served from the local cache of the ZookeeperClient, which is
+  -- kept coherent by zookeeper watches. Versions are cached along with the
+  -- data, so that a following updateMeta with version check still works.
+  getMeta         mid zk = RETHROW(fmap fst <$> decodeCachedZNodeValue zk (myPath @value @ZookeeperClient mid),ZookeeperClient)
+  getMetaWithVer  mid zk = RETHROW(decodeCachedZNodeValue zk (myPath @value @ZookeeperClient mid),ZookeeperClient)
 
   getAllMeta          zkclient = RETHROW(action,ZookeeperClient)
     where
       mid = "some of the meta when getting "
       action = do
         let path = textToCBytes $ myRootPath @value @ZookeeperClient
-        zk <- unsafeGetZHandle zkclient
-        ids <- Z.unStrVec . Z.strsCompletionValues <$> Z.zooGetChildren zk path
+        ids <- zkCachedGetChildren zkclient path
         idAndValues <- catMaybes <$> mapM (\x -> let x' = cBytesToText x in getMeta @value x' zkclient <&> fmap (x',)) ids
         pure $ Map.fromList idAndValues
   listMeta            zkclient = RETHROW(action,ZookeeperClient)
@@ -140,15 +146,20 @@ instance MetaStore value ZookeeperClient where
       mid = "some of the meta when listing"
       action = do
         let path = textToCBytes $ myRootPath @value @ZookeeperClient
-        zk <- unsafeGetZHandle zkclient
-        ids <- Z.unStrVec . Z.strsCompletionValues <$> Z.zooGetChildren zk path
+        ids <- zkCachedGetChildren zkclient path
         catMaybes <$> mapM (flip (getMeta @value) zkclient . cBytesToText) ids
 
+-- Run a write, then drop the written path from the local read cache so that
+-- the following reads see it without waiting for the watch to fire.
+withZkWrite :: ZookeeperClient -> Path -> (Z.ZHandle -> IO a) -> IO a
+withZkWrite zkclient path f =
+  (unsafeGetZHandle zkclient >>= f) `finally` zkCacheInvalidate zkclient (textToCBytes path)
+
 instance MetaMulti ZookeeperClient where
   metaMulti ops zkclient = do
     let zOps = map opToZ ops
     zk <- unsafeGetZHandle zkclient
-    void $ Z.zooMulti zk zOps
+    void (Z.zooMulti zk zOps) `finally` mapM_ (zkCacheInvalidate zkclient . textToCBytes . opPath) ops
     where
       opToZ op = case op of
         InsertOp p k v    -> Z.zooCreateOpInit (textToCBytes $ p <> "/" <> k) (Just $ ZF.fromByteString v) 0 Z.zooOpenAclUnsafe Z.ZooPersistent
@@ -156,6 +167,23 @@ instance MetaMulti ZookeeperClient where
         DeleteOp p k mv   -> Z.zooDeleteOpInit (textToCBytes $ p <> "/" <> k) (fromIntegral <$> mv)
         CheckOp  p k v    -> Z.zooCheckOpInit  (textToCBytes $ p <> "/" <> k) (fromIntegral v)
 
+  metaMultiBatch opss zkclient = do
+    rcs <- zkPipelinedWrite zkclient (map (map opToZk) opss)
+    forM rcs $ try . void . ZE.throwZooErrorIfNotOK
+    where
+      opToZk op = case op of
+        InsertOp _ _ v    -> ZkCreateOp (textToCBytes $ opPath op) (Just $ ZF.fromByteString v)
+        UpdateOp _ _ v mv -> ZkSetOp    (textToCBytes $ opPath op) (Just $ ZF.fromByteString v) (fromIntegral <$> mv)
+        DeleteOp _ _ mv   -> ZkDeleteOp (textToCBytes $ opPath op) (fromIntegral <$> mv)
+        CheckOp  _ _ v    -> ZkCheckOp  (textToCBytes $ opPath op) (fromIntegral v)
+
+opPath :: MetaOp -> Path
+opPath op = case op of
+  InsertOp p k _   -> p <> "/" <> k
+  UpdateOp p k _ _ -> p <> "/" <> k
+  DeleteOp p k _   -> p <> "/" <> k
+  CheckOp  p k _   -> p <> "/" <> k
+
 instance MetaStore value RHandle where
   myPath _ = myRootPath @value @RHandle
   insertMeta mid x    (RHandle m url) = RETHROW(RQ.insertInto m url (myRootPath @value @RHandle) mid x                               ,RHandle)
@@ -241,3 +269,4 @@ instance (HasPath value ZookeeperClient, HasPath value RHandle, HasPath value FH
 
 instance MetaMulti MetaHandle where
   metaMulti ops h = USE_WHICH_HANDLE(h, metaMulti ops)
+  metaMultiBatch opss h = USE_WHICH_HANDLE(h, metaMultiBatch opss)
@@ -1,29 +1,35 @@
 {-# LANGUAGE OverloadedStrings   #-}
 {-# LANGUAGE PatternSynonyms     #-}
 {-# LANGUAGE ScopedTypeVariables #-}
+{-# LANGUAGE TupleSections       #-}
 
 module HStream.MetaStore.ZookeeperUtils
    where
-import           Control.Exception    (catch, try)
-import           Control.Monad        (void)
-import           Data.Aeson           (FromJSON, ToJSON)
-import qualified Data.Aeson           as Aeson
-import qualified Data.ByteString      as BS
-import qualified Data.ByteString.Lazy as BL
-import qualified Data.Text            as T
-import           GHC.Stack            (HasCallStack)
-import           Z.Data.CBytes        (CBytes)
-import           Z.Data.Vector        (Bytes)
-import qualified Z.Foreign            as ZF
-import           ZooKeeper            (zooCreate, zooDelete, zooGet,
-                                       zooGetChildren, zooSet)
+import           Control.Exception              (catch, try)
+import           Control.Monad                  (void)
+import           Data.Aeson                     (FromJSON, ToJSON)
+import qualified Data.Aeson                     as Aeson
+import qualified Data.ByteString                as BS
+import qualified Data.ByteString.Lazy           as BL
+import qualified Data.Text                      as T
+import           GHC.Stack                      (HasCallStack)
+import           Z.Data.CBytes                  (CBytes)
+import           Z.Data.Vector                  (Bytes)
+import qualified Z.Foreign                      as ZF
+import           ZooKeeper                      (zooCreate, zooDelete, zooGet,
+                                                 zooGetChildren, zooSet)
 import           ZooKeeper.Exception
-import           ZooKeeper.Types      (DataCompletion (..), StringVector (..),
-                                       StringsCompletion (..), ZHandle,
-                                       pattern ZooPersistent, zooOpenAclUnsafe)
+import           ZooKeeper.Types                (DataCompletion (..),
+                                                 StringVector (..),
+                                                 StringsCompletion (..),
+                                                 ZHandle, pattern ZooPersistent,
+                                                 zooOpenAclUnsafe)
 
-import qualified HStream.Logger       as Log
-import           HStream.Utils        (textToCBytes)
+import           HStream.Common.ZookeeperClient (ZkWriteOp (..),
+                                                 ZookeeperClient, zkCachedGet,
+                                                 zkPipelinedWrite)
+import qualified HStream.Logger                 as Log
+import           HStream.Utils                  (textToCBytes)
 
 createInsertZK :: (Show a,ToJSON a) => ZHandle -> T.Text -> a -> IO ()
 createInsertZK zk path contents = do
@@ -59,6 +65,15 @@ deleteZkChildren zk path = do
   StringsCompletion (StringVector children) <- zooGetChildren zk path'
   mapM_ (\p -> zooDelete zk (path' <> "/" <> p) Nothing) children
 
+-- | Same as 'deleteZkChildren', but all the deletions are pipelined.
+deleteZkChildrenPipelined :: ZookeeperClient -> ZHandle -> T.Text -> IO ()
+deleteZkChildrenPipelined zkclient zk path = do
+  let path' = textToCBytes path
+  Log.debug . Log.buildString $ "delete children under path: " <> show path
+  StringsCompletion (StringVector children) <- zooGetChildren zk path'
+  rcs <- zkPipelinedWrite zkclient [[ZkDeleteOp (path' <> "/" <> p) Nothing] | p <- children]
+  mapM_ throwZooErrorIfNotOK rcs
+
 decodeZNodeValue :: FromJSON a => ZHandle -> T.Text -> IO (Maybe a)
 decodeZNodeValue zk path = do
   e_a <- try $ zooGet zk (textToCBytes path)
@@ -67,11 +82,23 @@ decodeZNodeValue zk path = do
     Right a                  -> return $ decodeDataCompletion a
 
 decodeDataCompletion :: FromJSON a => DataCompletion -> Maybe a
-decodeDataCompletion (DataCompletion (Just x) _) =
+decodeDataCompletion (DataCompletion (Just x) _) = decodeZNodeBytes x
+decodeDataCompletion (DataCompletion Nothing _) = Nothing
+
+decodeZNodeBytes :: FromJSON a => Bytes -> Maybe a
+decodeZNodeBytes x =
   case Aeson.eitherDecode' . BL.fromStrict . ZF.toByteString $ x of
     Right a -> Just a
     Left _  -> Nothing
-decodeDataCompletion (DataCompletion Nothing _) = Nothing
+
+-- | Same as 'decodeZNodeValue' but served from the local read cache, the
+-- version of the znode is also returned.
+decodeCachedZNodeValue :: FromJSON a => ZookeeperClient -> T.Text -> IO (Maybe (a, Int))
+decodeCachedZNodeValue zk path = do
+  e_a <- try $ zkCachedGet zk (textToCBytes path)
+  case e_a of
+    Left (_ :: ZooException) -> return Nothing
+    Right a                  -> return $ a >>= \(x, ver) -> (, ver) <$> decodeZNodeBytes x
 
 tryCreate :: HasCallStack => ZHandle -> CBytes -> IO ()
 tryCreate zk path = catch (createPath zk path) $
@@ -6,6 +6,7 @@ module HStream.Utils.Converter
   , jsonValueToValue
   , structToJsonObject
   , valueToJsonValue
+  , structToJsonBytes
   , structToZJsonObject
   , valueToZJsonValue
   , zJsonObjectToStruct
@@ -46,13 +47,14 @@ module HStream.Utils.Converter
   ) where
 
 import qualified Data.Aeson                  as Aeson
+import qualified Data.Aeson.Encoding         as AE
 import           Data.Bifunctor              (bimap)
 import qualified Data.ByteString             as BS
 import qualified Data.ByteString.Lazy        as BL
 import           Data.Int
 import qualified Data.Map                    as M
 import qualified Data.Map.Strict             as Map
-import           Data.Scientific             (toRealFloat)
+import           Data.Scientific             (fromFloatDigits, toRealFloat)
 import           Data.Text                   (Text)
 import qualified Data.Text                   as Text
 import qualified Data.Text.Encoding          as BSC
@@ -102,13 +104,36 @@ valueToJsonValue :: PB.Value -> Aeson.Value
 valueToJsonValue (V (PB.ValueKindStructValue struct))           = Aeson.Object (structToJsonObject struct)
 valueToJsonValue (V (PB.ValueKindListValue   (PB.ListValue list))) = Aeson.Array  (valueToJsonValue <$> list)
 valueToJsonValue (V (PB.ValueKindStringValue text))             = Aeson.String text
-valueToJsonValue (V (PB.ValueKindNumberValue num))              = Aeson.Number (read . show $ num)
+valueToJsonValue (V (PB.ValueKindNumberValue num))              = Aeson.Number (fromFloatDigits num)
 valueToJsonValue (V (PB.ValueKindBoolValue   bool))             = Aeson.Bool   bool
 valueToJsonValue (V (PB.ValueKindNullValue   _))                = Aeson.Null
 valueToJsonValue (PB.Value Nothing) = error "Nothing encountered"
 -- The following line of code is not used but to fix a warning
 valueToJsonValue (PB.Value (Just _)) = error "impossible happened"
 
+-- | The same as @Aeson.encode . structToJsonObject@, without building the
+-- intermediate json object.
+structToJsonBytes :: PB.Struct -> BL.ByteString
+structToJsonBytes = AE.encodingToLazyByteString . structToJsonEncoding
+
+structToJsonEncoding :: PB.Struct -> AE.Encoding
+structToJsonEncoding (PB.Struct kvmap) = AE.pairs $
+  Map.foldMapWithKey (\k v -> AE.pair (A.fromText k) (convertMaybeValue v)) kvmap
+  where
+    convertMaybeValue Nothing  = error "Nothing encountered"
+    convertMaybeValue (Just v) = valueToJsonEncoding v
+
+valueToJsonEncoding :: PB.Value -> AE.Encoding
+valueToJsonEncoding (V (PB.ValueKindStructValue struct))           = structToJsonEncoding struct
+valueToJsonEncoding (V (PB.ValueKindListValue   (PB.ListValue list))) = AE.list valueToJsonEncoding (V.toList list)
+valueToJsonEncoding (V (PB.ValueKindStringValue text))             = AE.text text
+valueToJsonEncoding (V (PB.ValueKindNumberValue num))              = AE.scientific (fromFloatDigits num)
+valueToJsonEncoding (V (PB.ValueKindBoolValue   bool))             = AE.bool bool
+valueToJsonEncoding (V (PB.ValueKindNullValue   _))                = AE.null_
+valueToJsonEncoding (PB.Value Nothing) = error "Nothing encountered"
+-- The following line of code is not used but to fix a warning
+valueToJsonEncoding (PB.Value (Just _)) = error "impossible happened"
+
 zJsonObjectToStruct :: ZObject -> PB.Struct
 zJsonObjectToStruct object = PB.Struct kvmap
  where
@@ -135,7 +160,7 @@ valueToZJsonValue :: PB.Value -> Z.Value
 valueToZJsonValue (V (PB.ValueKindStructValue struct))           = Z.Object (structToZJsonObject struct)
 valueToZJsonValue (V (PB.ValueKindListValue   (PB.ListValue list))) = Z.Array  (ZV.pack $ V.toList $ valueToZJsonValue <$> list)
 valueToZJsonValue (V (PB.ValueKindStringValue text))             = Z.String (ZT.pack $ Text.unpack text)
-valueToZJsonValue (V (PB.ValueKindNumberValue num))              = Z.Number (read . show $ num)
+valueToZJsonValue (V (PB.ValueKindNumberValue num))              = Z.Number (fromFloatDigits num)
 valueToZJsonValue (V (PB.ValueKindBoolValue   bool))             = Z.Bool   bool
 valueToZJsonValue (V (PB.ValueKindNullValue   _))                = Z.Null
 valueToZJsonValue (PB.Value Nothing) = error "Nothing encountered"
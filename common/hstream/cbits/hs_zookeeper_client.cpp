@@ -1,3 +1,11 @@
+#include <HsFFI.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <logdevice/common/ZookeeperClient.h>
 #include <zookeeper/zookeeper.h>
 
@@ -9,15 +17,364 @@
 // 1. Currently logging messages are printed by ld_info, which is controlled by
 // `--store-log-level`. We need to find a way to use the hstream logger.
 
+// ----------------------------------------------------------------------------
+// ZkReadCache
+//
+// A local cache of znode data (with version) and children. Each cached entry
+// has a zookeeper watch registered on it, the entry is dropped once the watch
+// fires. All entries are dropped when the session is disconnected or expired
+// (LogDevice's ZookeeperClient then creates a new zhandle), since the watches
+// may be lost.
+
+class ZkReadCache {
+public:
+  struct Node {
+    std::string data;
+    int32_t version;
+  };
+
+  // Return ZOK on success, otherwise the error code from zookeeper.
+  int getData(zhandle_t* zh, const std::string& path, Node* node_out) {
+    uint64_t gen;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      checkHandle(zh);
+      auto it = data_.find(path);
+      if (it != data_.end()) {
+        *node_out = it->second;
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return ZOK;
+      }
+      gen = generation_;
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    struct Stat stat;
+    std::string buf(kInitialBufferSize, '\0');
+    while (true) {
+      int buflen = buf.size();
+      int rc = zoo_wget(zh, path.c_str(), &ZkReadCache::dataWatcher, this,
+                        buf.data(), &buflen, &stat);
+      if (rc != ZOK) {
+        return rc;
+      }
+      if (stat.dataLength > static_cast<int32_t>(buf.size())) {
+        buf.resize(stat.dataLength);
+        continue;
+      }
+      // buflen is -1 if the znode has null data
+      buf.resize(buflen > 0 ? buflen : 0);
+      break;
+    }
+    node_out->data = std::move(buf);
+    node_out->version = stat.version;
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (gen == generation_ && zh == handle_) {
+      data_.insert_or_assign(path, *node_out);
+    }
+    return ZOK;
+  }
+
+  int getChildren(zhandle_t* zh, const std::string& path,
+                  std::vector<std::string>* children_out) {
+    uint64_t gen;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      checkHandle(zh);
+      auto it = children_.find(path);
+      if (it != children_.end()) {
+        *children_out = it->second;
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return ZOK;
+      }
+      gen = generation_;
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    struct String_vector strings;
+    int rc = zoo_wget_children(zh, path.c_str(), &ZkReadCache::childWatcher,
+                               this, &strings);
+    if (rc != ZOK) {
+      return rc;
+    }
+    children_out->clear();
+    children_out->reserve(strings.count);
+    for (int32_t i = 0; i < strings.count; ++i) {
+      children_out->emplace_back(strings.data[i]);
+    }
+    deallocate_String_vector(&strings);
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (gen == generation_ && zh == handle_) {
+      children_.insert_or_assign(path, *children_out);
+    }
+    return ZOK;
+  }
+
+  // Drop the path, all paths under it and the children of its parent. Used
+  // after a local write, so that the writer can read its own writes without
+  // waiting for the watch.
+  void invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    generation_++;
+    invalidations_.fetch_add(1, std::memory_order_relaxed);
+    std::string dir = path;
+    if (dir.empty() || dir.back() != '/') {
+      dir.push_back('/');
+    }
+    auto under = [&](const std::string& key) {
+      return key == path || key.compare(0, dir.size(), dir) == 0;
+    };
+    for (auto it = data_.begin(); it != data_.end();) {
+      it = under(it->first) ? data_.erase(it) : std::next(it);
+    }
+    for (auto it = children_.begin(); it != children_.end();) {
+      it = under(it->first) ? children_.erase(it) : std::next(it);
+    }
+    auto pos = path.find_last_of('/');
+    if (pos != std::string::npos) {
+      children_.erase(pos == 0 ? "/" : path.substr(0, pos));
+    }
+  }
+
+  void stats(uint64_t* hits, uint64_t* misses, uint64_t* invalidations,
+             HsInt* size) {
+    *hits = hits_.load(std::memory_order_relaxed);
+    *misses = misses_.load(std::memory_order_relaxed);
+    *invalidations = invalidations_.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(mutex_);
+    *size = data_.size() + children_.size();
+  }
+
+private:
+  static constexpr size_t kInitialBufferSize = 4096;
+
+  // Must be called with mutex_ held.
+  void checkHandle(zhandle_t* zh) {
+    if (zh != handle_) {
+      clearLocked();
+      handle_ = zh;
+    }
+  }
+
+  // Must be called with mutex_ held.
+  void clearLocked() {
+    generation_++;
+    invalidations_.fetch_add(1, std::memory_order_relaxed);
+    data_.clear();
+    children_.clear();
+  }
+
+  void onEvent(zhandle_t* zh, int type, int state, const char* path,
+               bool is_child_watch) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (zh != handle_) {
+      // Event from an old session, the entries were already dropped.
+      return;
+    }
+    if (type == ZOO_SESSION_EVENT) {
+      if (state != ZOO_CONNECTED_STATE) {
+        clearLocked();
+      }
+      return;
+    }
+    generation_++;
+    invalidations_.fetch_add(1, std::memory_order_relaxed);
+    if (is_child_watch) {
+      children_.erase(path);
+    } else {
+      data_.erase(path);
+    }
+  }
+
+  static void dataWatcher(zhandle_t* zh, int type, int state, const char* path,
+                          void* ctx) {
+    static_cast<ZkReadCache*>(ctx)->onEvent(zh, type, state, path, false);
+  }
+
+  static void childWatcher(zhandle_t* zh, int type, int state,
+                           const char* path, void* ctx) {
+    static_cast<ZkReadCache*>(ctx)->onEvent(zh, type, state, path, true);
+  }
+
+  std::mutex mutex_;
+  zhandle_t* handle_{nullptr};
+  // Bumped on every invalidation, a read which started before it must not
+  // fill the cache since its result may be outdated.
+  uint64_t generation_{0};
+  std::unordered_map<std::string, Node> data_;
+  std::unordered_map<std::string, std::vector<std::string>> children_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> invalidations_{0};
+};
+
+// ----------------------------------------------------------------------------
+// Pipelined writes
+//
+// All groups of a batch are submitted at once on the same session, so a batch
+// costs about one round trip instead of one per group. A group with more than
+// one op runs atomically with zoo_amulti.
+
+enum ZkWriteOpType : int {
+  ZK_WRITE_OP_CREATE = 0,
+  ZK_WRITE_OP_SET = 1,
+  ZK_WRITE_OP_DELETE = 2,
+  ZK_WRITE_OP_CHECK = 3,
+};
+
+struct ZkWriteOp {
+  int type;
+  std::string path;
+  std::string value;
+  bool has_value;
+  int32_t version;
+  // Only used by create ops in a multi.
+  std::string path_buffer;
+};
+
+struct ZkWriteBatch {
+  ZkWriteBatch(size_t len, std::shared_ptr<zhandle_t> zh, ZkReadCache* cache,
+               int* rcs_out, HsStablePtr mvar, HsInt cap)
+      : remaining(len), zh(std::move(zh)), cache(cache), rcs_out(rcs_out),
+        mvar(mvar), cap(cap) {}
+
+  std::atomic<size_t> remaining;
+  std::shared_ptr<zhandle_t> zh;
+  ZkReadCache* cache;
+  int* rcs_out;
+  HsStablePtr mvar;
+  HsInt cap;
+};
+
+struct ZkWriteGroup {
+  std::shared_ptr<ZkWriteBatch> batch;
+  size_t idx;
+  std::vector<ZkWriteOp> ops;
+  std::vector<zoo_op_t> multi_ops;
+  std::vector<zoo_op_result_t> multi_results;
+
+  void submit() {
+    int rc;
+    zhandle_t* zh = batch->zh.get();
+    if (ops.empty()) {
+      return done(ZOK);
+    }
+    if (ops.size() == 1) {
+      auto& op = ops[0];
+      const char* value = op.has_value ? op.value.data() : nullptr;
+      int valuelen = op.has_value ? op.value.size() : -1;
+      switch (op.type) {
+        case ZK_WRITE_OP_CREATE:
+          rc = zoo_acreate(zh, op.path.c_str(), value, valuelen,
+                           &ZOO_OPEN_ACL_UNSAFE, 0, &ZkWriteGroup::onString,
+                           this);
+          break;
+        case ZK_WRITE_OP_SET:
+          rc = zoo_aset(zh, op.path.c_str(), value, valuelen, op.version,
+                        &ZkWriteGroup::onStat, this);
+          break;
+        case ZK_WRITE_OP_DELETE:
+          rc = zoo_adelete(zh, op.path.c_str(), op.version,
+                           &ZkWriteGroup::onVoid, this);
+          break;
+        case ZK_WRITE_OP_CHECK:
+          rc = zoo_aexists(zh, op.path.c_str(), 0, &ZkWriteGroup::onCheck,
+                           this);
+          break;
+        default:
+          rc = ZBADARGUMENTS;
+      }
+    } else {
+      multi_ops.resize(ops.size());
+      multi_results.resize(ops.size());
+      for (size_t i = 0; i < ops.size(); ++i) {
+        auto& op = ops[i];
+        const char* value = op.has_value ? op.value.data() : nullptr;
+        int valuelen = op.has_value ? op.value.size() : -1;
+        switch (op.type) {
+          case ZK_WRITE_OP_CREATE:
+            op.path_buffer.resize(op.path.size() + 1);
+            zoo_create_op_init(&multi_ops[i], op.path.c_str(), value, valuelen,
+                               &ZOO_OPEN_ACL_UNSAFE, 0, op.path_buffer.data(),
+                               op.path_buffer.size());
+            break;
+          case ZK_WRITE_OP_SET:
+            zoo_set_op_init(&multi_ops[i], op.path.c_str(), value, valuelen,
+                            op.version, nullptr);
+            break;
+          case ZK_WRITE_OP_DELETE:
+            zoo_delete_op_init(&multi_ops[i], op.path.c_str(), op.version);
+            break;
+          case ZK_WRITE_OP_CHECK:
+            zoo_check_op_init(&multi_ops[i], op.path.c_str(), op.version);
+            break;
+          default:
+            return done(ZBADARGUMENTS);
+        }
+      }
+      rc = zoo_amulti(zh, multi_ops.size(), multi_ops.data(),
+                      multi_results.data(), &ZkWriteGroup::onVoid, this);
+    }
+    // The completion will not be called if we failed to submit.
+    if (rc != ZOK) {
+      done(rc);
+    }
+  }
+
+  // Write the result and delete this group.
+  void done(int rc) {
+    auto b = std::move(batch);
+    b->rcs_out[idx] = rc;
+    // Drop the written paths from the cache, so that the caller can read its
+    // own writes once we return.
+    for (auto& op : ops) {
+      b->cache->invalidate(op.path);
+    }
+    delete this;
+    if (b->remaining.fetch_sub(1) == 1) {
+      hs_try_putmvar(b->cap, b->mvar);
+    }
+  }
+
+  static void onVoid(int rc, const void* data) {
+    static_cast<ZkWriteGroup*>(const_cast<void*>(data))->done(rc);
+  }
+
+  static void onString(int rc, const char* value, const void* data) {
+    static_cast<ZkWriteGroup*>(const_cast<void*>(data))->done(rc);
+  }
+
+  static void onStat(int rc, const struct Stat* stat, const void* data) {
+    static_cast<ZkWriteGroup*>(const_cast<void*>(data))->done(rc);
+  }
+
+  static void onCheck(int rc, const struct Stat* stat, const void* data) {
+    auto group = static_cast<ZkWriteGroup*>(const_cast<void*>(data));
+    if (rc == ZOK && stat->version != group->ops[0].version) {
+      rc = ZBADVERSION;
+    }
+    group->done(rc);
+  }
+};
+
+// ----------------------------------------------------------------------------
+
 extern "C" {
 
 typedef struct zookeeper_client_t {
+  // Declared before rep, so that the zhandle (and its watches) are closed
+  // before the cache is destroyed.
+  std::unique_ptr<ZkReadCache> cache;
   std::unique_ptr<facebook::logdevice::ZookeeperClient> rep;
 } zookeeper_client_t;
 
 zookeeper_client_t* new_zookeeper_client(const char* quorum,
                                          int session_timeout) {
   zookeeper_client_t* client = new zookeeper_client_t();
+  client->cache = std::make_unique<ZkReadCache>();
   client->rep = std::make_unique<facebook::logdevice::ZookeeperClient>(
       std::string(quorum), std::chrono::milliseconds(session_timeout));
   return client;
@@ -29,5 +386,97 @@ zhandle_t* get_underlying_handle(zookeeper_client_t* client) {
 
 void delete_zookeeper_client(zookeeper_client_t* client) { delete client; }
 
+// Get the data and version of a znode, served from the local cache if
+// possible. The returned string must be freed by the caller.
+int zookeeper_client_cached_get(zookeeper_client_t* client, const char* path,
+                                std::string** data_out,
+                                int32_t* version_out) {
+  auto zh = client->rep->getHandle();
+  ZkReadCache::Node node;
+  int rc = client->cache->getData(zh.get(), path, &node);
+  if (rc == ZOK) {
+    *data_out = new std::string(std::move(node.data));
+    *version_out = node.version;
+  }
+  return rc;
+}
+
+// The returned vector must be freed by the caller.
+int zookeeper_client_cached_get_children(
+    zookeeper_client_t* client, const char* path, HsInt* len,
+    std::string** children_val, std::vector<std::string>** children_) {
+  auto zh = client->rep->getHandle();
+  auto children = new std::vector<std::string>;
+  int rc = client->cache->getChildren(zh.get(), path, children);
+  if (rc != ZOK) {
+    delete children;
+    return rc;
+  }
+  *len = children->size();
+  *children_val = children->data();
+  *children_ = children;
+  return rc;
+}
+
+void zookeeper_client_cache_invalidate(zookeeper_client_t* client,
+                                       const char* path) {
+  client->cache->invalidate(path);
+}
+
+void zookeeper_client_cache_stats(zookeeper_client_t* client, uint64_t* hits,
+                                  uint64_t* misses, uint64_t* invalidations,
+                                  HsInt* size) {
+  client->cache->stats(hits, misses, invalidations, size);
+}
+
+// Submit groups of write ops without waiting for each other, the mvar is
+// filled once all of them are done. The ops of the i-th group are the
+// following group_sizes[i] ops, its result code is written to rcs_out[i],
+// which must be kept alive until the mvar is filled.
+//
+// Paths are null-terminated strings in the `paths` buffer starting from
+// path_offs, values are in the `values` buffer. A negative value length means
+// null data, a negative version means any version (not allowed for check
+// ops).
+void zookeeper_client_pipelined_write(
+    zookeeper_client_t* client, HsInt num_groups, const HsInt* group_sizes,
+    const int* types, const char* paths, const HsInt* path_offs,
+    const char* values, const HsInt* value_offs, const HsInt* value_lens,
+    const int32_t* versions, HsStablePtr mvar, HsInt cap, int* rcs_out) {
+  if (num_groups == 0) {
+    hs_try_putmvar(cap, mvar);
+    return;
+  }
+  auto batch = std::make_shared<ZkWriteBatch>(num_groups,
+                                              client->rep->getHandle(),
+                                              client->cache.get(), rcs_out,
+                                              mvar, cap);
+  // Copy all the groups before submitting, since the arguments are unpinned
+  // and the haskell thread may be blocked on the mvar right after we return.
+  std::vector<ZkWriteGroup*> groups;
+  groups.reserve(num_groups);
+  HsInt i = 0;
+  for (HsInt g = 0; g < num_groups; ++g) {
+    auto group = new ZkWriteGroup{batch, static_cast<size_t>(g), {}, {}, {}};
+    group->ops.reserve(group_sizes[g]);
+    for (HsInt end = i + group_sizes[g]; i < end; ++i) {
+      ZkWriteOp op;
+      op.type = types[i];
+      op.path = std::string(paths + path_offs[i]);
+      op.has_value = value_lens[i] >= 0;
+      if (op.has_value) {
+        op.value = std::string(values + value_offs[i], value_lens[i]);
+      }
+      op.version = versions[i];
+      group->ops.push_back(std::move(op));
+    }
+    groups.push_back(group);
+  }
+  batch.reset();
+  for (auto group : groups) {
+    group->submit();
+  }
+}
+
 // end extern "C"
 }
@@ -1,7 +1,10 @@
 module HStream.MetaStoreSpec where
 
+import           Control.Concurrent               (threadDelay)
+import           Control.Exception                (SomeException, catch)
 import           Control.Monad                    (void)
 import qualified Data.Aeson                       as A
+import           Data.Either                      (isRight)
 import qualified Data.ByteString.Lazy             as BSL
 import qualified Data.List                        as L
 import qualified Data.Map.Strict                  as Map
@@ -16,7 +19,9 @@ import           System.IO                        (hClose, openTempFile)
 import           Test.Hspec
 import           Test.QuickCheck                  (generate)
 
-import           HStream.Common.ZookeeperClient   (ZookeeperClient,
+import           HStream.Common.ZookeeperClient   (ZkCacheStats (..),
+                                                   ZookeeperClient,
+                                                   getZkCacheStats,
                                                    unsafeGetZHandle,
                                                    withZookeeperClient)
 import qualified HStream.Logger                   as Log
@@ -26,7 +31,8 @@ import           HStream.MetaStore.Types          (FHandle, HasPath (..),
                                                    MetaHandle (..),
                                                    MetaMulti (..),
                                                    MetaStore (..), RHandle (..))
-import           HStream.MetaStore.ZookeeperUtils (tryCreate)
+import           HStream.MetaStore.ZookeeperUtils (deleteZkPath, setZkData,
+                                                   tryCreate)
 import           HStream.TestUtils                (MetaExample (..), metaGen)
 import           HStream.Utils                    (textToCBytes)
 
@@ -48,6 +54,7 @@ spec = do
   runIO $ withZookeeperClient urlZk 5000 $ \zk -> do
     let mHandle2 = ZKHandle zk
     hspec $ smokeTest mHandle2
+    hspec $ zkCacheTest zk
 
   -- local file
   tmpfile <- runIO $ do
@@ -134,4 +141,56 @@ smokeTest h = beforeAll_ (initMeta h) $ do
       listMeta @MetaExample h `shouldReturn` []
       getAllMeta @MetaExample h `shouldReturn` mempty
 
+    it "Meta MultiBatch Test" $ do
+      metas <- mapM (const $ generate metaGen) [1..20 :: Int]
+      newMeta <- generate metaGen
+      let ids = map metaId metas
+      rs1 <- metaMultiBatch [[insertMetaOp (metaId m) m h] | m <- metas] h
+      length (filter isRight rs1) `shouldBe` length metas
+      L.sort <$> listMeta @MetaExample h `shouldReturn` L.sort metas
+      -- The second group fails as a whole, the others are not affected
+      rs2 <- metaMultiBatch [ [updateMetaOp (head ids) newMeta (Just 0) h]
+                            , [ checkOp @MetaExample (ids !! 1) 1 h
+                              , updateMetaOp (ids !! 1) newMeta Nothing h ]
+                            , [updateMetaOp (ids !! 2) newMeta Nothing h]
+                            ] h
+      map isRight rs2 `shouldBe` [True, False, True]
+      getMeta @MetaExample (head ids) h `shouldReturn` Just newMeta
+      getMeta @MetaExample (ids !! 1) h `shouldReturn` Just (metas !! 1)
+      getMeta @MetaExample (ids !! 2) h `shouldReturn` Just newMeta
+      rs3 <- metaMultiBatch [[deleteMetaOp @MetaExample i Nothing h] | i <- ids] h
+      length (filter isRight rs3) `shouldBe` length metas
+      listMeta @MetaExample h `shouldReturn` []
+
     -- TODO: add test for Exceptions
+
+zkCacheTest :: HasCallStack => ZookeeperClient -> Spec
+zkCacheTest zk = beforeAll_ (initMeta $ ZKHandle zk) $ do
+  describe "Zookeeper read cache" $ do
+    it "Cached reads follow writes which bypass the cache" $ do
+      meta@Meta{metaId = mid} <- generate metaGen
+      newMeta <- generate metaGen
+      let path = myRootPath @MetaExample @ZookeeperClient <> "/" <> mid
+      insertMeta mid meta zk
+      getMetaWithVer @MetaExample mid zk `shouldReturn` Just (meta, 0)
+      hits <- zkCacheHits <$> getZkCacheStats zk
+      getMetaWithVer @MetaExample mid zk `shouldReturn` Just (meta, 0)
+      zkCacheHits <$> getZkCacheStats zk `shouldReturn` hits + 1
+
+      -- Write with the raw handle, the cached value is dropped by the watch
+      zh <- unsafeGetZHandle zk
+      setZkData zh path newMeta (Just 0)
+      eventually $ getMetaWithVer @MetaExample mid zk `shouldReturn` Just (newMeta, 1)
+      updateMeta mid meta (Just 0) zk `shouldThrow` anyException
+      updateMeta mid meta (Just 1) zk
+      getMetaWithVer @MetaExample mid zk `shouldReturn` Just (meta, 2)
+
+      deleteZkPath zh path Nothing
+      eventually $ listMeta @MetaExample zk `shouldReturn` []
+      getMeta @MetaExample mid zk `shouldReturn` Nothing
+  where
+    eventually :: IO () -> IO ()
+    eventually action = go (50 :: Int)
+      where
+        go n | n <= 1 = action
+             | otherwise = action `catch` \(_ :: SomeException) -> threadDelay 100000 >> go (n - 1)
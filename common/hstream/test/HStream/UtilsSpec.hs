@@ -2,14 +2,54 @@ module HStream.UtilsSpec (spec) where
 
 import           Control.Concurrent
 import           Control.Monad
+import qualified Data.Aeson            as Aeson
 import           Data.Either
-import qualified Data.Set           as Set
+import           Data.Scientific       (fromFloatDigits)
+import qualified Data.Set              as Set
+import qualified Data.Text             as T
+import qualified Data.Vector           as V
 import           HStream.Utils
+import qualified HStream.Utils.Aeson   as A
 import           Test.Hspec
+import           Test.Hspec.QuickCheck (prop)
+import           Test.QuickCheck       (Gen, chooseInt, elements, forAll,
+                                        frequency, listOf, oneof, sized,
+                                        vectorOf)
 
 spec :: Spec
 spec = parallel $ do
   timeIntervalSpec
+  structToJsonSpec
+
+structToJsonSpec :: Spec
+structToJsonSpec = describe "structToJsonBytes" $ do
+  it "encodes nested values" $ do
+    case Aeson.decode "{\"a\":[1,2.5,-3e-2,null],\"b\":{\"c\":true,\"d\":\"x\\\"y\"}}" of
+      Just (Aeson.Object o) ->
+        Aeson.decode (structToJsonBytes $ jsonObjectToStruct o) `shouldBe` Just (Aeson.Object o)
+      _ -> expectationFailure "invalid json"
+  prop "equals encoding the json object of the struct" $
+    forAll genJsonObject $ \o -> do
+      let struct = jsonObjectToStruct o
+      Aeson.decode (structToJsonBytes struct) `shouldBe` Just (Aeson.Object $ structToJsonObject struct)
+
+genJsonObject :: Gen Aeson.Object
+genJsonObject = sized $ \n -> genObject (min 3 n)
+  where
+    genObject depth = do
+      size <- chooseInt (0, 4)
+      A.fromList <$> vectorOf size ((,) <$> (A.fromText <$> genKey) <*> genValue depth)
+    genKey = T.pack <$> listOf (elements "ab\"\\\n\233")
+    genValue depth = frequency $
+      [ (3, oneof [ Aeson.Number . fromFloatDigits <$> (fromIntegral <$> chooseInt (minBound, maxBound) :: Gen Double)
+                  , Aeson.Number . fromFloatDigits <$> elements [0.1, -2.5e-7, 1.0e22, 3 :: Double]
+                  , Aeson.String <$> genKey
+                  , Aeson.Bool <$> elements [True, False]
+                  , pure Aeson.Null
+                  ])
+      ] ++
+      [ (1, Aeson.Object <$> genObject (depth - 1)) | depth > 0 ] ++
+      [ (1, Aeson.Array . V.fromList <$> vectorOf 2 (genValue (depth - 1))) | depth > 0 ]
 
 timeIntervalSpec :: Spec
 timeIntervalSpec = describe "TimeInterval" $ do
@@ -95,6 +95,11 @@ module HStream.Stats
   , serverHistogramAdd
   , serverHistogramEstimatePercentiles
   , serverHistogramEstimatePercentile
+
+    -- * Memory arenas
+  , MemoryArena (..)
+  , ArenaStats (..)
+  , getArenaStats
   ) where
 
 import           Control.Monad            (forM_, when)
@@ -103,11 +108,13 @@ import           Data.Int
 import qualified Data.Map.Strict          as Map
 import           Data.Primitive.ByteArray
 import           Data.Primitive.PrimArray
+import           Data.Word                (Word64)
 import           Foreign.ForeignPtr
 import           Foreign.Ptr
 import qualified Text.Read                as Read
 import qualified Z.Data.CBytes            as CBytes
 import           Z.Data.CBytes            (CBytes, withCBytesUnsafe)
+import qualified Z.Foreign                as Z
 
 import           HStream.Foreign
 import qualified HStream.Logger           as Log
@@ -475,3 +482,37 @@ serverHistogramEstimatePercentile (StatsHolder holder) label p =
   withForeignPtr holder $ \holder' ->
   withCBytesUnsafe (packServerHistogramLabel label) $ \label' -> do
     I.server_histogram_estimatePercentile holder' (BA# label') p
+
+-------------------------------------------------------------------------------
+-- Memory arenas, see hs_alloc.h
+
+-- | Must be in the same order as hs_arena_t
+data MemoryArena
+  = DefaultArena
+    -- ^ Everything which is not in the other arenas
+  | ReadArena
+  | WriteArena
+  | KafkaNetArena
+  deriving (Show, Eq, Enum, Bounded)
+
+data ArenaStats = ArenaStats
+  { arenaAllocated  :: !(Maybe Word64)
+    -- ^ Nothing if the server is not running with jemalloc
+  , arenaResident   :: !(Maybe Word64)
+  , arenaNumAllocs  :: !Word64
+    -- ^ Direct allocations only, i.e. not including the ones of the threads
+    -- bound to the arena
+  , arenaAllocBytes :: !Word64
+  } deriving (Show, Eq)
+
+getArenaStats :: MemoryArena -> IO ArenaStats
+getArenaStats arena = do
+  (allocated, (resident, (numAllocs, (allocBytes, hasJemalloc)))) <-
+    Z.withPrimUnsafe 0 $ \allocated' ->
+    Z.withPrimUnsafe 0 $ \resident' ->
+    Z.withPrimUnsafe 0 $ \numAllocs' ->
+    Z.withPrimUnsafe 0 $ \allocBytes' ->
+      I.hs_arena_stats (fromEnum arena) (MBA# allocated') (MBA# resident')
+                       (MBA# numAllocs') (MBA# allocBytes')
+  let mj x = if hasJemalloc then Just x else Nothing
+  pure $ ArenaStats (mj allocated) (mj resident) numAllocs allocBytes
@@ -206,4 +206,12 @@ foreign import ccall unsafe "hs_stats.h server_histogram_estimatePercentile"
   server_histogram_estimatePercentile
     :: Ptr CStatsHolder -> BA# Word8 -> Double -> IO Int64
 
+-------------------------------------------------------------------------------
+
+foreign import ccall unsafe "hs_alloc.h hs_arena_stats"
+  hs_arena_stats
+    :: Int
+    -> MBA# Word64 -> MBA# Word64 -> MBA# Word64 -> MBA# Word64
+    -> IO Bool
+
 #undef PER_X_STAT_DEFINE
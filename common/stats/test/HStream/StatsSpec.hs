@@ -1,11 +1,14 @@
 module HStream.StatsSpec (spec) where
 
 import           Control.Concurrent
+import           Control.Monad          (forM_)
 import           Data.Bits              (shiftL)
 import           Data.Either
 import           Data.Int
 import qualified Data.Map.Strict        as Map
-import           Data.Maybe             (fromJust)
+import           Data.Maybe             (fromJust, isJust)
+import           Foreign.C.Types        (CSize (..))
+import           Foreign.Ptr            (Ptr, nullPtr)
 import           Test.Hspec
 import           Z.Data.CBytes          (CBytes)
 
@@ -240,6 +243,28 @@ miscSpec = describe "HStream.Stats (misc)" $ do
     m <- stream_time_series_getall h "appends" tooBig
     m `shouldSatisfy` isLeft
 
+  it "memory arena stats" $ do
+    forM_ [minBound .. maxBound] $ \arena -> do
+      ArenaStats{..} <- getArenaStats arena
+      -- both available only with jemalloc
+      isJust arenaAllocated `shouldBe` isJust arenaResident
+
+  it "allocations in an arena are accounted to it" $ do
+    let size = 1 `shiftL` 20
+    before <- getArenaStats KafkaNetArena
+    p <- hs_arena_malloc (fromEnum KafkaNetArena) size
+    p `shouldNotBe` nullPtr
+    after <- getArenaStats KafkaNetArena
+    arenaNumAllocs after `shouldBe` arenaNumAllocs before + 1
+    arenaAllocBytes after `shouldBe` arenaAllocBytes before + fromIntegral size
+    -- the allocated bytes are only available with jemalloc
+    forM_ ((,) <$> arenaAllocated before <*> arenaAllocated after) $ \(x, y) ->
+      y `shouldSatisfy` (>= x + fromIntegral size)
+    hs_arena_free p
+    freed <- getArenaStats KafkaNetArena
+    forM_ ((,) <$> arenaAllocated after <*> arenaAllocated freed) $ \(x, y) ->
+      y `shouldSatisfy` (<= x - fromIntegral size)
+
 -------------------------------------------------------------------------------
 
 eraseSpec
@@ -305,3 +330,11 @@ setSpec label stat_add stat_get stat_set = do
     stat_set h "topic_1" 100
     s <- newAggregateStats h
     stat_get s "topic_1" `shouldReturn` 100
+
+-------------------------------------------------------------------------------
+
+foreign import ccall unsafe "hs_alloc.h hs_arena_malloc"
+  hs_arena_malloc :: Int -> CSize -> IO (Ptr ())
+
+foreign import ccall unsafe "hs_alloc.h hs_arena_free"
+  hs_arena_free :: Ptr () -> IO ()
@@ -61,8 +61,13 @@ runServerCli' s (Server.ServerAdminCmd adminCmd) = do
     else do
       cmd <- Text.unwords . map Text.pack <$> getArgs
       putStrLn =<< Server.formatCommandResponse
-               =<< Server.withAdminClient s (Server.sendAdminCommand cmd)
+               =<< Server.withAdminClient s (Server.sendAdminCommand' timeout cmd)
  where
+  -- The profile command returns after profiling, leave some time for the
+  -- symbolization.
+  timeout = case adminCmd of
+    Server.AdminProfileCommand Server.ProfileCommand{..} -> profileSeconds + 60
+    _                                                    -> 10
   checkLookup :: Server.AdminCommand -> (Bool, Text.Text)
   checkLookup cmd =
     case cmd of
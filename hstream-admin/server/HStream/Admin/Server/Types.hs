@@ -5,6 +5,7 @@ import qualified Data.Aeson                as Aeson
 import           Data.Text                 (Text)
 import qualified Data.Text.Lazy            as TL
 import qualified Data.Text.Lazy.Encoding   as TL
+import           Data.Word                 (Word64)
 import           GHC.Generics              (Generic)
 import qualified GHC.IO.Exception          as E
 import           Network.Socket            (PortNumber)
@@ -103,6 +104,9 @@ data AdminCommand
   | AdminStatusCommand
   | AdminInitCommand
   | AdminCheckReadyCommand
+  | AdminProfileCommand ProfileCommand
+  | AdminTraceCommand TraceCommand
+  | AdminMemoryCommand
   deriving (Show)
 
 adminCommandParser :: O.Parser AdminCommand
@@ -132,6 +136,53 @@ adminCommandParser = O.hsubparser
                                (O.progDesc "Check if an HServer cluster is ready"))
  <> O.command "connector" (O.info (AdminConnectorCommand <$> connectorCmdParser)
                                   (O.progDesc "Connector command"))
+ <> O.command "profile" (O.info (AdminProfileCommand <$> profileCmdParser)
+                                (O.progDesc $ "Sample the native stacks of the server for a while, "
+                                           <> "and print them in the folded format for flame graphs"))
+ <> O.command "trace" (O.info (AdminTraceCommand <$> traceCmdParser)
+                              (O.progDesc "Sampled request tracing, dumped as Chrome trace JSON"))
+ <> O.command "memory" (O.info (pure AdminMemoryCommand)
+                               (O.progDesc "Allocated and resident memory of each allocation arena"))
+  )
+
+-------------------------------------------------------------------------------
+
+data ProfileCommand = ProfileCommand
+  { profileSeconds   :: Int
+  , profileFrequency :: Int
+  } deriving (Show, Eq)
+
+profileCmdParser :: O.Parser ProfileCommand
+profileCmdParser = ProfileCommand
+  <$> O.option O.auto ( O.long "seconds" <> O.metavar "INT"
+                     <> O.showDefault <> O.value 10
+                     <> O.help "How long to profile"
+                      )
+  <*> O.option O.auto ( O.long "frequency" <> O.metavar "HZ"
+                     <> O.showDefault <> O.value 99
+                     <> O.help "Samples per second of cpu time"
+                      )
+
+-------------------------------------------------------------------------------
+
+data TraceCommand
+  = TraceStart Word64
+  | TraceStop
+  | TraceDump
+  deriving (Show, Eq)
+
+traceCmdParser :: O.Parser TraceCommand
+traceCmdParser = O.hsubparser
+  ( O.command "start" (O.info (TraceStart <$> O.option O.auto ( O.long "sample-every"
+                                                             <> O.metavar "N"
+                                                             <> O.showDefault <> O.value 100
+                                                             <> O.help "Trace one in every N requests"
+                                                              ))
+                              (O.progDesc "Clear the recorded spans and start tracing"))
+ <> O.command "stop" (O.info (pure TraceStop)
+                             (O.progDesc "Stop tracing, the recorded spans are kept"))
+ <> O.command "dump" (O.info (pure TraceDump)
+                             (O.progDesc "Print the recorded spans as Chrome trace JSON"))
   )
 
 -------------------------------------------------------------------------------
@@ -328,6 +379,7 @@ data StatsCategory
   | PerQueryStats
   | PerViewStats
   | ServerHistogram
+  | LogPathCacheStats
   deriving (Show, Eq)
 
 instance Read StatsCategory where
@@ -344,6 +396,7 @@ instance Read StatsCategory where
         Read.Ident "query_counter" -> PerQueryStats
         Read.Ident "view_counter" -> PerViewStats
         Read.Ident "server_histogram" -> ServerHistogram
+        Read.Ident "log_path_cache" -> LogPathCacheStats
         x -> errorWithoutStackTrace $ "cannot parse StatsCategory: " <> show x
 
 data StatsCommand = StatsCommand
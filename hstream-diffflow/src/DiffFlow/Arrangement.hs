@@ -0,0 +1,189 @@
+{-# LANGUAGE RecordWildCards #-}
+
+-- | Arrangements: the indexed state of DiffFlow nodes.
+--
+-- An arrangement is a spine of immutable, consolidated batches (newest
+-- first), in which each batch is at most half the size of the one below it,
+-- so that a new batch is merged into O(log n) batches in amortized O(log n)
+-- time, like the levels of a LSM tree. The merges are done synchronously by
+-- the insertion (and compaction) itself. If the arrangement is keyed, each
+-- batch also maps every key to the positions of its changes, so a lookup
+-- of a key costs one hash lookup per batch instead of a scan of the state.
+--
+-- The timestamps can be compacted by a frontier (see 'advanceTimestamp'),
+-- so that the changes of a row which differ only in timestamps earlier than
+-- the frontier are summed up and dropped if they cancel out.
+module DiffFlow.Arrangement
+  ( Arrangement
+  , arrangementKeyGen
+  , arrangementSince
+  , emptyArrangement
+  , arrangementLen
+  , arrangementBatches
+  , insertArrangement
+  , compactArrangement
+  , arrangementChanges
+  , arrangementChangesForKey
+  , arrangementCountForKey
+  , mergeJoinArrangement
+  ) where
+
+import           Data.Hashable       (Hashable)
+import qualified Data.HashMap.Strict as HM
+import qualified Data.List           as L
+import qualified Data.Set            as Set
+import qualified Data.Vector         as V
+import qualified Data.Vector.Unboxed as VU
+
+import           DiffFlow.Types
+
+data ArrangedBatch row a = ArrangedBatch
+  { abBatch :: DataChangeBatch row a
+    -- | key -> positions of its changes in the batch, empty if not keyed
+  , abKeys  :: HM.HashMap row (VU.Vector Int)
+  }
+
+data Arrangement row a = Arrangement
+  { arrangementKeyGen :: Maybe (row -> row)
+  , arrangementSince  :: Frontier a
+  , arrBatches        :: [ArrangedBatch row a]
+  }
+
+instance (Show row, Show a) => Show (Arrangement row a) where
+  show Arrangement{..} = "Arrangement {since = " <> show arrangementSince
+                      <> ", batches = " <> show (L.map abBatch arrBatches) <> "}"
+
+emptyArrangement :: Maybe (row -> row) -> Arrangement row a
+emptyArrangement keygen = Arrangement keygen Set.empty []
+
+arrangementLen :: Arrangement row a -> Int
+arrangementLen = L.sum . L.map (dataChangeBatchLen . abBatch) . arrBatches
+
+arrangementBatches :: Arrangement row a -> [DataChangeBatch row a]
+arrangementBatches = L.map abBatch . arrBatches
+
+arrangeBatch :: (Hashable row, Eq row)
+             => Maybe (row -> row) -> DataChangeBatch row a -> ArrangedBatch row a
+arrangeBatch Nothing batch = ArrangedBatch batch HM.empty
+arrangeBatch (Just keygen) batch = ArrangedBatch batch keys
+  where
+    rows = ccRows (dcbColumns batch)
+    keys = HM.map (VU.fromList . L.reverse) $
+      V.ifoldl' (\acc i row -> HM.insertWith (++) (keygen row) [i] acc) HM.empty rows
+
+insertArrangement :: (Hashable a, Ord a, Show a,
+                      Hashable row, Ord row, Show row)
+                  => Arrangement row a
+                  -> DataChangeBatch row a
+                  -> Arrangement row a
+insertArrangement arr@Arrangement{..} batch
+  | dataChangeBatchLen batch == 0 = arr
+  | otherwise = arr { arrBatches = adjust (arrangeBatch arrangementKeyGen batch : arrBatches) }
+  where
+    adjust (x:y:xs)
+      | dataChangeBatchLen (abBatch x) * 2 > dataChangeBatchLen (abBatch y) =
+        let merged = mergeDataChangeBatch (abBatch x) (abBatch y)
+         in if dataChangeBatchLen merged == 0
+              then adjust xs
+              else adjust (arrangeBatch arrangementKeyGen merged : xs)
+    adjust xs = xs
+
+-- | Advance the timestamps by the frontier, merging the batches from the
+-- newest one while the merged batch is more than half the size of the next,
+-- as 'insertArrangement' does. So an older (larger) batch is only rewritten
+-- once enough changes are above it, and keeps timestamps advanced by an
+-- earlier frontier until then, which is the same for lookups at timestamps
+-- not earlier than the frontier. The frontier must not be later than any
+-- timestamp the arrangement will be looked up at, and a frontier which is
+-- not later than the previous one is ignored.
+compactArrangement :: (Hashable a, Ord a, Show a,
+                       Hashable row, Ord row, Show row)
+                   => Frontier a
+                   -> Arrangement row a
+                   -> Arrangement row a
+compactArrangement ft arr@Arrangement{..}
+  | Set.null ft || ft == arrangementSince = arr
+  | not (Set.null arrangementSince) &&
+    not (L.all (\ts -> arrangementSince <.= ts) (Set.toList ft)) = arr
+  | otherwise = case arrBatches of
+      []     -> arr { arrangementSince = ft }
+      (x:xs) -> arr { arrangementSince = ft, arrBatches = merge (advance x) xs }
+  where
+    advance ArrangedBatch{..} =
+      mkDataChangeBatch $
+        L.map (\c -> c { dcTimestamp = advanceTimestamp ft (dcTimestamp c) }) (dcbChanges abBatch)
+    merge acc (y:ys)
+      | dataChangeBatchLen acc * 2 > dataChangeBatchLen (abBatch y) =
+        merge (mergeDataChangeBatch acc (advance y)) ys
+    merge acc ys
+      | dataChangeBatchLen acc == 0 = ys
+      | otherwise = arrangeBatch arrangementKeyGen acc : ys
+
+-- | All changes whose rows satisfy the predicate, by a scan of the state.
+arrangementChanges :: Arrangement row a -> (row -> Bool) -> [DataChange row a]
+arrangementChanges arr p =
+  L.concatMap (L.filter (p . dcRow) . dcbChanges . abBatch) (arrBatches arr)
+
+-- | All changes whose rows have the key, the predicate tells whether a row
+-- has the key, by which the state is scanned if the arrangement is not keyed.
+arrangementChangesForKey :: (Hashable row, Eq row)
+                         => Arrangement row a -> row -> (row -> Bool)
+                         -> [DataChange row a]
+arrangementChangesForKey arr key p =
+  case arrangementKeyGen arr of
+    Nothing -> arrangementChanges arr p
+    Just _  -> lookupKey arr key
+
+lookupKey :: (Hashable row, Eq row) => Arrangement row a -> row -> [DataChange row a]
+lookupKey arr key =
+  L.concatMap (\ArrangedBatch{..} ->
+                 case HM.lookup key abKeys of
+                   Nothing  -> []
+                   Just ixs -> L.map (changeAt (dcbColumns abBatch)) (VU.toList ixs)
+              ) (arrBatches arr)
+  where
+    changeAt cols i =
+      DataChange
+      { dcRow = V.unsafeIndex (ccRows cols) i
+      , dcTimestamp = columnsTimestampAt cols i
+      , dcDiff = VU.unsafeIndex (ccDiffs cols) i
+      }
+
+-- | Sum of the diffs of the row at timestamps (<.= ts), the row is used as
+-- the key (e.g. for the output of a distinct).
+arrangementCountForKey :: (Hashable row, Ord row, Ord a)
+                       => Arrangement row a -> row -> Timestamp a -> Int
+arrangementCountForKey arr row ts =
+  L.foldl' (\acc DataChange{..} ->
+              if dcRow == row && dcTimestamp <.= ts then acc + dcDiff else acc
+           ) 0 (arrangementChangesForKey arr row (== row))
+
+-- | Join a batch with the arrangement like 'mergeJoinIndex'. Given the key
+-- of the rows of the batch (which is compared with the keys of the
+-- arrangement), an inner join only visits the changes of the same keys.
+mergeJoinArrangement :: (Hashable a, Ord a, Show a,
+                         Hashable row, Ord row, Show row)
+                     => Arrangement row a
+                     -> Frontier a
+                     -> DataChangeBatch row a
+                     -> Maybe (row -> row)
+                     -> MergeJoinType
+                     -> (row -> row -> Bool)
+                     -> (row -> row -> row)
+                     -> (row -> row)
+                     -> DataChangeBatch row a
+mergeJoinArrangement self selfFt other (Just otherKeygen) MergeJoinInner joinCond rowgen _
+  | Just _ <- arrangementKeyGen self =
+    mkDataChangeBatch
+      [ DataChange
+        { dcRow = rowgen (dcRow this) (dcRow that)
+        , dcTimestamp = leastUpperBound (dcTimestamp this) (dcTimestamp that)
+        , dcDiff = dcDiff this * dcDiff that
+        }
+      | that <- dcbChanges other
+      , this <- lookupKey self (otherKeygen (dcRow that))
+      , selfFt `causalCompare` dcTimestamp this == PGT
+      , joinCond (dcRow this) (dcRow that)
+      ]
+mergeJoinArrangement self selfFt other _ joinType joinCond rowgen nullRowgen =
+  mergeJoinIndex (Index $ arrangementBatches self) selfFt other joinType joinCond rowgen nullRowgen
@@ -0,0 +1,85 @@
+{-# LANGUAGE BangPatterns #-}
+
+-- | Kernels on the flat, unboxed columns of a 'DiffFlow.Types.DataChangeBatch'.
+module DiffFlow.Columnar
+  ( radixSortIndices
+  , equalRuns
+  ) where
+
+import           Control.Monad
+import           Control.Monad.ST            (runST)
+import           Data.Bits                   (unsafeShiftR, (.&.))
+import qualified Data.Vector.Unboxed         as VU
+import qualified Data.Vector.Unboxed.Mutable as VUM
+import           Data.Word                   (Word64)
+
+-- | Return the indices of the keys in ascending order of the keys, indices of
+-- equal keys are kept in their original order.
+--
+-- This is a LSD radix sort over bytes. Each pass scans the keys (carried
+-- along with the indices) sequentially, and the histograms of all passes are
+-- built in one scan up front, so that the passes in which every key has the
+-- same byte (e.g. the high bytes of small keys) are skipped.
+radixSortIndices :: VU.Vector Word64 -> VU.Vector Int
+radixSortIndices keys
+  | n < 2     = VU.enumFromN 0 n
+  | otherwise = runST $ do
+      counts <- VUM.replicate (passes * radix) (0 :: Int)
+      loop n $ \j -> do
+        let k = VU.unsafeIndex keys j
+        forM_ [0 .. passes - 1] $ \p ->
+          VUM.unsafeModify counts (+ 1) (p * radix + digit p k)
+      keysA <- VU.thaw keys
+      idxA  <- VU.thaw (VU.enumFromN 0 n)
+      keysB <- VUM.unsafeNew n
+      idxB  <- VUM.unsafeNew n
+      let go !p (ks, is) (ks', is')
+            | p >= passes = VU.unsafeFreeze is
+            | otherwise = do
+                let base = p * radix
+                k0 <- VUM.unsafeRead ks 0
+                c0 <- VUM.unsafeRead counts (base + digit p k0)
+                if c0 == n then go (p + 1) (ks, is) (ks', is') else do
+                  -- counts to the first slot of each digit
+                  void $ foldM (\acc d -> do
+                    c <- VUM.unsafeRead counts (base + d)
+                    VUM.unsafeWrite counts (base + d) acc
+                    return $! acc + c) 0 [0 .. radix - 1]
+                  loop n $ \j -> do
+                    k <- VUM.unsafeRead ks j
+                    i <- VUM.unsafeRead is j
+                    let slot = base + digit p k
+                    pos <- VUM.unsafeRead counts slot
+                    VUM.unsafeWrite counts slot (pos + 1)
+                    VUM.unsafeWrite ks' pos k
+                    VUM.unsafeWrite is' pos i
+                  go (p + 1) (ks', is') (ks, is)
+      go 0 (keysA, idxA) (keysB, idxB)
+  where
+    n = VU.length keys
+    radix = 256
+    passes = 8
+    digit :: Int -> Word64 -> Int
+    digit p k = fromIntegral ((k `unsafeShiftR` (p * 8)) .&. 0xff)
+
+-- | Split the indices sorted by 'radixSortIndices' into the runs of equal
+-- keys, as (start, end) positions in the sorted indices.
+equalRuns :: VU.Vector Word64 -> VU.Vector Int -> [(Int, Int)]
+equalRuns keys sorted = go 0
+  where
+    n = VU.length sorted
+    keyAt j = VU.unsafeIndex keys (VU.unsafeIndex sorted j)
+    go !start
+      | start >= n = []
+      | otherwise  = let k = keyAt start
+                         end = runEnd k (start + 1)
+                      in (start, end) : go end
+    runEnd k !j
+      | j < n && keyAt j == k = runEnd k (j + 1)
+      | otherwise             = j
+
+loop :: Monad m => Int -> (Int -> m ()) -> m ()
+loop n f = go 0
+  where go !j | j >= n    = return ()
+              | otherwise = f j >> go (j + 1)
+{-# INLINE loop #-}
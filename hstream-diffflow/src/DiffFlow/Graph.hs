@@ -25,6 +25,7 @@ import qualified Data.Vector             as V
 import           Data.Word               (Word64)
 import           GHC.Generics            (Generic)
 
+import           DiffFlow.Arrangement
 import           DiffFlow.Error
 import           DiffFlow.Types
 
@@ -62,6 +63,7 @@ data NodeSpec row
   | MapSpec           Node (Mapper row)               -- input, mapper
   | FilterSpec        Node (Filter row)               -- input, filter
   | IndexSpec         Node                      -- input
+  | ArrangeSpec       Node (KeyGenerator row)   -- input, keygen
   | JoinSpec          Node Node MergeJoinType (JoinCondition row) (Joiner row) (RowGenerator row) -- input1, input2, joinType, joinCond, rowgen, nullRowgen
   | OutputSpec        Node                      -- input
   | TimestampPushSpec Node                      -- input
@@ -77,6 +79,7 @@ instance Show (NodeSpec row) where
   show (MapSpec _ _)          = "MapSpec"
   show (FilterSpec _ _)       = "FilterSpec"
   show (IndexSpec _)          = "IndexSpec"
+  show (ArrangeSpec _ _)      = "ArrangeSpec"
   show (JoinSpec _ _ _ _ _ _) = "JoinSpec"
   show (OutputSpec _)         = "OutputSpec"
   show (TimestampPushSpec _)  = "TimestampPushSpec"
@@ -88,6 +91,7 @@ instance Show (NodeSpec row) where
 
 outputIndex :: NodeSpec row -> Bool
 outputIndex (IndexSpec _)        = True
+outputIndex (ArrangeSpec _ _)    = True
 outputIndex (DistinctSpec _)     = True
 outputIndex (ReduceSpec _ _ _ _) = True
 outputIndex _                    = False
@@ -102,6 +106,7 @@ getInputsFromSpec InputSpec = V.empty
 getInputsFromSpec (MapSpec node _) = V.singleton node
 getInputsFromSpec (FilterSpec node _) = V.singleton node
 getInputsFromSpec (IndexSpec node) = V.singleton node
+getInputsFromSpec (ArrangeSpec node _) = V.singleton node
 getInputsFromSpec (JoinSpec node1 node2 _ _ _ _) = V.fromList [node1, node2]
 getInputsFromSpec (OutputSpec node) = V.singleton node
 getInputsFromSpec (TimestampPushSpec node) = V.singleton node
@@ -115,12 +120,12 @@ getInputsFromSpec (ReduceSpec node _ _ _) = V.singleton node
 
 
 data NodeState row a
-  = InputState (TVar (Frontier a)) (TVar (DataChangeBatch row a))
-  | IndexState (TVar (Index row a)) (TVar [DataChange row a])
+  = InputState (TVar (Frontier a)) (TVar [DataChange row a]) -- frontier, unflushed changes
+  | IndexState (TVar (Arrangement row a)) (TVar [DataChange row a])
   | JoinState (TVar (Frontier a)) (TVar (Frontier a))
   | OutputState (TVar [DataChangeBatch row a])
-  | DistinctState (TVar (Index row a)) (TVar (HashMap row (Set (Timestamp a))))
-  | ReduceState (TVar (Index row a)) (TVar (HashMap row (Set (Timestamp a))))
+  | DistinctState (TVar (Arrangement row a)) (TVar (HashMap row (Set (Timestamp a))))
+  | ReduceState (TVar (Arrangement row a)) (TVar (HashMap row (Set (Timestamp a))))
   | NoState
 
 instance Show (NodeState row a) where
@@ -132,38 +137,81 @@ instance Show (NodeState row a) where
   show (ReduceState _ _)   = "ReduceState"
   show NoState             = "NodeState"
 
-getIndexFromState :: NodeState row a -> TVar (Index row a)
+getIndexFromState :: NodeState row a -> TVar (Arrangement row a)
 getIndexFromState (IndexState    index_m _) = index_m
 getIndexFromState (DistinctState index_m _) = index_m
 getIndexFromState (ReduceState   index_m _) = index_m
 getIndexFromState _ = throw $ BuildGraphError "Trying getting index from a node which does not contains index"
 
+-- | The key by which the index of a node is arranged. An 'IndexSpec' is keyed
+-- only if its sole consumer is a reduce or distinct node, which then looks
+-- it up by that key.
+indexKeyGen :: Graph row -> Int -> Maybe (KeyGenerator row)
+indexKeyGen Graph{..} i =
+  case graphNodeSpecs HM.! i of
+    ArrangeSpec _ keygen    -> Just keygen
+    DistinctSpec _          -> Just id
+    ReduceSpec _ _ keygen _ -> Just keygen
+    IndexSpec _ -> case graphDownstreamNodes HM.! i of
+      [NodeInput consumer _] -> case graphNodeSpecs HM.! nodeId consumer of
+        DistinctSpec _          -> Just id
+        ReduceSpec _ _ keygen _ -> Just keygen
+        _                       -> Nothing
+      _ -> Nothing
+    _ -> Nothing
+
+-- | Whether a reduce or distinct node looks up its input index by key, see
+-- 'indexKeyGen'.
+lookupInputByKey :: Graph row -> NodeSpec row -> Bool
+lookupInputByKey Graph{..} spec =
+  case V.toList (getInputsFromSpec spec) of
+    [input] -> case graphNodeSpecs HM.! nodeId input of
+      IndexSpec _ -> L.length (graphDownstreamNodes HM.! nodeId input) == 1
+      _           -> False
+    _ -> False
+
+-- | Whether a join looks up the index of one side by the key of the changes
+-- of the other. Only if both sides are 'ArrangeSpec' nodes, which are
+-- arranged by the key of the join they feed.
+joinInputsByKey :: Graph row -> NodeSpec row -> Bool
+joinInputsByKey Graph{..} (JoinSpec node1 node2 _ _ _ _) =
+  L.all (\node -> case graphNodeSpecs HM.! nodeId node of
+                    ArrangeSpec _ _ -> True
+                    _               -> False
+        ) [node1, node2]
+joinInputsByKey _ _ = False
+
 specToState :: (Show a, Ord a, Hashable a,
-                Show row, Ord row, Hashable row) => NodeSpec row -> IO (NodeState row a)
-specToState InputSpec = do
+                Show row, Ord row, Hashable row)
+            => Maybe (KeyGenerator row) -> NodeSpec row -> IO (NodeState row a)
+specToState _ InputSpec = do
   frontier <- newTVarIO Set.empty
-  unflushedChanges <- newTVarIO $ mkDataChangeBatch []
+  unflushedChanges <- newTVarIO []
   return $ InputState frontier unflushedChanges
-specToState (IndexSpec _) = do
-  index <- newTVarIO $ Index []
+specToState keygen (IndexSpec _) = do
+  index <- newTVarIO $ emptyArrangement keygen
+  pendingChanges <- newTVarIO []
+  return $ IndexState index pendingChanges
+specToState keygen (ArrangeSpec _ _) = do
+  index <- newTVarIO $ emptyArrangement keygen
   pendingChanges <- newTVarIO []
   return $ IndexState index pendingChanges
-specToState (JoinSpec _ _ _ _ _ _) = do
+specToState _ (JoinSpec _ _ _ _ _ _) = do
   frontier1 <- newTVarIO Set.empty
   frontier2 <- newTVarIO Set.empty
   return $ JoinState frontier1 frontier2
-specToState (OutputSpec _) = do
+specToState _ (OutputSpec _) = do
   unpopedBatches <- newTVarIO []
   return $ OutputState unpopedBatches
-specToState (DistinctSpec _) = do
-  index <- newTVarIO $ Index []
+specToState keygen (DistinctSpec _) = do
+  index <- newTVarIO $ emptyArrangement keygen
   pendingCorrections <- newTVarIO HM.empty
   return $ DistinctState index pendingCorrections
-specToState (ReduceSpec _ _ _ _) = do
-  index <- newTVarIO $ Index []
+specToState keygen (ReduceSpec _ _ _ _) = do
+  index <- newTVarIO $ emptyArrangement keygen
   pendingCorrections <- newTVarIO HM.empty
   return $ ReduceState index pendingCorrections
-specToState _ = return NoState
+specToState _ _ = return NoState
 
 ----
 
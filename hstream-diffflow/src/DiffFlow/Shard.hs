@@ -16,7 +16,7 @@ import           Control.Exception
 import           Control.Monad
 import           Data.Foldable           (foldlM)
 import           Data.Foldable.Extra     (findM)
-import           Data.Hashable           (Hashable)
+import           Data.Hashable           (Hashable, hash)
 import           Data.HashMap.Lazy       (HashMap)
 import qualified Data.HashMap.Lazy       as HM
 import qualified Data.List               as L
@@ -30,6 +30,7 @@ import qualified Data.Tuple              as Tuple
 import qualified Data.Vector             as V
 import           GHC.Generics            (Generic)
 
+import           DiffFlow.Arrangement
 import           DiffFlow.Error
 import           DiffFlow.Graph
 import           DiffFlow.Types
@@ -83,34 +84,63 @@ instance (Ord a) => Ord (Pointstamp a) where
     where subgraph1 = pointstampSubgraphs ps1
           subgraph2 = pointstampSubgraphs ps2
 
+-- | A worker of a dataflow. The node states and the queue of change batches
+-- belong to the worker, while the progress tracking (the node frontiers and
+-- the frontier updates) is shared by all workers of the dataflow, so that
+-- each node frontier accounts for the changes on every worker.
 data Shard row a = Shard
   { shardGraph                      :: Graph row
   , shardNodeStates                 :: MVar (HM.HashMap Int (NodeState row a))
   , shardNodeFrontiers              :: MVar (HM.HashMap Int (TimestampsWithFrontier a))
   , shardUnprocessedChangeBatches   :: MVar [ChangeBatchAtNodeInput row a]
   , shardUnprocessedFrontierUpdates :: MVar (HM.HashMap (Pointstamp a) Int)
+    -- | Held while processing the frontier updates, by one worker at a time
+  , shardProgressLock               :: MVar ()
+    -- | Nodes whose frontiers were updated, to run their special actions
+  , shardPendingActions             :: MVar (Set Node)
+  , shardWorkerId                   :: Int
+    -- | All workers of the dataflow (including this one), by worker id
+  , shardPeers                      :: MVar (V.Vector (Shard row a))
   } deriving (Generic, NFData)
 
 
 buildShard :: (Hashable a, Ord a, Show a, Bounded a,
                Hashable row, Ord row, Show row) => Graph row -> IO (Shard row a)
-buildShard graph@Graph{..} = do
-  hmStateList <- mapM (\(k,v) -> do
-                          state <- specToState v
-                          return (k,state)
-                      )(HM.toList graphNodeSpecs)
-  states <- newMVar $ HM.fromList hmStateList
+buildShard graph = V.head <$> buildShards 1 graph
+
+-- | Build the workers of a dataflow, see 'DiffFlow.Workers'.
+buildShards :: (Hashable a, Ord a, Show a, Bounded a,
+                Hashable row, Ord row, Show row) => Int -> Graph row -> IO (V.Vector (Shard row a))
+buildShards n graph@Graph{..} = do
+  when (n < 1) $ throw . BuildGraphError $ "Invalid number of workers: " <> T.pack (show n)
   frontiers <- newMVar $ HM.map (\_ -> emptyTimestampsWithFrontier) graphNodeSpecs
-  unprocessedChangeBatches <- newMVar []
   unprocessedFrontierUpdates <- newMVar HM.empty
-
-  let shard = Shard { shardGraph = graph
-                    , shardNodeStates = states
-                    , shardNodeFrontiers = frontiers
-                    , shardUnprocessedChangeBatches = unprocessedChangeBatches
-                    , shardUnprocessedFrontierUpdates = unprocessedFrontierUpdates
-                    }
-  mapM_ (\(i,spec) -> case spec of
+  progressLock <- newMVar ()
+  peers <- newEmptyMVar
+  shards <- V.generateM n $ \workerId -> do
+    hmStateList <- mapM (\(k,v) -> do
+                            state <- specToState (indexKeyGen graph k) v
+                            return (k,state)
+                        )(HM.toList graphNodeSpecs)
+    states <- newMVar $ HM.fromList hmStateList
+    unprocessedChangeBatches <- newMVar []
+    pendingActions <- newMVar Set.empty
+    return Shard { shardGraph = graph
+                 , shardNodeStates = states
+                 , shardNodeFrontiers = frontiers
+                 , shardUnprocessedChangeBatches = unprocessedChangeBatches
+                 , shardUnprocessedFrontierUpdates = unprocessedFrontierUpdates
+                 , shardProgressLock = progressLock
+                 , shardPendingActions = pendingActions
+                 , shardWorkerId = workerId
+                 , shardPeers = peers
+                 }
+  putMVar peers shards
+  -- every worker holds a capability on each input node
+  V.mapM_ initInputs shards
+  return shards
+  where
+    initInputs shard = mapM_ (\(i,spec) -> case spec of
                     InputSpec -> do
                       let inputSubgraphs = graphNodeSubgraphs HM.! i
                       shardNodeStates' <- readMVar (shardNodeStates shard)
@@ -120,7 +150,6 @@ buildShard graph@Graph{..} = do
                       atomically $ modifyTVar ft_m (Set.insert ts)
                     _         -> return ()
         ) (HM.toList graphNodeSpecs)
-  return shard
 
 ----
 
@@ -139,8 +168,7 @@ pushInput Shard{..} Node{..} change = do
         False -> Log.fatal . Log.buildString $
              "!!! Can not push inputs whose ts < frontier of Input Node. Frontier = "
           <> show frontier <> ", ts = " <> show (dcTimestamp change)
-        True  -> atomically $ modifyTVar unflushedChanges_m
-                   (\batch -> updateDataChangeBatch batch (\xs -> xs ++ [change]))
+        True  -> atomically $ modifyTVar' unflushedChanges_m (change :)
     Just state -> throw . RunShardError $ "Incorrect type of node state found: " <> T.pack (show state)
 
 --
@@ -153,8 +181,9 @@ flushInput shard@Shard{..} node@Node{..} = do
   case HM.lookup nodeId shardNodeStates' of
     Nothing -> throw . RunShardError $ "No matching node found: " <> T.pack (show nodeId)
     Just (InputState frontier_m unflushedChanges_m) -> do
-      unflushedChangeBatch <- atomically $ swapTVar unflushedChanges_m emptyDataChangeBatch
-      unless (L.null $ dcbChanges unflushedChangeBatch) $
+      -- the changes pushed since the last flush are consolidated at once
+      unflushedChangeBatch <- mkDataChangeBatch <$> atomically (swapTVar unflushedChanges_m [])
+      unless (dataChangeBatchLen unflushedChangeBatch == 0) $
         emitChangeBatch shard node unflushedChangeBatch
     Just state -> throw . RunShardError $ "Incorrect type of node state found: " <> T.pack (show state)
 
@@ -207,15 +236,42 @@ emitChangeBatch shard@Shard{..} node dcb@DataChangeBatch{..} = do
                 "Emitting from node "
              <> show node <> "(" <> show spec <> ") to node " <> show toNode
              <> "(" <> show toSpec <>  ") with DataChangeBatch: " <> show dcb
-            mapM_ (\ts -> queueFrontierChange shard toNodeInput ts 1) dcbLowerBound
-            let newCbi = ChangeBatchAtNodeInput
-                         { cbiChangeBatch = dcb
-                         , cbiInputFrontier = inputFt
-                         , cbiNodeInput = toNodeInput
-                         }
-            modifyMVar_ shardUnprocessedChangeBatches (\xs -> return $ xs ++ [newCbi])
+            targets <- exchangeChangeBatch shard toNode dcb
+            mapM_ (\(target, dcb') -> do
+                      mapM_ (\ts -> queueFrontierChange shard toNodeInput ts 1) (dcbLowerBound dcb')
+                      let newCbi = ChangeBatchAtNodeInput
+                                   { cbiChangeBatch = dcb'
+                                   , cbiInputFrontier = inputFt
+                                   , cbiNodeInput = toNodeInput
+                                   }
+                      modifyMVar_ (shardUnprocessedChangeBatches target) (\xs -> return $ xs ++ [newCbi])
+                  ) targets
         ) toNodeInputs
 
+-- | The workers a change batch sent to the node goes to. Batches stay on
+-- this worker, except for the nodes which arrange their inputs: the changes
+-- are partitioned by the hash of their keys so that the changes of a key
+-- always meet on the same worker, or all go to the first worker if the
+-- arrangement is not keyed.
+exchangeChangeBatch :: (Hashable a, Ord a, Show a,
+                        Hashable row, Ord row, Show row)
+                    => Shard row a -> Node -> DataChangeBatch row a
+                    -> IO [(Shard row a, DataChangeBatch row a)]
+exchangeChangeBatch shard@Shard{..} toNode dcb = do
+  peers <- readMVar shardPeers
+  let n = V.length peers
+      arranged = case graphNodeSpecs shardGraph HM.! nodeId toNode of
+                   IndexSpec _     -> True
+                   ArrangeSpec _ _ -> True
+                   _               -> False
+  if n == 1 || not arranged then return [(shard, dcb)] else
+    case indexKeyGen shardGraph (nodeId toNode) of
+      Nothing     -> return [(V.head peers, dcb)]
+      Just keygen -> do
+        let parts = HM.fromListWith (flip (++))
+              [ (hash (keygen (dcRow change)) `mod` n, [change]) | change <- dcbChanges dcb ]
+        return [ (peers V.! i, mkDataChangeBatch changes) | (i, changes) <- HM.toList parts ]
+
 
 processChangeBatch :: (Hashable a, Ord a, Show a,
                        Hashable row, Ord row, Show row) => Shard row a -> IO ()
@@ -228,52 +284,51 @@ processChangeBatch shard@Shard{..} = do
       let nodeInput   = cbiNodeInput cbi
           changeBatch = cbiChangeBatch cbi
           node = nodeInputNode nodeInput
-      mapM_ (\ts -> queueFrontierChange shard nodeInput ts (-1)) (dcbLowerBound changeBatch)
       shardNodeStates'    <- readMVar shardNodeStates
+      let arrangeInput = do
+            mapM_ (\change -> do
+                      shardNodeFrontiers' <- readMVar shardNodeFrontiers
+                      let nodeFrontier = tsfFrontier $ shardNodeFrontiers' HM.! nodeId node
+                      assert (nodeFrontier <.= dcTimestamp change) (return ())
+                      applyFrontierChange shard node (dcTimestamp change) 1
+                  ) (dcbChanges changeBatch)
+            let (IndexState _ pendingChanges_m) = shardNodeStates' HM.! nodeId node
+            atomically $
+              modifyTVar pendingChanges_m (\xs -> xs ++ dcbChanges changeBatch)
       case graphNodeSpecs shardGraph HM.! nodeId node of
         InputSpec -> throw $ RunShardError "Input node will never have work to do on its input"
         MapSpec _ (Mapper mapper) -> do
-          outputChangeBatch <- foldlM
-                (\acc change -> do
+          outputChanges <- mapM
+                (\change -> do
                     outputRow <- case mapper (dcRow change) of
                       Left (e, def_) -> do
                         Log.warning . Log.buildString $ show e
                         return def_
                       Right row_     -> return row_
-                    let newChange = DataChange
-                          { dcRow = outputRow
-                          , dcTimestamp = dcTimestamp change
-                          , dcDiff = dcDiff change
-                          }
-                    return $ updateDataChangeBatch acc (\xs -> xs ++ [newChange])
-                ) emptyDataChangeBatch (dcbChanges changeBatch)
-          unless (L.null $ dcbChanges outputChangeBatch) $
+                    return DataChange
+                      { dcRow = outputRow
+                      , dcTimestamp = dcTimestamp change
+                      , dcDiff = dcDiff change
+                      }
+                ) (dcbChanges changeBatch)
+          let outputChangeBatch = mkDataChangeBatch outputChanges
+          unless (dataChangeBatchLen outputChangeBatch == 0) $
             emitChangeBatch shard node outputChangeBatch
         FilterSpec _ (Filter filter') -> do
-          let outputChangeBatch = L.foldl
-                (\acc change ->
-                   if filter' (dcRow change) then
-                     updateDataChangeBatch acc (\xs -> xs ++ [change]) else acc
-                ) emptyDataChangeBatch (dcbChanges changeBatch)
-          unless (L.null $ dcbChanges outputChangeBatch) $
+          let outputChangeBatch = mkDataChangeBatch $
+                L.filter (filter' . dcRow) (dcbChanges changeBatch)
+          unless (dataChangeBatchLen outputChangeBatch == 0) $
             emitChangeBatch shard node outputChangeBatch
-        IndexSpec _ -> do
-          mapM_ (\change -> do
-                    shardNodeFrontiers' <- readMVar shardNodeFrontiers
-                    let nodeFrontier = tsfFrontier $ shardNodeFrontiers' HM.! nodeId node
-                    assert (nodeFrontier <.= dcTimestamp change) (return ())
-                    applyFrontierChange shard node (dcTimestamp change) 1
-                ) (dcbChanges changeBatch)
-          let (IndexState _ pendingChanges_m) = shardNodeStates' HM.! nodeId node
-          atomically $
-            modifyTVar pendingChanges_m (\xs -> xs ++ dcbChanges changeBatch)
+        IndexSpec _ -> arrangeInput
+        ArrangeSpec _ _ -> arrangeInput
         JoinSpec node1 node2 joinType joinCond (Joiner joiner) nullRowgen -> do
           let inputIx = nodeInputIndex nodeInput
-              otherNode = case inputIx of
-                            0 -> node2
-                            1 -> node1
-                            _ -> throw ImpossibleError
+              (thisNode, otherNode) = case inputIx of
+                                        0 -> (node1, node2)
+                                        1 -> (node2, node1)
+                                        _ -> throw ImpossibleError
           otherIndex <- readTVarIO $ getIndexFromState (shardNodeStates' HM.! nodeId otherNode)
+          thisIndex  <- readTVarIO $ getIndexFromState (shardNodeStates' HM.! nodeId thisNode)
           let (JoinState ft1_m ft2_m) = shardNodeStates' HM.! nodeId node
           joinFt <- case inputIx of
                       0 -> readTVarIO ft2_m
@@ -283,9 +338,12 @@ processChangeBatch shard@Shard{..} = do
                                        0 -> (flip joinCond, flip joiner)
                                        1 -> (joinCond, joiner)
                                        _ -> throw ImpossibleError
-          let outputChangeBatch =
-                mergeJoinIndex otherIndex joinFt changeBatch joinType joinCond' joiner' nullRowgen
-          unless (L.null $ dcbChanges outputChangeBatch) $
+          let thisKeygen = if joinInputsByKey shardGraph (graphNodeSpecs shardGraph HM.! nodeId node)
+                             then arrangementKeyGen thisIndex else Nothing
+              outputChangeBatch =
+                mergeJoinArrangement otherIndex joinFt changeBatch thisKeygen
+                                     joinType joinCond' joiner' nullRowgen
+          unless (dataChangeBatchLen outputChangeBatch == 0) $
             emitChangeBatch shard node outputChangeBatch
           let inputFt = fromJust $ cbiInputFrontier cbi -- FIXME: unsafe
           case inputIx of
@@ -296,46 +354,25 @@ processChangeBatch shard@Shard{..} = do
           let (OutputState unpoppedChangeBatches_m) = shardNodeStates' HM.! nodeId node
           atomically $ modifyTVar unpoppedChangeBatches_m (\xs -> xs ++ [changeBatch])
         TimestampPushSpec _ -> do
-          let outputChangeBatch = L.foldl
-                (\acc change -> do
-                    let outputTs  = pushCoord (dcTimestamp change)
-                        newChange = DataChange
-                          { dcRow = dcRow change
-                          , dcTimestamp = outputTs
-                          , dcDiff = dcDiff change
-                          }
-                    updateDataChangeBatch acc (\xs -> xs ++ [newChange])
-                ) emptyDataChangeBatch (dcbChanges changeBatch)
-          unless (L.null $ dcbChanges outputChangeBatch) $
+          let outputChangeBatch = mkDataChangeBatch $
+                L.map (\change -> change { dcTimestamp = pushCoord (dcTimestamp change) })
+                      (dcbChanges changeBatch)
+          unless (dataChangeBatchLen outputChangeBatch == 0) $
             emitChangeBatch shard node outputChangeBatch
         TimestampIncSpec _ -> do
-          let outputChangeBatch = L.foldl
-                (\acc change -> do
-                    let outputTs  = incCoord (dcTimestamp change)
-                        newChange = DataChange
-                          { dcRow = dcRow change
-                          , dcTimestamp = outputTs
-                          , dcDiff = dcDiff change
-                          }
-                    updateDataChangeBatch acc (\xs -> xs ++ [newChange])
-                ) emptyDataChangeBatch (dcbChanges changeBatch)
-          unless (L.null $ dcbChanges outputChangeBatch) $
+          let outputChangeBatch = mkDataChangeBatch $
+                L.map (\change -> change { dcTimestamp = incCoord (dcTimestamp change) })
+                      (dcbChanges changeBatch)
+          unless (dataChangeBatchLen outputChangeBatch == 0) $
             emitChangeBatch shard node outputChangeBatch
         TimestampPopSpec _ -> do
-          let outputChangeBatch = L.foldl
-                (\acc change -> do
-                    let outputTs  = popCoord (dcTimestamp change)
-                        newChange = DataChange
-                          { dcRow = dcRow change
-                          , dcTimestamp = outputTs
-                          , dcDiff = dcDiff change
-                          }
-                    updateDataChangeBatch acc (\xs -> xs ++ [newChange])
-                ) emptyDataChangeBatch (dcbChanges changeBatch)
-          unless (L.null $ dcbChanges outputChangeBatch) $
+          let outputChangeBatch = mkDataChangeBatch $
+                L.map (\change -> change { dcTimestamp = popCoord (dcTimestamp change) })
+                      (dcbChanges changeBatch)
+          unless (dataChangeBatchLen outputChangeBatch == 0) $
             emitChangeBatch shard node outputChangeBatch
         UnionSpec _ _ -> do
-          unless (L.null $ dcbChanges changeBatch) $
+          unless (dataChangeBatchLen changeBatch == 0) $
             emitChangeBatch shard node changeBatch
         DistinctSpec _ -> do
           let (DistinctState index_m pendingCorrections_m) = shardNodeStates' HM.! nodeId node
@@ -395,12 +432,14 @@ processChangeBatch shard@Shard{..} = do
                                       void $ applyFrontierChange shard node lub 1
                                   ) (Set.insert (dcTimestamp change) timestamps)
                 ) (dcbChanges changeBatch)
+      -- release the batch only after its effects are recorded, so that other
+      -- workers never see the frontier pass a batch still being processed
+      mapM_ (\ts -> queueFrontierChange shard nodeInput ts (-1)) (dcbLowerBound changeBatch)
 
 queueFrontierChange :: (Hashable a, Ord a, Show a,
                         Hashable row, Ord row, Show row) => Shard row a -> NodeInput -> Timestamp a -> Int -> IO ()
 queueFrontierChange Shard{..} nodeInput@NodeInput{..} ts diff = do
   assert (diff /= 0) (return ())
-  shardUnprocessedFrontierUpdates' <- readMVar shardUnprocessedFrontierUpdates
   let nodeSpec = graphNodeSpecs shardGraph HM.! nodeId nodeInputNode
       inputNode = (V.!) (getInputsFromSpec nodeSpec) nodeInputIndex
   let thisSubgraphs = graphNodeSubgraphs shardGraph HM.! nodeId nodeInputNode
@@ -409,52 +448,59 @@ queueFrontierChange Shard{..} nodeInput@NodeInput{..} ts diff = do
         , pointstampSubgraphs = thisSubgraphs
         , pointstampTimestamp = ts
         }
-  case HM.lookup pointstamp shardUnprocessedFrontierUpdates' of
-    Nothing ->
-      modifyMVar_ shardUnprocessedFrontierUpdates (return . HM.insert pointstamp diff)
-    Just n  ->
-      if n + diff == 0 then
-        modifyMVar_ shardUnprocessedFrontierUpdates (return . HM.delete pointstamp)
-      else
-        modifyMVar_ shardUnprocessedFrontierUpdates (return . HM.adjust (+ diff) pointstamp)
+  modifyMVar_ shardUnprocessedFrontierUpdates $ \updates -> return $
+    case HM.lookup pointstamp updates of
+      Nothing -> HM.insert pointstamp diff updates
+      Just n  ->
+        if n + diff == 0 then HM.delete pointstamp updates
+                         else HM.adjust (+ diff) pointstamp updates
 
 -- True:  Updated
 -- False: Not updated
 applyFrontierChange :: (Hashable a, Ord a, Show a,
                         Hashable row, Ord row, Show row) => Shard row a -> Node -> Timestamp a -> Int -> IO Bool
-applyFrontierChange shard@Shard{..} node ts diff = do
-  shardNodeFrontiers' <- readMVar shardNodeFrontiers
-  case HM.lookup (nodeId node) shardNodeFrontiers' of
-    Nothing  -> throw . RunShardError $ "No matching node found: " <> T.pack (show (nodeId node))
-    Just tsf -> do
-      let (newTsf, ftChanges) = updateTimestampsWithFrontier tsf ts diff
-      modifyMVar_ shardNodeFrontiers (return . HM.insert (nodeId node) newTsf)
-      mapM_ (\ftChange -> do
-                mapM_ (\nodeInput ->
-                         queueFrontierChange shard nodeInput
-                           (frontierChangeTs ftChange) (frontierChangeDiff ftChange)
-                      ) (graphDownstreamNodes shardGraph HM.! nodeId node)
-            ) ftChanges
-      if L.null ftChanges then return False else return True
+applyFrontierChange shard@Shard{..} node ts diff =
+  -- the frontiers are shared by all workers, so the change of the frontier
+  -- and the updates it queues downstream are made at once
+  modifyMVar shardNodeFrontiers $ \shardNodeFrontiers' ->
+    case HM.lookup (nodeId node) shardNodeFrontiers' of
+      Nothing  -> throw . RunShardError $ "No matching node found: " <> T.pack (show (nodeId node))
+      Just tsf -> do
+        let (newTsf, ftChanges) = updateTimestampsWithFrontier tsf ts diff
+        mapM_ (\ftChange -> do
+                  mapM_ (\nodeInput ->
+                           queueFrontierChange shard nodeInput
+                             (frontierChangeTs ftChange) (frontierChangeDiff ftChange)
+                        ) (graphDownstreamNodes shardGraph HM.! nodeId node)
+              ) ftChanges
+        return (HM.insert (nodeId node) newTsf shardNodeFrontiers', not (L.null ftChanges))
 
 
 processFrontierUpdates :: forall row a. (Hashable a, Ord a, Show a,
                                          Hashable row, Ord row, Show row, Semigroup row) => Shard row a -> IO ()
 processFrontierUpdates shard@Shard{..} = do
-  updatedNodes <- go
-  mapM_ specialActions updatedNodes
+  -- one worker at a time processes the shared frontier updates, the special
+  -- actions of the updated nodes then run on every worker for its own state
+  withMVar shardProgressLock $ \_ -> do
+    updatedNodes <- go
+    unless (Set.null updatedNodes) $ do
+      peers <- readMVar shardPeers
+      V.mapM_ (\peer -> modifyMVar_ (shardPendingActions peer) (return . Set.union updatedNodes)) peers
+  pendingNodes <- modifyMVar shardPendingActions (\xs -> return (Set.empty, xs))
+  mapM_ specialActions pendingNodes
   where
     -- process pointstamps in causal order to ensure termination
     go :: IO (Set Node) -- return: updatedNodes
     go = do
-      unprocessedNow <- readMVar shardUnprocessedFrontierUpdates
-      if HM.null unprocessedNow then return Set.empty else do
-        let minKey  = L.minimum (HM.keys unprocessedNow)
-            node    = nodeInputNode (pointstampNodeInput minKey)
+      popped <- modifyMVar shardUnprocessedFrontierUpdates $ \unprocessedNow ->
+        if HM.null unprocessedNow then return (unprocessedNow, Nothing) else do
+          let minKey = L.minimum (HM.keys unprocessedNow)
+          return (HM.delete minKey unprocessedNow, Just (minKey, unprocessedNow HM.! minKey))
+      case popped of
+       Nothing -> return Set.empty
+       Just (minKey, diff) -> do
+        let node    = nodeInputNode (pointstampNodeInput minKey)
             inputTs = pointstampTimestamp minKey
-            diff    = unprocessedNow HM.! minKey
-        modifyMVar_ shardUnprocessedFrontierUpdates (return . HM.delete minKey)
-
         let outputTs = case graphNodeSpecs shardGraph HM.! nodeId node of
               TimestampPushSpec _ -> pushCoord inputTs
               TimestampIncSpec  _ -> incCoord inputTs
@@ -474,23 +520,23 @@ processFrontierUpdates shard@Shard{..} = do
         IndexState index_m pendingChanges_m      -> do
           shardNodeFrontiers' <- readMVar shardNodeFrontiers
           pendingChanges <- readTVarIO pendingChanges_m
-          let (IndexSpec inputNode) = nodeSpec
+          let inputNode = V.head $ getInputsFromSpec nodeSpec
           let inputTsf = shardNodeFrontiers' HM.! nodeId inputNode
-          (tssToRemove, newDataChangeBatch, newPendingChanges) <-
-            foldM (\(curTssToRemove, curDataChangeBatch, curPendingChanges) change -> do
+          (tssToRemove, newDataChanges, newPendingChanges) <-
+            foldM (\(curTssToRemove, curDataChanges, curPendingChanges) change -> do
                       case tsfFrontier inputTsf `causalCompare` dcTimestamp change of
                         PGT -> do
                           let tssToRemove' = curTssToRemove ++ [dcTimestamp change]
-                              dataChangeBatch' = updateDataChangeBatch curDataChangeBatch (++ [change])
-                          return (tssToRemove', dataChangeBatch', curPendingChanges)
+                          return (tssToRemove', change : curDataChanges, curPendingChanges)
                         _   -> do
                           let pendingChanges' = curPendingChanges ++ [change]
-                          return (curTssToRemove, curDataChangeBatch, pendingChanges')
-                  ) ([], emptyDataChangeBatch, []) pendingChanges
+                          return (curTssToRemove, curDataChanges, pendingChanges')
+                  ) ([], [], []) pendingChanges
           atomically $ writeTVar pendingChanges_m newPendingChanges
-          unless (L.null $ dcbChanges newDataChangeBatch) $ do
+          let newDataChangeBatch = mkDataChangeBatch newDataChanges
+          unless (dataChangeBatchLen newDataChangeBatch == 0) $ do
             atomically $ modifyTVar index_m
-              (\oldIndex -> addChangeBatchToIndex oldIndex newDataChangeBatch)
+              (\oldIndex -> insertArrangement oldIndex newDataChangeBatch)
             emitChangeBatch shard node newDataChangeBatch
           mapM_ (\tsToRemove -> applyFrontierChange shard node tsToRemove (-1)) tssToRemove
         DistinctState index_m pendingCorrections_m -> do
@@ -511,8 +557,11 @@ processFrontierUpdates shard@Shard{..} = do
           mapM_ (goPendingCorrection nodeSpec (tsfFrontier inputTsf) inputIndex_m index_m pendingCorrections_m) (HM.toList pendingCorrections)
         _ -> return ()
       where
-        goPendingCorrection :: NodeSpec row -> Frontier a -> TVar (Index row a) -> TVar (Index row a) -> TVar (HashMap row (Set (Timestamp a))) -> (row, Set (Timestamp a)) -> IO ()
+        goPendingCorrection :: NodeSpec row -> Frontier a -> TVar (Arrangement row a) -> TVar (Arrangement row a) -> TVar (HashMap row (Set (Timestamp a))) -> (row, Set (Timestamp a)) -> IO ()
         goPendingCorrection nodeSpec inputFt inputIndex_m outputIndex_m pendingCorrections_m (key, timestamps) = do
+          let inputChangesForKey index key' p
+                | lookupInputByKey shardGraph nodeSpec = arrangementChangesForKey index key' p
+                | otherwise = arrangementChanges index p
           (tssToCheck, ftChanges) <-
             foldM (\(curTssToCheck,curFtChanges) ts -> do
                       if inputFt `causalCompare` ts == PGT then do
@@ -526,14 +575,14 @@ processFrontierUpdates shard@Shard{..} = do
           let realTimestamps = L.foldl (flip Set.delete) timestamps tssToCheck
           atomically $
             modifyTVar pendingCorrections_m (HM.insert key realTimestamps)
-          newOutputdcb <- foldM (\acc tsToCheck -> do
+          newOutputChanges <- foldM (\acc tsToCheck -> do
                     inputIndex  <- readTVarIO inputIndex_m
                     outputIndex <- readTVarIO outputIndex_m
 
                     case nodeSpec of
                       ReduceSpec _ initValue keygen (Reducer reducer) -> do
-                        let inputChanges  = getChangesForKey inputIndex  (\row -> keygen row == key)
-                            outputChanges = getChangesForKey outputIndex (\row -> keygen row == key)
+                        let inputChanges  = inputChangesForKey inputIndex key (\row -> keygen row == key)
+                            outputChanges = arrangementChangesForKey outputIndex key (\row -> keygen row == key)
 
                         -- coalesce same rows so the reducer function will only process positive results
                         let inputBag = dcbChanges $ Weird.mkDataChangeBatch' (L.filter
@@ -565,12 +614,12 @@ processFrontierUpdates shard@Shard{..} = do
                         let outputChanges'' = outputChanges' ++ [newOutput]
                         let thisChangeBatch = mkDataChangeBatch outputChanges''
                         atomically $
-                          modifyTVar outputIndex_m (flip addChangeBatchToIndex thisChangeBatch)
-                        return $ updateDataChangeBatch acc (\xs -> xs ++ outputChanges'')
+                          modifyTVar outputIndex_m (flip insertArrangement thisChangeBatch)
+                        return $ outputChanges'' ++ acc
                       DistinctSpec _ -> do
-                        let inputChanges = getChangesForKey inputIndex (== key)
+                        let inputChanges = inputChangesForKey inputIndex key (== key)
                         let inputCount = L.foldl (\acc DataChange{..} -> if dcTimestamp <.= tsToCheck then acc + dcDiff else acc) 0 inputChanges
-                        let outputCount = getCountForKey outputIndex key tsToCheck
+                        let outputCount = arrangementCountForKey outputIndex key tsToCheck
                         let correctOutputCount = if inputCount == 0 then 0 else 1
                         let diffOutputCount = correctOutputCount - outputCount
                         if (diffOutputCount /= 0) then do
@@ -581,12 +630,13 @@ processFrontierUpdates shard@Shard{..} = do
                                        }
                           let thisChangeBatch = mkDataChangeBatch [change]
                           atomically $
-                            modifyTVar outputIndex_m (flip addChangeBatchToIndex thisChangeBatch)
-                          return $ updateDataChangeBatch acc (\xs -> xs ++ [change])
+                            modifyTVar outputIndex_m (flip insertArrangement thisChangeBatch)
+                          return $ change : acc
                         else do
                           return acc
-                ) emptyDataChangeBatch (L.sort tssToCheck)
-          unless (L.null $ dcbChanges newOutputdcb) $
+                ) [] (L.sort tssToCheck)
+          let newOutputdcb = mkDataChangeBatch newOutputChanges
+          unless (dataChangeBatchLen newOutputdcb == 0) $
             emitChangeBatch shard node newOutputdcb
           mapM_ (\FrontierChange{..} -> applyFrontierChange shard node frontierChangeTs frontierChangeDiff) ftChanges
 
@@ -608,20 +658,22 @@ hasWork :: Shard row a -> IO Bool
 hasWork shard@Shard{..} = do
   shardUnprocessedChangeBatches' <- readMVar shardUnprocessedChangeBatches
   shardUnprocessedFrontierUpdates' <- readMVar shardUnprocessedFrontierUpdates
+  shardPendingActions' <- readMVar shardPendingActions
   return $
     not (L.null shardUnprocessedChangeBatches')    ||
-    not (HM.null shardUnprocessedFrontierUpdates')
+    not (HM.null shardUnprocessedFrontierUpdates') ||
+    not (Set.null shardPendingActions')
 
 doWork :: (Hashable a, Ord a, Show a,
            Hashable row, Ord row, Show row, Semigroup row) => Shard row a -> IO ()
 doWork shard@Shard{..} = do
   shardUnprocessedChangeBatches' <- readMVar shardUnprocessedChangeBatches
   shardUnprocessedFrontierUpdates' <- readMVar shardUnprocessedFrontierUpdates
-  shardNodeStates' <- readMVar shardNodeStates
+  shardPendingActions' <- readMVar shardPendingActions
   if not (L.null shardUnprocessedChangeBatches') then do
     Log.trace . Log.buildString $ "=== Working (processChangeBatch)..."
     processChangeBatch shard else
-    if not (L.null shardUnprocessedFrontierUpdates') then do
+    if not (L.null shardUnprocessedFrontierUpdates') || not (Set.null shardPendingActions') then do
       Log.trace . Log.buildString $ "=== Working (processFrontierUpdates)..."
       processFrontierUpdates shard else return ()
 
@@ -638,6 +690,32 @@ popOutput Shard{..} node delayAction action = do
     Nothing  -> delayAction
     Just dcb -> action dcb
 
+-- | Compact the arrangements of reduce and distinct nodes (and their input
+-- indexes they look up by key) by the earliest timestamps they can still be
+-- looked up at: the frontier of their input and their pending corrections.
+-- Only arrangements with new batches since the last compaction are touched.
+compactArrangements :: (Hashable a, Ord a, Show a,
+                        Hashable row, Ord row, Show row) => Shard row a -> IO ()
+compactArrangements Shard{..} = do
+  shardNodeStates' <- readMVar shardNodeStates
+  shardNodeFrontiers' <- readMVar shardNodeFrontiers
+  let compact ft index_m = atomically $ modifyTVar' index_m $ \arr ->
+        if L.length (arrangementBatches arr) > 1 then compactArrangement ft arr else arr
+  forM_ (HM.toList $ graphNodeSpecs shardGraph) $ \(i, spec) -> do
+    let corrections = case shardNodeStates' HM.! i of
+          DistinctState index_m pendingCorrections_m -> Just (index_m, pendingCorrections_m)
+          ReduceState   index_m pendingCorrections_m -> Just (index_m, pendingCorrections_m)
+          _                                          -> Nothing
+    forM_ corrections $ \(index_m, pendingCorrections_m) -> do
+      let inputNode = V.head $ getInputsFromSpec spec
+          inputFt = tsfFrontier $ shardNodeFrontiers' HM.! nodeId inputNode
+      pendingCorrections <- readTVarIO pendingCorrections_m
+      let ft = frontierOf $
+            Set.toList inputFt ++ L.concatMap Set.toList (HM.elems pendingCorrections)
+      compact ft index_m
+      when (lookupInputByKey shardGraph spec) $
+        compact ft (getIndexFromState (shardNodeStates' HM.! nodeId inputNode))
+
 run :: (Hashable a, Ord a, Show a,
         Hashable row, Ord row, Show row, Semigroup row) => Shard row a -> MVar () -> IO ()
 run shard stop = do
@@ -651,6 +729,7 @@ run shard stop = do
       stop_m <- tryTakeMVar stop
       case stop_m of
         Nothing -> do
+          compactArrangements shard
           threadDelay 100000
           run shard stop
         Just _  -> return ()
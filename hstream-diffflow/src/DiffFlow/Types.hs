@@ -14,8 +14,7 @@ import           Control.Exception     (throw)
 import           Control.Monad
 import           Data.Aeson            (Object (..), Value (..))
 import qualified Data.Aeson            as Aeson
-import           Data.Hashable         (Hashable)
-import qualified Data.HashMap.Lazy     as HM
+import           Data.Hashable         (Hashable, hash, hashWithSalt)
 import qualified Data.List             as L
 import           Data.MultiSet         (MultiSet)
 import qualified Data.MultiSet         as MultiSet
@@ -25,9 +24,11 @@ import qualified Data.Text             as T
 import qualified Data.Universe.Helpers as Helpers
 import           Data.Vector           (Vector)
 import qualified Data.Vector           as V
+import qualified Data.Vector.Unboxed   as VU
 import           Data.Word             (Word64)
 import           GHC.Generics          (Generic)
 
+import           DiffFlow.Columnar
 import           DiffFlow.Error
 
 type Bag row = MultiSet row
@@ -82,6 +83,22 @@ leastUpperBoundMany :: (Ord a) => [Timestamp a] -> Timestamp a
 leastUpperBoundMany tss =
   L.foldl1 (\acc ts -> leastUpperBound acc ts) tss
 
+greatestLowerBound :: (Ord a) => Timestamp a -> Timestamp a -> Timestamp a
+greatestLowerBound ts1 ts2 =
+  Timestamp { timestampTime = lowerTime, timestampCoords = lowerCoords }
+  where lowerTime = min (timestampTime ts1) (timestampTime ts2)
+        lowerCoords = L.zipWith min (timestampCoords ts1) (timestampCoords ts2)
+
+-- | Advance a timestamp by a frontier, to the earliest timestamp which is
+-- indistinguishable from it for every timestamp later than the frontier,
+-- i.e. for each ts' with (frontier <.= ts'), (ts <.= ts') iff
+-- (advanceTimestamp frontier ts <.= ts'). An empty frontier keeps it as is.
+advanceTimestamp :: (Ord a) => Frontier a -> Timestamp a -> Timestamp a
+advanceTimestamp ft ts
+  | Set.null ft = ts
+  | otherwise   = L.foldl1 greatestLowerBound
+                    (L.map (leastUpperBound ts) (Set.toList ft))
+
 pushCoord :: (Ord a) => Timestamp a -> Timestamp a
 pushCoord ts =
   Timestamp
@@ -114,6 +131,13 @@ infix 4 <.=
 ----
 type Frontier a = Set (Timestamp a)
 
+-- | The frontier of a set of timestamps, i.e. the earliest ones of them.
+frontierOf :: (Ord a) => [Timestamp a] -> Frontier a
+frontierOf tss =
+  Set.filter (\ts -> not (L.any (\x -> x `causalCompare` ts == PLT) distinct)) distinctSet
+  where distinctSet = Set.fromList tss
+        distinct = Set.toList distinctSet
+
 instance (Ord a) => CausalOrd (Frontier a) (Timestamp a) where
   causalCompare ft ts =
     Set.foldl (\acc x -> if acc == PNONE then x `causalCompare` ts else acc) PNONE ft
@@ -283,34 +307,178 @@ compareDataChangeByTimeFirst dc1 dc2 =
     PGT   -> GT
     PNONE -> dcRow dc1 `compare` dcRow dc2
 
+-- | The changes of a batch, stored by columns: the i-th change is made of the
+-- i-th element of each column. The rows are kept along with their hashes,
+-- and the coordinates of all timestamps are kept in one flat vector, in
+-- which those of the i-th change are in [ccCoordOffs ! i, ccCoordOffs ! (i+1)).
+data ChangeColumns row a = ChangeColumns
+  { ccRows      :: !(V.Vector row)
+  , ccRowHashes :: !(VU.Vector Int)
+  , ccTimes     :: !(V.Vector a)
+  , ccCoords    :: !(VU.Vector Word64)
+  , ccCoordOffs :: !(VU.Vector Int)
+  , ccDiffs     :: !(VU.Vector Int)
+  }
+
+emptyChangeColumns :: ChangeColumns row a
+emptyChangeColumns =
+  ChangeColumns V.empty VU.empty V.empty VU.empty (VU.singleton 0) VU.empty
+
+changeColumnsLen :: ChangeColumns row a -> Int
+changeColumnsLen = VU.length . ccDiffs
+
+changesToColumns :: (Hashable row) => [DataChange row a] -> ChangeColumns row a
+changesToColumns changes =
+  ChangeColumns
+  { ccRows      = V.fromListN n (L.map dcRow changes)
+  , ccRowHashes = VU.fromListN n (L.map (hash . dcRow) changes)
+  , ccTimes     = V.fromListN n (L.map (timestampTime . dcTimestamp) changes)
+  , ccCoords    = VU.fromList (L.concatMap (timestampCoords . dcTimestamp) changes)
+  , ccCoordOffs = VU.fromListN (n + 1) $
+      L.scanl (\acc x -> acc + L.length (timestampCoords $ dcTimestamp x)) 0 changes
+  , ccDiffs     = VU.fromListN n (L.map dcDiff changes)
+  }
+  where n = L.length changes
+
+columnsToChanges :: ChangeColumns row a -> [DataChange row a]
+columnsToChanges cols =
+  L.map (\i -> DataChange
+               { dcRow = V.unsafeIndex (ccRows cols) i
+               , dcTimestamp = columnsTimestampAt cols i
+               , dcDiff = VU.unsafeIndex (ccDiffs cols) i
+               }) [0 .. changeColumnsLen cols - 1]
+
+columnsCoordsAt :: ChangeColumns row a -> Int -> VU.Vector Word64
+columnsCoordsAt ChangeColumns{..} i =
+  VU.unsafeSlice start (VU.unsafeIndex ccCoordOffs (i + 1) - start) ccCoords
+  where start = VU.unsafeIndex ccCoordOffs i
+
+columnsTimestampAt :: ChangeColumns row a -> Int -> Timestamp a
+columnsTimestampAt cols i =
+  Timestamp
+  { timestampTime = V.unsafeIndex (ccTimes cols) i
+  , timestampCoords = VU.toList (columnsCoordsAt cols i)
+  }
+
+appendColumns :: ChangeColumns row a -> ChangeColumns row a -> ChangeColumns row a
+appendColumns x y =
+  ChangeColumns
+  { ccRows      = ccRows x V.++ ccRows y
+  , ccRowHashes = ccRowHashes x VU.++ ccRowHashes y
+  , ccTimes     = ccTimes x V.++ ccTimes y
+  , ccCoords    = ccCoords x VU.++ ccCoords y
+  , ccCoordOffs = ccCoordOffs x VU.++
+      VU.map (+ VU.length (ccCoords x)) (VU.tail $ ccCoordOffs y)
+  , ccDiffs     = ccDiffs x VU.++ ccDiffs y
+  }
+
+-- | Keep the changes at the given indices, with new diffs.
+selectColumns :: ChangeColumns row a -> VU.Vector Int -> VU.Vector Int
+              -> ChangeColumns row a
+selectColumns cols@ChangeColumns{..} ixs diffs =
+  ChangeColumns
+  { ccRows      = V.backpermute ccRows (VU.convert ixs)
+  , ccRowHashes = VU.backpermute ccRowHashes ixs
+  , ccTimes     = V.backpermute ccTimes (VU.convert ixs)
+  , ccCoords    = VU.concatMap (columnsCoordsAt cols) ixs
+  , ccCoordOffs = VU.prescanl' (+) 0 (VU.snoc coordLens 0)
+  , ccDiffs     = diffs
+  }
+  where coordLens = VU.map (\i -> VU.unsafeIndex ccCoordOffs (i + 1)
+                                - VU.unsafeIndex ccCoordOffs i) ixs
+
+-- | Sum up the diffs of the same (row, timestamp), drop the ones summed to
+-- zero, then sort the rest by (timestamp, row).
+--
+-- The changes are grouped by a radix sort on the hashes of (row, timestamp),
+-- so that only the changes in the same run of equal hashes (which are
+-- almost always the same change) have their rows compared. Only the changes
+-- left are sorted by the 'Ord' of timestamps and rows.
+consolidateColumns :: (Hashable a, Ord a, Ord row)
+                   => ChangeColumns row a -> ChangeColumns row a
+consolidateColumns cols@ChangeColumns{..}
+  | n == 0    = cols
+  | otherwise = selectColumns cols (VU.fromListN m (L.map fst sorted))
+                                   (VU.fromListN m (L.map snd sorted))
+  where
+    n = changeColumnsLen cols
+    keys = VU.generate n $ \i ->
+      fromIntegral $ VU.foldl' hashWithSalt
+        (VU.unsafeIndex ccRowHashes i `hashWithSalt` V.unsafeIndex ccTimes i)
+        (columnsCoordsAt cols i) :: Word64
+    perm = radixSortIndices keys
+    survivors = L.concatMap
+      (\(start, end) -> sumRun [VU.unsafeIndex perm j | j <- [start .. end - 1]])
+      (equalRuns keys perm)
+    sumRun []     = []
+    sumRun (i:is) =
+      let (same, rest) = L.partition (sameChange i) is
+          diff = L.foldl' (\acc j -> acc + VU.unsafeIndex ccDiffs j)
+                          (VU.unsafeIndex ccDiffs i) same
+       in if diff == 0 then sumRun rest else (i, diff) : sumRun rest
+    sameChange i j = VU.unsafeIndex ccRowHashes i == VU.unsafeIndex ccRowHashes j
+                  && V.unsafeIndex ccTimes i == V.unsafeIndex ccTimes j
+                  && columnsCoordsAt cols i == columnsCoordsAt cols j
+                  && V.unsafeIndex ccRows i == V.unsafeIndex ccRows j
+    compareChange i j =
+      compare (V.unsafeIndex ccTimes i) (V.unsafeIndex ccTimes j)
+      <> compare (columnsCoordsAt cols i) (columnsCoordsAt cols j)
+      <> compare (V.unsafeIndex ccRows i) (V.unsafeIndex ccRows j)
+    sorted = L.sortBy (\(i, _) (j, _) -> compareChange i j) survivors
+    m = L.length sorted
+
 data DataChangeBatch row a = DataChangeBatch
   { dcbLowerBound :: Frontier a
-  , dcbChanges    :: [DataChange row a] -- sorted and de-duplicated
+  , dcbColumns    :: ChangeColumns row a -- sorted and de-duplicated
   }
-deriving instance (Eq row, Eq a) => Eq (DataChangeBatch row a)
-deriving instance (Ord row, Ord a) => Ord (DataChangeBatch row a)
-deriving instance (Show row, Show a) => Show (DataChangeBatch row a)
+
+-- | The changes of the batch, sorted by (timestamp, row).
+dcbChanges :: DataChangeBatch row a -> [DataChange row a]
+dcbChanges = columnsToChanges . dcbColumns
+
+instance (Eq row, Eq a) => Eq (DataChangeBatch row a) where
+  dcb1 == dcb2 = dataChangeBatchLen dcb1 == dataChangeBatchLen dcb2
+              && dcbLowerBound dcb1 == dcbLowerBound dcb2
+              && dcbChanges dcb1 == dcbChanges dcb2
+instance (Ord row, Ord a) => Ord (DataChangeBatch row a) where
+  compare dcb1 dcb2 =
+    compare (dcbLowerBound dcb1, dcbChanges dcb1) (dcbLowerBound dcb2, dcbChanges dcb2)
+instance (Show row, Show a) => Show (DataChangeBatch row a) where
+  show dcb = "DataChangeBatch {dcbLowerBound = " <> show (dcbLowerBound dcb)
+          <> ", dcbChanges = " <> show (dcbChanges dcb) <> "}"
 
 emptyDataChangeBatch :: DataChangeBatch row a
-emptyDataChangeBatch = DataChangeBatch {dcbLowerBound=Set.empty, dcbChanges=[]}
+emptyDataChangeBatch = DataChangeBatch {dcbLowerBound=Set.empty, dcbColumns=emptyChangeColumns}
 
 dataChangeBatchLen :: DataChangeBatch row a -> Int
-dataChangeBatchLen DataChangeBatch{..} = L.length dcbChanges
+dataChangeBatchLen DataChangeBatch{..} = changeColumnsLen dcbColumns
+
+-- | Make a batch of consolidated columns, i.e. its changes are already sorted
+-- and de-duplicated.
+columnsToDataChangeBatch :: (Ord a, Show a)
+                         => ChangeColumns row a -> DataChangeBatch row a
+columnsToDataChangeBatch cols = DataChangeBatch frontier cols
+  where frontier = L.foldl
+          (\acc i -> acc ~>> (MoveEarlier, columnsTimestampAt cols i))
+          Set.empty [0 .. changeColumnsLen cols - 1]
 
 mkDataChangeBatch :: (Hashable a, Ord a, Show a,
                       Hashable row, Ord row, Show row)
                   => [DataChange row a]
                   -> DataChangeBatch row a
-mkDataChangeBatch changes = DataChangeBatch frontier sortedChanges
-  where getKey DataChange{..} = (dcRow, dcTimestamp)
-        coalescedChanges = HM.filter (\DataChange{..} -> dcDiff /= 0) $
-          L.foldl (\acc x -> HM.insertWith
-                    (\new old -> old {dcDiff = dcDiff new + dcDiff old} )
-                    (getKey x) x acc) HM.empty changes
-        sortedChanges = L.sort $ HM.elems coalescedChanges
-        frontier = L.foldl
-          (\acc DataChange{..} -> acc ~>> (MoveEarlier,dcTimestamp))
-          Set.empty sortedChanges
+mkDataChangeBatch = columnsToDataChangeBatch . consolidateColumns . changesToColumns
+
+-- | Merge two batches into one, without going through the lists of changes.
+mergeDataChangeBatch :: (Hashable a, Ord a, Show a,
+                         Hashable row, Ord row, Show row)
+                     => DataChangeBatch row a
+                     -> DataChangeBatch row a
+                     -> DataChangeBatch row a
+mergeDataChangeBatch x y
+  | dataChangeBatchLen x == 0 = y
+  | dataChangeBatchLen y == 0 = x
+  | otherwise = columnsToDataChangeBatch . consolidateColumns $
+      appendColumns (dcbColumns x) (dcbColumns y)
 
 updateDataChangeBatch :: (Hashable a, Ord a, Show a,
                           Hashable row, Ord row, Show row)
@@ -338,36 +506,26 @@ mergeJoinDataChangeBatch :: (Hashable a, Ord a, Show a,
                          -> (row -> row)
                          -> DataChangeBatch row a
 mergeJoinDataChangeBatch self selfFt other joinType joinCond rowgen nullRowgen =
-  L.foldl (\acc (this,that) ->
-             if selfFt `causalCompare` dcTimestamp this == PGT then
-               let newDataChange_inner =
-                     DataChange
-                     { dcRow = rowgen (dcRow this) (dcRow that)
-                     , dcTimestamp = leastUpperBound (dcTimestamp this) (dcTimestamp that)
-                     , dcDiff = dcDiff this * dcDiff that
-                     }
-                   newDataChange_left =
-                     DataChange
-                     { dcRow = rowgen (nullRowgen $ dcRow this) (dcRow that)
-                     , dcTimestamp = leastUpperBound (dcTimestamp this) (dcTimestamp that)
-                     , dcDiff = dcDiff this * dcDiff that
-                     }
-                   newDataChange_right =
-                     DataChange
-                     { dcRow = rowgen (dcRow this) (nullRowgen $ dcRow that)
-                     , dcTimestamp = leastUpperBound (dcTimestamp this) (dcTimestamp that)
-                     , dcDiff = dcDiff this * dcDiff that
-                     }
-                in case joinCond (dcRow this) (dcRow that) of
-                     True  -> updateDataChangeBatch acc (\xs -> xs ++ [newDataChange_inner])
-                     False -> case joinType of
-                                MergeJoinInner -> acc
-                                MergeJoinLeft  -> updateDataChangeBatch acc (\xs -> xs ++ [newDataChange_left])
-                                MergeJoinRight -> updateDataChangeBatch acc (\xs -> xs ++ [newDataChange_right])
-                                MergeJoinFull  -> updateDataChangeBatch acc (\xs -> xs ++ [newDataChange_left, newDataChange_right])
-             else acc
-          ) emptyDataChangeBatch
-  [(self_x, other_x) | self_x <- dcbChanges self, other_x <- dcbChanges other]
+  mkDataChangeBatch
+    [ newDataChange
+    | this <- dcbChanges self
+    , selfFt `causalCompare` dcTimestamp this == PGT
+    , that <- dcbChanges other
+    , let mkChange row = DataChange
+            { dcRow = row
+            , dcTimestamp = leastUpperBound (dcTimestamp this) (dcTimestamp that)
+            , dcDiff = dcDiff this * dcDiff that
+            }
+          newDataChange_left  = mkChange $ rowgen (nullRowgen $ dcRow this) (dcRow that)
+          newDataChange_right = mkChange $ rowgen (dcRow this) (nullRowgen $ dcRow that)
+    , newDataChange <- case joinCond (dcRow this) (dcRow that) of
+        True  -> [mkChange $ rowgen (dcRow this) (dcRow that)]
+        False -> case joinType of
+                   MergeJoinInner -> []
+                   MergeJoinLeft  -> [newDataChange_left]
+                   MergeJoinRight -> [newDataChange_right]
+                   MergeJoinFull  -> [newDataChange_left, newDataChange_right]
+    ]
 
 
 setAt :: [a] -> Int -> a -> [a]
@@ -395,8 +553,8 @@ addChangeBatchToIndex Index{..} changeBatch =
     adjustBatches l@(x:y:xs)
       | dataChangeBatchLen x * 2 <= dataChangeBatchLen y = l
       | otherwise =
-        let newBatch = mkDataChangeBatch (dcbChanges x ++ dcbChanges y)
-         in if (L.null $ dcbChanges newBatch) then
+        let newBatch = mergeDataChangeBatch x y
+         in if dataChangeBatchLen newBatch == 0 then
               adjustBatches xs else
               adjustBatches (newBatch:xs)
 
@@ -437,13 +595,11 @@ mergeJoinIndex self selfFt otherChangeBatch joinType joinCond rowgen nullRowgen
   L.foldl (\acc selfChangeBatch ->
              let newChangeBatch =
                    mergeJoinDataChangeBatch selfChangeBatch selfFt otherChangeBatch joinType joinCond rowgen nullRowgen
-              in updateDataChangeBatch acc (\xs -> xs ++ dcbChanges newChangeBatch)
+              in mergeDataChangeBatch acc newChangeBatch
           ) emptyDataChangeBatch (indexChangeBatches self)
 
 indexToDataChangeBatch :: (Hashable a, Ord a, Show a,
                            Hashable row, Ord row, Show row)
                        => Index row a -> DataChangeBatch row a
 indexToDataChangeBatch Index{..} =
-  L.foldl (\acc thisBatch ->
-             updateDataChangeBatch acc (\changes -> changes ++ dcbChanges thisBatch)
-          ) emptyDataChangeBatch indexChangeBatches
+  L.foldl mergeDataChangeBatch emptyDataChangeBatch indexChangeBatches
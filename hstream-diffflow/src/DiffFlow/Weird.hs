@@ -17,7 +17,7 @@ mkDataChangeBatch' :: (Hashable a, Ord a, Show a,
                        Hashable row, Ord row, Show row)
                   => [DataChange row a]
                   -> DataChangeBatch row a
-mkDataChangeBatch' changes = DataChangeBatch frontier sortedChanges
+mkDataChangeBatch' changes = DataChangeBatch frontier (changesToColumns sortedChanges)
   where getKey DataChange{..} = dcRow
         coalescedChanges = HM.filter (\DataChange{..} -> dcDiff /= 0) $
           L.foldl (\acc x -> HM.insertWith
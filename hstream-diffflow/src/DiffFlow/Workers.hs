@@ -0,0 +1,94 @@
+{-# LANGUAGE RecordWildCards #-}
+
+-- | Run a dataflow on several workers in parallel.
+--
+-- Every worker is a 'Shard' with its own copy of the node states, running
+-- on its own thread. The inputs are partitioned by the hash of the rows, the
+-- nodes stay on the worker of their inputs, except that the changes sent to
+-- an index are exchanged by the hash of their keys (see
+-- 'DiffFlow.Shard.exchangeChangeBatch'), so that joins, distincts and
+-- reduces see all changes of a key on one worker. The progress (frontiers)
+-- is tracked once for all workers, so an output is complete at a timestamp
+-- only when no worker can produce changes at it any more.
+module DiffFlow.Workers
+  ( Workers
+  , workersShards
+  , buildWorkers
+  , runWorkers
+  , pushInput
+  , flushInput
+  , advanceInput
+  , popOutput
+  , nodeFrontier
+  ) where
+
+import           Control.Concurrent      (forkFinally)
+import           Control.Concurrent.MVar
+import           Control.Monad
+import           Data.Hashable           (Hashable, hash)
+import qualified Data.HashMap.Lazy       as HM
+import qualified Data.Vector             as V
+
+import           DiffFlow.Graph
+import           DiffFlow.Shard          (Shard (..), buildShards)
+import qualified DiffFlow.Shard          as Shard
+import           DiffFlow.Types
+
+newtype Workers row a = Workers
+  { workersShards :: V.Vector (Shard row a)
+  }
+
+buildWorkers :: (Hashable a, Ord a, Show a, Bounded a,
+                 Hashable row, Ord row, Show row)
+             => Int -> Graph row -> IO (Workers row a)
+buildWorkers n graph = Workers <$> buildShards n graph
+
+-- | Run all workers until the stop MVar is filled, then wait for all of
+-- them to stop.
+runWorkers :: (Hashable a, Ord a, Show a,
+               Hashable row, Ord row, Show row, Semigroup row)
+           => Workers row a -> MVar () -> IO ()
+runWorkers Workers{..} stop = do
+  stops <- V.replicateM (V.length workersShards) newEmptyMVar
+  dones <- V.forM (V.zip workersShards stops) $ \(shard, stop') -> do
+    done <- newEmptyMVar
+    void $ forkFinally (Shard.run shard stop') (\_ -> putMVar done ())
+    return done
+  takeMVar stop
+  V.mapM_ (`putMVar` ()) stops
+  V.mapM_ takeMVar dones
+
+-- | Push a change to the worker of its row.
+pushInput :: (Hashable a, Ord a, Show a,
+              Hashable row, Ord row, Show row)
+          => Workers row a -> Node -> DataChange row a -> IO ()
+pushInput Workers{..} node change =
+  Shard.pushInput (workersShards V.! (hash (dcRow change) `mod` V.length workersShards)) node change
+
+flushInput :: (Hashable a, Ord a, Show a,
+               Hashable row, Ord row, Show row)
+           => Workers row a -> Node -> IO ()
+flushInput Workers{..} node = V.mapM_ (`Shard.flushInput` node) workersShards
+
+-- | Advance the input on all workers, the frontier of the input moves only
+-- when every worker has advanced it.
+advanceInput :: (Hashable a, Ord a, Show a,
+                 Hashable row, Ord row, Show row)
+             => Workers row a -> Node -> Timestamp a -> IO ()
+advanceInput Workers{..} node ts = V.mapM_ (\shard -> Shard.advanceInput shard node ts) workersShards
+
+-- | Pop an output change batch of any worker, or run the delay action if
+-- there is none.
+popOutput :: (Show a, Show row)
+          => Workers row a -> Node -> IO () -> (DataChangeBatch row a -> IO ()) -> IO ()
+popOutput Workers{..} node delayAction action = go 0
+  where
+    go i
+      | i >= V.length workersShards = delayAction
+      | otherwise = Shard.popOutput (workersShards V.! i) node (go (i + 1)) action
+
+-- | The frontier of a node, which is tracked once for all workers: no worker
+-- produces changes at timestamps earlier than it any more.
+nodeFrontier :: Workers row a -> Node -> IO (Frontier a)
+nodeFrontier Workers{..} node =
+  tsfFrontier . (HM.! nodeId node) <$> readMVar (shardNodeFrontiers (V.head workersShards))
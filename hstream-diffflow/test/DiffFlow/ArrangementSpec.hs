@@ -0,0 +1,88 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+module DiffFlow.ArrangementSpec where
+
+import           Data.Aeson           (Object, Value (..))
+import qualified Data.List            as L
+import           Data.Maybe           (fromMaybe)
+import qualified Data.Set             as Set
+import           DiffFlow.Arrangement
+import           DiffFlow.Types
+import           Test.Hspec
+
+import qualified HStream.Utils.Aeson  as A
+
+spec :: Spec
+spec = describe "ArrangementSpec" $ do
+  arrangementSpine
+  arrangementCompaction
+  arrangementJoin
+
+mkRow :: Int -> Int -> Object
+mkRow k v = A.fromList [("k", Number (fromIntegral k)), ("v", Number (fromIntegral v))]
+
+keyOf :: Object -> Object
+keyOf = A.fromList . L.filter ((== "k") . fst) . A.toList
+
+arrangeAll :: Maybe (Object -> Object) -> [DataChange Object Int] -> Arrangement Object Int
+arrangeAll keygen =
+  L.foldl (\acc c -> insertArrangement acc (mkDataChangeBatch [c])) (emptyArrangement keygen)
+
+changes :: [DataChange Object Int]
+changes = [ DataChange (mkRow (i `mod` 10) i) (Timestamp (i `mod` 5) []) 1 | i <- [0 .. 199] ]
+
+arrangementSpine :: Spec
+arrangementSpine = describe "Spine" $ do
+  it "keep a logarithmic number of batches" $ do
+    let arr = arrangeAll (Just keyOf) changes
+    arrangementLen arr `shouldBe` 200
+    L.length (arrangementBatches arr) `shouldSatisfy` (<= 8)
+  it "look up changes by key" $ do
+    let arr = arrangeAll (Just keyOf) changes
+        key = keyOf (mkRow 3 0)
+        expected = L.filter ((== key) . keyOf . dcRow) changes
+    L.sort (arrangementChangesForKey arr key ((== key) . keyOf)) `shouldBe` L.sort expected
+    L.sort (arrangementChangesForKey (arrangeAll Nothing changes) key ((== key) . keyOf))
+      `shouldBe` L.sort expected
+
+arrangementCompaction :: Spec
+arrangementCompaction = describe "Compaction" $ do
+  it "sum up changes earlier than the frontier" $ do
+    let row = mkRow 1 1
+        arr = arrangeAll (Just id)
+                [ DataChange row (Timestamp 0 []) 1
+                , DataChange row (Timestamp 1 []) (-1)
+                , DataChange row (Timestamp 2 []) 1
+                , DataChange row (Timestamp 5 []) 1
+                ]
+        compacted = compactArrangement (Set.singleton (Timestamp 3 [])) arr
+    L.map dcbChanges (arrangementBatches compacted) `shouldBe`
+      [[DataChange row (Timestamp 3 []) 1, DataChange row (Timestamp 5 []) 1]]
+    mapM_ (\t -> arrangementCountForKey compacted row (Timestamp t [])
+                   `shouldBe` arrangementCountForKey arr row (Timestamp t []))
+          [3 .. 6]
+  it "only rewrite the batches which the newer ones grew to" $ do
+    let arr = insertArrangement (arrangeAll (Just id) changes)
+                (mkDataChangeBatch [DataChange (mkRow 3 3) (Timestamp 1 []) 1])
+        compacted = compactArrangement (Set.singleton (Timestamp 3 [])) arr
+    L.length (arrangementBatches compacted) `shouldBe` L.length (arrangementBatches arr)
+    L.drop 1 (L.map dcbChanges $ arrangementBatches compacted)
+      `shouldBe` L.drop 1 (L.map dcbChanges $ arrangementBatches arr)
+    mapM_ (\(row, t) -> arrangementCountForKey compacted row (Timestamp t [])
+                          `shouldBe` arrangementCountForKey arr row (Timestamp t []))
+          [ (dcRow c, t) | c <- L.take 20 changes, t <- [3 .. 6] ]
+
+arrangementJoin :: Spec
+arrangementJoin = describe "Join" $ do
+  it "inner join by key is the same as by scan" $ do
+    let other = mkDataChangeBatch
+                  [ DataChange (mkRow k 1000) (Timestamp 4 []) 1 | k <- [0, 3, 7, 11] ]
+        joinCond a b = keyOf a == keyOf b
+        rowgen a b = A.fromList $ A.toList a ++ [("w", fromMaybe Null (A.lookup "v" b))]
+        ft = Set.singleton (Timestamp 5 [])
+        byKey  = mergeJoinArrangement (arrangeAll (Just keyOf) changes) ft other
+                   (Just keyOf) MergeJoinInner joinCond rowgen id
+        byScan = mergeJoinArrangement (arrangeAll Nothing changes) ft other
+                   Nothing MergeJoinInner joinCond rowgen id
+    dataChangeBatchLen byKey `shouldSatisfy` (> 0)
+    byKey `shouldBe` byScan
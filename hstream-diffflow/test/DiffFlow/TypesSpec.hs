@@ -3,7 +3,7 @@
 
 module DiffFlow.TypesSpec where
 
-import           Data.Aeson          (Value (..))
+import           Data.Aeson          (Object, Value (..))
 import           Data.Hashable       (Hashable)
 import qualified Data.List           as L
 import           Data.MultiSet       (MultiSet)
@@ -250,35 +250,57 @@ dataChangeBatch = describe "DataChangeBatch" $ do
       ]
       [ DataChange (A.fromList [("a", Null)]) (Timestamp  0         []) 1]
       `shouldBe` True
-    mkDataChangeBatch
+    (\dcb -> (dcbLowerBound dcb, dcbChanges dcb)) (mkDataChangeBatch
       [ DataChange (A.fromList [("a", Number 1)]) (Timestamp (0 :: Int) []) 1
       , DataChange (A.fromList [("b", Number 2)]) (Timestamp (0 :: Int) []) 1
-      , DataChange (A.fromList [("c", Number 3)]) (Timestamp (3 :: Int) []) 1]
+      , DataChange (A.fromList [("c", Number 3)]) (Timestamp (3 :: Int) []) 1])
       `shouldBe`
 -- Note: (Ord Object) of aeson<2 and aeson>2 has different implementations
 --------------------------------------------------------------------------------
 #if MIN_VERSION_aeson(2,0,0)
 --------------------------------------------------------------------------------
-      DataChangeBatch
-      { dcbLowerBound = Set.singleton (Timestamp 0 [])
-      , dcbChanges = [ DataChange (A.fromList [("a", Number 1)]) (Timestamp 0 []) 1
-                     , DataChange (A.fromList [("b", Number 2)]) (Timestamp 0 []) 1
-                     , DataChange (A.fromList [("c", Number 3)]) (Timestamp 3 []) 1
-                     ]
-      }
+      ( Set.singleton (Timestamp 0 [])
+      , [ DataChange (A.fromList [("a", Number 1)]) (Timestamp 0 []) 1
+        , DataChange (A.fromList [("b", Number 2)]) (Timestamp 0 []) 1
+        , DataChange (A.fromList [("c", Number 3)]) (Timestamp 3 []) 1
+        ]
+      )
 --------------------------------------------------------------------------------
 #else
 --------------------------------------------------------------------------------
-      DataChangeBatch
-      { dcbLowerBound = Set.singleton (Timestamp 0 [])
-      , dcbChanges = [ DataChange (A.fromList [("b", Number 2)]) (Timestamp 0 []) 1
-                     , DataChange (A.fromList [("a", Number 1)]) (Timestamp 0 []) 1
-                     , DataChange (A.fromList [("c", Number 3)]) (Timestamp 3 []) 1
-                     ]
-      }
+      ( Set.singleton (Timestamp 0 [])
+      , [ DataChange (A.fromList [("b", Number 2)]) (Timestamp 0 []) 1
+        , DataChange (A.fromList [("a", Number 1)]) (Timestamp 0 []) 1
+        , DataChange (A.fromList [("c", Number 3)]) (Timestamp 3 []) 1
+        ]
+      )
 --------------------------------------------------------------------------------
 #endif
 --------------------------------------------------------------------------------
+  it "consolidate a large DataChangeBatch" $ do
+    dcbChanges (mkDataChangeBatch largeChanges) `shouldBe` naiveConsolidate largeChanges
+  it "merge DataChangeBatches" $ do
+    let (xs, ys) = L.splitAt 5000 largeChanges
+    mergeDataChangeBatch (mkDataChangeBatch xs) (mkDataChangeBatch ys)
+      `shouldBe` mkDataChangeBatch largeChanges
+
+-- Many duplicated (row, timestamp) with diffs that partly cancel out
+largeChanges :: [DataChange Object Int]
+largeChanges =
+  [ DataChange (A.fromList [("k", Number (fromIntegral (i `mod` 97)))])
+               (Timestamp (i `mod` 3) [fromIntegral (i `mod` 2)])
+               (if even (i `div` 7) then 1 else (-1))
+  | i <- [0 .. 9999 :: Int]
+  ]
+
+naiveConsolidate :: (Ord row, Ord a) => [DataChange row a] -> [DataChange row a]
+naiveConsolidate =
+    L.sort
+  . L.filter ((/= 0) . dcDiff)
+  . L.map (\xs -> (L.head xs) { dcDiff = L.sum (L.map dcDiff xs) })
+  . L.groupBy (\x y -> getKey x == getKey y)
+  . L.sortOn getKey
+  where getKey x = (dcTimestamp x, dcRow x)
 
 frontierMove :: Spec
 frontierMove = describe "FrontierMove" $ do
@@ -0,0 +1,73 @@
+{-# LANGUAGE LambdaCase        #-}
+{-# LANGUAGE OverloadedStrings #-}
+
+module DiffFlow.WorkersSpec where
+
+import           Control.Concurrent
+import           Control.Monad
+import           Data.Aeson          (Object, Value (..))
+import           Data.Function       (fix)
+import qualified Data.List           as L
+import qualified Data.Set            as Set
+import           Data.Word
+import           DiffFlow.Graph
+import           DiffFlow.Types
+import           DiffFlow.Workers
+import           Test.Hspec
+
+import qualified HStream.Utils.Aeson as A
+
+-- | Sum up "v" of the rows by "k" on n workers, return the consolidated
+-- output changes.
+sumByKey :: Int -> [DataChange Object Word32] -> IO [DataChange Object Word32]
+sumByKey n changes = do
+  let subgraph_0 = Subgraph 0
+      (builder_1, input) = addNode emptyGraphBuilder subgraph_0 InputSpec
+      (builder_2, input_index) = addNode builder_1 subgraph_0 (IndexSpec input)
+  let reducer = Reducer (\acc row -> let (Number s) = (A.!) acc "sum"
+                                         (Number v) = (A.!) row "v"
+                                      in Right $ A.fromList [("sum", Number (s + v))]
+                        )
+      initValue = A.fromList [("sum", Number 0)]
+      keygen = \row -> A.fromList [("k", (A.!) row "k")]
+  let (builder_3, reduced) = addNode builder_2 subgraph_0 (ReduceSpec input_index initValue keygen reducer)
+      (builder_4, out) = addNode builder_3 subgraph_0 (OutputSpec reduced)
+
+  workers <- buildWorkers n (buildGraph builder_4)
+  stop_m <- newEmptyMVar
+  done_m <- newEmptyMVar
+  void . forkIO $ runWorkers workers stop_m >> putMVar done_m ()
+
+  mapM_ (pushInput workers input) changes
+  advanceInput workers input (Timestamp (1 :: Word32) [])
+  -- the output is complete at timestamp 0 once its frontier is past it
+  fix $ \wait -> do
+    ft <- nodeFrontier workers out
+    when (Set.null ft || ft <.= Timestamp (0 :: Word32) []) $ threadDelay 10000 >> wait
+
+  let popAll acc = do
+        dcb_m <- newEmptyMVar
+        popOutput workers out (putMVar dcb_m Nothing) (putMVar dcb_m . Just)
+        takeMVar dcb_m >>= \case
+          Nothing  -> return acc
+          Just dcb -> popAll (acc ++ dcbChanges dcb)
+  outputs <- popAll []
+  putMVar stop_m ()
+  takeMVar done_m
+  return . dcbChanges $ mkDataChangeBatch outputs
+
+spec :: Spec
+spec = describe "WorkersSpec" $ do
+  let changes = [ DataChange (A.fromList [("k", Number (fromIntegral (i `mod` 7))), ("v", Number (fromIntegral i))])
+                             (Timestamp (0 :: Word32) []) 1
+                | i <- [0 .. 99 :: Int] ]
+      expected = L.sort
+        [ DataChange (A.fromList [ ("k", Number (fromIntegral k))
+                                 , ("sum", Number (fromIntegral (L.sum [ i | i <- [0 .. 99 :: Int], i `mod` 7 == k ])))
+                                 ])
+                     (Timestamp 0 []) 1
+        | k <- [0 .. 6] ]
+  it "reduce on one worker" $
+    L.sort <$> sumByKey 1 changes `shouldReturn` expected
+  it "reduce on several workers with the changes exchanged by key" $
+    L.sort <$> sumByKey 4 changes `shouldReturn` expected
@@ -46,7 +46,7 @@ scheduleGossip gc@GossipContext{..} = do
     doGossip = do
       memberMap <- getOtherMembersSTM gc
       check (not $ null memberMap)
-      msgs <- stateTVar broadcastPool $ getMessagesToSend (fromIntegral (length memberMap))
+      msgs <- stateTVar broadcastPool $ getMessagesToSend gossipOpts (fromIntegral (length memberMap))
       check (not $ null msgs)
       let members = I.serverNodeId <$> memberMap
       let selected = take (gossipFanout gossipOpts) $ shuffle' members (length members) randomGen
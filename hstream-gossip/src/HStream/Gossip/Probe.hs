@@ -173,7 +173,7 @@ scheduleProbe gc@GossipContext{..} = do
 runProbe :: RandomGen gen => GossipContext -> gen -> [ServerId] -> [ServerId] -> IO ()
 runProbe gc@GossipContext{..} gen (x:xs) members = do
   atomically $ do
-    msgs <- stateTVar broadcastPool $ getMessagesToSend (fromIntegral (length members))
+    msgs <- stateTVar broadcastPool $ getMessagesToSend gossipOpts (fromIntegral (length members))
     writeTChan actionChan (DoPing x msgs)
   threadDelay $ probeInterval gossipOpts
   members' <- atomically $ map I.serverNodeId <$> getOtherMembersSTM gc
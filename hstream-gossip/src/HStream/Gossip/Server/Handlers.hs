@@ -110,7 +110,7 @@ sendPingCore gc@GossipContext{..} Ping {..} = do
   msgs <- atomically $ do
     broadcast (V.toList pingMsg) statePool eventPool
     memberMap <- getOtherMembersSTM gc
-    stateTVar broadcastPool $ getMessagesToSend (fromIntegral (length memberMap))
+    stateTVar broadcastPool $ getMessagesToSend gossipOpts (fromIntegral (length memberMap))
   return (Ack $ V.fromList msgs)
 
 sendPingReqHandler :: GossipContext
@@ -124,7 +124,7 @@ sendPingReqCore gc@GossipContext{..} PingReq {..} = do
   msgs <- atomically $ do
     broadcast (V.toList pingReqMsg) statePool eventPool
     memberMap <- getOtherMembersSTM gc
-    stateTVar broadcastPool $ getMessagesToSend (fromIntegral (length memberMap))
+    stateTVar broadcastPool $ getMessagesToSend gossipOpts (fromIntegral (length memberMap))
   case pingReqTarget of
     Nothing -> throwIO EmptyPingRequest
     Just x  -> do
@@ -136,7 +136,7 @@ sendPingReqCore gc@GossipContext{..} PingReq {..} = do
           newMsgs <- atomically $ do
             broadcast msg statePool eventPool
             memberNum <- length <$> getMemberListSTM gc
-            stateTVar broadcastPool $ getMessagesToSend (fromIntegral memberNum)
+            stateTVar broadcastPool $ getMessagesToSend gossipOpts (fromIntegral memberNum)
           return (PingReqResp True (V.fromList newMsgs))
         Nothing  -> return (PingReqResp False (V.fromList msgs))
 
@@ -56,7 +56,9 @@ data ServerState = ServerAlive | ServerSuspicious | ServerDead | ServerLeft
 
 data InitType = User | Gossip | Self deriving(Show)
 type Workers       = Map ServerId ThreadId
-type BroadcastPool = [(G.Message, Word32)]
+-- | The pending broadcasts, with the number of times they were sent and
+-- their encoded size in bytes
+type BroadcastPool = [(G.Message, Word32, Int)]
 
 data GossipContext = GossipContext
   { -- Server Context
@@ -168,6 +170,7 @@ data GossipOpts = GossipOpts
   , probeInterval         :: Int
   , roundtripTimeout      :: Int
   , joinWorkerConcurrency :: Int
+  , maxPiggybackBytes     :: Int
   } deriving (Show, Eq)
 
 defaultGossipOpts :: GossipOpts
@@ -178,6 +181,7 @@ defaultGossipOpts = GossipOpts
   , probeInterval         = 2 * 1000 * 1000
   , roundtripTimeout      = 500 * 1000
   , joinWorkerConcurrency = 10
+  , maxPiggybackBytes     = 16 * 1024
   }
 
 -------------------------------------------------------------------------------
@@ -17,9 +17,11 @@ import           Control.Exception                (Handler (..))
 import           Control.Exception.Base
 import           Control.Monad                    (filterM, forever, unless)
 import           Data.ByteString                  (ByteString)
+import qualified Data.ByteString.Lazy             as BL
 import           Data.Foldable                    (foldl')
 import           Data.Functor
 import qualified Data.HashMap.Strict              as HM
+import qualified Data.List                        as L
 import qualified Data.Map.Strict                  as Map
 import           Data.String                      (IsString (fromString))
 import           Data.Text                        (Text)
@@ -33,12 +35,14 @@ import           Network.GRPC.HighLevel.Generated (ClientConfig (..),
                                                    ServerResponse (..),
                                                    StatusCode (..),
                                                    StatusDetails (..))
+import qualified Proto3.Suite                     as PT
 
 import           HStream.Common.Types             (fromInternalServerNode)
 import qualified HStream.Exception                as HE
 import           HStream.Gossip.Types             (BroadcastPool, EventHandler,
                                                    EventMessage (..), EventName,
                                                    GossipContext (..),
+                                                   GossipOpts (..),
                                                    InitType (..), Message (..),
                                                    Messages, SeenEvents,
                                                    ServerState (..),
@@ -111,14 +115,21 @@ isStateMessage :: Message -> Bool
 isStateMessage (T.GState _) = True
 isStateMessage _            = False
 
--- TODO: add max resend
-getMessagesToSend :: Word32 -> BroadcastPool -> ([Message], BroadcastPool)
-getMessagesToSend l = foldl' f ([], mempty)
+-- | Take the messages to piggyback on a probe or a gossip round of a
+-- cluster of l other members. The least sent (i.e. the newest) messages go
+-- first, as long as they fit in 'maxPiggybackBytes' (the first one always
+-- goes), the others wait for the next rounds. A message leaves the pool once
+-- it has been sent retransmitMult * log (l + 2) times.
+getMessagesToSend :: GossipOpts -> Word32 -> BroadcastPool -> ([Message], BroadcastPool)
+getMessagesToSend GossipOpts{..} l = (\(_, msgs, new) -> (msgs, new))
+                                   . foldl' f (maxPiggybackBytes, [], mempty)
+                                   . L.sortOn (\(_, i, _) -> i)
   where
-    l' = 4 * ceiling (log $ fromIntegral l + 2 :: Double)
-    f (msgs, new)  (msg, i) = if l' >= succ i
-      then (msg : msgs, (msg, succ i) : new)
-      else (msgs,       (msg, i) : new)
+    l' = fromIntegral retransmitMult * ceiling (log $ fromIntegral l + 2 :: Double)
+    f (budget, msgs, new) x@(msg, i, size)
+      | null msgs || size <= budget =
+          (budget - size, msg : msgs, if succ i >= l' then new else (msg, succ i, size) : new)
+      | otherwise = (budget, msgs, x : new)
 
 getStateMessagesToHandle :: StateDelta -> ([StateMessage], StateDelta)
 getStateMessagesToHandle = Map.mapAccum f []
@@ -135,8 +146,18 @@ cleanStateMessages = Map.elems . foldl' (flip insertMsg) mempty
   where
     insertMsg x = Map.insertWith (\a b -> if TC a > TC b then a else b) (I.serverNodeId $ getMsgNode x) x
 
+-- | Add a message to the pool. A state message supersedes the pending state
+-- messages of the same node (the handlers only broadcast the newer state of
+-- a node), so what is piggybacked grows with the changes of the members
+-- rather than with their number.
 broadcastMessage :: Message -> BroadcastPool -> BroadcastPool
-broadcastMessage msg xs = (msg, 0) : xs
+broadcastMessage msg xs =
+  (msg, 0, fromIntegral . BL.length $ PT.toLazyByteString msg) : filter (not . supersededBy msg . fst3) xs
+  where
+    fst3 (x, _, _) = x
+    supersededBy (T.GState new) (T.GState old) = nodeId new == nodeId old
+    supersededBy new old                       = new == old
+    nodeId = I.serverNodeId . getMsgNode
 
 updateLamportTime :: TVar Word32 -> Word32 -> STM Word32
 updateLamportTime localClock eventTime = do
@@ -0,0 +1,98 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+module HStream.Gossip.UtilsSpec (spec) where
+
+import qualified Data.ByteString.Lazy           as BL
+import qualified Data.List                      as L
+import           Data.Text                      (Text, pack)
+import           Data.Word                      (Word32)
+import qualified Proto3.Suite                   as PT
+import           Test.Hspec
+
+import           HStream.Gossip.Types           (BroadcastPool,
+                                                 EventMessage (..),
+                                                 GossipOpts (..), Message,
+                                                 defaultGossipOpts)
+import qualified HStream.Gossip.Types           as T
+import           HStream.Gossip.Utils           (broadcastMessage,
+                                                 getMessagesToSend)
+import qualified HStream.Server.HStreamInternal as I
+
+spec :: Spec
+spec = describe "HStream.Gossip.Utils" $ do
+  getMessagesToSendSpec
+  broadcastMessageSpec
+
+getMessagesToSendSpec :: Spec
+getMessagesToSendSpec = describe "getMessagesToSend" $ do
+  it "send the least sent messages which fit in the byte budget" $ do
+    let pool = [(event "a", 3, 10), (event "b", 0, 10), (event "c", 1, 10), (event "d", 2, 4)]
+        (msgs, pool') = getMessagesToSend defaultGossipOpts{maxPiggybackBytes = 25} 1 pool
+    -- a is the most sent and no longer fits, but the smaller d still does
+    names msgs `shouldBe` ["b", "c", "d"]
+    counts pool' `shouldBe` [("a", 3), ("b", 1), ("c", 2), ("d", 3)]
+
+  it "always send the first message" $ do
+    let (msgs, pool') = getMessagesToSend defaultGossipOpts{maxPiggybackBytes = 25} 1
+                          [(event "a", 0, 100), (event "b", 1, 10)]
+    names msgs `shouldBe` ["a"]
+    counts pool' `shouldBe` [("a", 1), ("b", 1)]
+
+  it "retire a message after retransmitMult * log (n + 2) sends" $ do
+    let rounds n = length . takeWhile (not . null)
+                 $ iterate (snd . getMessagesToSend defaultGossipOpts n) [(event "a", 0, 10)]
+    -- 4 * ceiling (log 3)
+    rounds 1 `shouldBe` 8
+    -- 4 * ceiling (log 102)
+    rounds 100 `shouldBe` 20
+    let rounds' = length . takeWhile (not . null)
+                $ iterate (snd . getMessagesToSend defaultGossipOpts{retransmitMult = 1} 1) [(event "a", 0, 10)]
+    rounds' `shouldBe` 2
+
+broadcastMessageSpec :: Spec
+broadcastMessageSpec = describe "broadcastMessage" $ do
+  it "replace the pending state messages of the same node" $ do
+    let suspect = T.GState (T.GSuspect 2 (node 1) (node 0))
+        pool = broadcastMessage suspect
+             . broadcastMessage (event "a")
+             . broadcastMessage (T.GState (T.GAlive 1 (node 2) (node 0)))
+             . broadcastMessage (T.GState (T.GAlive 1 (node 1) (node 3)))
+             $ []
+    messages pool `shouldBe` [suspect, event "a", T.GState (T.GAlive 1 (node 2) (node 0))]
+
+  it "replace the pending copy of an event, and send it anew" $ do
+    let pool = broadcastMessage (event "a") [(event "a", 3, 10), (event "b", 1, 10)]
+    counts pool `shouldBe` [("a", 0), ("b", 1)]
+
+  it "keep the encoded size of a message" $ do
+    let msg = T.GState (T.GConfirm 1 (node 1) (node 2))
+    broadcastMessage msg [] `shouldBe` [(msg, 0, fromIntegral . BL.length $ PT.toLazyByteString msg)]
+
+event :: Text -> Message
+event name = T.GEvent (EventMessage name 1 "payload")
+
+node :: Word32 -> I.ServerNode
+node i = I.ServerNode
+  { I.serverNodeId = i
+  , I.serverNodeVersion = Nothing
+  , I.serverNodePort = 6570
+  , I.serverNodeGossipPort = 6571
+  , I.serverNodeAdvertisedAddress = "127.0.0.1"
+  , I.serverNodeGossipAddress = "127.0.0.1"
+  , I.serverNodeAdvertisedListeners = mempty
+  }
+
+messages :: BroadcastPool -> [Message]
+messages = fmap (\(msg, _, _) -> msg)
+
+-- | The names of the events, in order.
+names :: [Message] -> [Text]
+names = L.sort . fmap name
+
+-- | The names of the events with their send counts, in order.
+counts :: BroadcastPool -> [(Text, Word32)]
+counts = L.sort . fmap (\(msg, i, _) -> (name msg, i))
+
+name :: Message -> Text
+name (T.GEvent msg) = eventMessageName msg
+name msg            = pack (show msg)
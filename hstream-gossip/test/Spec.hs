@@ -0,0 +1 @@
+{-# OPTIONS_GHC -F -pgmF hspec-discover #-}
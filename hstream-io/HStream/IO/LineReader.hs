@@ -1,69 +1,92 @@
-{-# LANGUAGE LambdaCase        #-}
 {-# LANGUAGE OverloadedStrings #-}
 
 module HStream.IO.LineReader where
 
-import qualified Control.Concurrent         as C
-import qualified Control.Exception          as E
-import           Data.Int                   (Int64)
-import qualified Data.Text                  as T
-import qualified Data.Text.Internal.Builder as T
-import qualified Data.Text.IO               as T
-import qualified Data.Text.Lazy             as TL
-import qualified System.IO                  as IO
+import qualified Control.Concurrent       as C
+import qualified Data.ByteString          as BS
+import           Data.Int                 (Int64)
+import qualified Data.IntMap.Strict       as IM
+import           Data.Maybe               (fromMaybe)
+import qualified Data.Text                as T
+import qualified Data.Text.Encoding       as T
+import qualified Data.Text.Encoding.Error as T
+import qualified System.IO                as IO
 
--- TODO:
--- + [FINISHED] optimize sequential read(cache latest line offset)
--- + optimize random read(cache line offsets)
+-- | Lines are found by scanning the file in chunks for newlines
+-- ('BS.elemIndices' is a memchr), from the nearest known line offset:
+-- the end of the latest read (for sequential reads), or an entry of a sparse
+-- index of the offsets of every 'indexInterval'-th line, filled while
+-- scanning (for random reads).
 data LineReader = LineReader
   { filePath         :: String
   , latestLineOffset :: C.MVar (Int, Int64)
+    -- | line number -> byte offset of the lines 1, 1 + indexInterval, ...
+  , lineIndex        :: C.MVar (IM.IntMap Int64)
   }
 
 newLineReader :: String -> IO LineReader
 newLineReader filePath = do
   latestLineOffset <- C.newMVar (1, 0)
+  lineIndex <- C.newMVar (IM.singleton 1 0)
   return $ LineReader{..}
 
+indexInterval :: Int
+indexInterval = 1024
+
+chunkSize :: Int
+chunkSize = 64 * 1024
+
 readLines :: LineReader -> Int -> Int -> IO T.Text
 readLines lr@LineReader{..} begin count = do
   if begin < 1 || count < 1 then
     return ""
   else
     IO.withFile filePath IO.ReadMode $ \hdl -> do
-      seekToLineOffset lr hdl begin >>= \case
-        False -> return ""
-        True -> do
-          (result, gotCount) <- getLines hdl mempty 0 count
-          currentOffset <- IO.hTell hdl
-          _ <- C.swapMVar latestLineOffset (begin + gotCount, fromIntegral currentOffset)
-          return . TL.toStrict $ T.toLazyText result
-
-seekToLineOffset :: LineReader -> IO.Handle -> Int -> IO Bool
-seekToLineOffset LineReader{..} hdl begin = do
-  (lineNum, fileOffset) <- C.readMVar latestLineOffset
-  if lineNum == begin then do
-    IO.hSeek hdl IO.AbsoluteSeek (fromIntegral fileOffset)
-    return True
-  else
-    dropLines hdl 0 (begin - 1)
+      fileSize <- fromIntegral <$> IO.hFileSize hdl
+      (lineNum, start) <- seekToLineOffset lr hdl fileSize begin
+      if lineNum < begin then return "" else do
+        (endLine, end) <- scanLines lr hdl (begin + count) (begin, start)
+        -- a last line without newline is still returned (with one)
+        let partial = endLine < begin + count && end < fileSize
+        IO.hSeek hdl IO.AbsoluteSeek (fromIntegral start)
+        bytes <- BS.hGet hdl (fromIntegral $ (if partial then fileSize else end) - start)
+        _ <- C.swapMVar latestLineOffset (endLine, end)
+        return . T.decodeUtf8With T.lenientDecode $
+          if partial then bytes <> "\n" else bytes
 
-dropLines :: IO.Handle -> Int -> Int -> IO Bool
-dropLines hdl n total = do
-  if n < total then
-    E.try (T.hGetLine hdl) >>= \case
-      Left (_ :: E.SomeException) -> return False
-      Right _                     -> dropLines hdl (n + 1) total
-  else
-    return True
+-- | Find the offset of a line, or of the last line of the file if it has
+-- fewer lines.
+seekToLineOffset :: LineReader -> IO.Handle -> Int64 -> Int -> IO (Int, Int64)
+seekToLineOffset lr@LineReader{..} hdl fileSize begin = do
+  -- the offsets are dropped if the file was truncated
+  index <- C.modifyMVar lineIndex $ \index ->
+    let index' = if maybe False ((> fileSize) . snd) (IM.lookupMax index)
+                   then IM.singleton 1 0 else index
+     in return (index', index')
+  latest@(lineNum, fileOffset) <- C.readMVar latestLineOffset
+  let indexed = fromMaybe (1, 0) $ IM.lookupLE begin index
+      from = if lineNum <= begin && lineNum > fst indexed && fileOffset <= fileSize
+               then latest else indexed
+  scanLines lr hdl begin from
 
-getLines :: IO.Handle -> T.Builder -> Int -> Int -> IO (T.Builder, Int)
-getLines hdl builder n total = do
-  if n < total then
-    E.try (T.hGetLine hdl) >>= \case
-      Left (_ :: E.SomeException) -> return (builder, n)
-      Right line -> do
-        let newBuilder = builder <> T.fromText line <> "\n"
-        getLines hdl newBuilder (n + 1) total
-  else
-    return (builder, total)
+-- | Scan from the offset of a line to the offset of the target line, or to
+-- the end of the file. The offsets of the lines passed are added to the
+-- index.
+scanLines :: LineReader -> IO.Handle -> Int -> (Int, Int64) -> IO (Int, Int64)
+scanLines LineReader{..} hdl target = go
+  where
+    go (n, start) = readFrom (n, start) start
+    readFrom (n, start) pos
+      | n >= target = return (n, start)
+      | otherwise = do
+          IO.hSeek hdl IO.AbsoluteSeek (fromIntegral pos)
+          chunk <- BS.hGetSome hdl chunkSize
+          if BS.null chunk then return (n, start) else do
+            let starts = takeWhile ((<= target) . fst) $
+                  zip [n + 1 ..] [ pos + fromIntegral i + 1 | i <- BS.elemIndices 10 chunk ]
+                indexed = filter ((== 1) . (`mod` indexInterval) . fst) starts
+            C.modifyMVar_ lineIndex $ \index ->
+              return $! IM.union index (IM.fromDistinctAscList indexed)
+            case starts of
+              [] -> readFrom (n, start) (pos + fromIntegral (BS.length chunk))
+              _  -> go (last starts)
@@ -13,6 +13,9 @@ data AdminCommand
   = AdminInitCommand
   | AdminCheckReadyCommand
   | AdminStatusCommand
+  | AdminProfileCommand AT.ProfileCommand
+  | AdminTraceCommand AT.TraceCommand
+  | AdminMemoryCommand
   deriving (Show, Eq)
 
 adminCommandParser :: O.Parser AdminCommand
@@ -23,6 +26,12 @@ adminCommandParser = O.hsubparser
                               (O.progDesc "Check if an hserver kafka cluster is ready"))
  <> O.command "status" (O.info (pure AdminStatusCommand)
                                (O.progDesc "Cluster status"))
+ <> O.command "profile" (O.info (AdminProfileCommand <$> AT.profileCmdParser)
+                                (O.progDesc "Profile the native stacks of the server"))
+ <> O.command "trace" (O.info (AdminTraceCommand <$> AT.traceCmdParser)
+                              (O.progDesc "Sampled request tracing, dumped as Chrome trace JSON"))
+ <> O.command "memory" (O.info (pure AdminMemoryCommand)
+                               (O.progDesc "Allocated and resident memory of each allocation arena"))
   )
 
 parseAdminCommand :: [String] -> IO AdminCommand
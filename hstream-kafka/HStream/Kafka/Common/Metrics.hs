@@ -9,6 +9,7 @@ module HStream.Kafka.Common.Metrics
 
   , module HStream.Kafka.Common.Metrics.ConsumeStats
   , module HStream.Kafka.Common.Metrics.ProduceStats
+  , module HStream.Kafka.Common.Metrics.RetentionStats
   , module HStream.Kafka.Common.Metrics.ServerStats
   ) where
 
@@ -23,6 +24,7 @@ import           System.Clock                              (Clock (..),
 
 import           HStream.Kafka.Common.Metrics.ConsumeStats
 import           HStream.Kafka.Common.Metrics.ProduceStats
+import           HStream.Kafka.Common.Metrics.RetentionStats
 import           HStream.Kafka.Common.Metrics.ServerStats
 
 -- | Start a prometheus server
@@ -0,0 +1,27 @@
+module HStream.Kafka.Common.Metrics.RetentionStats where
+
+import qualified Prometheus as P
+
+retentionChecks :: P.Counter
+retentionChecks =
+  P.unsafeRegister . P.counter $
+    P.Info "retention_checks" "Total number of retention checks done by this server"
+{-# NOINLINE retentionChecks #-}
+
+retentionCheckLatency :: P.Histogram
+retentionCheckLatency =
+  P.unsafeRegister . P.histogram (P.Info "retention_check_latency" "Total time of a retention check in second") $
+      [0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 120, 300]
+{-# NOINLINE retentionCheckLatency #-}
+
+topicRetentionTrims :: P.Vector P.Label2 P.Counter
+topicRetentionTrims =
+  P.unsafeRegister . P.vector ("topicName", "partition") . P.counter $
+    P.Info "topic_retention_trims" "Total number of trims issued by retention for a topic"
+{-# NOINLINE topicRetentionTrims #-}
+
+topicRetentionFailedTrims :: P.Vector P.Label2 P.Counter
+topicRetentionFailedTrims =
+  P.unsafeRegister . P.vector ("topicName", "partition") . P.counter $
+    P.Info "topic_retention_failed_trims" "Total number of failed trims issued by retention for a topic"
+{-# NOINLINE topicRetentionFailedTrims #-}
@@ -12,12 +12,14 @@ module HStream.Kafka.Common.OffsetManager
   , getLatestOffset
   , getLatestOffsetWithLsn
   , getOffsetByTimestamp
+  , getOffsetsByTimestamp
 
     -- * SparseOffset
   , getOldestSparseOffset
   , getLatestHeadSparseOffsetWithLsn
   , getLatestHeadSparseOffset
   , getSparseOffsetByTimestamp
+  , getSparseOffsetsByTimestamp
   , composeSparseOffset
   , sparseOffsetToLsn
   , calNextSparseOffset
@@ -25,6 +27,7 @@ module HStream.Kafka.Common.OffsetManager
 
 import           Control.Concurrent
 import           Control.Exception
+import           Control.Monad
 import           Data.Bits
 import qualified Data.HashTable.IO                 as H
 import           Data.Int
@@ -138,6 +141,28 @@ getOffsetByTimestamp OffsetManager{..} logid timestamp = do
                      else pure (lsn, tailLsn)
    in fmap (calOffset . third) <$> readOneRecordBypassGap store reader logid getLsn
 
+-- | Batch version of 'getOffsetByTimestamp', the lsns of all logs are looked
+-- up concurrently, while the records are still read one by one.
+getOffsetsByTimestamp
+  :: HasCallStack
+  => OffsetManager -> [(Word64, Int64)] -> IO [Maybe Int64]
+getOffsetsByTimestamp OffsetManager{..} reqs = do
+  ranges <- findTimeRanges store reqs
+  forM (zip (map fst reqs) ranges) $ \(logid, (lsn, tailLsn)) ->
+    let getLsn = pure $ if lsn > tailLsn
+                           then (S.LSN_INVALID, S.LSN_INVALID)
+                           else (lsn, tailLsn)
+     in fmap (calOffset . third) <$> readOneRecordBypassGap store reader logid getLsn
+
+-- Return the (findTime lsn, tail lsn) of each (logid, timestamp)
+findTimeRanges
+  :: HasCallStack
+  => S.LDClient -> [(Word64, Int64)] -> IO [(S.LSN, S.LSN)]
+findTimeRanges store reqs = do
+  lsns <- S.findTimes store S.FindKeyStrict reqs
+  tailLsns <- S.getTailLSNs store (map fst reqs)
+  pure $ zip lsns tailLsns
+
 -- Suppose we have three batched records:
 --
 -- record0, record1, record2
@@ -191,6 +216,15 @@ getSparseOffsetByTimestamp OffsetManager{..} logid timestamp = do
      -- FIXME: the lsn here may be a gap, do we need to handle this?
      else pure $ Just $ composeSparseOffset lsn 0
 
+-- | Batch version of 'getSparseOffsetByTimestamp'.
+getSparseOffsetsByTimestamp
+  :: HasCallStack
+  => OffsetManager -> [(Word64, Int64)] -> IO [Maybe Int64]
+getSparseOffsetsByTimestamp OffsetManager{..} reqs = do
+  ranges <- findTimeRanges store reqs
+  pure $ flip map ranges $ \(lsn, tailLsn) ->
+    if lsn > tailLsn then Nothing else Just $ composeSparseOffset lsn 0
+
 -- epoch: 20bit, esn: 20bit, record_index: 24bit
 --
 -- Actually, epoch will use 19 bits
@@ -45,7 +45,9 @@ import qualified Network.Socket                    as N
 import qualified Network.Socket.ByteString         as N
 import qualified Network.Socket.ByteString.Lazy    as NL
 import           Numeric                           (showHex, showInt)
+import qualified Z.Data.Text                       as ZT
 
+import qualified HStream.Base.Tracing              as Tracing
 import qualified HStream.Kafka.Common.Metrics      as M
 import qualified HStream.Kafka.Network.Cxx         as Cxx
 import qualified HStream.Kafka.Network.IO          as KIO
@@ -134,14 +136,18 @@ runHsServer opts sc_ mkPreAuthedHandlers mkAuthedHandlers =
       Log.debug $ "Received request header: " <> Log.buildString' reqHeader
       M.incCounter M.totalRequests
       let ServiceHandler{..} = findHandler handlers requestApiKey requestApiVersion
-      case rpcHandler of
-        UnaryHandler rpcHandler' -> do
-          M.observeWithLabel
-            M.handlerLatencies
-            (Text.pack $ show requestApiKey) $
-              doUnaryHandler reqBs reqHeader rpcHandler' peer
-
-    doUnaryHandler l reqHeader@RequestHeader{..} rpcHandler' peer = do
+      -- The haskell server has no cpp side to begin the trace, so the
+      -- request span is recorded here.
+      traceId <- Tracing.traceBegin
+      Tracing.withSpan' traceId 0 "kafka.request" "" $ \spanId ->
+        case rpcHandler of
+          UnaryHandler rpcHandler' -> do
+            M.observeWithLabel
+              M.handlerLatencies
+              (Text.pack $ show requestApiKey) $
+                doUnaryHandler reqBs reqHeader rpcHandler' peer traceId spanId
+
+    doUnaryHandler l reqHeader@RequestHeader{..} rpcHandler' peer traceId parentSpanId = do
       (req, left) <- runGet' l
       when (not . BS.null $ left) $
         Log.warning $ "Leftover bytes: " <> Log.buildString' left
@@ -156,7 +162,9 @@ runHsServer opts sc_ mkPreAuthedHandlers mkAuthedHandlers =
               , clientHost = showSockAddrHost peer
               , apiVersion = requestApiVersion
               }
-      resp <- rpcHandler' reqContext req
+      resp <- Tracing.withSpan traceId parentSpanId
+                (ZT.pack $ "kafka.handler." <> show requestApiKey) $
+                  rpcHandler' reqContext req
       Log.debug $ "Server response: " <> Log.buildString' resp
       return $ KIO.packKafkaMsgBs reqHeader resp
 
@@ -240,7 +248,8 @@ runCppServer opts sc_ mkAuthedHandlers =
         -- respBs: Nothing means some error occurred, and the server will close
         -- the connection
         respBs <- E.catch
-          (Just <$> handleKafkaMsg conn handlers req.requestPayload)
+          (Just <$> handleKafkaMsg conn handlers req.requestTraceId
+                                   req.requestSpanId req.requestPayload)
           (\err -> do Log.fatal $ Log.buildString' (err :: E.SomeException)
                       pure Nothing)
         poke response_ptr Cxx.Response{responseData = respBs}
@@ -250,8 +259,10 @@ runCppServer opts sc_ mkAuthedHandlers =
 -- Server misc
 
 handleKafkaMsg
-  :: Cxx.ConnContext -> [ServiceHandler] -> ByteString -> IO ByteString
-handleKafkaMsg conn handlers bs = do
+  :: Cxx.ConnContext -> [ServiceHandler]
+  -> Tracing.TraceId -> Tracing.SpanId
+  -> ByteString -> IO ByteString
+handleKafkaMsg conn handlers traceId parentSpanId bs = do
   (header, reqBs) <- runGet' @RequestHeader bs
   let ServiceHandler{..} = findHandler handlers header.requestApiKey header.requestApiVersion
   case rpcHandler of
@@ -270,7 +281,9 @@ handleKafkaMsg conn handlers bs = do
               , clientHost = show conn.peerHost
               , apiVersion = header.requestApiVersion
               }
-      resp <- rpcHandler' reqContext req
+      resp <- Tracing.withSpan traceId parentSpanId
+                (ZT.pack $ "kafka.handler." <> show header.requestApiKey) $
+                  rpcHandler' reqContext req
       Log.debug $ "Server response: " <> Log.buildString' resp
       let (_, respHeaderVer) = getHeaderVersion header.requestApiKey header.requestApiVersion
           respHeaderBuilder =
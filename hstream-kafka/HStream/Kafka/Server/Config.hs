@@ -19,6 +19,8 @@ module HStream.Kafka.Server.Config
   , KafkaBrokerConfigs
   , updateConfigs
   , mkKafkaBrokerConfigs
+  , KafkaTopicConfigs
+  , mkKafkaTopicConfigs
   ) where
 
 import           Control.Exception                       (throwIO)
@@ -81,6 +81,7 @@ parseJSONToOptions CliOptions{..} obj = do
   probeInterval    <- clusterCfgObj .:? "probe-interval"    .!= probeInterval defaultGossipOpts
   roundtripTimeout <- clusterCfgObj .:? "roundtrip-timeout" .!= roundtripTimeout defaultGossipOpts
   joinWorkerConcurrency <- clusterCfgObj .:? "join-worker-concurrency" .!= joinWorkerConcurrency defaultGossipOpts
+  maxPiggybackBytes <- clusterCfgObj .:? "max-piggyback-bytes" .!= maxPiggybackBytes defaultGossipOpts
   let _gossipOpts = GossipOpts {..}
 
   -- TLS config
@@ -111,6 +112,7 @@ parseJSONToOptions CliOptions{..} obj = do
   scdEnabled <- storageCfg .:? "scd-enabled" .!= False
   localScdEnabled <- storageCfg .:? "local-scd-enabled" .!= False
   stickyCopysets <- storageCfg .:? "sticky-copysets" .!= False
+  retentionTrimRate <- storageCfg .:? "retention-trim-rate" .!= 100
   let _storage = StorageOptions{..}
 
   -- SASL config
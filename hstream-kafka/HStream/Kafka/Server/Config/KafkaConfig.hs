@@ -8,7 +8,7 @@ module HStream.Kafka.Server.Config.KafkaConfig where
 import qualified Control.Monad   as M
 import qualified Data.Aeson.Key  as Y
 import qualified Data.Aeson.Text as Y
-import           Data.Int        (Int32)
+import           Data.Int        (Int32, Int64)
 import           Data.List       (intercalate)
 import           Data.Map.Strict (Map)
 import qualified Data.Map.Strict as Map
@@ -134,13 +134,23 @@ instance KafkaConfig FetchMaxBytes where
   defaultConfig = FetchMaxBytes 57671680{- 55*1024*1024 -}
 SHOWCONFIG(FetchMaxBytes)
 
+newtype LogRetentionCheckIntervalMs = LogRetentionCheckIntervalMs { _value :: Int } deriving (Eq)
+instance KafkaConfig LogRetentionCheckIntervalMs where
+  name = const "log.retention.check.interval.ms"
+  value (LogRetentionCheckIntervalMs v)  = T.pack $ show v
+  isSentitive = const False
+  fromText t = LogRetentionCheckIntervalMs <$> textToIntE t
+  defaultConfig = LogRetentionCheckIntervalMs 300000{- 5 minutes -}
+SHOWCONFIG(LogRetentionCheckIntervalMs)
+
 data KafkaBrokerConfigs = KafkaBrokerConfigs
-  { autoCreateTopicsEnable     :: !AutoCreateTopicsEnable
-  , numPartitions              :: !NumPartitions
-  , defaultReplicationFactor   :: !DefaultReplicationFactor
-  , offsetsTopicReplication    :: !OffsetsTopicReplicationFactor
-  , groupInitialRebalanceDelay :: !GroupInitialRebalanceDelayMs
-  , fetchMaxBytes              :: !FetchMaxBytes
+  { autoCreateTopicsEnable      :: !AutoCreateTopicsEnable
+  , numPartitions               :: !NumPartitions
+  , defaultReplicationFactor    :: !DefaultReplicationFactor
+  , offsetsTopicReplication     :: !OffsetsTopicReplicationFactor
+  , groupInitialRebalanceDelay  :: !GroupInitialRebalanceDelayMs
+  , fetchMaxBytes               :: !FetchMaxBytes
+  , logRetentionCheckIntervalMs :: !LogRetentionCheckIntervalMs
   } deriving (Eq, G.Generic)
 instance KafkaConfigs KafkaBrokerConfigs
 
@@ -197,10 +207,21 @@ instance KafkaConfig RetentionMs where
                   Right (intVal, _) -> Right (RetentionMs intVal)
   defaultConfig = RetentionMs 604800000
 
+newtype RetentionBytes = RetentionBytes Int64 deriving (Eq)
+instance KafkaConfig RetentionBytes where
+  name = const "retention.bytes"
+  value (RetentionBytes v) = T.pack $ show v
+  isSentitive = const False
+  fromText textVal = case (T.signed T.decimal) textVal of
+                  Left msg          -> Left (T.pack msg)
+                  Right (intVal, _) -> Right (RetentionBytes intVal)
+  defaultConfig = RetentionBytes (-1)
+
 data KafkaTopicConfigs
   = KafkaTopicConfigs
-  { cleanupPolicy :: CleanupPolicy
-  , retentionMs   :: RetentionMs
+  { cleanupPolicy  :: CleanupPolicy
+  , retentionMs    :: RetentionMs
+  , retentionBytes :: RetentionBytes
   } deriving (G.Generic)
 instance KafkaConfigs KafkaTopicConfigs
 
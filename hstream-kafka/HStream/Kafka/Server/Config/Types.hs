@@ -229,6 +229,8 @@ data StorageOptions = StorageOptions
   , scdEnabled         :: Bool
   , localScdEnabled    :: Bool
   , stickyCopysets     :: Bool
+  , retentionTrimRate  :: Int
+    -- ^ max number of trims per second issued by the retention enforcer
   } deriving (Show, Eq)
 
 data ExperimentalFeature
@@ -5,20 +5,27 @@ module HStream.Kafka.Server.Handler.AdminCommand
   ) where
 
 import           Control.Concurrent            (tryReadMVar)
+import           Control.Monad                 (forM)
 import           Data.Aeson                    ((.=))
 import qualified Data.Aeson                    as Aeson
 import qualified Data.HashMap.Strict           as HM
 import qualified Data.Text                     as Text
 
-import           HStream.Admin.Server.Types    (errorResponse, plainResponse,
+import           HStream.Admin.Server.Types    (ProfileCommand (..),
+                                                TraceCommand (..),
+                                                errorResponse, plainResponse,
                                                 tableResponse)
+import qualified HStream.Base.Profiler         as Profiler
+import qualified HStream.Base.Tracing          as Tracing
 import           HStream.Gossip                (GossipContext (clusterReady),
                                                 getClusterStatus, initCluster)
 import           HStream.Kafka.Common.AdminCli (AdminCommand (..),
                                                 parseAdminCommand)
 import           HStream.Kafka.Server.Types    (ServerContext (..))
+import qualified HStream.Logger                as Log
 import qualified HStream.Server.HStreamApi     as API
-import           HStream.Utils                 (showNodeStatus)
+import qualified HStream.Stats                 as Stats
+import           HStream.Utils                 (cBytesToText, showNodeStatus)
 import qualified Kafka.Protocol.Encoding       as K
 import qualified Kafka.Protocol.Message        as K
 import qualified Kafka.Protocol.Service        as K
@@ -35,6 +42,9 @@ handleHadminCommand sc _ req = do
     AdminInitCommand       -> runInit sc
     AdminCheckReadyCommand -> runCheckReady sc
     AdminStatusCommand     -> runStatus sc
+    AdminProfileCommand c  -> runProfile c
+    AdminTraceCommand c    -> runTrace c
+    AdminMemoryCommand     -> runMemory
 
 runInit :: ServerContext -> IO K.HadminCommandResponse
 runInit ServerContext{..} = do
@@ -66,5 +76,45 @@ runStatus ServerContext{..} = do
           , nodeHost <> ":" <> nodePort
           ]
 
+runProfile :: ProfileCommand -> IO K.HadminCommandResponse
+runProfile ProfileCommand{..} = do
+  Log.info $ "Start profiling for " <> Log.build profileSeconds <> " seconds"
+  Profiler.Profile{..} <- Profiler.profileFor profileSeconds profileFrequency
+  Log.info $ "Profiling done, samples: " <> Log.build profileSamples
+          <> ", dropped: " <> Log.build profileDropped
+  return $ packResp $ plainResponse $ cBytesToText profileFolded
+
+runTrace :: TraceCommand -> IO K.HadminCommandResponse
+runTrace (TraceStart n) = do
+  Tracing.clearTrace
+  Tracing.setTraceSampleEvery n
+  return $ packResp $ plainResponse $
+    "Tracing one in every " <> Text.pack (show n) <> " requests"
+runTrace TraceStop = do
+  Tracing.setTraceSampleEvery 0
+  return $ packResp $ plainResponse "Tracing stopped"
+runTrace TraceDump =
+  packResp . plainResponse . cBytesToText <$> Tracing.dumpChromeTrace
+
+runMemory :: IO K.HadminCommandResponse
+runMemory = do
+  rows <- forM [minBound .. maxBound] $ \arena -> do
+    Stats.ArenaStats{..} <- Stats.getArenaStats arena
+    pure [ arenaName arena
+         , maybe "-" show' arenaAllocated
+         , maybe "-" show' arenaResident
+         , show' arenaNumAllocs
+         , show' arenaAllocBytes
+         ]
+  let headers = ["arena" :: Text.Text, "allocated", "resident", "allocs", "alloc_bytes"]
+      content = Aeson.object ["headers" .= headers, "rows" .= rows]
+  return $ packResp $ tableResponse content
+  where
+    show' = Text.pack . show
+    arenaName Stats.DefaultArena  = "default"
+    arenaName Stats.ReadArena     = "read"
+    arenaName Stats.WriteArena    = "write"
+    arenaName Stats.KafkaNetArena = "kafka_net"
+
 packResp :: Text.Text -> K.HadminCommandResponse
 packResp r = K.HadminCommandResponse (K.CompactString r) K.EmptyTaggedFields
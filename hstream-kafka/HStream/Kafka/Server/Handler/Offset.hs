@@ -9,9 +9,12 @@ module HStream.Kafka.Server.Handler.Offset
 #endif
 
 import qualified Control.Exception                     as E
+import           Control.Monad                         (join)
 import           Data.Int                              (Int64)
+import qualified Data.Map.Strict                       as Map
 import           Data.Maybe                            (fromMaybe)
 import qualified Data.Vector                           as V
+import           Data.Word                             (Word64)
 
 import           HStream.Kafka.Common.Acl
 import           HStream.Kafka.Common.Authorizer.Class
@@ -97,11 +100,22 @@ handleListOffsetsSparseOffset sc reqCtx req = do
                              -> IO K.ListOffsetsTopicResponse
    listOffsetTopicPartitions listOffsetsTopic = do
      orderedParts <- S.listStreamPartitionsOrderedByName sc.scLDClient (S.transToTopicStreamName listOffsetsTopic.name)
+     -- TODO: handle Nothing
+     let getLogid :: K.ListOffsetsPartition -> Word64
+         getLogid p = snd $ orderedParts V.! (fromIntegral p.partitionIndex)
+         timestampReqs =
+           [ (getLogid p, p.timestamp)
+           | p <- maybe [] V.toList (K.unKaArray listOffsetsTopic.partitions)
+           , p.timestamp /= LatestTimestamp && p.timestamp /= EarliestTimestamp
+           ]
+     -- Lookup all timestamps of the topic in one batch instead of one round
+     -- trip per partition.
+     timestampOffsets <- Map.fromList . zip timestampReqs
+                     <$> getOffsetsByTimestamp timestampReqs
      partitionResps <-
        forKaArrayM listOffsetsTopic.partitions $ \listOffsetsPartition -> do
-         -- TODO: handle Nothing
-         let partition = orderedParts V.! (fromIntegral listOffsetsPartition.partitionIndex)
-         offset <- getOffset (snd partition) listOffsetsPartition.timestamp
+         offset <- getOffset timestampOffsets (getLogid listOffsetsPartition)
+                             listOffsetsPartition.timestamp
          -- FIXME: Similar function to 'makeErrorTopicResponse' above.
          --        Extract to a common function.
          return $ K.ListOffsetsPartitionResponse
@@ -119,27 +133,31 @@ handleListOffsetsSparseOffset sc reqCtx req = do
 #ifndef HSTREAM_SPARSE_OFFSET
    -- NOTE: The last offset of a partition is the offset of the upcoming
    -- message, i.e. the offset of the last available message + 1.
-   getOffset logid LatestTimestamp =
+   getOffset _ logid LatestTimestamp =
      maybe 0 (+ 1) <$> K.getLatestOffset sc.scOffsetManager logid
-   getOffset logid EarliestTimestamp =
+   getOffset _ logid EarliestTimestamp =
      fromMaybe 0 <$> K.getOldestOffset sc.scOffsetManager logid
    -- Return the earliest offset whose timestamp is greater than or equal to
    -- the given timestamp.
    --
    -- TODO: actually, this is not supported currently.
-   getOffset logid timestamp =
-     fromMaybe (-1) <$> K.getOffsetByTimestamp sc.scOffsetManager logid timestamp
+   getOffset timestampOffsets logid timestamp =
+     pure $ fromMaybe (-1) $ join $ Map.lookup (logid, timestamp) timestampOffsets
+
+   getOffsetsByTimestamp = K.getOffsetsByTimestamp sc.scOffsetManager
 #else
-   getOffset logid LatestTimestamp =
+   getOffset _ logid LatestTimestamp =
      maybe 0 K.calNextSparseOffset <$> K.getLatestHeadSparseOffset sc.scOffsetManager logid
-   getOffset logid EarliestTimestamp =
+   getOffset _ logid EarliestTimestamp =
      fromMaybe 0 <$> K.getOldestSparseOffset sc.scOffsetManager logid
    -- Return the earliest offset whose timestamp is greater than or equal to
    -- the given timestamp.
    --
    -- TODO: actually, this is not supported currently.
-   getOffset logid timestamp =
-     fromMaybe (-1) <$> K.getSparseOffsetByTimestamp sc.scOffsetManager logid timestamp
+   getOffset timestampOffsets logid timestamp =
+     pure $ fromMaybe (-1) $ join $ Map.lookup (logid, timestamp) timestampOffsets
+
+   getOffsetsByTimestamp = K.getSparseOffsetsByTimestamp sc.scOffsetManager
 #endif
 
 --------------------
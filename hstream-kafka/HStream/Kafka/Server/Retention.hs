@@ -0,0 +1,267 @@
+{-# LANGUAGE OverloadedRecordDot #-}
+
+-- | A background service which enforces the retention policies of topics
+-- (retention.ms and retention.bytes) by trimming the underlying logs.
+--
+-- LogDevice only knows the backlog duration of a loggroup, which is coarse
+-- and has no idea of size based retention. Instead, for each topic owned by
+-- this server (see 'isOwner'), we periodically:
+--
+-- 1. Get the tail attributes of all partitions, remember the
+--    (time, bytes written) of each partition as a sample.
+-- 2. Compute the timestamp to trim before, by retention.ms and by the latest
+--    sample which still keeps at least retention.bytes in the log.
+-- 3. Convert the timestamps to lsns by findTime and trim all of them in
+--    batches, with at most 'retentionTrimRate' trims per second.
+--
+-- Note that size based retention only works if the byte offsets are enabled
+-- on the LogDevice cluster, and its granularity is the check interval, which
+-- is similar to the segment granularity of Kafka.
+module HStream.Kafka.Server.Retention
+  ( RetentionEnforcer
+  , newRetentionEnforcer
+  , runRetentionEnforcer
+
+    -- * Internals
+  , ByteSamples
+  , addByteSample
+  , retentionTrimTimestamp
+  ) where
+
+import           Control.Concurrent                      (threadDelay)
+import           Control.Exception
+import           Control.Monad
+import qualified Data.Aeson                              as J
+import           Data.Bifunctor                          (bimap)
+import           Data.Foldable                           (toList)
+import           Data.Int                                (Int64)
+import           Data.IORef
+import qualified Data.Map.Strict                         as Map
+import           Data.Maybe                              (catMaybes)
+import           Data.Sequence                           (Seq, ViewR (..), (|>))
+import qualified Data.Sequence                           as Seq
+import           Data.Text                               (Text)
+import qualified Data.Text                               as T
+import qualified Data.Vector                             as V
+import           Data.Word                               (Word32, Word64)
+
+import qualified HStream.Base.Time                       as BaseTime
+import           HStream.Common.Server.HashRing          (LoadBalanceHashRing)
+import qualified HStream.Common.Server.Lookup            as Lookup
+import qualified HStream.Kafka.Common.Metrics            as M
+import qualified HStream.Kafka.Server.Config.KafkaConfig as KC
+import           HStream.Kafka.Server.Config.Types       (ServerOpts (..),
+                                                          StorageOptions (..))
+import           HStream.Kafka.Server.Types              (ServerContext (..))
+import qualified HStream.Logger                          as Log
+import qualified HStream.Server.HStreamApi               as A
+import qualified HStream.Utils                           as Utils
+import qualified Kafka.Storage                           as S
+
+-- | (timestamp in milliseconds, total bytes written to the log at that time)
+-- of a log, in ascending order.
+type ByteSamples = Seq (Int64, Word64)
+
+data RetentionEnforcer = RetentionEnforcer
+  { ldclient        :: !S.LDClient
+  , serverID        :: !Word32
+  , hashRing        :: !LoadBalanceHashRing
+  , checkIntervalMs :: !Int
+  , trimRate        :: !Int
+  , byteSamples     :: !(IORef (Map.Map Word64{- logid -} ByteSamples))
+  }
+
+newRetentionEnforcer :: ServerContext -> IO RetentionEnforcer
+newRetentionEnforcer sc = do
+  byteSamples <- newIORef Map.empty
+  pure RetentionEnforcer
+    { ldclient        = sc.scLDClient
+    , serverID        = sc.serverID
+    , hashRing        = sc.loadBalanceHashRing
+    , checkIntervalMs = sc.kafkaBrokerConfigs.logRetentionCheckIntervalMs._value
+    , trimRate        = sc.serverOpts._storage.retentionTrimRate
+    , byteSamples     = byteSamples
+    }
+
+-- | Run forever, a non-positive check interval disables the enforcer.
+runRetentionEnforcer :: RetentionEnforcer -> IO ()
+runRetentionEnforcer e
+  | e.checkIntervalMs <= 0 = Log.info "Retention enforcer is disabled"
+  | otherwise = do
+      Log.info $ "Starting retention enforcer, check interval: "
+              <> Log.build e.checkIntervalMs <> "ms"
+      forever $ do
+        threadDelay (e.checkIntervalMs * 1000)
+        M.observeDuration M.retentionCheckLatency (enforceRetention e)
+          `catches` [ Handler $ \(ex :: SomeAsyncException) -> throwIO ex
+                    , Handler $ \(ex :: SomeException) ->
+                        Log.warning $ "Retention check failed: " <> Log.buildString' ex
+                    ]
+        M.incCounter M.retentionChecks
+
+data Partition = Partition
+  { topic   :: !Text
+  , index   :: !Int
+  , logid   :: !Word64
+  , configs :: !KC.KafkaTopicConfigs
+  }
+
+enforceRetention :: RetentionEnforcer -> IO ()
+enforceRetention e@RetentionEnforcer{..} = do
+  streamIds <- S.findStreams ldclient S.StreamTypeTopic
+  partitions <- concat <$> mapM (getPartitions e) streamIds
+  now <- BaseTime.getSystemMsTimestamp
+  tails <- S.getLogTailAttrsBatch ldclient 0 (map (.logid) partitions)
+  oldSamples <- readIORef byteSamples
+  -- Logs which are not owned by us anymore (or deleted) are dropped here
+  let (samples, candidates) = unzip $ flip map (zip partitions tails) $ \case
+        (p, Left _) -> ((p.logid, Map.findWithDefault Seq.empty p.logid oldSamples), Nothing)
+        (p, Right attrs) ->
+          let tailBytes = if attrs.tailByteOffset == maxBound
+                             then Nothing else Just attrs.tailByteOffset
+              ss = addByteSample now tailBytes $
+                     Map.findWithDefault Seq.empty p.logid oldSamples
+              candidate = do
+                guard $ attrs.tailLastReleasedRealLSN /= S.LSN_INVALID
+                ts <- retentionTrimTimestamp now p.configs tailBytes ss
+                pure (p, ts, attrs.tailLastReleasedRealLSN)
+           in ((p.logid, ss), candidate)
+  writeIORef byteSamples (Map.fromList samples)
+
+  trims <- getTrimPoints e (catMaybes candidates)
+  results <- trimRateLimited e (map (\(p, _, lsn) -> (p.logid, lsn)) trims)
+  forM_ (zip trims results) $ \((p, ts, lsn), r) -> do
+    let labels = (p.topic, T.pack $ show p.index)
+    case r of
+      Right () -> do
+        Log.debug $ "Retention trimmed " <> Log.build p.topic
+                 <> "(" <> Log.build p.index <> ") up to " <> Log.build lsn
+        M.withLabel M.topicRetentionTrims labels M.incCounter
+        -- The samples before the trim point are useless now
+        modifyIORef' byteSamples $ Map.adjust (Seq.dropWhileL ((< ts) . fst)) p.logid
+      Left err -> do
+        Log.warning $ "Retention failed to trim " <> Log.build p.topic
+                   <> "(" <> Log.build p.index <> "): " <> Log.buildString err
+        M.withLabel M.topicRetentionFailedTrims labels M.incCounter
+
+-- | Get the partitions of the topic if we are the owner and the topic has a
+-- retention policy.
+getPartitions :: RetentionEnforcer -> S.StreamId -> IO [Partition]
+getPartitions e@RetentionEnforcer{..} streamId = handle onErr $ do
+  let topic = Utils.cBytesToText (S.streamName streamId)
+  owned <- isOwner e topic
+  if not owned then pure [] else do
+    extras <- S.getStreamExtraAttrs ldclient streamId
+    let extras' = Map.fromList . map (bimap Utils.cBytesToText (J.decode . Utils.cBytesToLazyByteString))
+                . Map.toList $ extras
+    case KC.mkKafkaTopicConfigs extras' of
+      Left msg -> do
+        Log.warning $ "Invalid configs of topic " <> Log.build topic <> ": " <> Log.build msg
+        pure []
+      Right configs
+        | not (hasRetention configs) -> pure []
+        | otherwise -> do
+            ps <- S.listStreamPartitionsOrderedByName ldclient streamId
+            pure [ Partition topic i logid configs
+                 | (i, (_, logid)) <- zip [0..] (V.toList ps) ]
+  where
+    -- The topic may be deleted at the same time
+    onErr (ex :: SomeException) = do
+      Log.warning $ "Retention skip " <> Log.buildString' streamId
+                 <> ": " <> Log.buildString' ex
+      pure []
+    hasRetention KC.KafkaTopicConfigs{ cleanupPolicy = policy
+                                     , retentionMs = KC.RetentionMs ms
+                                     , retentionBytes = KC.RetentionBytes bytes } =
+      policy /= KC.CleanupPolicyCompact && (ms > 0 || bytes > 0)
+
+-- | Each topic is enforced by the server which owns it on the hash ring, so
+-- that there won't be duplicate trims.
+isOwner :: RetentionEnforcer -> Text -> IO Bool
+isOwner RetentionEnforcer{..} topic = do
+  node <- Lookup.lookupKafka hashRing Nothing (Lookup.KafkaResTopic topic)
+  pure $ A.serverNodeId node == serverID
+
+-- | Convert the trim timestamps to trim points, the ones which are not
+-- beyond the current trim points are filtered out.
+getTrimPoints
+  :: RetentionEnforcer
+  -> [(Partition, Int64, S.LSN)]
+  -> IO [(Partition, Int64, S.LSN)]
+getTrimPoints RetentionEnforcer{..} candidates = do
+  let logids = map (\(p, _, _) -> p.logid) candidates
+  -- An approximate result is never later than the accurate one, so we may
+  -- trim less than expected but never more.
+  lsns <- S.findTimeBatch ldclient 0 S.FindKeyApproximate
+            (map (\(p, ts, _) -> (p.logid, ts)) candidates)
+  heads <- S.getLogHeadAttrsBatch ldclient 0 logids
+  pure $ catMaybes $ zipWith3 toTrimPoint candidates lsns heads
+  where
+    toTrimPoint (p, ts, tailLsn) (Right lsn) (Right headAttrs) =
+      -- findTime returns the first record to keep
+      let trimPoint = min tailLsn (lsn - 1)
+       in if lsn /= S.LSN_INVALID && trimPoint > headAttrs.headTrimPoint
+             then Just (p, ts, trimPoint)
+             else Nothing
+    toTrimPoint _ _ _ = Nothing
+
+trimRateLimited
+  :: RetentionEnforcer -> [(Word64, S.LSN)] -> IO [Either String ()]
+trimRateLimited RetentionEnforcer{..} = go
+  where
+    go [] = pure []
+    go reqs = do
+      let (batch, rest) = if trimRate > 0 then splitAt trimRate reqs else (reqs, [])
+      start <- BaseTime.getSystemMsTimestamp
+      rs <- map (either (Left . show) Right) <$> S.trimBatch ldclient 0 batch
+      unless (null rest) $ do
+        end <- BaseTime.getSystemMsTimestamp
+        let elapsed = fromIntegral (end - start)
+        when (elapsed < 1000) $ threadDelay ((1000 - elapsed) * 1000)
+      (rs ++) <$> go rest
+
+-------------------------------------------------------------------------------
+
+-- | Max number of samples of each log, the samples are downsampled (which
+-- keeps the time range but loses precision) once exceeded.
+maxByteSamples :: Int
+maxByteSamples = 1024
+
+addByteSample :: Int64 -> Maybe Word64 -> ByteSamples -> ByteSamples
+addByteSample _ Nothing ss = ss
+addByteSample now (Just bytes) ss =
+  let ss' = ss |> (now, bytes)
+   in if Seq.length ss' > maxByteSamples
+         then let n = Seq.length ss'
+               in Seq.fromList [ x | (i, x) <- zip [0..] (toList ss')
+                                   , even i || i == n - 1 ]
+         else ss'
+
+-- | The timestamp before which all records of the log should be trimmed.
+--
+-- For retention.bytes, like Kafka, we keep at least retention.bytes in the
+-- log, i.e. trim before the latest sample whose bytes are within the excess.
+retentionTrimTimestamp
+  :: Int64
+  -- ^ now in milliseconds
+  -> KC.KafkaTopicConfigs
+  -> Maybe Word64
+  -- ^ total bytes written to the log, Nothing if unknown
+  -> ByteSamples
+  -> Maybe Int64
+retentionTrimTimestamp now configs tailBytes samples =
+  case catMaybes [byTime, bySize] of
+    [] -> Nothing
+    xs -> Just (maximum xs)
+  where
+    KC.KafkaTopicConfigs{ retentionMs = KC.RetentionMs ms
+                        , retentionBytes = KC.RetentionBytes bytes } = configs
+    byTime = if ms > 0 then Just (now - fromIntegral ms) else Nothing
+    bySize = do
+      guard (bytes > 0)
+      total <- tailBytes
+      guard (total > fromIntegral bytes)
+      let excess = total - fromIntegral bytes
+      case Seq.viewr (Seq.takeWhileL ((<= excess) . snd) samples) of
+        EmptyR   -> Nothing
+        _ :> (ts, _) -> Just ts
@@ -12,12 +12,19 @@
 #include <asio/write.hpp>
 #include <iostream>
 #include <list>
+#include <optional>
 #include <thread>
 
+#include "hs_alloc.h"
+#include "hs_coredump.h"
 #include "hs_kafka_server.h"
+#include "hs_tracing.h"
 
 // ----------------------------------------------------------------------------
 
+// Requests at least this large are excluded from core dumps.
+static constexpr int32_t kNoDumpRequestBytes = 1024 * 1024;
+
 static void writeBE(int32_t value, uint8_t bytes[4]) {
   bytes[0] = (value >> 24) & 0xFF;
   bytes[1] = (value >> 16) & 0xFF;
@@ -75,7 +82,12 @@ public:
     // Create a pool of threads to run all of the io_contexts.
     std::vector<std::thread> threads;
     for (std::size_t i = 0; i < io_contexts_.size(); ++i)
-      threads.emplace_back([this, i] { io_contexts_[i]->run(); });
+      threads.emplace_back([this, i] {
+        // These threads only serve the kafka connections, account all their
+        // allocations (e.g. the request buffers) to the network arena.
+        hstream::alloc::bindThreadArena(HS_ARENA_KAFKA_NET);
+        io_contexts_[i]->run();
+      });
 
     // Wait for all threads in the pool to exit.
     for (std::size_t i = 0; i < threads.size(); ++i)
@@ -169,13 +181,30 @@ private:
         // FIXME:
         // 1. How about the case when length_ is negative?
         // 2. How about using stack memory for small messages?
-        std::vector<uint8_t> msg_bytes_(length_);
-        co_await asio::async_read(socket_, asio::buffer(msg_bytes_),
+        //
+        // Large requests (mostly produce requests) are excluded from core
+        // dumps, malloc would map them directly anyway.
+        std::vector<uint8_t> msg_bytes_;
+        std::optional<hstream::coredump::NoDumpBuffer> large_msg_bytes_;
+        uint8_t* msg_data_;
+        if (length_ >= kNoDumpRequestBytes) {
+          large_msg_bytes_.emplace(length_);
+          msg_data_ = large_msg_bytes_->data();
+        } else {
+          msg_bytes_.resize(length_);
+          msg_data_ = msg_bytes_.data();
+        }
+        co_await asio::async_read(socket_, asio::buffer(msg_data_, length_),
                                   asio::use_awaitable);
 
+        // Covers the request from the message is read until the response is
+        // written, the haskell handler records its own span under this one.
+        hstream::tracing::Span span(hs_trace_begin(), 0, "kafka.request");
+        span.tag("request_bytes", length_);
+
         auto coro_lock = CoroLock(co_await asio::this_coro::executor, 1);
-        server_request_t request{msg_bytes_.data(), msg_bytes_.size(),
-                                 &coro_lock};
+        server_request_t request{msg_data_, static_cast<size_t>(length_),
+                                 &coro_lock, span.traceId(), span.spanId()};
         server_response_t response;
 
         // Call haskell handler
@@ -194,7 +223,7 @@ private:
             buffers.push_back(asio::buffer(response.data, response.data_size));
 
             co_await asio::async_write(socket_, buffers, asio::use_awaitable);
-            free(response.data);
+            hs_arena_free(response.data);
           } else {
             // Server active close
             stop();
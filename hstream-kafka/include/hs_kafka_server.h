@@ -12,6 +12,9 @@ struct server_request_t {
   uint8_t* data;
   size_t data_size;
   CoroLock* lock;
+  // Zero if the request is not sampled, see hs_tracing.h
+  uint64_t trace_id;
+  uint64_t span_id;
 };
 
 struct server_response_t {
@@ -7,6 +7,7 @@ module Kafka.Storage.Logdevice
   , setClientSetting
   , LDLogLevel
   , trimLastBefore
+  , trimBatch
 
     -- * Topic
   , StreamId (streamName)
@@ -29,9 +30,12 @@ module Kafka.Storage.Logdevice
   , pattern LSN_MAX
   , pattern LSN_INVALID
   , getTailLSN
+  , getTailLSNs
   , findKey
   , findTime
-  , FindKeyAccuracy (FindKeyStrict)
+  , findTimes
+  , findTimeBatch
+  , FindKeyAccuracy (FindKeyStrict, FindKeyApproximate)
   , pattern KeyTypeFindKey
     -- ** Attributes
   , removeStream
@@ -44,6 +48,10 @@ module Kafka.Storage.Logdevice
   , defAttr1
   , getLogTailAttrsLSN
   , getLogTailAttrs
+  , LogTailAttributes (..)
+  , getLogTailAttrsBatch
+  , LogHeadAttributes (..)
+  , getLogHeadAttrsBatch
   , getStreamExtraAttrs
 
     -- * Records
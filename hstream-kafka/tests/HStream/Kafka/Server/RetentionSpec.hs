@@ -0,0 +1,47 @@
+module HStream.Kafka.Server.RetentionSpec where
+
+import qualified Data.Map.Strict             as M
+import qualified Data.Sequence               as Seq
+import           Data.Text                   (Text)
+import           Test.Hspec
+
+import           HStream.Kafka.Server.Config
+import           HStream.Kafka.Server.Retention
+
+mkConfigs :: [(Text, Text)] -> KafkaTopicConfigs
+mkConfigs kvs =
+  either (error . show) id $ mkKafkaTopicConfigs $ M.fromList [(k, Just v) | (k, v) <- kvs]
+
+spec :: Spec
+spec = describe "RetentionSpec" $ do
+  it "addByteSample" $ do
+    addByteSample 1 Nothing Seq.empty `shouldBe` Seq.empty
+    addByteSample 2 (Just 10) (Seq.fromList [(1, 5)])
+      `shouldBe` Seq.fromList [(1, 5), (2, 10)]
+    -- downsample but keep the time range
+    let ss = foldl (\acc i -> addByteSample i (Just $ fromIntegral i) acc)
+                   Seq.empty [0..1024]
+    Seq.length ss `shouldSatisfy` (<= 1024)
+    Seq.index ss 0 `shouldBe` (0, 0)
+    Seq.index ss (Seq.length ss - 1) `shouldBe` (1024, 1024)
+
+  it "retentionTrimTimestamp by time" $ do
+    let cfg = mkConfigs [("retention.ms", "1000")]
+    retentionTrimTimestamp 5000 cfg Nothing Seq.empty `shouldBe` Just 4000
+
+  it "retentionTrimTimestamp by size" $ do
+    let cfg = mkConfigs [("retention.ms", "-1"), ("retention.bytes", "100")]
+        samples = Seq.fromList [(1, 50), (2, 100), (3, 150), (4, 200)]
+    -- within the limit
+    retentionTrimTimestamp 5 cfg (Just 100) samples `shouldBe` Nothing
+    -- unknown byte offset
+    retentionTrimTimestamp 5 cfg Nothing samples `shouldBe` Nothing
+    -- keep at least 100 bytes
+    retentionTrimTimestamp 5 cfg (Just 220) samples `shouldBe` Just 2
+    retentionTrimTimestamp 5 cfg (Just 250) samples `shouldBe` Just 3
+
+  it "retentionTrimTimestamp choose the later one" $ do
+    let cfg = mkConfigs [("retention.ms", "2"), ("retention.bytes", "100")]
+        samples = Seq.fromList [(1, 50), (2, 100), (3, 150), (4, 200)]
+    retentionTrimTimestamp 5 cfg (Just 250) samples `shouldBe` Just 3
+    retentionTrimTimestamp 10 cfg (Just 250) samples `shouldBe` Just 8
@@ -90,7 +90,7 @@ main = do
             sicKeySerde = timeWindowKeySerde textSerde (timeWindowSerde timeWindowSize) timeWindowSize,
             sicValueSerde = intSerde
           }
-  aggStore <- mkInMemoryStateKVStore
+  aggStore <- mkInMemoryStateSessionStore
   let materialized =
         HS.Materialized
           { mKeySerde = textSerde,
@@ -35,12 +35,14 @@ data SourceConnectorWithoutCkp = SourceConnectorWithoutCkp
     unSubscribeToStreamWithoutCkp :: StreamName -> IO (),
     isSubscribedToStreamWithoutCkp :: StreamName -> IO Bool,
     -- readRecordsWithoutCkp :: StreamName -> IO [SourceRecord]
+    -- | The action gets the number of records read, including the ones
+    -- dropped by the key and value transformations, and the records left.
     withReadRecordsWithoutCkp ::
       StreamName ->
       (BL.ByteString -> Maybe BL.ByteString) ->
       (BL.ByteString -> Maybe BL.ByteString) ->
       TVar Bool ->
-      ([SourceRecord] -> IO (IO (), IO ())) ->
+      (Int -> [SourceRecord] -> IO (IO (), IO ())) ->
       IO (),
     connectorClosed :: TVar Bool
   }
@@ -50,5 +52,8 @@ data SinkConnector = SinkConnector
       (BL.ByteString -> Maybe BL.ByteString) ->
       (BL.ByteString -> Maybe BL.ByteString) ->
       SinkRecord ->
-      IO ()
+      IO (),
+    -- | Wait until the records written so far are stored, so the source
+    -- records they come from can be acked. Throws if some of them failed.
+    flushRecords :: IO ()
   }
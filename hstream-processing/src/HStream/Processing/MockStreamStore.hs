@@ -57,7 +57,8 @@ mkMockStoreSinkConnector mockStore = do
   producer <- mkMockProducer mockStore
   return $
     SinkConnector
-      { writeRecord = \_ _ -> writeRecordMock producer
+      { writeRecord = \_ _ -> writeRecordMock producer,
+        flushRecords = return ()
       }
 
 -- 实现的时候都要传一个隐式的 共享的 client 进去的，
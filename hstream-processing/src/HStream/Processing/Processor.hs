@@ -13,11 +13,14 @@ module HStream.Processing.Processor
     taskBuilderWithName,
     addSource,
     addProcessor,
+    addBatchProcessor,
+    addExchange,
     addSink,
     addStateStore,
     runTask,
     runImmTask,
     forward,
+    forwardBatch,
     getKVStateStore,
     getSessionStateStore,
     getTimestampedKVStateStore,
@@ -25,6 +28,8 @@ module HStream.Processing.Processor
     Materialized (..),
     Record (..),
     Processor (..),
+    BatchProcessor (..),
+    RecordGuard,
     SourceConfig (..),
     SinkConfig (..),
     TaskBuilder (..),
@@ -40,9 +45,13 @@ where
 
 import           Control.Concurrent
 import           Control.Exception                      (throw)
+import           Data.Function                          (on)
+import           Data.Hashable                          (hash)
 import qualified Data.Aeson                             as Aeson
 import           Data.Maybe
+import           Data.Proxy                             (asProxyTypeOf)
 import           Data.Typeable
+import qualified Data.Vector                            as V
 import qualified Prelude
 import qualified RIO
 import           RIO
@@ -112,9 +121,33 @@ build tp@TaskTopologyConfig {..} =
           taskSinkConfig = sinkCfgs,
           taskTopologyReversed = topology,
           taskTopologyForward = topologyForward,
-          taskStores = stores
+          taskStores = stores,
+          taskExchanges = partitionedExchanges tp
         }
 
+-- | The exchanges of a topology, if every processor after them can run on
+-- the sub-task of its partition: each processor, and all processors sharing
+-- a store, are reached through the same single exchange or through none, and
+-- no exchange is after another one. Otherwise (e.g. a join of which only one
+-- side is grouped) the task runs without exchanges.
+partitionedExchanges :: TaskTopologyConfig -> HM.HashMap T.Text Exchange
+partitionedExchanges TaskTopologyConfig {..}
+  | all ((<= 1) . HS.size) (HM.elems origins),
+    all ((== Just (HS.singleton Nothing)) . (`HM.lookup` origins)) (HM.keys exchanges),
+    all ((<= 1) . HS.size . HS.unions . map originsOf . HS.toList . snd) (HM.elems stores) =
+    exchanges
+  | otherwise = HM.empty
+  where
+    origins = HM.mapWithKey (\name _ -> originsOf name) topology
+    -- the exchanges a processor is reached through, Nothing for a source
+    originsOf name = case snd <$> HM.lookup name topology of
+      Just parents@(_ : _) ->
+        HS.unions
+          [ if HM.member parent exchanges then HS.singleton (Just parent) else originsOf parent
+            | parent <- parents
+          ]
+      _ -> HS.singleton Nothing
+
 buildTask ::
   T.Text ->
   TaskBuilder
@@ -142,7 +175,7 @@ runTask
   -> Text  -- ^ queryId, use for stats gathering
   -> h1
   -> h2
-  -> (Task -> IO ())
+  -> (Task -> IO (IO ()))  -- ^ take the changes for a snapshot, return the action which writes them
 #ifdef HStreamEnableSchema
   -> (T.Text -> IO (Maybe schema))
   -> (schema -> BL.ByteString -> Maybe BL.ByteString) -- FIXME: schema actually only belongs to value
@@ -231,22 +264,51 @@ runTask statsHolder
     f chan consumerClosed sourceStreamName = do
 #ifdef HStreamEnableSchema
       schema <- getSchema sourceStreamName <&> fromJust
-      withReadRecordsWithoutCkp sourceStreamName (transKSrc schema) (transVSrc schema) consumerClosed $ \sourceRecords -> do
+      withReadRecordsWithoutCkp sourceStreamName (transKSrc schema) (transVSrc schema) consumerClosed $ \numRead sourceRecords -> do
 #else
-      withReadRecordsWithoutCkp sourceStreamName (transKSrc sourceStreamName) (transVSrc sourceStreamName) consumerClosed $ \sourceRecords -> do
+      withReadRecordsWithoutCkp sourceStreamName (transKSrc sourceStreamName) (transVSrc sourceStreamName) consumerClosed $ \numRead sourceRecords -> do
 #endif
         mvar <- RIO.newEmptyMVar
         let callback  = do
-              query_stat_add_total_input_records statsHolder (textToCBytes qid) (fromIntegral . length $ sourceRecords)
+              -- including the records dropped by the pushed-down predicate
+              query_stat_add_total_input_records statsHolder (textToCBytes qid) (fromIntegral numRead)
               atomically $ writeTChan chan (sourceRecords, mvar)
             beforeAck = RIO.takeMVar mvar
         return (callback,beforeAck)
 
     g :: Task -> TaskContext -> TChan ([SourceRecord], MVar ()) -> IO ()
-    g task@Task{..} ctx chan = do
+    g task@Task{..} ctx0 chan = do
       timer <- newIORef False
+      writing <- newIORef Nothing
+      -- A task with exchanges runs the processors after them on a sub-task
+      -- per capability, each with its own context. This thread runs the
+      -- processors before the exchanges and sends the records forwarded by
+      -- an exchange to the sub-task of their partition, one batch per
+      -- sub-task for a batch of source records. The batch of source records
+      -- is acked once all sub-tasks have processed their parts of it. The
+      -- state stores are shared, each key is only updated by one sub-task.
+      -- A record is sent with the stream time when it left this thread, so
+      -- the sub-tasks see the same stream time as a task without exchanges
+      -- whatever the number of sub-tasks and the partition of the record.
+      n <- if HM.null taskExchanges then return 0 else Control.Concurrent.getNumCapabilities
+      buffers <- V.replicateM n (newIORef [])
+      queues <- V.replicateM n (newTBQueueIO 16)
+      -- the number of batches not processed yet by all their sub-tasks
+      inFlight <- newTVarIO (0 :: Int)
+      pctxs <- V.replicateM n $ do
+        pRef <- newIORef ""
+        tRef <- newIORef (-1)
+        return ctx0 {curProcessor = pRef, tcTimestamp = tRef}
+      let send name er = do
+            let i = partitionOf (taskExchanges HM'.! name) er `mod` n
+            ts <- getTimestampInTaskContext ctx0
+            modifyIORef' (buffers V.! i) ((name, er, ts) :)
+          ctx = if n == 0 then ctx0 else ctx0 {tcExchange = Just send}
       -- Start two threads here. One is used to set the timer of snapshotting
-      -- and the other is used to do the **snapshotting** and **processing**.
+      -- and the other is used to do the **processing** and to take the
+      -- changes of the stores for **snapshotting**. The changes are written
+      -- by a third thread, so the processing does not wait for the writes.
+      -- A new snapshot is not taken until the previous one is written.
 
       -- [important] we use 'waitEitherCancel' to ensure both threads are
       --             cancelled when one of them throws an exception.
@@ -254,43 +316,100 @@ runTask statsHolder
         Control.Concurrent.threadDelay $ 10 * 1000 * 1000
         atomicWriteIORef timer True) $ \a -> withAsync (forever $ do
           readIORef timer >>= \case
-            False -> go
-            True  -> do
-              doSnapshot task
-              atomicWriteIORef timer False) $ \b -> void (waitEitherCancel a b)
+            False -> go ctx buffers queues inFlight
+            True  -> readIORef writing >>= \case
+              Just w -> poll w >>= \case
+                Nothing -> go ctx buffers queues inFlight
+                -- an error of writing a snapshot is as fatal as it was when
+                -- the snapshot was written by this thread
+                Just r  -> atomicWriteIORef writing Nothing >> either throwIO return r
+              Nothing -> do
+                -- The changelog tail of a snapshot is read before the
+                -- changes of the stores are taken, so no sub-task may be
+                -- between logging a change and applying it to its store.
+                atomically $ readTVar inFlight >>= checkSTM . (== 0)
+                write <- doSnapshot task
+                w <- async write
+                atomicWriteIORef writing (Just w)
+                atomicWriteIORef timer False) $ \b ->
+            withAll (V.toList $ V.zipWith runSubTask pctxs queues) $ \cs ->
+              void (waitAnyCancel (a : b : cs))
+                `finally` (readIORef writing >>= mapM_ cancel)
       where
-        go = do
+        withAll [] k       = k []
+        withAll (x : xs) k = withAsync x $ \c -> withAll xs (k . (c :))
+
+        runSubTask pctx queue = forever $ do
+          (records, done) <- atomically $ readTBQueue queue
+          runRIO pctx $ forM_ records $ \(name, ERecord r, ts) -> do
+            writeIORef (tcTimestamp pctx) ts
+            recordGuard $ do
+              writeIORef (curProcessor pctx) name
+              forward r
+          done
+
+        go ctx buffers queues inFlight = do
           (sourceRecords, mvar) <- atomically $ readTChan chan
-          runRIO ctx $ forM_ sourceRecords $ \SourceRecord {..} -> do
-            let acSourceName = iSourceName (taskSourceConfig HM'.! srcStream)
-            let (sourceEProcessor, _) = taskTopologyForward HM'.! acSourceName
-            liftIO $ updateTimestampInTaskContext ctx srcTimestamp
-            -- [WARNING] [FIXME]
-            -- The following code means that we only consider 'StreamNotFound'
-            -- as a fatal error so we re-throw it. This causes all threads
-            -- related to this task to exit. As for other errors, we just
-            -- log them and continue.
-            -- HOWEVER, this should be re-considered. Which errors are actually
-            -- fatal?
-            catches (runEP sourceEProcessor (mkERecord Record {recordKey = srcKey, recordValue = srcValue, recordTimestamp = srcTimestamp}))
-              [ Handler $ \(err :: HE.StreamNotFound) -> do
-                liftIO $ query_stat_add_total_execute_errors statsHolder (textToCBytes qid) 1
-                -- 'throw' here: very important! Or the threads related to the
-                --               task will not be cleaned up. See above.
-                throw err
-              , Handler $ \(err :: SomeException) -> do
-                liftIO $ Log.warning $ Log.buildString' err
-                liftIO $ query_stat_add_total_execute_errors statsHolder (textToCBytes qid) 1
-                -- No 'throw' here: very important! Just omit the error and
-                --                  continue processing. See above.
-              ]
-            liftIO $ query_stat_add_total_output_records statsHolder (textToCBytes qid) 1
+          -- The records of a stream are pushed through the topology as a
+          -- batch, so that the processors which have a batch form (e.g. the
+          -- filters and projections of SQL) evaluate it column by column.
+          -- The other processors still run on the records one by one, each
+          -- under 'recordGuard'.
+          runRIO ctx $ forM_ (L.groupBy ((==) `on` srcStream) sourceRecords) $ \case
+            [] -> return ()
+            records@(SourceRecord {srcStream = stream} : _) -> do
+              let acSourceName = iSourceName (taskSourceConfig HM'.! stream)
+              let (sourceEProcessor, _) = taskTopologyForward HM'.! acSourceName
+              let batch = V.fromList [ Record {recordKey = srcKey, recordValue = srcValue, recordTimestamp = srcTimestamp}
+                                     | SourceRecord {..} <- records ]
+              -- An error out of the batch form of a processor (rather than
+              -- out of a single record) drops the rest of the batch.
+              recordGuard $ runEPBatch sourceEProcessor recordGuard (mkEBatch batch)
+              forM_ records $ liftIO . updateTimestampInTaskContext ctx . srcTimestamp
+              liftIO $ query_stat_add_total_output_records statsHolder (textToCBytes qid) (fromIntegral $ L.length records)
           -- NOTE: tell the server that we have processed this "batch" of records
           --       so it can mark them as acked. Here we associate a batch of
           --       'SourceRecord' with a single ack. This granularity may be too
           --       coarse if the batch size is large.
           -- CAUTION: the position of the following line!!!
-          liftIO $ RIO.putMVar mvar ()
+          -- The sink may still be appending the output of the records, so
+          -- they are acked only once it is flushed.
+          parts <- V.filter (not . L.null . snd) . V.indexed <$> V.mapM (\b -> atomicModifyIORef' b (\rs -> ([], rs))) buffers
+          if V.null parts
+            then liftIO $ flushRecords sinkConnector >> RIO.putMVar mvar ()
+            else do
+              remaining <- newIORef (V.length parts)
+              atomically $ modifyTVar' inFlight (+ 1)
+              let done = do
+                    left <- atomicModifyIORef' remaining (\x -> (x - 1, x - 1))
+                    when (left == 0) $ do
+                      flushRecords sinkConnector
+                      atomically $ modifyTVar' inFlight (subtract 1)
+                      RIO.putMVar mvar ()
+              V.forM_ parts $ \(i, records) ->
+                atomically $ writeTBQueue (queues V.! i) (L.reverse records, done)
+
+        -- [WARNING] [FIXME]
+        -- The following code means that we only consider 'StreamNotFound'
+        -- as a fatal error so we re-throw it. This causes all threads
+        -- related to this task to exit. As for other errors, we just
+        -- log them and continue.
+        -- HOWEVER, this should be re-considered. Which errors are actually
+        -- fatal?
+        recordGuard :: RecordGuard
+        recordGuard action =
+          catches action
+            [ Handler $ \(err :: HE.StreamNotFound) -> do
+              liftIO $ query_stat_add_total_execute_errors statsHolder (textToCBytes qid) 1
+              -- 'throw' here: very important! Or the threads related to the
+              --               task will not be cleaned up. See above.
+              throw err
+            , Handler $ \(err :: SomeException) -> do
+              liftIO $ Log.warning $ Log.buildString' err
+              liftIO $ query_stat_add_total_execute_errors statsHolder (textToCBytes qid) 1
+              -- No 'throw' here: very important! Just omit the error and
+              --                  continue processing. See above.
+            ]
 
 runImmTask ::
   (Ord t, Monoid t, Aeson.FromJSON t, Aeson.ToJSON t, Typeable t, ChangeLogger h1, Snapshotter h2
@@ -453,7 +572,7 @@ addSource cfg@SourceConfig {..} =
       topology =
         HM.singleton
           sourceName
-          (mkEProcessor $ buildSourceProcessor cfg, [])
+          (mkEProcessorWithBatch (buildSourceProcessor cfg) (buildSourceBatchProcessor cfg), [])
     }
 
 buildSourceProcessor ::
@@ -474,6 +593,23 @@ buildSourceProcessor SourceConfig {..} = Processor $ \r@Record {..} -> do
           }
   forward rr
 
+buildSourceBatchProcessor ::
+  (Typeable k, Typeable v) =>
+  SourceConfig k v s ->
+  BatchProcessor s s
+buildSourceBatchProcessor SourceConfig {..} = BatchProcessor $ \recordGuard records -> do
+  ctx <- ask
+  writeIORef (curProcessor ctx) sourceName
+  forwardBatch recordGuard $
+    V.map
+      ( \r@Record {..} ->
+          r
+            { recordKey = fmap runDeser keyDeserializer <*> recordKey,
+              recordValue = runDeser valueDeserializer recordValue
+            }
+      )
+      records
+
 addProcessor ::
   (Typeable kin, Typeable vin) =>
   T.Text ->
@@ -485,6 +621,31 @@ addProcessor name processor parentNames =
     { topology = HM.singleton name (mkEProcessor processor, parentNames)
     }
 
+-- | Add a processor which also has a batch form, see 'forwardBatch'.
+addBatchProcessor ::
+  (Typeable kin, Typeable vin) =>
+  T.Text ->
+  Processor kin vin ->
+  BatchProcessor kin vin ->
+  [T.Text] ->
+  TaskBuilder
+addBatchProcessor name processor batchProcessor parentNames =
+  mempty
+    { topology = HM.singleton name (mkEProcessorWithBatch processor batchProcessor, parentNames)
+    }
+
+-- | Partition the records forwarded by a processor by the hash of their keys,
+-- see 'Exchange'.
+addExchange ::
+  (Typeable k, Typeable v, Hashable k) =>
+  T.Text ->
+  Proxy (Record k v) ->
+  TaskBuilder
+addExchange name proxy =
+  mempty
+    { exchanges = HM.singleton name (Exchange $ maybe 0 hash . recordKey . (`asProxyTypeOf` proxy))
+    }
+
 buildSinkProcessor ::
   (Typeable k, Typeable v, Typeable s) =>
   SinkConfig k v s ->
@@ -563,13 +724,38 @@ forward record = do
   curProcessorName <- readIORef $ curProcessor ctx
   logDebug $ "enter forward, curProcessor is " <> display curProcessorName
   let taskInfo = taskConfig ctx
-  let tplgy = taskTopologyForward taskInfo
-  let (_, children) = tplgy HM'.! curProcessorName
-  for_ children $ \cname -> do
-    logDebug $ "forward to child: " <> display cname
-    writeIORef (curProcessor ctx) cname
-    let (eProcessor, _) = tplgy HM'.! cname
-    runEP eProcessor (mkERecord record)
+  case tcExchange ctx of
+    Just send | HM.member curProcessorName (taskExchanges taskInfo) ->
+      liftIO $ send curProcessorName (mkERecord record)
+    _ -> do
+      let tplgy = taskTopologyForward taskInfo
+      let (_, children) = tplgy HM'.! curProcessorName
+      for_ children $ \cname -> do
+        logDebug $ "forward to child: " <> display cname
+        writeIORef (curProcessor ctx) cname
+        let (eProcessor, _) = tplgy HM'.! cname
+        runEP eProcessor (mkERecord record)
+
+-- | Forward a batch of records to the batch form of the children. A child
+-- without a batch form processes the records one by one under the guard.
+forwardBatch ::
+  (Typeable k, Typeable v) =>
+  RecordGuard ->
+  V.Vector (Record k v) ->
+  RIO TaskContext ()
+forwardBatch recordGuard records = unless (V.null records) $ do
+  ctx <- ask
+  curProcessorName <- readIORef $ curProcessor ctx
+  case tcExchange ctx of
+    Just send | HM.member curProcessorName (taskExchanges $ taskConfig ctx) ->
+      liftIO $ V.mapM_ (send curProcessorName . mkERecord) records
+    _ -> do
+      let tplgy = taskTopologyForward $ taskConfig ctx
+      let (_, children) = tplgy HM'.! curProcessorName
+      for_ children $ \cname -> do
+        writeIORef (curProcessor ctx) cname
+        let (eProcessor, _) = tplgy HM'.! cname
+        runEPBatch eProcessor recordGuard (mkEBatch records)
 
 getKVStateStore ::
   (Typeable k, Typeable v, Ord k) =>
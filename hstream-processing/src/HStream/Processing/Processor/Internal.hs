@@ -11,6 +11,7 @@ module HStream.Processing.Processor.Internal where
 import           Control.Exception                      (throw)
 import           Data.Default
 import           Data.Typeable
+import qualified Data.Vector                            as V
 import           HStream.Processing.Error               (HStreamProcessingError (..))
 import           HStream.Processing.Processor.ChangeLog
 import           HStream.Processing.Processor.Snapshot
@@ -24,16 +25,50 @@ import qualified RIO.Text                               as T
 
 newtype Processor kin vin = Processor {runP :: Record kin vin -> RIO TaskContext ()}
 
-newtype EProcessor = EProcessor {runEP :: ERecord -> RIO TaskContext ()}
+-- | Wraps the processing of a single record, e.g. to handle its errors, when
+-- a batch of records is split up into single records.
+type RecordGuard = RIO TaskContext () -> RIO TaskContext ()
 
+-- | A processor which handles a whole batch of records at a time, e.g. a
+-- filter which evaluates its predicate over the columns of the batch.
+newtype BatchProcessor kin vin = BatchProcessor {runBP :: RecordGuard -> V.Vector (Record kin vin) -> RIO TaskContext ()}
+
+data EProcessor = EProcessor
+  { runEP      :: ERecord -> RIO TaskContext (),
+    runEPBatch :: RecordGuard -> EBatch -> RIO TaskContext ()
+  }
+
+-- | A processor without a batch form runs on the records of a batch one by
+-- one, each under the guard and with the timestamp of the task context
+-- updated as if the record came from the source alone.
 mkEProcessor ::
   (Typeable k, Typeable v) =>
   Processor k v ->
   EProcessor
-mkEProcessor proc = EProcessor $ \(ERecord record) ->
-  case cast record of
-    Just r -> runP proc r
-    Nothing -> throw $ TypeCastError ("mkEProcessor: type cast error, real record type is: " `T.append` T.pack (show (typeOf record)))
+mkEProcessor proc = mkEProcessorWithBatch proc $ BatchProcessor $ \recordGuard records -> do
+  ctx <- ask
+  name <- readIORef $ curProcessor ctx
+  V.forM_ records $ \r -> recordGuard $ do
+    writeIORef (curProcessor ctx) name
+    liftIO $ updateTimestampInTaskContext ctx (recordTimestamp r)
+    runP proc r
+
+mkEProcessorWithBatch ::
+  (Typeable k, Typeable v) =>
+  Processor k v ->
+  BatchProcessor k v ->
+  EProcessor
+mkEProcessorWithBatch proc batchProc =
+  EProcessor
+    { runEP = \(ERecord record) ->
+        case cast record of
+          Just r -> runP proc r
+          Nothing -> throw $ TypeCastError ("mkEProcessor: type cast error, real record type is: " `T.append` T.pack (show (typeOf record))),
+      runEPBatch = \recordGuard (EBatch records) ->
+        case cast records of
+          Just rs -> runBP batchProc recordGuard rs
+          Nothing -> throw $ TypeCastError ("mkEProcessor: type cast error, real batch type is: " `T.append` T.pack (show (typeOf records)))
+    }
 
 --
 newtype SourceProcessor = SourceProcessor {runSourceP :: RIO TaskContext ()}
@@ -51,12 +86,27 @@ data ERecord = forall k v. (Typeable k, Typeable v) => ERecord (Record k v)
 mkERecord :: (Typeable k, Typeable v) => Record k v -> ERecord
 mkERecord = ERecord
 
+data EBatch = forall k v. (Typeable k, Typeable v) => EBatch (V.Vector (Record k v))
+
+mkEBatch :: (Typeable k, Typeable v) => V.Vector (Record k v) -> EBatch
+mkEBatch = EBatch
+
+-- | The partition of the records forwarded by a processor, by their keys.
+-- The records after such a processor are processed by the sub-task of their
+-- partition, so a task with exchanges runs on several cores while each key
+-- (and the state of the key) stays on one sub-task.
+data Exchange = forall k v. (Typeable k, Typeable v) => Exchange (Record k v -> Int)
+
+partitionOf :: Exchange -> ERecord -> Int
+partitionOf (Exchange f) (ERecord r) = maybe 0 f (cast r)
+
 data TaskTopologyConfig = TaskTopologyConfig
   { ttcName    :: T.Text,
     sourceCfgs :: HM.HashMap T.Text InternalSourceConfig,
     topology   :: HM.HashMap T.Text (EProcessor, [T.Text]),
     sinkCfgs   :: HM.HashMap T.Text InternalSinkConfig,
-    stores     :: HM.HashMap T.Text (EStateStore, HS.HashSet T.Text)
+    stores     :: HM.HashMap T.Text (EStateStore, HS.HashSet T.Text),
+    exchanges  :: HM.HashMap T.Text Exchange
   }
 
 ----
@@ -145,7 +195,8 @@ instance Default TaskTopologyConfig where
         sourceCfgs = HM.empty,
         topology = HM.empty,
         sinkCfgs = HM.empty,
-        stores = HM.empty
+        stores = HM.empty,
+        exchanges = HM.empty
       }
 
 instance Semigroup TaskTopologyConfig where
@@ -185,7 +236,8 @@ instance Semigroup TaskTopologyConfig where
                 (s1, HS.union processors2 processors1)
             )
             (stores t1)
-            (stores t2)
+            (stores t2),
+        exchanges = HM.union (exchanges t1) (exchanges t2)
       }
 
 instance Monoid TaskTopologyConfig where
@@ -212,7 +264,8 @@ data Task = Task
     taskTopologyReversed :: HM.HashMap T.Text (EProcessor, [T.Text]),
     taskTopologyForward  :: HM.HashMap T.Text (EProcessor, [T.Text]),
     taskSinkConfig       :: HM.HashMap T.Text InternalSinkConfig,
-    taskStores           :: HM.HashMap T.Text (EStateStore, HS.HashSet T.Text)
+    taskStores           :: HM.HashMap T.Text (EStateStore, HS.HashSet T.Text),
+    taskExchanges        :: HM.HashMap T.Text Exchange
   }
 
 data TaskContext = forall h1 h2. (ChangeLogger h1, Snapshotter h2) => TaskContext
@@ -221,7 +274,11 @@ data TaskContext = forall h1 h2. (ChangeLogger h1, Snapshotter h2) => TaskContex
     curProcessor   :: IORef T.Text,
     tcTimestamp    :: IORef Int64,
     tcChangeLogger :: h1,
-    tcSnapshotter  :: h2
+    tcSnapshotter  :: h2,
+    -- | Sends a record forwarded by an exchange to the sub-task of its
+    -- partition, set in the context which runs the processors before the
+    -- exchanges of a partitioned task
+    tcExchange     :: Maybe (T.Text -> ERecord -> IO ())
   }
 
 instance HasLogFunc TaskContext where
@@ -244,13 +301,13 @@ buildTaskContext task lf changeLogger snapshotter = do
         curProcessor = pRef,
         tcTimestamp = tRef,
         tcChangeLogger = changeLogger,
-        tcSnapshotter = snapshotter
+        tcSnapshotter = snapshotter,
+        tcExchange = Nothing
       }
 
 updateTimestampInTaskContext :: TaskContext -> Timestamp -> IO ()
-updateTimestampInTaskContext TaskContext {..} recordTimestamp = do
-  oldTs <- readIORef tcTimestamp
-  writeIORef tcTimestamp (max oldTs recordTimestamp)
+updateTimestampInTaskContext TaskContext {..} recordTimestamp =
+  atomicModifyIORef' tcTimestamp (\oldTs -> (max oldTs recordTimestamp, ()))
 
 getTimestampInTaskContext :: TaskContext -> IO Timestamp
 getTimestampInTaskContext TaskContext {..} = readIORef tcTimestamp
@@ -1,15 +1,42 @@
 {-# LANGUAGE DeriveAnyClass     #-}
 {-# LANGUAGE DeriveGeneric      #-}
+{-# LANGUAGE LambdaCase         #-}
+{-# LANGUAGE RecordWildCards    #-}
 {-# LANGUAGE StandaloneDeriving #-}
 
+-- | Snapshots of state stores.
+--
+-- A snapshot used to be the whole state of a store encoded into a single
+-- value under the JSON of its 'StateStoreSnapshotKey'. It is now written
+-- incrementally: every entry of the store is a key of its own under that
+-- key, and a snapshot only writes the entries changed since the previous
+-- one (see 'StoreChanges'), together with the changelog tail, in a single
+-- batch. Key layout (the base key is the JSON of 'StateStoreSnapshotKey'):
+--
+-- * changelog tail:    base <> 0x00
+-- * KV store:          base <> 0x01 <> key
+-- * timestamped store: base <> 0x01 <> timestamp <> key
+-- * session store:     base <> 0x01 <> window end <> key length <> key <> window start
+--
+-- with the timestamps and lengths encoded like in the RocksDB stores, so the
+-- expired entries of the time ordered stores are a range of keys.
 module HStream.Processing.Processor.Snapshot where
 
 import           Data.Aeson
-import           Data.ByteString                       as BS
+import qualified Data.ByteString                       as BS
+import qualified Data.ByteString.Lazy                  as BL
 import           Data.Int                              (Int64)
 import           Data.Map.Strict                       (Map)
+import qualified Data.Map.Strict                       as Map
 import           Data.Text                             (Text)
+import           Data.Typeable                         (Typeable)
 import           GHC.Generics
+import           HStream.Processing.Store
+import           HStream.Processing.Store.RocksDB      (decodeLength,
+                                                        decodeTimestamp,
+                                                        encodeLength,
+                                                        encodeTimestamp,
+                                                        prefixEnd)
 import           HStream.Processing.Stream.TimeWindows
 import           HStream.Processing.Type
 
@@ -36,4 +63,128 @@ deriving instance (ToJSON i, ToJSON k, ToJSON v, ToJSON ser, ToJSONKey k, ToJSON
   ToJSON (StateStoreSnapshotValue i k v ser)
 
 class Snapshotter h where
-  snapshot :: h -> BS.ByteString -> BS.ByteString -> IO ()
+  snapshotGet :: h -> BS.ByteString -> IO (Maybe BS.ByteString)
+  -- | The entries with keys in [from, to), or after from if to is Nothing.
+  snapshotRange :: h -> BS.ByteString -> Maybe BS.ByteString -> IO [(BS.ByteString, BS.ByteString)]
+  -- | Put (Just) or delete (Nothing) all the keys at once.
+  snapshotBatch :: h -> [(BS.ByteString, Maybe BS.ByteString)] -> IO ()
+
+--------------------------------------------------------------------------------
+
+-- | How the keys and values of the stores are encoded in the entries of
+-- their snapshots.
+data EntryCodec a = EntryCodec
+  { encodeEntry :: a -> BS.ByteString
+  , decodeEntry :: BS.ByteString -> a
+  }
+
+jsonEntryCodec :: (ToJSON a, FromJSON a) => EntryCodec a
+jsonEntryCodec = EntryCodec
+  { encodeEntry = BL.toStrict . encode
+  , decodeEntry = either error id . eitherDecodeStrict
+  }
+
+bytesEntryCodec :: EntryCodec BL.ByteString
+bytesEntryCodec = EntryCodec BL.toStrict BL.fromStrict
+
+-- | The changes of a store taken for a snapshot.
+data SnapshotChanges k v ser
+  = KSChanges  (StoreChanges k v)
+  | SSChanges  (StoreChanges (Timestamp, k, Timestamp) v)
+  | TKSChanges (StoreChanges (Int64, ser) ser)
+
+-- | Take the changes of a store since the previous snapshot. This is cheap
+-- (it does not traverse the state), so it can be done by the processing
+-- thread between two batches of records.
+takeSnapshotChanges :: (Typeable k, Typeable v, Typeable ser, Ord k, Ord ser)
+                    => EStateStore -> IO (SnapshotChanges k v ser)
+takeSnapshotChanges ess = case ess of
+  EKVStateStore dekvs -> KSChanges <$> ksTakeChanges (fromDEKVStoreToEKVStore dekvs)
+  ESessionStateStore desss -> SSChanges <$> ssTakeChanges (fromDESessionStoreToESessionStore desss)
+  ETimestampedKVStateStore detkvs -> TKSChanges <$> tksTakeChanges (fromDETimestampedKVStoreToETimestampedKVStore detkvs)
+
+snapshotBaseKey :: StateStoreSnapshotKey -> BS.ByteString
+snapshotBaseKey = BL.toStrict . encode
+
+snapshotTailKey :: StateStoreSnapshotKey -> BS.ByteString
+snapshotTailKey key = snapshotBaseKey key <> BS.singleton 0
+
+snapshotEntryPrefix :: StateStoreSnapshotKey -> BS.ByteString
+snapshotEntryPrefix key = snapshotBaseKey key <> BS.singleton 1
+
+sessionEntryKey :: EntryCodec k -> EntryCodec (Timestamp, k, Timestamp)
+sessionEntryKey EntryCodec{..} = EntryCodec
+  { encodeEntry = \(we, k, ws) ->
+      let keyBytes = encodeEntry k
+       in encodeTimestamp we <> encodeLength (BS.length keyBytes) <> keyBytes <> encodeTimestamp ws
+  , decodeEntry = \bs ->
+      let (endBytes, rest0) = BS.splitAt 8 bs
+          (lenBytes, rest1) = BS.splitAt 4 rest0
+          (keyBytes, startBytes) = BS.splitAt (decodeLength lenBytes) rest1
+       in (decodeTimestamp endBytes, decodeEntry keyBytes, decodeTimestamp startBytes)
+  }
+
+timestampedEntryKey :: EntryCodec k -> EntryCodec (Int64, k)
+timestampedEntryKey EntryCodec{..} = EntryCodec
+  { encodeEntry = \(ts, k) -> encodeTimestamp ts <> encodeEntry k
+  , decodeEntry = \bs -> let (tsBytes, keyBytes) = BS.splitAt 8 bs
+                          in (decodeTimestamp tsBytes, decodeEntry keyBytes)
+  }
+
+-- | The writes which bring the snapshot of a store up to date with its
+-- changes, to be given to 'snapshotBatch' (together with the writes of the
+-- other stores of the task). Replacing the whole state also removes the
+-- snapshot of the old layout.
+snapshotWrites :: (Snapshotter h, ToJSON i)
+               => h -> EntryCodec k -> EntryCodec v -> EntryCodec ser
+               -> StateStoreSnapshotKey -> i -> SnapshotChanges k v ser
+               -> IO [(BS.ByteString, Maybe BS.ByteString)]
+snapshotWrites h kc vc sc key i changes = case changes of
+  KSChanges c  -> go kc vc c
+  SSChanges c  -> go (sessionEntryKey kc) vc c
+  TKSChanges c -> go (timestampedEntryKey sc) sc c
+  where
+    prefix = snapshotEntryPrefix key
+    tailWrite = (snapshotTailKey key, Just . BL.toStrict $ encode i)
+    go :: EntryCodec key -> EntryCodec a -> StoreChanges key a
+       -> IO [(BS.ByteString, Maybe BS.ByteString)]
+    go keyCodec valueCodec c = do
+      let entryKey = (prefix <>) . encodeEntry keyCodec
+      stale <- case c of
+        AllEntries _                   -> snapshotRange h prefix (prefixEnd prefix)
+        ChangedEntries (Just before) _ -> snapshotRange h prefix (Just $ prefix <> encodeTimestamp before)
+        ChangedEntries Nothing _       -> return []
+      let writes = case c of
+            AllEntries entries ->
+              Map.insert (snapshotBaseKey key) Nothing $
+                Map.fromList [ (entryKey k, Just (encodeEntry valueCodec a)) | (k, a) <- Map.toList entries ]
+            ChangedEntries _ entries ->
+              Map.fromList [ (entryKey k, encodeEntry valueCodec <$> ma) | (k, ma) <- Map.toList entries ]
+          deletes = Map.fromList [ (k, Nothing) | (k, _) <- stale ]
+      return $ Map.toList (writes `Map.union` deletes) ++ [tailWrite]
+
+-- | Read the incremental snapshot of a store of the same kind as the given
+-- one, or Nothing if there is none.
+readSnapshot :: (Snapshotter h, FromJSON i, Ord k, Ord ser)
+             => h -> EntryCodec k -> EntryCodec v -> EntryCodec ser
+             -> StateStoreSnapshotKey -> EStateStore
+             -> IO (Maybe (StateStoreSnapshotValue i k v ser))
+readSnapshot h kc vc sc key ess = snapshotGet h (snapshotTailKey key) >>= \case
+  Nothing -> return Nothing
+  Just tailBytes -> do
+    let i = either error id $ eitherDecodeStrict tailBytes
+        prefix = snapshotEntryPrefix key
+    entries <- fmap (\(k, v) -> (BS.drop (BS.length prefix) k, v))
+           <$> snapshotRange h prefix (prefixEnd prefix)
+    return . Just $ case ess of
+      EKVStateStore _ ->
+        SnapshotKS i $ Map.fromList
+          [ (decodeEntry kc k, decodeEntry vc v) | (k, v) <- entries ]
+      ESessionStateStore _ ->
+        SnapshotSS i $ Map.fromListWith (Map.unionWith Map.union)
+          [ (we, Map.singleton k (Map.singleton ws (decodeEntry vc v)))
+          | (bs, v) <- entries, let (we, k, ws) = decodeEntry (sessionEntryKey kc) bs ]
+      ETimestampedKVStateStore _ ->
+        SnapshotTKS i $ Map.fromListWith Map.union
+          [ (ts, Map.singleton k (decodeEntry sc v))
+          | (bs, v) <- entries, let (ts, k) = decodeEntry (timestampedEntryKey sc) bs ]
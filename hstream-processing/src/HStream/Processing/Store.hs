@@ -6,18 +6,19 @@
 
 module HStream.Processing.Store
   ( KVStore (..),
+    StoreChanges (..),
     SessionStore (..),
     TimestampedKVStore (..),
     StateStore (..),
     InMemoryKVStore,
-    -- mkInMemoryKVStore,
+    mkInMemoryKVStore,
     mkInMemoryStateKVStore,
     mkDEKVStore,
     EKVStore(..),
     DEKVStore(..),
     fromDEKVStoreToEKVStore,
     InMemorySessionStore,
-    -- mkInMemorySessionStore,
+    mkInMemorySessionStore,
     mkInMemoryStateSessionStore,
     fromEStateStoreToKVStore,
     fromEStateStoreToSessionStore,
@@ -26,11 +27,16 @@ module HStream.Processing.Store
     EStateStore(..),
     ESessionStore(..),
     DESessionStore(..),
+    InMemoryTimestampedKVStore,
+    mkInMemoryTimestampedKVStore,
     mkInMemoryStateTimestampedKVStore,
     ETimestampedKVStore(..),
     DETimestampedKVStore(..),
     fromEStateStoreToTimestampedKVStore,
-    fromDETimestampedKVStoreToETimestampedKVStore
+    fromDETimestampedKVStoreToETimestampedKVStore,
+    defaultSegmentInterval,
+    segmentOf,
+    toSegments
   )
 where
 
@@ -43,18 +49,33 @@ import           HStream.Processing.Stream.TimeWindows
 import           HStream.Processing.Type
 import           RIO
 import qualified RIO.Map                                  as Map
+import qualified RIO.Set                                  as Set
 import qualified RIO.Text                                 as T
 
+-- | The changes of a store since they were taken the last time, which an
+-- incremental snapshot writes instead of the whole state. The fields are
+-- lazy, so that taking them is cheap and they are computed by the writer.
+data StoreChanges key v
+  = -- | The entries replace the whole state.
+    AllEntries ~(Map key v)
+  | -- | The entries before the time (if any) expired, then the keys changed
+    -- to the values (Nothing if removed).
+    ChangedEntries ~(Maybe Int64) ~(Map key (Maybe v))
+
 data InMemoryKVStore k v = InMemoryKVStore
-  { imksData :: IORef (Map k v)
+  { imksData  :: IORef (Map k v),
+    -- | Keys changed since the changes were taken, Nothing for all keys
+    imksDirty :: IORef (Maybe (Set k))
   }
 
 mkInMemoryKVStore :: IO (InMemoryKVStore k v)
 mkInMemoryKVStore = do
   internalData <- newIORef Map.empty
+  dirty <- newIORef (Just Set.empty)
   return
     InMemoryKVStore
-      { imksData = internalData
+      { imksData = internalData,
+        imksDirty = dirty
       }
 
 class KVStore s where
@@ -63,6 +84,7 @@ class KVStore s where
   ksRange :: (Ord k) => k -> k -> s k v -> IO [(k, v)]
   ksDump :: (Ord k) => s k v -> IO (Map.Map k v)
   ksImport :: (Ord k) => s k v -> Map.Map k v -> IO ()
+  ksTakeChanges :: (Ord k) => s k v -> IO (StoreChanges k v)
 
 instance KVStore InMemoryKVStore where
   ksGet k InMemoryKVStore {..} = do
@@ -70,8 +92,8 @@ instance KVStore InMemoryKVStore where
     return $ Map.lookup k dict
 
   ksPut k v InMemoryKVStore {..} = do
-    dict <- readIORef imksData
-    writeIORef imksData (Map.insert k v dict)
+    modifyStore imksData (Map.insert k v)
+    modifyStore imksDirty (fmap (Set.insert k))
 
   ksRange fromKey toKey InMemoryKVStore {..} = do
     dict <- readIORef imksData
@@ -86,7 +108,18 @@ instance KVStore InMemoryKVStore where
 
   ksDump InMemoryKVStore {..} = readIORef imksData
 
-  ksImport InMemoryKVStore {..} extData = atomicWriteIORef imksData extData
+  ksImport InMemoryKVStore {..} extData = do
+    atomicWriteIORef imksData extData
+    atomicWriteIORef imksDirty Nothing
+
+  ksTakeChanges InMemoryKVStore {..} = do
+    dirty <- atomicModifyIORef' imksDirty (\d -> (Just Set.empty, d))
+    -- the changes are taken before the data, so a write racing with the take
+    -- is in this snapshot or in the next one
+    dict <- readIORef imksData
+    return $ case dirty of
+      Nothing   -> AllEntries dict
+      Just keys -> ChangedEntries Nothing (Map.fromSet (`Map.lookup` dict) keys)
 
 data EKVStore k v
   = forall s.
@@ -111,6 +144,8 @@ instance KVStore EKVStore where
 
   ksImport (EKVStore s) extData = ksImport s extData
 
+  ksTakeChanges (EKVStore s) = ksTakeChanges s
+
 mkDEKVStore ::
   (KVStore s, Typeable k, Typeable v, Ord k) =>
   s k v ->
@@ -153,6 +188,11 @@ class SessionStore s where
   ssDump :: (Typeable k, Ord k) => s k v -> IO (Map Timestamp (Map k (Map Timestamp v)))
   ssImport :: (Typeable k, Ord k) => s k v -> Map Timestamp (Map k (Map Timestamp v)) -> IO ()
   findSessions :: (Typeable k, Ord k) => k -> Timestamp -> Timestamp -> s k v -> IO [(SessionWindowKey k, v)]
+  -- | Drop the sessions which end before the time. A store may keep some of
+  -- them longer, e.g. until the whole time segment they are in expires.
+  ssExpire :: (Typeable k, Ord k) => Timestamp -> s k v -> IO ()
+  -- | Changes by (window end, key, window start).
+  ssTakeChanges :: (Typeable k, Ord k) => s k v -> IO (StoreChanges (Timestamp, k, Timestamp) v)
 
 data ESessionStore k v
   = forall s.
@@ -167,6 +207,8 @@ instance SessionStore ESessionStore where
   ssDump (ESessionStore s) = ssDump s
   ssImport (ESessionStore s) extData = ssImport s extData
   findSessions k ts1 ts2 (ESessionStore s) = findSessions k ts1 ts2 s
+  ssExpire ts (ESessionStore s) = ssExpire ts s
+  ssTakeChanges (ESessionStore s) = ssTakeChanges s
 
 data DESessionStore
   = forall k v.
@@ -186,106 +228,116 @@ fromDESessionStoreToESessionStore (DESessionStore eStore) =
         TypeCastError $
           "fromDESessionStoreToESessionStore: type cast error, actual eStore type is " `T.append` T.pack (show $ typeOf eStore)
 
+-- | Sessions by segment of their window end, then by window end, key and
+-- window start, so that expired sessions are dropped segment by segment.
 data InMemorySessionStore k v = InMemorySessionStore
-  { imssData :: IORef (Map Timestamp (IORef (Map k (IORef (Map Timestamp v)))))
+  { imssSegmentInterval :: Int64,
+    imssData            :: IORef (Map Int64 (Map Timestamp (Map k (Map Timestamp v)))),
+    -- | Sessions changed since the changes were taken, Nothing for all
+    imssDirty           :: IORef (Maybe (Set (Timestamp, k, Timestamp))),
+    -- | Sessions before the time expired since the changes were taken
+    imssExpiredBefore   :: IORef (Maybe Timestamp)
   }
 
 mkInMemorySessionStore :: IO (InMemorySessionStore k v)
 mkInMemorySessionStore = do
   internalData <- newIORef Map.empty
+  dirty <- newIORef (Just Set.empty)
+  expiredBefore <- newIORef Nothing
   return
     InMemorySessionStore
-      { imssData = internalData
+      { imssSegmentInterval = defaultSegmentInterval,
+        imssData = internalData,
+        imssDirty = dirty,
+        imssExpiredBefore = expiredBefore
       }
 
+lookupSession :: (Ord k) => Int64 -> Timestamp -> k -> Timestamp -> Map Int64 (Map Timestamp (Map k (Map Timestamp v))) -> Maybe v
+lookupSession interval we k ws segments =
+  Map.lookup (segmentOf interval we) segments
+    >>= Map.lookup we
+    >>= Map.lookup k
+    >>= Map.lookup ws
+
 instance SessionStore InMemorySessionStore where
-  ssGet TimeWindowKey {..} InMemorySessionStore {..} = do
-    let ws = tWindowStart twkWindow
-    let we = tWindowEnd twkWindow
-    dict0 <- readIORef imssData
-    case Map.lookup we dict0 of
-      Just rd -> do
-        dict1 <- readIORef rd
-        case Map.lookup twkKey dict1 of
-          Just rd1 -> do
-            dict2 <- readIORef rd1
-            return $ Map.lookup ws dict2
-          Nothing -> return Nothing
-      Nothing -> return Nothing
+  ssGet TimeWindowKey {..} InMemorySessionStore {..} =
+    lookupSession imssSegmentInterval (tWindowEnd twkWindow) twkKey (tWindowStart twkWindow) <$> readIORef imssData
 
   ssPut TimeWindowKey {..} v InMemorySessionStore {..} = do
     let ws = tWindowStart twkWindow
     let we = tWindowEnd twkWindow
-    dict0 <- readIORef imssData
-    case Map.lookup we dict0 of
-      Just rd -> do
-        dict1 <- readIORef rd
-        case Map.lookup twkKey dict1 of
-          Just rd1 -> do
-            dict2 <- readIORef rd1
-            writeIORef rd1 (Map.insert ws v dict2)
-          Nothing -> do
-            rd1 <- newIORef $ Map.singleton ws v
-            writeIORef rd (Map.insert twkKey rd1 dict1)
-      Nothing -> do
-        rd1 <- newIORef $ Map.singleton ws v
-        rd2 <- newIORef $ Map.singleton twkKey rd1
-        writeIORef imssData (Map.insert we rd2 dict0)
+    modifyStore imssData $
+      Map.insertWith (Map.unionWith (Map.unionWith Map.union)) (segmentOf imssSegmentInterval we) $
+        Map.singleton we (Map.singleton twkKey (Map.singleton ws v))
+    modifyStore imssDirty (fmap (Set.insert (we, twkKey, ws)))
 
   ssRemove TimeWindowKey {..} InMemorySessionStore {..} = do
     let ws = tWindowStart twkWindow
     let we = tWindowEnd twkWindow
-    dict0 <- readIORef imssData
-    case Map.lookup we dict0 of
-      Just rd -> do
-        dict1 <- readIORef rd
-        case Map.lookup twkKey dict1 of
-          Just rd1 -> do
-            dict2 <- readIORef rd1
-            writeIORef rd1 (Map.delete ws dict2)
-          Nothing -> return ()
-      Nothing -> return ()
-
-  -- do nothing but lift nested IO and Map
-  ssDump store = do
-    store <- imssData store & readIORef
-    store <- (fmap . fmap) readIORef <$> readIORef <$> store & sequence
-    sequence <$> store & sequence
-
-  ssImport store extData = do
-    extData' <- mapM ((newIORef =<<) . mapM newIORef) extData
-    atomicWriteIORef (imssData store) extData'
+    modifyStore imssData $
+      Map.update (nonEmpty . Map.update (nonEmpty . Map.update (nonEmpty . Map.delete ws) twkKey) we) (segmentOf imssSegmentInterval we)
+    modifyStore imssDirty (fmap (Set.insert (we, twkKey, ws)))
+
+  ssDump InMemorySessionStore {..} = Map.unions . Map.elems <$> readIORef imssData
+
+  ssImport InMemorySessionStore {..} extData = do
+    atomicWriteIORef imssData $ toSegments imssSegmentInterval extData
+    atomicWriteIORef imssDirty Nothing
+    atomicWriteIORef imssExpiredBefore Nothing
+
+  ssExpire expiredBefore InMemorySessionStore {..} = do
+    let segment = segmentOf imssSegmentInterval expiredBefore
+    modifyStore imssData $ Map.dropWhileAntitone (< segment)
+    modifyStore imssExpiredBefore (max (Just $ segment * imssSegmentInterval))
+
+  ssTakeChanges InMemorySessionStore {..} = do
+    dirty <- atomicModifyIORef' imssDirty (\d -> (Just Set.empty, d))
+    expiredBefore <- atomicModifyIORef' imssExpiredBefore (\e -> (Nothing, e))
+    segments <- readIORef imssData
+    return $ case dirty of
+      Nothing ->
+        AllEntries $
+          Map.fromDistinctAscList
+            [ ((we, k, ws), v)
+              | segment <- Map.elems segments,
+                (we, dict1) <- Map.toAscList segment,
+                (k, dict2) <- Map.toAscList dict1,
+                (ws, v) <- Map.toAscList dict2
+            ]
+      Just keys ->
+        ChangedEntries expiredBefore $
+          Map.fromSet (\(we, k, ws) -> lookupSession imssSegmentInterval we k ws segments) keys
 
   findSessions key earliestSessionEndTime latestSessionStartTime InMemorySessionStore {..} = do
-    dict0 <- readIORef imssData
-    let (_, mv0, tailDict0') = Map.splitLookup earliestSessionEndTime dict0
-    let tailDict0 =
-          if isJust mv0
-            then Map.insert earliestSessionEndTime (fromJust mv0) tailDict0'
-            else tailDict0'
-    Map.foldlWithKey'
-      ( \macc et rd1 -> do
-          acc <- macc
-          dict1 <- readIORef rd1
-          case Map.lookup key dict1 of
-            Just rd2 -> do
-              dict2 <- readIORef rd2
-              let (headDict2', mv2, _) = Map.splitLookup latestSessionStartTime dict2
-              let headDict2 =
-                    if isJust mv2
-                      then Map.insert latestSessionStartTime (fromJust mv2) headDict2'
-                      else headDict2'
-              return $
-                Map.foldlWithKey'
-                  ( \acc1 st v ->
-                      acc1 ++ [(mkTimeWindowKey key (mkTimeWindow st et), v)]
-                  )
-                  acc
-                  headDict2
-            Nothing -> return acc
-      )
-      (return [])
-      tailDict0
+    segments <- readIORef imssData
+    let candidates = Map.dropWhileAntitone (< segmentOf imssSegmentInterval earliestSessionEndTime) segments
+    return
+      [ (mkTimeWindowKey key (mkTimeWindow st et), v)
+        | segment <- Map.elems candidates,
+          (et, dict1) <- Map.toAscList (Map.dropWhileAntitone (< earliestSessionEndTime) segment),
+          dict2 <- maybeToList (Map.lookup key dict1),
+          (st, v) <- Map.toAscList (Map.takeWhileAntitone (<= latestSessionStartTime) dict2)
+      ]
+
+-- | The stores are shared by the sub-tasks of a task (see 'runTask'), which
+-- write different keys, so their updates must be atomic.
+modifyStore :: IORef a -> (a -> a) -> IO ()
+modifyStore ref f = atomicModifyIORef' ref (\a -> (f a, ()))
+
+-- | Width in milliseconds of the time segments of the in-memory window
+-- stores.
+defaultSegmentInterval :: Int64
+defaultSegmentInterval = 60 * 1000
+
+segmentOf :: Int64 -> Int64 -> Int64
+segmentOf interval ts = ts `div` interval
+
+toSegments :: Int64 -> Map Int64 a -> Map Int64 (Map Int64 a)
+toSegments interval =
+  Map.foldrWithKey (\ts a -> Map.insertWith Map.union (segmentOf interval ts) (Map.singleton ts a)) Map.empty
+
+nonEmpty :: Map k a -> Maybe (Map k a)
+nonEmpty m = if Map.null m then Nothing else Just m
 
 mkInMemoryStateKVStore :: IO (StateStore k v)
 mkInMemoryStateKVStore = do
@@ -335,74 +387,98 @@ class TimestampedKVStore s where
   tksRange :: (Ord k) => TimestampedKey k -> TimestampedKey k -> s k v -> IO [(TimestampedKey k, v)]
   tksDump :: (Ord k) => s k v -> IO (Map Int64 (Map k v))
   tksImport :: (Ord k) => s k v -> Map Int64 (Map k v) -> IO ()
-
+  -- | Drop the values whose timestamps are before the time. A store may keep
+  -- some of them longer, e.g. until the whole time segment they are in
+  -- expires.
+  tksExpire :: (Ord k) => Int64 -> s k v -> IO ()
+  -- | Changes by (timestamp, key).
+  tksTakeChanges :: (Ord k) => s k v -> IO (StoreChanges (Int64, k) v)
+
+-- | Values by segment of their timestamps, then by timestamp and key, so
+-- that a range only visits the segments it overlaps and expired values are
+-- dropped segment by segment.
 data InMemoryTimestampedKVStore k v = InMemoryTimestampedKVStore
-  { imtksData :: IORef (Map Int64 (IORef (Map k v)))
+  { imtksSegmentInterval :: Int64,
+    imtksData            :: IORef (Map Int64 (Map Int64 (Map k v))),
+    -- | Keys changed since the changes were taken, Nothing for all keys
+    imtksDirty           :: IORef (Maybe (Set (Int64, k))),
+    -- | Values before the time expired since the changes were taken
+    imtksExpiredBefore   :: IORef (Maybe Int64)
   }
 
 mkInMemoryTimestampedKVStore :: IO (InMemoryTimestampedKVStore k v)
 mkInMemoryTimestampedKVStore = do
   internalData <- newIORef Map.empty
+  dirty <- newIORef (Just Set.empty)
+  expiredBefore <- newIORef Nothing
   return
     InMemoryTimestampedKVStore
-      { imtksData = internalData
+      { imtksSegmentInterval = defaultSegmentInterval,
+        imtksData = internalData,
+        imtksDirty = dirty,
+        imtksExpiredBefore = expiredBefore
       }
 
+lookupTimestamped :: (Ord k) => Int64 -> Int64 -> k -> Map Int64 (Map Int64 (Map k v)) -> Maybe v
+lookupTimestamped interval ts k segments =
+  Map.lookup (segmentOf interval ts) segments
+    >>= Map.lookup ts
+    >>= Map.lookup k
+
 instance TimestampedKVStore InMemoryTimestampedKVStore where
-  tksGet TimestampedKey {..} InMemoryTimestampedKVStore {..} = do
-    map1 <- readIORef imtksData
-    case Map.lookup tkTimestamp map1 of
-      Just rmap2 -> do
-        map2 <- readIORef rmap2
-        return $ Map.lookup tkKey map2
-      Nothing -> return Nothing
+  tksGet TimestampedKey {..} InMemoryTimestampedKVStore {..} =
+    lookupTimestamped imtksSegmentInterval tkTimestamp tkKey <$> readIORef imtksData
 
   tksPut TimestampedKey {..} v InMemoryTimestampedKVStore {..} = do
-    map1 <- readIORef imtksData
-    case Map.lookup tkTimestamp map1 of
-      Just rmap2 -> do
-        map2 <- readIORef rmap2
-        let newMap2 = Map.insert tkKey v map2
-        writeIORef rmap2 newMap2
-      Nothing -> do
-        let map2 = Map.singleton tkKey v
-        rmap2 <- newIORef map2
-        let newMap1 = Map.insert tkTimestamp rmap2 map1
-        writeIORef imtksData newMap1
+    modifyStore imtksData $
+      Map.insertWith (Map.unionWith Map.union) (segmentOf imtksSegmentInterval tkTimestamp) $
+        Map.singleton tkTimestamp (Map.singleton tkKey v)
+    modifyStore imtksDirty (fmap (Set.insert (tkTimestamp, tkKey)))
 
+  -- all timestamps in the (inclusive) range, of the key of fromKey
   tksRange fromKey toKey InMemoryTimestampedKVStore {..} = do
-    map1 <- readIORef imtksData
-    let (_, ms, lm) = Map.splitLookup (tkTimestamp fromKey) map1
-    let (sm, ml, _) = Map.splitLookup (tkTimestamp toKey) lm
-    let r1 = do
-          r0 <- fmap (\v -> Map.insert (tkTimestamp fromKey) v sm) ms
-          fmap (\v -> Map.insert (tkTimestamp toKey) v r0) ml
-    let innerKey = tkKey fromKey
-    case r1 of
-      Just rm -> genR innerKey rm
-      Nothing -> genR innerKey sm
-    where
-      genR :: (Ord k) => k -> Map Int64 (IORef (Map k v)) -> IO [(TimestampedKey k, v)]
-      -- 需要遍历这个 map,
-      -- 找到 key 匹配的然后返回.
-      genR key dict =
-        Map.foldlWithKey'
-          ( \macc ts rmap2 -> do
-              acc <- macc
-              map2 <- readIORef rmap2
-              case Map.lookup key map2 of
-                Just v  -> return $ acc ++ [(mkTimestampedKey key ts, v)]
-                Nothing -> return acc
-          )
-          (return [])
-          dict
-  tksDump store = do
-    store <- imtksData store & readIORef
-    readIORef <$> store & sequence
-
-  tksImport store extData = do
-    extData' <- mapM newIORef extData
-    atomicWriteIORef (imtksData store) extData'
+    segments <- readIORef imtksData
+    let fromTs = tkTimestamp fromKey
+        toTs = tkTimestamp toKey
+        key = tkKey fromKey
+        candidates =
+          Map.takeWhileAntitone (<= segmentOf imtksSegmentInterval toTs) $
+            Map.dropWhileAntitone (< segmentOf imtksSegmentInterval fromTs) segments
+    return
+      [ (mkTimestampedKey key ts, v)
+        | segment <- Map.elems candidates,
+          (ts, dict) <- Map.toAscList (Map.takeWhileAntitone (<= toTs) (Map.dropWhileAntitone (< fromTs) segment)),
+          v <- maybeToList (Map.lookup key dict)
+      ]
+
+  tksDump InMemoryTimestampedKVStore {..} = Map.unions . Map.elems <$> readIORef imtksData
+
+  tksImport InMemoryTimestampedKVStore {..} extData = do
+    atomicWriteIORef imtksData $ toSegments imtksSegmentInterval extData
+    atomicWriteIORef imtksDirty Nothing
+    atomicWriteIORef imtksExpiredBefore Nothing
+
+  tksExpire expiredBefore InMemoryTimestampedKVStore {..} = do
+    let segment = segmentOf imtksSegmentInterval expiredBefore
+    modifyStore imtksData $ Map.dropWhileAntitone (< segment)
+    modifyStore imtksExpiredBefore (max (Just $ segment * imtksSegmentInterval))
+
+  tksTakeChanges InMemoryTimestampedKVStore {..} = do
+    dirty <- atomicModifyIORef' imtksDirty (\d -> (Just Set.empty, d))
+    expiredBefore <- atomicModifyIORef' imtksExpiredBefore (\e -> (Nothing, e))
+    segments <- readIORef imtksData
+    return $ case dirty of
+      Nothing ->
+        AllEntries $
+          Map.fromDistinctAscList
+            [ ((ts, k), v)
+              | segment <- Map.elems segments,
+                (ts, dict) <- Map.toAscList segment,
+                (k, v) <- Map.toAscList dict
+            ]
+      Just keys ->
+        ChangedEntries expiredBefore $
+          Map.fromSet (\(ts, k) -> lookupTimestamped imtksSegmentInterval ts k segments) keys
 
 data ETimestampedKVStore k v
   = forall s.
@@ -435,3 +511,7 @@ instance TimestampedKVStore ETimestampedKVStore where
   tksDump (ETimestampedKVStore s) = tksDump s
 
   tksImport (ETimestampedKVStore s) extData = tksImport s extData
+
+  tksExpire ts (ETimestampedKVStore s) = tksExpire ts s
+
+  tksTakeChanges (ETimestampedKVStore s) = tksTakeChanges s
@@ -0,0 +1,507 @@
+{-# LANGUAGE LambdaCase        #-}
+{-# LANGUAGE NoImplicitPrelude #-}
+{-# LANGUAGE OverloadedStrings #-}
+{-# LANGUAGE RecordWildCards   #-}
+{-# LANGUAGE StrictData        #-}
+
+-- | State stores kept in RocksDB instead of the heap.
+--
+-- All stores of a task can share one database, each store owns the keys
+-- under its own prefix. Writes are collected in a write batch which is
+-- written to the database once it is large enough (or by 'flushRocksDBHandle'),
+-- reads see the unwritten changes first. A flush and the reads of a store
+-- take the lock of the store, so a read never misses the changes being
+-- written, and the write batches are written in order. Keys are serialized by the serdes of
+-- the stores, which need not preserve the order of the keys (the JSON of the
+-- SQL values does not), so ranges over keys ('ksRange') read the whole store.
+--
+-- A store is persisted once its write batch is flushed ('flushRocksDBHandle'),
+-- so a checkpoint of the database (e.g. by the hard links of RocksDB
+-- checkpoints) only adds the files written since the previous one, instead
+-- of a dump of the whole state like the in-memory stores.
+--
+-- The timestamped and session stores expire their old entries by the time
+-- prefix of their keys, in steps of 'rsoExpiryInterval', so that the write
+-- batch is not flushed for every record.
+--
+-- Like the in-memory stores, the stores track the keys written since their
+-- changes were taken, so an incremental snapshot only reads those keys. The
+-- first changes taken from a store are all of its entries, since the
+-- database may already hold state written before.
+--
+-- Key layouts (timestamps are big-endian with the sign bit flipped, so they
+-- sort as numbers; each segment of the prefix is preceded by its length, so
+-- no prefix is the beginning of another one, e.g. "s1" of "s10", while the
+-- stores under the same first segments share them, see 'deleteRocksDBPrefix'):
+--
+-- * KV store:          prefix <> key
+-- * timestamped store: prefix <> timestamp <> key
+-- * session store:     prefix <> 0x01 <> key length <> key <> window end <> window start
+-- * session expiry:    prefix <> 0x00 <> window end <> key length <> key <> window start
+--
+-- The sessions of a key are next to each other, so 'findSessions' only reads
+-- those of the key, and the expiry entries (with empty values) index them by
+-- their window end for 'ssExpire'.
+module HStream.Processing.Store.RocksDB
+  ( RocksDBStoreOptions (..),
+    defaultRocksDBStoreOptions,
+    RocksDBHandle,
+    mkRocksDBHandle,
+    flushRocksDBHandle,
+    clearRocksDBHandle,
+    deleteRocksDBPrefix,
+    writeBatch,
+    readRange,
+    RocksDBKVStore,
+    RocksDBSessionStore,
+    RocksDBTimestampedKVStore,
+    mkRocksDBStateKVStore,
+    mkRocksDBStateSessionStore,
+    mkRocksDBStateTimestampedKVStore,
+    -- * Key encoding
+    encodeTimestamp,
+    decodeTimestamp,
+    encodeLength,
+    decodeLength,
+    encodePrefix,
+    prefixEnd,
+    sessionKeyBytes,
+    decodeSessionKey,
+  )
+where
+
+import           Data.Bits                             (shiftL, xor, (.|.))
+import qualified Data.ByteString.Builder               as BB
+import           Data.Default                          (def)
+import qualified Database.RocksDB                      as RocksDB
+import           HStream.Processing.Encoding
+import           HStream.Processing.Store
+import           HStream.Processing.Stream.TimeWindows
+import           HStream.Processing.Type
+import           RIO
+import qualified RIO.ByteString                        as BS
+import qualified RIO.ByteString.Lazy                   as BL
+import qualified RIO.Map                               as Map
+import qualified RIO.Set                               as Set
+import qualified Streamly.Data.Stream                  as S
+
+data RocksDBStoreOptions = RocksDBStoreOptions
+  { -- | Segments of the prefix of all keys of the store, unique in the
+    -- database, e.g. the query and the name of the store
+    rsoPrefix         :: [ByteString],
+    -- | Number of changes to collect before writing them to the database
+    rsoBatchSize      :: Int,
+    -- | Granularity in milliseconds of the expiry of timestamped and session
+    -- stores
+    rsoExpiryInterval :: Int64
+  }
+
+defaultRocksDBStoreOptions :: [ByteString] -> RocksDBStoreOptions
+defaultRocksDBStoreOptions prefix =
+  RocksDBStoreOptions
+    { rsoPrefix = prefix,
+      rsoBatchSize = 1024,
+      rsoExpiryInterval = 60 * 1000
+    }
+
+-- | The database and the unwritten changes (Nothing for a deletion) of a
+-- store. Keys are given to the handle without the prefix of the store.
+data RocksDBHandle = RocksDBHandle
+  { rhDB            :: RocksDB.DB,
+    rhOptions       :: RocksDBStoreOptions,
+    -- | 'rsoPrefix' encoded by 'encodePrefix'
+    rhKeyPrefix     :: ByteString,
+    rhPending       :: IORef (Map ByteString (Maybe ByteString)),
+    -- | Held while the unwritten changes are written and while they and the
+    -- database are read, see 'flushRocksDBHandle'
+    rhLock          :: MVar (),
+    -- | All entries before the time have been expired
+    rhExpiredBefore :: IORef Timestamp,
+    -- | Keys written since the changes were taken, Nothing for all keys
+    rhDirty         :: IORef (Maybe (Set ByteString)),
+    -- | Entries before the time expired since the changes were taken
+    rhExpiredSince  :: IORef (Maybe Timestamp)
+  }
+
+mkRocksDBHandle :: RocksDB.DB -> RocksDBStoreOptions -> IO RocksDBHandle
+mkRocksDBHandle db opts =
+  RocksDBHandle db opts (encodePrefix $ rsoPrefix opts)
+    <$> newIORef Map.empty
+    <*> newMVar ()
+    <*> newIORef minBound
+    <*> newIORef Nothing
+    <*> newIORef Nothing
+
+-- | Write the unwritten changes to the database in one write batch. The
+-- changes are no longer in the write batch before they are in the database,
+-- so the reads wait for the write (the sub-tasks of a task share a store,
+-- see 'runTask'), and so do other flushes, which could overtake it.
+flushRocksDBHandle :: RocksDBHandle -> IO ()
+flushRocksDBHandle RocksDBHandle {..} = withMVar rhLock $ \_ -> do
+  pending <- atomicModifyIORef' rhPending (\m -> (Map.empty, m))
+  unless (Map.null pending) $ writeBatch rhDB (Map.toList pending)
+
+-- | Put (Just) or delete (Nothing) the keys in one write batch.
+writeBatch :: RocksDB.DB -> [(ByteString, Maybe ByteString)] -> IO ()
+writeBatch db changes =
+  RocksDB.withWriteBatch $ \batch -> do
+    forM_ changes $ \case
+      (k, Just v)  -> RocksDB.batchPut batch k v
+      (k, Nothing) -> RocksDB.batchDelete batch k
+    RocksDB.write db def batch
+
+-- | All entries with keys in [from, to), or after from if to is Nothing.
+readRange :: RocksDB.DB -> ByteString -> Maybe ByteString -> IO [(ByteString, ByteString)]
+readRange db from to = S.toList $ RocksDB.range db def (Just from) to
+
+-- | Add a change to the write batch, without marking the key as changed.
+pendRaw :: RocksDBHandle -> ByteString -> Maybe ByteString -> IO ()
+pendRaw h@RocksDBHandle {..} k v = do
+  n <- atomicModifyIORef' rhPending (\m -> let m' = Map.insert (rhKeyPrefix <> k) v m in (m', Map.size m'))
+  when (n >= rsoBatchSize rhOptions) $ flushRocksDBHandle h
+
+putRaw :: RocksDBHandle -> ByteString -> Maybe ByteString -> IO ()
+putRaw h@RocksDBHandle {..} k v = do
+  atomicModifyIORef' rhDirty (\d -> (Set.insert k <$> d, ()))
+  pendRaw h k v
+
+getRaw :: RocksDBHandle -> ByteString -> IO (Maybe ByteString)
+getRaw RocksDBHandle {..} k = withMVar rhLock $ \_ -> do
+  pending <- readIORef rhPending
+  case Map.lookup (rhKeyPrefix <> k) pending of
+    Just v  -> return v
+    Nothing -> RocksDB.get rhDB def (rhKeyPrefix <> k)
+
+-- | All entries with keys in [from, to), without the prefix of the store.
+-- The unwritten changes in the range are merged into the entries read from
+-- the database, so a range does not flush the write batch.
+rangeRaw :: RocksDBHandle -> ByteString -> Maybe ByteString -> IO [(ByteString, ByteString)]
+rangeRaw RocksDBHandle {..} from to = do
+  let lower = rhKeyPrefix <> from
+      upper = maybe (prefixEnd rhKeyPrefix) (Just . (rhKeyPrefix <>)) to
+      inRange k = k >= lower && maybe True (k <) upper
+  (pending, entries) <- withMVar rhLock $ \_ ->
+    (,) <$> (Map.filterWithKey (\k _ -> inRange k) <$> readIORef rhPending)
+        <*> readRange rhDB lower upper
+  return . map (first (BS.drop (BS.length rhKeyPrefix))) . Map.toAscList . Map.mapMaybe id $
+    Map.union pending (Map.fromDistinctAscList (map (second Just) entries))
+
+-- | Remove all keys of the store.
+clearRocksDBHandle :: RocksDBHandle -> IO ()
+clearRocksDBHandle h@RocksDBHandle {..} = do
+  entries <- rangeRaw h "" Nothing
+  mapM_ (\(k, _) -> pendRaw h k Nothing) entries
+  flushRocksDBHandle h
+  atomicWriteIORef rhDirty Nothing
+
+-- | Remove the keys of all stores whose prefixes start with the segments,
+-- e.g. of all stores of a deleted query. The stores must not be in use.
+deleteRocksDBPrefix :: RocksDB.DB -> [ByteString] -> IO ()
+deleteRocksDBPrefix db segments = do
+  let prefix = encodePrefix segments
+  entries <- readRange db prefix (prefixEnd prefix)
+  go $ map (\(k, _) -> (k, Nothing)) entries
+  where
+    go [] = return ()
+    go changes = do
+      let (batch, rest) = splitAt 1024 changes
+      writeBatch db batch
+      go rest
+
+-- | Replace all keys of the store, the next changes taken are all entries.
+importRaw :: RocksDBHandle -> [(ByteString, ByteString)] -> IO ()
+importRaw h@RocksDBHandle {..} entries = do
+  clearRocksDBHandle h
+  mapM_ (\(k, v) -> pendRaw h k (Just v)) entries
+  flushRocksDBHandle h
+
+-- | Remove the keys of a store which follow the sub-prefix with a timestamp
+-- before the time, rounded down to the expiry interval, together with the
+-- other keys of their entries (given by the keys themselves).
+expireRaw :: RocksDBHandle -> ByteString -> (ByteString -> [ByteString]) -> Timestamp -> IO ()
+expireRaw h@RocksDBHandle {..} sub keysOf expiredBefore = do
+  let interval = rsoExpiryInterval rhOptions
+      bound = expiredBefore `div` interval * interval
+  advanced <- atomicModifyIORef' rhExpiredBefore (\old -> (max old bound, bound > old))
+  when advanced $ do
+    entries <- rangeRaw h sub (Just $ sub <> encodeTimestamp bound)
+    -- a snapshot drops the expired range as a whole, so the keys are not
+    -- marked as changed
+    mapM_ (\(k, _) -> mapM_ (\k' -> pendRaw h k' Nothing) (keysOf k)) entries
+    atomicModifyIORef' rhExpiredSince (\e -> (max e (Just bound), ()))
+
+-- | The changes since they were taken the last time, by the keys without
+-- the prefix. All entries are those of the keys under the sub-prefix, the
+-- changed ones are the keys given to 'putRaw'. The keys are taken before
+-- the values are read, so a write racing with the take is in these changes
+-- or in the next ones.
+takeChangesRaw :: RocksDBHandle -> ByteString -> IO (StoreChanges ByteString ByteString)
+takeChangesRaw h@RocksDBHandle {..} sub = do
+  dirty <- atomicModifyIORef' rhDirty (\d -> (Just Set.empty, d))
+  expiredSince <- atomicModifyIORef' rhExpiredSince (\e -> (Nothing, e))
+  case dirty of
+    Nothing -> AllEntries . Map.fromList <$> rangeRaw h sub (prefixEnd sub)
+    Just keys -> do
+      values <- mapM (getRaw h) (Set.toAscList keys)
+      return . ChangedEntries expiredSince $
+        Map.fromDistinctAscList (zip (Set.toAscList keys) values)
+
+-- | The changes of a store with its keys and values decoded.
+mapChanges :: Ord key => (ByteString -> key) -> (ByteString -> v) -> StoreChanges ByteString ByteString -> StoreChanges key v
+mapChanges decodeKey decodeValue = \case
+  AllEntries entries ->
+    AllEntries . Map.fromList $ map (bimap decodeKey decodeValue) (Map.toList entries)
+  ChangedEntries expiredSince entries ->
+    ChangedEntries expiredSince . Map.fromList $ map (bimap decodeKey (fmap decodeValue)) (Map.toList entries)
+
+-- | The prefix of the keys of the stores whose prefixes start with the
+-- segments, each of them preceded by its length.
+encodePrefix :: [ByteString] -> ByteString
+encodePrefix = foldMap (\segment -> encodeLength (BS.length segment) <> segment)
+
+-- | The least key greater than all keys with the prefix.
+prefixEnd :: ByteString -> Maybe ByteString
+prefixEnd prefix =
+  let stripped = BS.dropWhileEnd (== 0xff) prefix
+   in if BS.null stripped
+        then Nothing
+        else Just $ BS.snoc (BS.init stripped) (BS.last stripped + 1)
+
+encodeTimestamp :: Timestamp -> ByteString
+encodeTimestamp ts =
+  BL.toStrict . BB.toLazyByteString . BB.word64BE $ fromIntegral ts `xor` 0x8000000000000000
+
+decodeTimestamp :: ByteString -> Timestamp
+decodeTimestamp bs =
+  fromIntegral $ BS.foldl' (\acc w -> acc `shiftL` 8 .|. fromIntegral w) (0 :: Word64) bs `xor` 0x8000000000000000
+
+encodeLength :: Int -> ByteString
+encodeLength = BL.toStrict . BB.toLazyByteString . BB.word32BE . fromIntegral
+
+decodeLength :: ByteString -> Int
+decodeLength = BS.foldl' (\acc w -> acc `shiftL` 8 .|. fromIntegral w) 0
+
+ser :: Serde a BL.ByteString -> a -> ByteString
+ser serde = BL.toStrict . runSer (serializer serde)
+
+deser :: Serde a BL.ByteString -> ByteString -> a
+deser serde = runDeser (deserializer serde) . BL.fromStrict
+
+--------------------------------------------------------------------------------
+
+data RocksDBKVStore k v = RocksDBKVStore
+  { rksHandle     :: RocksDBHandle,
+    rksKeySerde   :: Serde k BL.ByteString,
+    rksValueSerde :: Serde v BL.ByteString
+  }
+
+instance KVStore RocksDBKVStore where
+  ksGet k RocksDBKVStore {..} =
+    fmap (deser rksValueSerde)
+      <$> getRaw rksHandle (ser rksKeySerde k)
+
+  ksPut k v RocksDBKVStore {..} =
+    putRaw rksHandle (ser rksKeySerde k) (Just $ ser rksValueSerde v)
+
+  ksRange fromKey toKey RocksDBKVStore {..} = do
+    -- the range is inclusive, like the in-memory store, and of the keys
+    -- rather than of their serialized bytes, which may be in another order
+    entries <- rangeRaw rksHandle "" Nothing
+    return . Map.toAscList . Map.filterWithKey (\k _ -> k >= fromKey && k <= toKey) . Map.fromList $
+      map (\(k, v) -> (deser rksKeySerde k, deser rksValueSerde v)) entries
+
+  ksDump RocksDBKVStore {..} = do
+    entries <- rangeRaw rksHandle "" Nothing
+    return . Map.fromList $ map (\(k, v) -> (deser rksKeySerde k, deser rksValueSerde v)) entries
+
+  ksImport RocksDBKVStore {..} extData =
+    importRaw rksHandle [(ser rksKeySerde k, ser rksValueSerde v) | (k, v) <- Map.toList extData]
+
+  ksTakeChanges RocksDBKVStore {..} =
+    mapChanges (deser rksKeySerde) (deser rksValueSerde) <$> takeChangesRaw rksHandle ""
+
+--------------------------------------------------------------------------------
+
+data RocksDBTimestampedKVStore k v = RocksDBTimestampedKVStore
+  { rtksHandle     :: RocksDBHandle,
+    rtksKeySerde   :: Serde k BL.ByteString,
+    rtksValueSerde :: Serde v BL.ByteString
+  }
+
+timestampedKeyBytes :: RocksDBTimestampedKVStore k v -> TimestampedKey k -> ByteString
+timestampedKeyBytes RocksDBTimestampedKVStore {..} TimestampedKey {..} =
+  encodeTimestamp tkTimestamp <> ser rtksKeySerde tkKey
+
+-- | (timestamp, key) of a timestamped key without the prefix.
+decodeTimestampedKey :: ByteString -> (Timestamp, ByteString)
+decodeTimestampedKey bs =
+  let (tsBytes, keyBytes) = BS.splitAt 8 bs
+   in (decodeTimestamp tsBytes, keyBytes)
+
+instance TimestampedKVStore RocksDBTimestampedKVStore where
+  tksGet k store@RocksDBTimestampedKVStore {..} =
+    fmap (deser rtksValueSerde) <$> getRaw rtksHandle (timestampedKeyBytes store k)
+
+  tksPut k v store@RocksDBTimestampedKVStore {..} =
+    putRaw rtksHandle (timestampedKeyBytes store k) (Just $ ser rtksValueSerde v)
+
+  -- all timestamps in the (inclusive) range, of the key of fromKey
+  tksRange fromKey toKey RocksDBTimestampedKVStore {..} = do
+    entries <- rangeRaw rtksHandle (encodeTimestamp (tkTimestamp fromKey))
+                                   (prefixEnd (encodeTimestamp (tkTimestamp toKey)))
+    let keyBytes = ser rtksKeySerde (tkKey fromKey)
+    return
+      [ (mkTimestampedKey (tkKey fromKey) ts, deser rtksValueSerde v)
+        | (k, v) <- entries,
+          let (ts, rest) = decodeTimestampedKey k,
+          rest == keyBytes
+      ]
+
+  tksDump RocksDBTimestampedKVStore {..} = do
+    entries <- rangeRaw rtksHandle "" Nothing
+    return $
+      Map.fromListWith Map.union
+        [ (ts, Map.singleton (deser rtksKeySerde rest) (deser rtksValueSerde v))
+          | (k, v) <- entries,
+            let (ts, rest) = decodeTimestampedKey k
+        ]
+
+  tksImport store@RocksDBTimestampedKVStore {..} extData =
+    importRaw rtksHandle
+      [ (timestampedKeyBytes store (mkTimestampedKey k ts), ser rtksValueSerde v)
+        | (ts, kvs) <- Map.toList extData,
+          (k, v) <- Map.toList kvs
+      ]
+
+  tksExpire expiredBefore RocksDBTimestampedKVStore {..} = expireRaw rtksHandle "" pure expiredBefore
+
+  tksTakeChanges RocksDBTimestampedKVStore {..} =
+    mapChanges (fmap (deser rtksKeySerde) . decodeTimestampedKey) (deser rtksValueSerde)
+      <$> takeChangesRaw rtksHandle ""
+
+--------------------------------------------------------------------------------
+
+data RocksDBSessionStore k v = RocksDBSessionStore
+  { rssHandle     :: RocksDBHandle,
+    rssKeySerde   :: Serde k BL.ByteString,
+    rssValueSerde :: Serde v BL.ByteString
+  }
+
+sessionTag, expiryTag :: ByteString
+sessionTag = BS.singleton 0x01
+expiryTag = BS.singleton 0x00
+
+-- | The serialized key with its length before it.
+framedKey :: ByteString -> ByteString
+framedKey keyBytes = encodeLength (BS.length keyBytes) <> keyBytes
+
+-- | Key of a session (without the prefix) by the serialized key and window.
+sessionKeyBytes :: ByteString -> TimeWindow -> ByteString
+sessionKeyBytes keyBytes TimeWindow {..} =
+  sessionTag <> framedKey keyBytes <> encodeTimestamp tWindowEnd <> encodeTimestamp tWindowStart
+
+-- | Key of the expiry entry of a session, see 'sessionKeyBytes'.
+expiryKeyBytes :: ByteString -> TimeWindow -> ByteString
+expiryKeyBytes keyBytes TimeWindow {..} =
+  expiryTag <> encodeTimestamp tWindowEnd <> framedKey keyBytes <> encodeTimestamp tWindowStart
+
+-- | (window end, key, window start) of a session key without the prefix.
+decodeSessionKey :: ByteString -> (Timestamp, ByteString, Timestamp)
+decodeSessionKey bs =
+  let (lenBytes, rest0) = BS.splitAt 4 (BS.drop 1 bs)
+      (keyBytes, rest1) = BS.splitAt (decodeLength lenBytes) rest0
+      (endBytes, startBytes) = BS.splitAt 8 rest1
+   in (decodeTimestamp endBytes, keyBytes, decodeTimestamp startBytes)
+
+-- | (window end, key, window start) of an expiry key without the prefix.
+decodeExpiryKey :: ByteString -> (Timestamp, ByteString, Timestamp)
+decodeExpiryKey bs =
+  let (endBytes, rest0) = BS.splitAt 8 (BS.drop 1 bs)
+      (lenBytes, rest1) = BS.splitAt 4 rest0
+      (keyBytes, startBytes) = BS.splitAt (decodeLength lenBytes) rest1
+   in (decodeTimestamp endBytes, keyBytes, decodeTimestamp startBytes)
+
+-- | Put (Just) or remove (Nothing) a session and its expiry entry.
+putSession :: RocksDBSessionStore k v -> k -> TimeWindow -> Maybe ByteString -> IO ()
+putSession RocksDBSessionStore {..} k window v = do
+  let keyBytes = ser rssKeySerde k
+  putRaw rssHandle (sessionKeyBytes keyBytes window) v
+  pendRaw rssHandle (expiryKeyBytes keyBytes window) ("" <$ v)
+
+instance SessionStore RocksDBSessionStore where
+  ssGet TimeWindowKey {..} RocksDBSessionStore {..} =
+    fmap (deser rssValueSerde) <$> getRaw rssHandle (sessionKeyBytes (ser rssKeySerde twkKey) twkWindow)
+
+  ssPut TimeWindowKey {..} v store@RocksDBSessionStore {..} =
+    putSession store twkKey twkWindow (Just $ ser rssValueSerde v)
+
+  ssRemove TimeWindowKey {..} store =
+    putSession store twkKey twkWindow Nothing
+
+  ssDump RocksDBSessionStore {..} = do
+    entries <- rangeRaw rssHandle sessionTag (prefixEnd sessionTag)
+    return $
+      Map.fromListWith (Map.unionWith Map.union)
+        [ (we, Map.singleton (deser rssKeySerde keyBytes) (Map.singleton ws (deser rssValueSerde v)))
+          | (k, v) <- entries,
+            let (we, keyBytes, ws) = decodeSessionKey k
+        ]
+
+  ssImport RocksDBSessionStore {..} extData =
+    importRaw rssHandle $
+      concat
+        [ [(sessionKeyBytes keyBytes window, ser rssValueSerde v), (expiryKeyBytes keyBytes window, "")]
+          | (we, kvs) <- Map.toList extData,
+            (k, sessions) <- Map.toList kvs,
+            let keyBytes = ser rssKeySerde k,
+            (ws, v) <- Map.toList sessions,
+            let window = mkTimeWindow ws we
+        ]
+
+  ssExpire expiredBefore RocksDBSessionStore {..} =
+    expireRaw rssHandle expiryTag keysOf expiredBefore
+    where
+      keysOf k =
+        let (we, keyBytes, ws) = decodeExpiryKey k
+         in [k, sessionKeyBytes keyBytes (mkTimeWindow ws we)]
+
+  ssTakeChanges RocksDBSessionStore {..} =
+    mapChanges (\k -> let (we, keyBytes, ws) = decodeSessionKey k in (we, deser rssKeySerde keyBytes, ws)) (deser rssValueSerde)
+      <$> takeChangesRaw rssHandle sessionTag
+
+  -- the sessions of the key by their window end, from the earliest one
+  findSessions key earliestSessionEndTime latestSessionStartTime RocksDBSessionStore {..} = do
+    let keyPrefix = sessionTag <> framedKey (ser rssKeySerde key)
+    entries <- rangeRaw rssHandle (keyPrefix <> encodeTimestamp earliestSessionEndTime) (prefixEnd keyPrefix)
+    return
+      [ (mkTimeWindowKey key (mkTimeWindow ws we), deser rssValueSerde v)
+        | (k, v) <- entries,
+          let (we, _, ws) = decodeSessionKey k,
+          ws <= latestSessionStartTime
+      ]
+
+--------------------------------------------------------------------------------
+
+mkRocksDBStateKVStore ::
+  RocksDBHandle ->
+  Serde k BL.ByteString ->
+  Serde v BL.ByteString ->
+  IO (StateStore k v)
+mkRocksDBStateKVStore h keySerde valueSerde =
+  return $ KVStateStore $ EKVStore $ RocksDBKVStore h keySerde valueSerde
+
+mkRocksDBStateSessionStore ::
+  RocksDBHandle ->
+  Serde k BL.ByteString ->
+  Serde v BL.ByteString ->
+  IO (StateStore k v)
+mkRocksDBStateSessionStore h keySerde valueSerde =
+  return $ SessionStateStore $ ESessionStore $ RocksDBSessionStore h keySerde valueSerde
+
+mkRocksDBStateTimestampedKVStore ::
+  RocksDBHandle ->
+  Serde k BL.ByteString ->
+  Serde v BL.ByteString ->
+  IO (StateStore k v)
+mkRocksDBStateTimestampedKVStore h keySerde valueSerde =
+  return $ TimestampedKVStateStore $ ETimestampedKVStore $ RocksDBTimestampedKVStore h keySerde valueSerde
@@ -12,7 +12,9 @@ module HStream.Processing.Stream
     HStream.Processing.Stream.build,
     HStream.Processing.Stream.to,
     HStream.Processing.Stream.filter,
+    HStream.Processing.Stream.filterBatch,
     HStream.Processing.Stream.map,
+    HStream.Processing.Stream.mapBatch,
     HStream.Processing.Stream.groupBy,
     HStream.Processing.Stream.joinStream,
     HStream.Processing.Stream.joinTable,
@@ -28,6 +30,9 @@ where
 
 import qualified Data.Aeson                              as Aeson
 import           Data.Maybe
+import           Data.Proxy                              (Proxy (..))
+import qualified Data.Vector                             as V
+import qualified Data.Vector.Unboxed                     as VU
 import           HStream.Processing.Encoding
 import           HStream.Processing.Processor
 import           HStream.Processing.Processor.ChangeLog
@@ -176,6 +181,26 @@ filterProcessor ::
 filterProcessor f = Processor $ \r ->
   when (f r) $ forward r
 
+-- | Like 'filter', but the predicate is evaluated over a batch of records
+-- at a time and returns the selection vector of the batch: the positions of
+-- the records which pass, in ascending order.
+filterBatch ::
+  (Typeable k, Typeable v) =>
+  (V.Vector (Record k v) -> VU.Vector Int) ->
+  Stream k v s ->
+  IO (Stream k v s)
+filterBatch f s@Stream {..} = do
+  name <- mkInternalProcessorName "FILTER-" streamInternalBuilder
+  let p = filterProcessor (not . VU.null . f . V.singleton)
+  let bp = BatchProcessor $ \recordGuard records ->
+        forwardBatch recordGuard $ V.backpermute records (V.convert $ f records)
+  let newBuilder = addBatchProcessorInternal name p bp [streamProcessorName] streamInternalBuilder
+  return
+    s
+      { streamInternalBuilder = newBuilder,
+        streamProcessorName = name
+      }
+
 mapProcessor ::
   (Typeable k1, Typeable v1, Typeable k2, Typeable v2) =>
   (Record k1 v1 -> Record k2 v2) ->
@@ -199,15 +224,40 @@ map f s@Stream {..} = do
         streamValueSerde = Nothing
       }
 
+-- | Like 'map', but the function maps a batch of records at a time and
+-- returns the same number of records.
+mapBatch ::
+  (Typeable k1, Typeable v1, Typeable k2, Typeable v2) =>
+  (V.Vector (Record k1 v1) -> V.Vector (Record k2 v2)) ->
+  Stream k1 v1 s ->
+  IO (Stream k2 v2 s)
+mapBatch f s@Stream {..} = do
+  name <- mkInternalProcessorName "MAP-" streamInternalBuilder
+  let p = mapProcessor (V.head . f . V.singleton)
+  let bp = BatchProcessor $ \recordGuard records -> forwardBatch recordGuard (f records)
+  let newBuilder = addBatchProcessorInternal name p bp [streamProcessorName] streamInternalBuilder
+  return
+    s
+      { streamInternalBuilder = newBuilder,
+        streamProcessorName = name,
+        streamKeySerde = Nothing,
+        streamValueSerde = Nothing
+      }
+
+-- | The records are rekeyed and then exchanged by the hash of their new
+-- keys, so the aggregations after a groupBy can run on several sub-tasks
+-- (see 'runTask').
 groupBy ::
-  (Typeable k1, Typeable v1, Typeable k2) =>
+  (Typeable k1, Typeable v1, Typeable k2, Hashable k2) =>
   (Record k1 v1 -> k2) ->
   Stream k1 v1 s ->
   IO (GroupedStream k2 v1 s)
 groupBy f Stream {..} = do
   name <- mkInternalProcessorName "GROUP-BY-" streamInternalBuilder
   let p = mapProcessor (\r -> r {recordKey = Just $ f r})
-  let newBuilder = addProcessorInternal name p [streamProcessorName] streamInternalBuilder
+  let newBuilder =
+        addExchangeInternal name (groupedProxy f) $
+          addProcessorInternal name p [streamProcessorName] streamInternalBuilder
   return
     GroupedStream
       { gsInternalBuilder = newBuilder,
@@ -216,6 +266,9 @@ groupBy f Stream {..} = do
         gsValueSerde = Nothing
       }
 
+groupedProxy :: (Record k1 v1 -> k2) -> Proxy (Record k2 v1)
+groupedProxy _ = Proxy
+
 data StreamJoined k1 v1 k2 v2 s = StreamJoined
   { sjK1Serde    :: Serde k1 s,
     sjV1Serde    :: Serde v1 s,
@@ -243,8 +296,8 @@ joinStream otherStream joiner joinCond newKeySelector JoinWindows {..} StreamJoi
   let otherJoinStoreName = mkInternalStoreName otherJoinProcessorName
   -- ts1 - beforeMs <= ts2 <= ts1 + afterMs
   -- ts2 - afterMs <= ts1 <= ts2 + beforeMs
-  let thisJoinProcessor = joinStreamProcessor joiner joinCond newKeySelector jwBeforeMs jwAfterMs thisJoinStoreName otherJoinStoreName sjK1Serde sjV1Serde sjK2Serde sjV2Serde
-  let otherJoinProcessor = joinStreamProcessor (flip joiner) (flip joinCond) (flip newKeySelector) jwAfterMs jwBeforeMs otherJoinStoreName thisJoinStoreName sjK2Serde sjV2Serde sjK1Serde sjV1Serde
+  let thisJoinProcessor = joinStreamProcessor joiner joinCond newKeySelector jwBeforeMs jwAfterMs jwGraceMs thisJoinStoreName otherJoinStoreName sjK1Serde sjV1Serde sjK2Serde sjV2Serde
+  let otherJoinProcessor = joinStreamProcessor (flip joiner) (flip joinCond) (flip newKeySelector) jwAfterMs jwBeforeMs jwGraceMs otherJoinStoreName thisJoinStoreName sjK2Serde sjV2Serde sjK1Serde sjV1Serde
   mergeProcessorName <- mkInternalProcessorName "PASSTHROUGH-" mergedStreamBuilder
   let mergeProcessor = passThroughProcessor thisStream joiner
   let newTaskBuilder =
@@ -277,6 +330,7 @@ joinStreamProcessor ::
   (Record k1 v1 -> Record k2 v2 -> k3) ->
   Int64 ->
   Int64 ->
+  Int64 ->
   Text ->
   Text ->
   Serde k1 s ->
@@ -284,32 +338,40 @@ joinStreamProcessor ::
   Serde k2 s ->
   Serde v2 s ->
   Processor k1 v1
-joinStreamProcessor joiner joinCond newKeySelector beforeMs afterMs storeName1 storeName2 k1Serde v1Serde k2Serde v2Serde = Processor $ \r1@Record {..} -> do
-  TaskContext{..} <- ask
-  store1 <- getTimestampedKVStateStore storeName1
-  let k1 = fromJust recordKey
-  let k1Bytes = runSer (serializer k1Serde) k1
-  let v1Bytes = runSer (serializer v1Serde) recordValue
-  liftIO $ tksPut (mkTimestampedKey k1Bytes recordTimestamp) v1Bytes store1
-  let changeLog = CLTKSPut @() @() storeName1 (mkTimestampedKey k1Bytes recordTimestamp) v1Bytes
-  liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
-  store2 <- getTimestampedKVStateStore storeName2
-  candinates <- liftIO $ tksRange (mkTimestampedKey k1Bytes $ recordTimestamp - beforeMs) (mkTimestampedKey k1Bytes $ recordTimestamp + afterMs) store2
-  curProcessorName <- liftIO $ readIORef curProcessor
-  forM_
-    candinates
-    ( \(timestampedKey, v2Bytes) -> do
-        let k2 = runDeser (deserializer k2Serde) (tkKey timestampedKey)
-        let v2 = runDeser (deserializer v2Serde) v2Bytes
-        let ts2 = tkTimestamp timestampedKey
-        let r1' = r1
-        let r2' = Record {recordKey = Just k2, recordValue = v2, recordTimestamp = ts2}
-        when (joinCond r1' r2') $ do
-          let v3 = joiner recordValue v2
-              jk3 = newKeySelector r1' r2'
-          liftIO $ writeIORef curProcessor curProcessorName -- Note: return to parent node
-          forward $ Record {recordKey = Just jk3, recordValue = v3, recordTimestamp = max recordTimestamp ts2}
-    )
+joinStreamProcessor joiner joinCond newKeySelector beforeMs afterMs graceMs storeName1 storeName2 k1Serde v1Serde k2Serde v2Serde = Processor $ \r1@Record {..} -> do
+  ctx@TaskContext{..} <- ask
+  observedStreamTime <- liftIO $ getTimestampInTaskContext ctx
+  if recordTimestamp < observedStreamTime - graceMs
+    then logWarn "Skipping record later than the grace period."
+    else do
+      store1 <- getTimestampedKVStateStore storeName1
+      let k1 = fromJust recordKey
+      let k1Bytes = runSer (serializer k1Serde) k1
+      let v1Bytes = runSer (serializer v1Serde) recordValue
+      liftIO $ tksPut (mkTimestampedKey k1Bytes recordTimestamp) v1Bytes store1
+      let changeLog = CLTKSPut @() @() storeName1 (mkTimestampedKey k1Bytes recordTimestamp) v1Bytes
+      liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
+      store2 <- getTimestampedKVStateStore storeName2
+      -- Records of this side older than the grace period before the stream
+      -- time are dropped above, so none of them can join the other side
+      -- earlier than beforeMs before that.
+      liftIO $ tksExpire (observedStreamTime - graceMs - beforeMs) store2
+      candinates <- liftIO $ tksRange (mkTimestampedKey k1Bytes $ recordTimestamp - beforeMs) (mkTimestampedKey k1Bytes $ recordTimestamp + afterMs) store2
+      curProcessorName <- liftIO $ readIORef curProcessor
+      forM_
+        candinates
+        ( \(timestampedKey, v2Bytes) -> do
+            let k2 = runDeser (deserializer k2Serde) (tkKey timestampedKey)
+            let v2 = runDeser (deserializer v2Serde) v2Bytes
+            let ts2 = tkTimestamp timestampedKey
+            let r1' = r1
+            let r2' = Record {recordKey = Just k2, recordValue = v2, recordTimestamp = ts2}
+            when (joinCond r1' r2') $ do
+              let v3 = joiner recordValue v2
+                  jk3 = newKeySelector r1' r2'
+              liftIO $ writeIORef curProcessor curProcessorName -- Note: return to parent node
+              forward $ Record {recordKey = Just jk3, recordValue = v3, recordTimestamp = max recordTimestamp ts2}
+        )
 
 joinTable ::
   (Typeable k, Typeable v1, Typeable v2, Typeable v3, Typeable s, Ord s) =>
@@ -12,12 +12,15 @@ module HStream.Processing.Stream.Internal
     mkInternalStoreName,
     addSourceInternal,
     addProcessorInternal,
+    addBatchProcessorInternal,
+    addExchangeInternal,
     addSinkInternal,
     addStateStoreInternal,
     mergeInternalStreamBuilder,
   )
 where
 
+import           Data.Proxy                   (Proxy)
 import           HStream.Processing.Encoding
 import           HStream.Processing.Processor
 import           HStream.Processing.Store
@@ -88,6 +91,28 @@ addProcessorInternal processorName processor parents builder@InternalStreamBuild
   let taskBuilder = isbTaskBuilder <> addProcessor processorName processor parents
    in builder {isbTaskBuilder = taskBuilder}
 
+addBatchProcessorInternal ::
+  (Typeable k, Typeable v) =>
+  T.Text ->
+  Processor k v ->
+  BatchProcessor k v ->
+  [T.Text] ->
+  InternalStreamBuilder ->
+  InternalStreamBuilder
+addBatchProcessorInternal processorName processor batchProcessor parents builder@InternalStreamBuilder {..} =
+  let taskBuilder = isbTaskBuilder <> addBatchProcessor processorName processor batchProcessor parents
+   in builder {isbTaskBuilder = taskBuilder}
+
+addExchangeInternal ::
+  (Typeable k, Typeable v, Hashable k) =>
+  T.Text ->
+  Proxy (Record k v) ->
+  InternalStreamBuilder ->
+  InternalStreamBuilder
+addExchangeInternal processorName proxy builder@InternalStreamBuilder {..} =
+  let taskBuilder = isbTaskBuilder <> addExchange processorName proxy
+   in builder {isbTaskBuilder = taskBuilder}
+
 addSinkInternal ::
   (Typeable k, Typeable v, Typeable s) =>
   SinkConfig k v s ->
@@ -5,13 +5,25 @@
 
 module HStream.Processing.Stream.JoinWindows
   ( JoinWindows (..),
+    mkJoinWindows,
   )
 where
 
 import           RIO
 
+-- | Records more than the grace period older than the stream time are
+-- dropped, so the records of the other side older than that minus
+-- 'jwBeforeMs' can be expired.
 data JoinWindows = JoinWindows
   { jwBeforeMs :: Int64,
     jwAfterMs  :: Int64,
     jwGraceMs  :: Int64
   }
+
+mkJoinWindows :: Int64 -> Int64 -> JoinWindows
+mkJoinWindows beforeMs afterMs =
+  JoinWindows
+    { jwBeforeMs = beforeMs,
+      jwAfterMs = afterMs,
+      jwGraceMs = 24 * 3600 * 1000
+    }
@@ -91,48 +91,56 @@ aggregateProcessor ::
   SessionWindows ->
   Processor k v
 aggregateProcessor storeName initialValue aggF sessionMergeF outputF keySerde accSerde SessionWindows {..} = Processor $ \r@Record {..} -> do
-  TaskContext{..} <- ask
-  store <- getSessionStateStore storeName
-  logDebug $ "recordTimestamp: " <> displayShow recordTimestamp
-  let rk = fromJust recordKey
-  let rkBytes = runSer (serializer keySerde) rk
-  overlappedSessions <- liftIO $ findSessions rkBytes (recordTimestamp - swInactivityGap) (recordTimestamp + swInactivityGap) store
-  logDebug $ "overlappedSessions: " <> displayShow (length overlappedSessions)
-  if null overlappedSessions
-    then do
-      let newSession = mkTimeWindowKey rkBytes (mkTimeWindow recordTimestamp recordTimestamp)
-      let newAcc = aggF initialValue r
-      let newAccBytes = runSer (serializer accSerde) newAcc
-      liftIO $ ssPut newSession newAccBytes store
-      let changeLog = CLSSPut @_ @_ @BL.ByteString storeName newSession newAccBytes
-      liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
-      -- Erase key info because we may meet further joins and
-      -- joining relies on'same key' to work.
-      forward r {recordKey = Just (def `asTypeOf` newSession), recordValue = outputF newAcc rk}
+  ctx@TaskContext{..} <- ask
+  observedStreamTime <- liftIO $ getTimestampInTaskContext ctx
+  if recordTimestamp < observedStreamTime - swGraceMs
+    then logWarn "Skipping record later than the grace period."
     else do
-      (mergedWindowKey, mergedAccBytes) <-
-        foldM
-          ( \(mergedWindowKey, accValueBytes) (curWindowKey, curValueBytes) -> do
-              logDebug $ "mergedSessionWindow: " <> displayShow (twkWindow mergedWindowKey)
-              logDebug $ "curSessionWindow: " <> displayShow (twkWindow curWindowKey)
-              let newStartTime = min (tWindowStart $ twkWindow mergedWindowKey) (tWindowStart $ twkWindow curWindowKey)
-              let newEndTime = max (tWindowEnd $ twkWindow mergedWindowKey) (tWindowEnd $ twkWindow curWindowKey)
-              let newWindowKey = mergedWindowKey {twkWindow = mkTimeWindow newStartTime newEndTime}
-              let accValue = runDeser (deserializer accSerde) accValueBytes
-              let curValue = runDeser (deserializer accSerde) curValueBytes
-              let newValue = sessionMergeF rk accValue curValue
-              liftIO $ ssRemove curWindowKey store
-              let changeLog = CLSSRemove @_ @() @BL.ByteString storeName curWindowKey
-              liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
-              logDebug $ "removed session window: " <> displayShow (twkWindow curWindowKey)
-              return (newWindowKey, runSer (serializer accSerde) newValue)
-          )
-          (mkTimeWindowKey rkBytes (mkTimeWindow recordTimestamp recordTimestamp), runSer (serializer accSerde) (aggF initialValue r))
-          overlappedSessions
-      liftIO $ ssPut mergedWindowKey mergedAccBytes store
-      let changeLog = CLSSPut @_ @_ @BL.ByteString storeName mergedWindowKey mergedAccBytes
-      liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
-      logDebug $ "last merged session window: " <> displayShow (twkWindow mergedWindowKey)
-      -- Erase key info because we may meet further joins and
-      -- joining relies on'same key' to work.
-      forward r {recordKey = Just (def `asTypeOf` mergedWindowKey), recordValue = outputF (runDeser (deserializer accSerde) mergedAccBytes) rk}
+      store <- getSessionStateStore storeName
+      -- Records older than the grace period before the stream time are
+      -- dropped above, so a session which ended more than the gap before
+      -- that can not be merged any more.
+      liftIO $ ssExpire (observedStreamTime - swInactivityGap - swGraceMs) store
+      logDebug $ "recordTimestamp: " <> displayShow recordTimestamp
+      let rk = fromJust recordKey
+      let rkBytes = runSer (serializer keySerde) rk
+      overlappedSessions <- liftIO $ findSessions rkBytes (recordTimestamp - swInactivityGap) (recordTimestamp + swInactivityGap) store
+      logDebug $ "overlappedSessions: " <> displayShow (length overlappedSessions)
+      if null overlappedSessions
+        then do
+          let newSession = mkTimeWindowKey rkBytes (mkTimeWindow recordTimestamp recordTimestamp)
+          let newAcc = aggF initialValue r
+          let newAccBytes = runSer (serializer accSerde) newAcc
+          liftIO $ ssPut newSession newAccBytes store
+          let changeLog = CLSSPut @_ @_ @BL.ByteString storeName newSession newAccBytes
+          liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
+          -- Erase key info because we may meet further joins and
+          -- joining relies on'same key' to work.
+          forward r {recordKey = Just (def `asTypeOf` newSession), recordValue = outputF newAcc rk}
+        else do
+          (mergedWindowKey, mergedAccBytes) <-
+            foldM
+              ( \(mergedWindowKey, accValueBytes) (curWindowKey, curValueBytes) -> do
+                  logDebug $ "mergedSessionWindow: " <> displayShow (twkWindow mergedWindowKey)
+                  logDebug $ "curSessionWindow: " <> displayShow (twkWindow curWindowKey)
+                  let newStartTime = min (tWindowStart $ twkWindow mergedWindowKey) (tWindowStart $ twkWindow curWindowKey)
+                  let newEndTime = max (tWindowEnd $ twkWindow mergedWindowKey) (tWindowEnd $ twkWindow curWindowKey)
+                  let newWindowKey = mergedWindowKey {twkWindow = mkTimeWindow newStartTime newEndTime}
+                  let accValue = runDeser (deserializer accSerde) accValueBytes
+                  let curValue = runDeser (deserializer accSerde) curValueBytes
+                  let newValue = sessionMergeF rk accValue curValue
+                  liftIO $ ssRemove curWindowKey store
+                  let changeLog = CLSSRemove @_ @() @BL.ByteString storeName curWindowKey
+                  liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
+                  logDebug $ "removed session window: " <> displayShow (twkWindow curWindowKey)
+                  return (newWindowKey, runSer (serializer accSerde) newValue)
+              )
+              (mkTimeWindowKey rkBytes (mkTimeWindow recordTimestamp recordTimestamp), runSer (serializer accSerde) (aggF initialValue r))
+              overlappedSessions
+          liftIO $ ssPut mergedWindowKey mergedAccBytes store
+          let changeLog = CLSSPut @_ @_ @BL.ByteString storeName mergedWindowKey mergedAccBytes
+          liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
+          logDebug $ "last merged session window: " <> displayShow (twkWindow mergedWindowKey)
+          -- Erase key info because we may meet further joins and
+          -- joining relies on'same key' to work.
+          forward r {recordKey = Just (def `asTypeOf` mergedWindowKey), recordValue = outputF (runDeser (deserializer accSerde) mergedAccBytes) rk}
@@ -88,24 +88,27 @@ aggregateProcessor ::
   Processor k v
 aggregateProcessor storeName initialValue aggF outputF keySerde accSerde twSerde windows@TimeWindows {..} = Processor $ \r@Record {..} -> do
   ctx@TaskContext{..} <- ask
-  store <- getKVStateStore storeName
+  store <- getSessionStateStore storeName
   logDebug $ "recordTimestamp: " <> displayShow recordTimestamp
   let matchedWindows = windowsFor recordTimestamp windows
   logDebug $ "matchedWindows: " <> displayShow matchedWindows
   observedStreamTime <- liftIO $ getTimestampInTaskContext ctx
+  -- Windows are stored by their end, and a window which ended the grace
+  -- period before the stream time does not admit records any more.
+  liftIO $ ssExpire (observedStreamTime - twGraceMs) store
   forM_
     matchedWindows
     ( \tw@TimeWindow {..} ->
         if observedStreamTime < tWindowEnd + twGraceMs
           then do
             let windowKey = mkTimeWindowKey (fromJust recordKey) tw
-            let key = runSer (timeWindowKeySerializer (serializer keySerde) (serializer twSerde)) windowKey
-            ma <- liftIO $ ksGet key store
+            let key = mkTimeWindowKey (runSer (timeWindowKeySerializer (serializer keySerde) (serializer twSerde)) windowKey) tw
+            ma <- liftIO $ ssGet key store
             let acc = maybe initialValue (runDeser $ deserializer accSerde) ma
             let newAcc = aggF acc r
             let sNewAcc = runSer (serializer accSerde) newAcc
-            liftIO $ ksPut key sNewAcc store
-            let changeLog = CLKSPut @_ @_ @BL.ByteString storeName key sNewAcc
+            liftIO $ ssPut key sNewAcc store
+            let changeLog = CLSSPut @_ @_ @BL.ByteString storeName key sNewAcc
             liftIO $ logChangelog tcChangeLogger (Aeson.encode changeLog)
             -- Erase key info because we may meet further joins and
             -- joining relies on'same key' to work.
@@ -0,0 +1,134 @@
+{-# LANGUAGE LambdaCase        #-}
+{-# LANGUAGE OverloadedStrings #-}
+
+module HStream.Processing.Processor.SnapshotSpec (spec) where
+
+import qualified Data.ByteString                       as BS
+import qualified Data.ByteString.Lazy                  as BL
+import qualified Data.Map.Strict                       as Map
+import           Data.Maybe                            (isNothing)
+import           Data.Text                             (Text)
+import           Test.Hspec
+
+import           HStream.Processing.Processor.Snapshot
+import           HStream.Processing.SpecUtils
+import           HStream.Processing.Store
+import           HStream.Processing.Stream.TimeWindows
+import           HStream.Processing.Type
+
+spec :: Spec
+spec = describe "HStream.Processing.Processor.Snapshot" $ do
+  it "restore a KV store from its incremental snapshots" $ do
+    h <- newMemorySnapshotter
+    store <- mkInMemoryKVStore :: IO (InMemoryKVStore Text Int)
+    let ess = wrapStateStore (KVStateStore (EKVStore store))
+    ksPut "a" 1 store >> ksPut "b" 2 store
+    _ <- snapshot h ess 1
+    ksPut "b" 3 store >> ksPut "c" 4 store
+    writes <- snapshot h ess 2
+    -- the changed entries and the tail
+    length writes `shouldBe` 3
+    restore h ess >>= \case
+      Just (SnapshotKS i m) -> (i, m) `shouldBe` (2, Map.fromList [("a", 1), ("b", 3), ("c", 4)])
+      _                     -> expectationFailure "no snapshot of the KV store"
+
+  it "delete the expired entries of a timestamped store as a range" $ do
+    h <- newMemorySnapshotter
+    store <- mkInMemoryTimestampedKVStore :: IO (InMemoryTimestampedKVStore BL.ByteString BL.ByteString)
+    let ess = wrapStateStore (TimestampedKVStateStore (ETimestampedKVStore store))
+    mapM_ (\(k, ts) -> tksPut (mkTimestampedKey k ts) "v" store)
+      [("a", 59000), ("b", 60500), ("a", 121000)]
+    _ <- snapshot h ess 1
+    tksExpire 61000 store
+    tksPut (mkTimestampedKey "c" 130000) "w" store
+    writes <- snapshot h ess 2
+    -- the expired entry, the changed one and the tail
+    length writes `shouldBe` 3
+    dump <- tksDump store
+    Map.keys dump `shouldBe` [60500, 121000, 130000]
+    restore h ess >>= \case
+      Just (SnapshotTKS i m) -> (i, m) `shouldBe` (2, dump)
+      _                      -> expectationFailure "no snapshot of the timestamped store"
+
+  it "restore a session store with removed and expired sessions" $ do
+    h <- newMemorySnapshotter
+    store <- mkInMemorySessionStore :: IO (InMemorySessionStore Text Int)
+    let ess = wrapStateStore (SessionStateStore (ESessionStore store))
+        session k start end = mkTimeWindowKey k (mkTimeWindow start end)
+    mapM_ (\(k, v) -> ssPut k v store)
+      [(session "a" 0 59990, 1), (session "a" 60010 60020, 2), (session "b" 60000 60000, 3)]
+    _ <- snapshot h ess 1
+    ssRemove (session "b" 60000 60000) store
+    ssExpire 61000 store
+    _ <- snapshot h ess 2
+    dump <- ssDump store
+    dump `shouldBe` Map.fromList [(60020, Map.fromList [("a", Map.fromList [(60010, 2)])])]
+    restore h ess >>= \case
+      Just (SnapshotSS i m) -> (i, m) `shouldBe` (2, dump)
+      _                     -> expectationFailure "no snapshot of the session store"
+
+  it "fall back to the snapshot of the old layout, and replace it" $ do
+    h <- newMemorySnapshotter
+    store <- mkInMemoryKVStore :: IO (InMemoryKVStore Text Int)
+    let ess = wrapStateStore (KVStateStore (EKVStore store))
+    snapshotBatch h [(snapshotBaseKey key, Just "{}")]
+    -- without a tail the caller reads the single value of the old layout
+    (isNothing <$> restore h ess) `shouldReturn` True
+    ksPut "a" 1 store
+    _ <- snapshot h ess 1
+    snapshotGet h (snapshotBaseKey key) `shouldReturn` Nothing
+    (isNothing <$> restore h ess) `shouldReturn` False
+
+  it "take all entries after an import" $ do
+    h <- newMemorySnapshotter
+    store <- mkInMemoryKVStore :: IO (InMemoryKVStore Text Int)
+    let ess = wrapStateStore (KVStateStore (EKVStore store))
+    ksPut "a" 1 store
+    (isAllEntries <$> ksTakeChanges store) `shouldReturn` True
+    ksPut "b" 2 store
+    _ <- snapshot h ess 1
+    ksImport store (Map.singleton "c" 3)
+    -- the entries of the snapshot which are not in the import are deleted
+    _ <- snapshot h ess 2
+    restore h ess >>= \case
+      Just (SnapshotKS i m) -> (i, m) `shouldBe` (2, Map.singleton "c" 3)
+      _                     -> expectationFailure "no snapshot of the KV store"
+    (isAllEntries <$> ksTakeChanges store) `shouldReturn` False
+
+    tks <- mkInMemoryTimestampedKVStore :: IO (InMemoryTimestampedKVStore Text Int)
+    _ <- tksTakeChanges tks
+    tksImport tks Map.empty
+    (isAllEntries <$> tksTakeChanges tks) `shouldReturn` True
+
+    ss <- mkInMemorySessionStore :: IO (InMemorySessionStore Text Int)
+    _ <- ssTakeChanges ss
+    ssImport ss Map.empty
+    (isAllEntries <$> ssTakeChanges ss) `shouldReturn` True
+
+key :: StateStoreSnapshotKey
+key = StateStoreSnapshotKey "query" "store"
+
+-- | Write the snapshot of the changes of a store since the previous one,
+-- with the tail. Returns the writes.
+snapshot :: MemorySnapshotter -> EStateStore -> Int -> IO [(BS.ByteString, Maybe BS.ByteString)]
+snapshot h ess i = do
+  changes <- takeSnapshotChanges ess
+  writes <- snapshotWrites h keyCodec valueCodec bytesEntryCodec key i changes
+  snapshotBatch h writes
+  return writes
+
+restore :: MemorySnapshotter -> EStateStore -> IO (Maybe (StateStoreSnapshotValue Int Text Int BL.ByteString))
+restore h = readSnapshot h keyCodec valueCodec bytesEntryCodec key
+
+-- The timestamped stores keep serialized records, the others the values
+-- themselves.
+keyCodec :: EntryCodec Text
+keyCodec = jsonEntryCodec
+
+valueCodec :: EntryCodec Int
+valueCodec = jsonEntryCodec
+
+isAllEntries :: StoreChanges k v -> Bool
+isAllEntries = \case
+  AllEntries _ -> True
+  _            -> False
@@ -0,0 +1,120 @@
+{-# LANGUAGE CPP               #-}
+{-# LANGUAGE OverloadedStrings #-}
+
+module HStream.Processing.SpecUtils
+  ( Noop (..)
+  , MemorySnapshotter (..)
+  , newMemorySnapshotter
+  , runTaskOn
+  , sourceRecord
+  , bytesSerde
+  , jsonSerde
+  ) where
+
+import           Control.Concurrent
+import           Control.Monad
+import qualified Data.Aeson                            as Aeson
+import qualified Data.ByteString                       as BS
+import qualified Data.ByteString.Lazy                  as BL
+import           Data.IORef
+import           Data.Int                              (Int64)
+import qualified Data.Map.Strict                       as Map
+import           Data.Maybe                            (fromJust)
+import           Data.Text                             (Text)
+import           GHC.Conc                              (newTVarIO)
+import           System.Timeout                        (timeout)
+
+import           HStream.Processing.Connector
+import           HStream.Processing.Encoding
+import           HStream.Processing.Processor
+import           HStream.Processing.Processor.Snapshot
+import           HStream.Processing.Type
+import           HStream.Stats                         (newStatsHolder)
+
+-- | Neither logs the changes nor keeps the snapshots.
+data Noop = Noop
+
+instance ChangeLogger Noop where
+  logChangelog _ _ = return ()
+  getChangelogProgress _ = return 0
+  trimChangelog _ _ = return ()
+
+instance Snapshotter Noop where
+  snapshotGet _ _ = return Nothing
+  snapshotRange _ _ _ = return []
+  snapshotBatch _ _ = return ()
+
+-- | Keeps the snapshots in memory, like the snapshot database keeps them on
+-- disk.
+newtype MemorySnapshotter = MemorySnapshotter (IORef (Map.Map BS.ByteString BS.ByteString))
+
+newMemorySnapshotter :: IO MemorySnapshotter
+newMemorySnapshotter = MemorySnapshotter <$> newIORef Map.empty
+
+instance Snapshotter MemorySnapshotter where
+  snapshotGet (MemorySnapshotter ref) k = Map.lookup k <$> readIORef ref
+  snapshotRange (MemorySnapshotter ref) from to =
+    Map.toAscList . maybe id (\k -> Map.takeWhileAntitone (< k)) to . Map.dropWhileAntitone (< from)
+      <$> readIORef ref
+  snapshotBatch (MemorySnapshotter ref) writes =
+    atomicModifyIORef' ref $ \m -> (foldl (\m' (k, v) -> Map.alter (const v) k m') m writes, ())
+
+-- | Run a task on the batches of source records, all of them read before
+-- the first one is acked. The records of a batch may be of any source
+-- stream of the task. Returns the sink records written by the time each
+-- batch was acked (and after the previous one), in the order they were
+-- written. Fails if the batches are not acked within ten seconds.
+runTaskOn :: TaskBuilder -> [[SourceRecord]] -> IO [[SinkRecord]]
+runTaskOn builder batches = do
+  statsHolder <- newStatsHolder True
+  closed <- newTVarIO False
+  written <- newIORef []
+  acked <- newIORef []
+  let feeder = srcStream . head $ concat batches
+      sourceConnector = SourceConnectorWithoutCkp
+        { subscribeToStreamWithoutCkp = \_ _ -> return ()
+        , unSubscribeToStreamWithoutCkp = \_ -> return ()
+        , isSubscribedToStreamWithoutCkp = \_ -> return True
+          -- all batches are read from one of the streams, and the task is
+          -- done once they are acked
+        , withReadRecordsWithoutCkp = \stream _ _ _ act -> when (stream == feeder) $ do
+            beforeAcks <- forM batches $ \records -> do
+              (callback, beforeAck) <- act (length records) records
+              callback
+              return beforeAck
+            forM_ beforeAcks $ \beforeAck -> do
+              beforeAck
+              records <- atomicModifyIORef' written (\rs -> ([], rs))
+              modifyIORef' acked (reverse records :)
+        , connectorClosed = closed
+        }
+      sinkConnector = SinkConnector
+        { writeRecord = \_ _ record -> atomicModifyIORef' written (\rs -> (record : rs, ()))
+        , flushRecords = return ()
+        }
+  r <- timeout (10 * 1000 * 1000) $
+    runTask statsHolder sourceConnector sinkConnector builder "test" Noop Noop
+            (\_ -> return (return ()))
+#ifdef HStreamEnableSchema
+            (\stream -> return (Just stream))
+#endif
+            (const Just) (const Just) Just Just
+  case r of
+    Nothing -> fail "the batches were not acked in time"
+    Just () -> reverse <$> readIORef acked
+
+sourceRecord :: Text -> BL.ByteString -> BL.ByteString -> Int64 -> SourceRecord
+sourceRecord stream key value timestamp =
+  SourceRecord
+    { srcStream = stream
+    , srcOffset = 0
+    , srcTimestamp = timestamp
+    , srcKey = Just key
+    , srcValue = value
+    }
+
+bytesSerde :: Serde BL.ByteString BL.ByteString
+bytesSerde = Serde (Serializer id) (Deserializer id)
+
+jsonSerde :: (Aeson.ToJSON a, Aeson.FromJSON a) => Serde a BL.ByteString
+jsonSerde = Serde (Serializer Aeson.encode) (Deserializer $ fromJust . Aeson.decode)
@@ -0,0 +1,196 @@
+{-# LANGUAGE LambdaCase        #-}
+{-# LANGUAGE OverloadedStrings #-}
+
+module HStream.Processing.Store.RocksDBSpec (spec) where
+
+import           Control.Concurrent
+import           Control.Exception                     (bracket)
+import           Control.Monad
+import qualified Data.ByteString                       as BS
+import           Data.Default                          (def)
+import           Data.Int                              (Int64)
+import           Data.List                             (sort)
+import qualified Data.Map.Strict                       as Map
+import           Data.Text                             (Text)
+import qualified Database.RocksDB                      as RocksDB
+import           System.IO.Temp                        (withSystemTempDirectory)
+import           Test.Hspec
+
+import           HStream.Processing.SpecUtils
+import           HStream.Processing.Store
+import           HStream.Processing.Store.RocksDB
+import           HStream.Processing.Stream.TimeWindows
+import           HStream.Processing.Type
+
+spec :: Spec
+spec = describe "HStream.Processing.Store.RocksDB" $ do
+  encodingSpec
+  around withDB $ do
+    kvStoreSpec
+    timestampedStoreSpec
+    sessionStoreSpec
+    prefixSpec
+
+encodingSpec :: Spec
+encodingSpec = describe "key encoding" $ do
+  it "encode timestamps in the order of the numbers" $ do
+    let timestamps = [minBound, -60000, -1, 0, 1, 59999, 60000, maxBound] :: [Int64]
+    fmap (decodeTimestamp . encodeTimestamp) timestamps `shouldBe` timestamps
+    sort (fmap encodeTimestamp timestamps) `shouldBe` fmap encodeTimestamp timestamps
+
+  it "give the least key after all keys with a prefix" $ do
+    prefixEnd "ab" `shouldBe` Just "ac"
+    prefixEnd "a\xff\xff" `shouldBe` Just "b"
+    prefixEnd "\xff\xff" `shouldBe` Nothing
+    prefixEnd "" `shouldBe` Nothing
+
+  it "decode the session keys" $ do
+    decodeSessionKey (sessionKeyBytes "key" (mkTimeWindow (-5) 60000))
+      `shouldBe` (60000, "key", -5)
+    decodeSessionKey (sessionKeyBytes "" (mkTimeWindow 0 0))
+      `shouldBe` (0, "", 0)
+
+  it "not make a prefix the beginning of another one" $ do
+    encodePrefix ["s1"] `shouldNotSatisfy` (`BS.isPrefixOf` encodePrefix ["s10"])
+    encodePrefix ["q"] `shouldSatisfy` (`BS.isPrefixOf` encodePrefix ["q", "s"])
+
+-- The RocksDB stores give the same results as the in-memory ones. The write
+-- batches are small, so that some of the entries are read from the database
+-- and some from the unwritten changes.
+kvStoreSpec :: SpecWith RocksDB.DB
+kvStoreSpec = describe "RocksDBKVStore" $ do
+  let ops :: KVStore s => s Int Text -> IO ([(Int, Text)], [(Int, Text)], Maybe Text, Map.Map Int Text)
+      ops store = do
+        mapM_ (\(k, v) -> ksPut k v store) [(1, "a"), (9, "b"), (10, "c"), (20, "d"), (9, "e")]
+        -- 10 is serialized before 9
+        (,,,) <$> ksRange 9 10 store <*> ksRange 0 100 store <*> ksGet 9 store <*> ksDump store
+
+  it "give the results of the in-memory store" $ \db -> do
+    expected <- ops =<< mkInMemoryKVStore
+    (ops =<< rocksDBKVStore db ["kv"]) `shouldReturn` expected
+
+  it "read the writes of the sub-tasks sharing the store" $ \db -> do
+    store <- rocksDBKVStore db ["kv"]
+    -- each write batch is written while the other threads read
+    results <- forM [0 .. 3] $ \t -> do
+      result <- newEmptyMVar
+      _ <- forkIO $ do
+        found <- forM [1 .. 500] $ \i -> do
+          let k = t * 1000 + i
+          ksPut k "v" store
+          ksGet k store
+        putMVar result found
+      return result
+    concat <$> mapM takeMVar results `shouldReturn` replicate 2000 (Just "v")
+
+  it "import a dump" $ \db -> do
+    store <- rocksDBKVStore db ["kv"]
+    _ <- ops store
+    dump <- ksDump store
+    store' <- rocksDBKVStore db ["kv'"]
+    ksImport store' dump
+    ksDump store' `shouldReturn` dump
+
+timestampedStoreSpec :: SpecWith RocksDB.DB
+timestampedStoreSpec = describe "RocksDBTimestampedKVStore" $ do
+  let ops :: TimestampedKVStore s => s Text Int -> IO [([(Int64, Int)], Map.Map Int64 (Map.Map Text Int))]
+      ops store = do
+        mapM_ (\(k, ts, v) -> tksPut (mkTimestampedKey k ts) v store)
+          [ ("a", 59000, 1), ("a", 60500, 2), ("b", 60000, 3), ("a", 121000, 4), ("a", -1, 5) ]
+        let state = (,) <$> range store <*> tksDump store
+        before <- state
+        tksExpire 61000 store
+        afterFirst <- state
+        tksExpire 120000 store
+        (\s -> [before, afterFirst, s]) <$> state
+      range store =
+        fmap (\(tk, v) -> (tkTimestamp tk, v)) <$>
+          tksRange (mkTimestampedKey "a" (-100)) (mkTimestampedKey "a" 121000) store
+
+  it "give the results of the in-memory store, also after expiring" $ \db -> do
+    expected <- ops =<< mkInMemoryTimestampedKVStore
+    (ops =<< rocksDBTimestampedStore db ["tks"]) `shouldReturn` expected
+
+sessionStoreSpec :: SpecWith RocksDB.DB
+sessionStoreSpec = describe "RocksDBSessionStore" $ do
+  let session k start end = mkTimeWindowKey k (mkTimeWindow start end)
+      putAll store = mapM_ (\(k, v) -> ssPut k v store)
+        [ (session "a" 0 59990, 1)
+        , (session "a" 60010 60020, 2)
+        , (session "b" 60000 60000, 3)
+        , (session "a" 200000 200000, 4)
+        , (session "" 60005 60005, 5)
+        ]
+      windows = fmap (\(k, v) -> (twkWindow k, v))
+      ops :: SessionStore s => s Text Int -> IO [[(TimeWindow, Int)]]
+      ops store = do
+        putAll store
+        ssRemove (session "a" 200000 200000) store
+        ssPut (session "a" 250000 260000) 6 store
+        let found = mapM (\(k, end, start) -> windows <$> findSessions k end start store)
+              [("a", 59000, 60015), ("a", 60000, 300000), ("b", 0, 300000), ("", 0, 300000), ("c", 0, 300000)]
+        before <- found
+        ssExpire 61000 store
+        afterFirst <- found
+        ssExpire 180000 store
+        (\f -> before <> afterFirst <> f) <$> found
+
+  it "give the results of the in-memory store, also after expiring" $ \db -> do
+    expected <- ops =<< mkInMemorySessionStore
+    (ops =<< rocksDBSessionStore db ["ss"]) `shouldReturn` expected
+
+  it "dump the sessions only, and import them" $ \db -> do
+    store <- rocksDBSessionStore db ["ss"]
+    inMemory <- mkInMemorySessionStore
+    putAll store
+    putAll inMemory
+    dump <- ssDump store
+    ssDump inMemory `shouldReturn` dump
+    store' <- rocksDBSessionStore db ["ss'"]
+    ssImport store' dump
+    ssDump store' `shouldReturn` dump
+    -- the imported sessions expire like the written ones
+    ssExpire 180000 store'
+    ssDump store' `shouldReturn`
+      Map.fromList [(200000, Map.fromList [("a", Map.fromList [(200000, 4)])])]
+
+prefixSpec :: SpecWith RocksDB.DB
+prefixSpec = describe "deleteRocksDBPrefix" $ do
+  it "delete the stores under the prefix only" $ \db -> do
+    handles <- mapM (mkRocksDBHandle db . options) [["q1", "s"], ["q1", "t"], ["q10", "s"]]
+    stores <- mapM kvStore handles
+    mapM_ (ksPut 1 "a") stores
+    -- the stores of a deleted query are no longer in use, and their changes
+    -- are written
+    mapM_ flushRocksDBHandle handles
+    deleteRocksDBPrefix db ["q1"]
+    mapM ksDump stores `shouldReturn` [Map.empty, Map.empty, Map.singleton 1 "a"]
+
+withDB :: (RocksDB.DB -> IO ()) -> IO ()
+withDB act = withSystemTempDirectory "hstream-processing-rocksdb" $ \dir ->
+  bracket (RocksDB.open def {RocksDB.createIfMissing = True} dir) RocksDB.close act
+
+options :: [BS.ByteString] -> RocksDBStoreOptions
+options prefix = (defaultRocksDBStoreOptions prefix) {rsoBatchSize = 2}
+
+kvStore :: RocksDBHandle -> IO (EKVStore Int Text)
+kvStore h = mkRocksDBStateKVStore h jsonSerde jsonSerde >>= \case
+  KVStateStore store -> return store
+  _                  -> fail "not a KV store"
+
+rocksDBKVStore :: RocksDB.DB -> [BS.ByteString] -> IO (EKVStore Int Text)
+rocksDBKVStore db prefix = mkRocksDBHandle db (options prefix) >>= kvStore
+
+rocksDBTimestampedStore :: RocksDB.DB -> [BS.ByteString] -> IO (ETimestampedKVStore Text Int)
+rocksDBTimestampedStore db prefix = do
+  h <- mkRocksDBHandle db (options prefix)
+  mkRocksDBStateTimestampedKVStore h jsonSerde jsonSerde >>= \case
+    TimestampedKVStateStore store -> return store
+    _                             -> fail "not a timestamped store"
+
+rocksDBSessionStore :: RocksDB.DB -> [BS.ByteString] -> IO (ESessionStore Text Int)
+rocksDBSessionStore db prefix = do
+  h <- mkRocksDBHandle db (options prefix)
+  mkRocksDBStateSessionStore h jsonSerde jsonSerde >>= \case
+    SessionStateStore store -> return store
+    _                       -> fail "not a session store"
@@ -0,0 +1,124 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+module HStream.Processing.StoreSpec (spec) where
+
+import qualified Data.Map.Strict                       as Map
+import           Data.Text                             (Text)
+import           Test.Hspec
+
+import           HStream.Processing.Store
+import           HStream.Processing.Stream.TimeWindows
+import           HStream.Processing.Type
+
+spec :: Spec
+spec = describe "HStream.Processing.Store" $ do
+  segmentSpec
+  timestampedStoreSpec
+  sessionStoreSpec
+
+segmentSpec :: Spec
+segmentSpec = describe "segments" $ do
+  it "put a time into the segment it is in" $ do
+    -- one minute
+    defaultSegmentInterval `shouldBe` 60000
+    segmentOf defaultSegmentInterval 0 `shouldBe` 0
+    segmentOf defaultSegmentInterval 59999 `shouldBe` 0
+    segmentOf defaultSegmentInterval 60000 `shouldBe` 1
+    segmentOf defaultSegmentInterval (-1) `shouldBe` (-1)
+
+  it "split a map by time into segments" $ do
+    let m = Map.fromList [(0, 'a'), (59999, 'b'), (60000, 'c'), (180001, 'd')]
+    toSegments defaultSegmentInterval m `shouldBe`
+      Map.fromList [ (0, Map.fromList [(0, 'a'), (59999, 'b')])
+                   , (1, Map.fromList [(60000, 'c')])
+                   , (3, Map.fromList [(180001, 'd')])
+                   ]
+    Map.unions (Map.elems $ toSegments defaultSegmentInterval m) `shouldBe` m
+
+timestampedStoreSpec :: Spec
+timestampedStoreSpec = describe "InMemoryTimestampedKVStore" $ do
+  let putAll store = mapM_ (\(k, ts, v) -> tksPut (mkTimestampedKey k ts) v store)
+        [ ("a", 59000, 1), ("a", 60500, 2), ("b", 60000, 3), ("a", 121000, 4) ]
+      range store k from to =
+        fmap (\(tk, v) -> (tkTimestamp tk, v)) <$> tksRange (mkTimestampedKey k from) (mkTimestampedKey k to) store
+
+  it "range over the timestamps of a key across segments" $ do
+    store <- mkInMemoryTimestampedKVStore :: IO (InMemoryTimestampedKVStore Text Int)
+    putAll store
+    range store "a" 59000 121000 `shouldReturn` [(59000, 1), (60500, 2), (121000, 4)]
+    range store "a" 59500 120000 `shouldReturn` [(60500, 2)]
+    range store "b" 0 200000 `shouldReturn` [(60000, 3)]
+    range store "c" 0 200000 `shouldReturn` []
+    tksGet (mkTimestampedKey "a" 60500) store `shouldReturn` Just 2
+    tksGet (mkTimestampedKey "a" 60501) store `shouldReturn` Nothing
+
+  it "expire whole segments before the time" $ do
+    store <- mkInMemoryTimestampedKVStore :: IO (InMemoryTimestampedKVStore Text Int)
+    putAll store
+    tksExpire 61000 store
+    -- 60500 is before the time, but its segment is not
+    range store "a" 0 200000 `shouldReturn` [(60500, 2), (121000, 4)]
+    tksExpire 120000 store
+    range store "a" 0 200000 `shouldReturn` [(121000, 4)]
+    tksDump store `shouldReturn` Map.fromList [(121000, Map.fromList [("a", 4)])]
+
+  it "import a dump into segments" $ do
+    store <- mkInMemoryTimestampedKVStore :: IO (InMemoryTimestampedKVStore Text Int)
+    putAll store
+    dump <- tksDump store
+    store' <- mkInMemoryTimestampedKVStore
+    tksImport store' dump
+    tksDump store' `shouldReturn` dump
+    range store' "a" 59000 121000 `shouldReturn` [(59000, 1), (60500, 2), (121000, 4)]
+
+sessionStoreSpec :: Spec
+sessionStoreSpec = describe "InMemorySessionStore" $ do
+  let session k start end = mkTimeWindowKey k (mkTimeWindow start end)
+      putAll store = mapM_ (\(k, v) -> ssPut k v store)
+        [ (session "a" 0 59990, 1)
+        , (session "a" 60010 60020, 2)
+        , (session "b" 60000 60000, 3)
+        , (session "a" 200000 200000, 4)
+        ]
+      windows = fmap (\(k, v) -> (twkWindow k, v))
+
+  it "find the sessions of a key across segments" $ do
+    store <- mkInMemorySessionStore :: IO (InMemorySessionStore Text Int)
+    putAll store
+    -- sessions ending at or after 59000 and starting at or before 60015
+    windows <$> findSessions "a" 59000 60015 store
+      `shouldReturn` [(mkTimeWindow 0 59990, 1), (mkTimeWindow 60010 60020, 2)]
+    windows <$> findSessions "a" 60000 300000 store
+      `shouldReturn` [(mkTimeWindow 60010 60020, 2), (mkTimeWindow 200000 200000, 4)]
+    windows <$> findSessions "b" 0 300000 store
+      `shouldReturn` [(mkTimeWindow 60000 60000, 3)]
+    ssGet (session "a" 60010 60020) store `shouldReturn` Just 2
+
+  it "remove a session" $ do
+    store <- mkInMemorySessionStore :: IO (InMemorySessionStore Text Int)
+    putAll store
+    ssRemove (session "a" 60010 60020) store
+    ssGet (session "a" 60010 60020) store `shouldReturn` Nothing
+    windows <$> findSessions "a" 0 300000 store
+      `shouldReturn` [(mkTimeWindow 0 59990, 1), (mkTimeWindow 200000 200000, 4)]
+
+  it "expire whole segments by window end" $ do
+    store <- mkInMemorySessionStore :: IO (InMemorySessionStore Text Int)
+    putAll store
+    ssExpire 60015 store
+    -- [60010, 60020] ended before the time, but its segment did not
+    windows <$> findSessions "a" 0 300000 store
+      `shouldReturn` [(mkTimeWindow 60010 60020, 2), (mkTimeWindow 200000 200000, 4)]
+    ssExpire 180000 store
+    ssDump store `shouldReturn`
+      Map.fromList [(200000, Map.fromList [("a", Map.fromList [(200000, 4)])])]
+
+  it "import a dump into segments" $ do
+    store <- mkInMemorySessionStore :: IO (InMemorySessionStore Text Int)
+    putAll store
+    dump <- ssDump store
+    store' <- mkInMemorySessionStore
+    ssImport store' dump
+    ssDump store' `shouldReturn` dump
+    windows <$> findSessions "a" 59000 60015 store'
+      `shouldReturn` [(mkTimeWindow 0 59990, 1), (mkTimeWindow 60010 60020, 2)]
@@ -0,0 +1,181 @@
+{-# LANGUAGE OverloadedStrings #-}
+{-# OPTIONS_GHC -Wno-orphans #-}
+
+module HStream.Processing.StreamSpec (spec) where
+
+import           Control.Concurrent                              (getNumCapabilities,
+                                                                  setNumCapabilities)
+import           Control.Exception                               (bracket)
+import           Control.Monad                                   (forM_)
+import qualified Data.ByteString.Lazy.Char8                      as BLC
+import           Data.Default                                    (Default (..))
+import qualified Data.HashMap.Strict                             as HM
+import           Data.Int                                        (Int64)
+import           Data.List                                       (sort)
+import           Data.Maybe                                      (fromJust)
+import           Test.Hspec
+
+import           HStream.Processing.Processor
+import           HStream.Processing.SpecUtils
+import           HStream.Processing.Store
+import qualified HStream.Processing.Stream                       as HS
+import qualified HStream.Processing.Stream.GroupedStream         as HG
+import           HStream.Processing.Stream.JoinWindows
+import qualified HStream.Processing.Stream.SessionWindowedStream as HSW
+import           HStream.Processing.Stream.SessionWindows
+import qualified HStream.Processing.Table                        as HT
+import           HStream.Processing.Type
+
+-- The session aggregation erases the keys it forwards to their defaults.
+instance Default BLC.ByteString where
+  def = BLC.empty
+
+spec :: Spec
+spec = describe "HStream.Processing.Stream" $ do
+  it "give joins the same grace period as the windows" $ do
+    let windows = mkJoinWindows 1000 2000
+    (jwBeforeMs windows, jwAfterMs windows, jwGraceMs windows)
+      `shouldBe` (1000, 2000, 24 * hour)
+    jwGraceMs windows `shouldBe` swGraceMs (mkSessionWindows 1000)
+
+  -- the stream time of the sub-tasks is the one of the source thread
+  forM_ [1, 4] $ \n ->
+    it ("drop the records of a session aggregation past the grace period on " <> show n <> " capabilities") $
+      withCapabilities n $ do
+        builder <- sessionCount
+        out <- runTaskOn builder . pure $
+          [ sourceRecord "s" "a" "" t0
+          , sourceRecord "s" "a" "" (t0 + 500)
+            -- behind the stream time by more than the grace period
+          , sourceRecord "s" "a" "" (t0 - 90 * hour)
+          , sourceRecord "s" "a" "" (t0 - 20 * hour)
+          , sourceRecord "s" "b" "" (t0 - 20 * hour + 500)
+          ]
+        -- the keys may be aggregated on different sub-tasks
+        let values = snkValue <$> concat out
+        filter ("a:" `BLC.isPrefixOf`) values `shouldBe` ["a:1", "a:2", "a:1"]
+        filter ("b:" `BLC.isPrefixOf`) values `shouldBe` ["b:1"]
+
+  it "drop the records of both sides of a join past the grace period" $ do
+    builder <- streamJoin
+    out <- runTaskOn builder . pure $
+      [ sourceRecord "l" "a" "l1" t0
+      , sourceRecord "r" "a" "r1" (t0 + 500)
+        -- neither of them joins, although they are within the join window
+      , sourceRecord "r" "a" "r2" (t0 - 90 * hour)
+      , sourceRecord "l" "a" "l2" (t0 - 90 * hour + 500)
+      , sourceRecord "l" "a" "l3" (t0 - 20 * hour)
+      , sourceRecord "r" "a" "r3" (t0 - 20 * hour + 200)
+      , sourceRecord "r" "b" "r4" (t0 - 20 * hour + 200)
+      ]
+    fmap snkValue (concat out) `shouldBe` ["l1|r1", "l3|r3"]
+
+  describe "exchanges" $ do
+    let batches =
+          [ [sourceRecord "s" k "" t0 | k <- ["a", "b", "a"]]
+          , [sourceRecord "s" k "" t0 | k <- ["c", "a"]]
+          , [sourceRecord "s" k "" t0 | k <- ["b", "c", "d"]]
+          ]
+        counts =
+          [ ["a:1", "b:1", "a:2"]
+          , ["c:1", "a:3"]
+          , ["b:2", "c:2", "d:1"]
+          ]
+
+    forM_ [1, 4] $ \n ->
+      it ("give a grouped aggregation the same results on " <> show n <> " capabilities") $
+        withCapabilities n $ do
+          builder <- groupedCount
+          out <- fmap (fmap snkValue) <$> runTaskOn builder batches
+          sort (concat out) `shouldBe` sort (concat counts)
+          -- the keys are routed to the sub-tasks by hash, so each of them is
+          -- counted in order
+          forM_ ["a:", "b:", "c:", "d:"] $ \k ->
+            filter (k `BLC.isPrefixOf`) (concat out) `shouldBe` filter (k `BLC.isPrefixOf`) (concat counts)
+          -- a batch is acked once all of its records are processed
+          forM_ [1 .. length batches] $ \i ->
+            concat (take i counts) `shouldSatisfy` all (`elem` concat (take i out))
+
+    it "partition the processors after a groupBy" $ do
+      builder <- groupedCount
+      HM.size (taskExchanges $ build builder) `shouldBe` 1
+
+    it "not partition a join of which only one side is grouped" $ do
+      builder <- groupedJoin
+      HM.keys (taskExchanges $ build builder) `shouldBe` []
+
+withCapabilities :: Int -> IO a -> IO a
+withCapabilities n action =
+  bracket getNumCapabilities setNumCapabilities $ \_ -> setNumCapabilities n >> action
+
+t0 :: Int64
+t0 = 1000 * hour
+
+hour :: Int64
+hour = 3600 * 1000
+
+-- | Counts of the sessions of the keys (with a gap of one second), as
+-- "key:count".
+sessionCount :: IO TaskBuilder
+sessionCount = fmap HS.build $ do
+  store <- mkInMemoryStateSessionStore
+  let mat = HS.Materialized bytesSerde bytesSerde store
+      count = BLC.pack . show
+      countOf = read . BLC.unpack :: BLC.ByteString -> Int
+  HS.mkStreamBuilder "session"
+    >>= HS.stream (HS.StreamSourceConfig "s" bytesSerde bytesSerde)
+    >>= HS.groupBy (fromJust . recordKey)
+    >>= HG.sessionWindowedBy (mkSessionWindows 1000)
+    >>= HSW.aggregate (count 0) (\acc _ -> count (countOf acc + 1))
+                      (\_ acc1 acc2 -> count (countOf acc1 + countOf acc2))
+                      (\acc k -> k <> ":" <> acc)
+                      jsonSerde bytesSerde mat
+    >>= HT.toStream
+    >>= HS.to (HS.StreamSinkConfig "sink" (sessionWindowKeySerde bytesSerde jsonSerde) bytesSerde)
+
+-- | Counts of the records of the keys, as "key:count".
+groupedCount :: IO TaskBuilder
+groupedCount = fmap HS.build $
+  HS.mkStreamBuilder "count"
+    >>= HS.stream (HS.StreamSourceConfig "s" bytesSerde bytesSerde)
+    >>= countByKey
+    >>= HS.to (HS.StreamSinkConfig "sink" bytesSerde bytesSerde)
+
+-- | Join of the counts of the keys of l with the values of r, of which only
+-- the side of l is partitioned by a groupBy.
+groupedJoin :: IO TaskBuilder
+groupedJoin = fmap HS.build $ do
+  thisStore <- mkInMemoryStateTimestampedKVStore
+  otherStore <- mkInMemoryStateTimestampedKVStore
+  let joined = HS.StreamJoined bytesSerde bytesSerde bytesSerde bytesSerde thisStore otherStore
+  builder <- HS.mkStreamBuilder "grouped-join"
+  l <- HS.stream (HS.StreamSourceConfig "l" bytesSerde bytesSerde) builder >>= countByKey
+  r <- HS.stream (HS.StreamSourceConfig "r" bytesSerde bytesSerde) builder
+  HS.joinStream r (\v1 v2 -> v1 <> "|" <> v2) (\_ _ -> True) (\r1 _ -> fromJust $ recordKey r1)
+                (mkJoinWindows 1000 1000) joined l
+    >>= HS.to (HS.StreamSinkConfig "sink" bytesSerde bytesSerde)
+
+countByKey :: HS.Stream BLC.ByteString BLC.ByteString BLC.ByteString -> IO (HS.Stream BLC.ByteString BLC.ByteString BLC.ByteString)
+countByKey s = do
+  store <- mkInMemoryStateKVStore
+  let mat = HS.Materialized bytesSerde bytesSerde store
+      count = BLC.pack . show
+      countOf = read . BLC.unpack :: BLC.ByteString -> Int
+  HS.groupBy (fromJust . recordKey) s
+    >>= HG.aggregate (count 0) (\acc _ -> count (countOf acc + 1)) (\acc k -> k <> ":" <> acc)
+                     bytesSerde bytesSerde mat
+    >>= HT.toStream
+
+-- | Join of the values of the same keys of l and r within a second, as
+-- "l|r".
+streamJoin :: IO TaskBuilder
+streamJoin = fmap HS.build $ do
+  thisStore <- mkInMemoryStateTimestampedKVStore
+  otherStore <- mkInMemoryStateTimestampedKVStore
+  let joined = HS.StreamJoined bytesSerde bytesSerde bytesSerde bytesSerde thisStore otherStore
+  builder <- HS.mkStreamBuilder "join"
+  l <- HS.stream (HS.StreamSourceConfig "l" bytesSerde bytesSerde) builder
+  r <- HS.stream (HS.StreamSourceConfig "r" bytesSerde bytesSerde) builder
+  HS.joinStream r (\v1 v2 -> v1 <> "|" <> v2) (\_ _ -> True) (\r1 _ -> fromJust $ recordKey r1)
+                (mkJoinWindows 1000 1000) joined l
+    >>= HS.to (HS.StreamSinkConfig "sink" bytesSerde bytesSerde)
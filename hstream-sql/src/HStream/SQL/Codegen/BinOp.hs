@@ -31,33 +31,33 @@ import           HStream.SQL.Binder
 
 --------------------------------------------------------------------------------
 binOpOnValue :: BinaryOp -> FlowValue -> FlowValue -> Either ERROR_TYPE FlowValue
-binOpOnValue OpAdd v1 v2       = op_add v1 v2
-binOpOnValue OpSub v1 v2       = op_sub v1 v2
-binOpOnValue OpMul v1 v2       = op_mul v1 v2
-binOpOnValue OpAnd v1 v2       = op_and v1 v2
-binOpOnValue OpOr  v1 v2       = op_or  v1 v2
-binOpOnValue OpEQ  v1 v2       = op_eq  v1 v2
-binOpOnValue OpNEQ v1 v2       = op_neq v1 v2
-binOpOnValue OpLT  v1 v2       = op_lt  v1 v2
-binOpOnValue OpGT  v1 v2       = op_gt  v1 v2
-binOpOnValue OpLEQ v1 v2       = op_leq v1 v2
-binOpOnValue OpGEQ v1 v2       = op_geq v1 v2
-binOpOnValue OpContain v1 v2   = op_contain v1 v2
-binOpOnValue OpExcept v1 v2    = op_except v1 v2
-binOpOnValue OpIntersect v1 v2 = op_intersect v1 v2
-binOpOnValue OpRemove v1 v2    = op_remove v1 v2
-binOpOnValue OpUnion v1 v2     = op_union v1 v2
-binOpOnValue OpArrJoin' v1 v2  = op_arrJoin v1 v2
-binOpOnValue OpIfNull v1 v2    = op_ifNull v1 v2
-binOpOnValue OpNullIf v1 v2    = op_nullIf v1 v2
-binOpOnValue OpDateStr v1 v2   = op_dateStr v1 v2
-binOpOnValue OpStrDate v1 v2   = op_strDate v1 v2
-binOpOnValue OpSplit v1 v2     = op_split v1 v2
-binOpOnValue OpChunksOf v1 v2  = op_chunksOf v1 v2
-binOpOnValue OpTake v1 v2      = op_take v1 v2
-binOpOnValue OpTakeEnd v1 v2   = op_takeEnd v1 v2
-binOpOnValue OpDrop v1 v2      = op_drop v1 v2
-binOpOnValue OpDropEnd v1 v2   = op_dropEnd v1 v2
+binOpOnValue OpAdd       = op_add
+binOpOnValue OpSub       = op_sub
+binOpOnValue OpMul       = op_mul
+binOpOnValue OpAnd       = op_and
+binOpOnValue OpOr        = op_or
+binOpOnValue OpEQ        = op_eq
+binOpOnValue OpNEQ       = op_neq
+binOpOnValue OpLT        = op_lt
+binOpOnValue OpGT        = op_gt
+binOpOnValue OpLEQ       = op_leq
+binOpOnValue OpGEQ       = op_geq
+binOpOnValue OpContain   = op_contain
+binOpOnValue OpExcept    = op_except
+binOpOnValue OpIntersect = op_intersect
+binOpOnValue OpRemove    = op_remove
+binOpOnValue OpUnion     = op_union
+binOpOnValue OpArrJoin'  = op_arrJoin
+binOpOnValue OpIfNull    = op_ifNull
+binOpOnValue OpNullIf    = op_nullIf
+binOpOnValue OpDateStr   = op_dateStr
+binOpOnValue OpStrDate   = op_strDate
+binOpOnValue OpSplit     = op_split
+binOpOnValue OpChunksOf  = op_chunksOf
+binOpOnValue OpTake      = op_take
+binOpOnValue OpTakeEnd   = op_takeEnd
+binOpOnValue OpDrop      = op_drop
+binOpOnValue OpDropEnd   = op_dropEnd
 
 --------------------------------------------------------------------------------
 op_add :: FlowValue -> FlowValue -> Either ERROR_TYPE FlowValue
@@ -37,30 +37,30 @@ import           HStream.SQL.Binder
 --------------------------------------------------------------------------------
 #ifdef HStreamEnableSchema
 castOnValue :: BoundDataType -> FlowValue -> Either ERROR_TYPE FlowValue
-castOnValue BTypeInteger     v = castToInteger v
-castOnValue BTypeFloat       v = castToFloat v
-castOnValue BTypeBoolean     v = castToBoolean v
-castOnValue BTypeBytea       v = castToByte v
-castOnValue BTypeText        v = castToText v
-castOnValue BTypeDate        v = castToDate v
-castOnValue BTypeTime        v = castToTime v
-castOnValue BTypeTimestamp   v = castToTimestamp v
-castOnValue BTypeInterval    v = castToInterval v
-castOnValue BTypeJsonb       v = castToJson v
-castOnValue (BTypeArray t)   v = castToArray t v
+castOnValue BTypeInteger        = castToInteger
+castOnValue BTypeFloat          = castToFloat
+castOnValue BTypeBoolean        = castToBoolean
+castOnValue BTypeBytea          = castToByte
+castOnValue BTypeText           = castToText
+castOnValue BTypeDate           = castToDate
+castOnValue BTypeTime           = castToTime
+castOnValue BTypeTimestamp      = castToTimestamp
+castOnValue BTypeInterval       = castToInterval
+castOnValue BTypeJsonb          = castToJson
+castOnValue (BTypeArray t)      = castToArray t
 #else
 castOnValue :: RDataType -> FlowValue -> Either ERROR_TYPE FlowValue
-castOnValue RTypeInteger     v = castToInteger v
-castOnValue RTypeFloat       v = castToFloat v
-castOnValue RTypeBoolean     v = castToBoolean v
-castOnValue RTypeBytea       v = castToByte v
-castOnValue RTypeText        v = castToText v
-castOnValue RTypeDate        v = castToDate v
-castOnValue RTypeTime        v = castToTime v
-castOnValue RTypeTimestamp   v = castToTimestamp v
-castOnValue RTypeInterval    v = castToInterval v
-castOnValue RTypeJsonb       v = castToJson v
-castOnValue (RTypeArray t)   v = castToArray t v
+castOnValue RTypeInteger        = castToInteger
+castOnValue RTypeFloat          = castToFloat
+castOnValue RTypeBoolean        = castToBoolean
+castOnValue RTypeBytea          = castToByte
+castOnValue RTypeText           = castToText
+castOnValue RTypeDate           = castToDate
+castOnValue RTypeTime           = castToTime
+castOnValue RTypeTimestamp      = castToTimestamp
+castOnValue RTypeInterval       = castToInterval
+castOnValue RTypeJsonb          = castToJson
+castOnValue (RTypeArray t)      = castToArray t
 #endif
 --------------------------------------------------------------------------------
 mkCanNotCastErr :: FlowValue -> T.Text -> Either ERROR_TYPE FlowValue
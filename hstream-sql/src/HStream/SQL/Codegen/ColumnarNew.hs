@@ -0,0 +1,247 @@
+{-# LANGUAGE CPP               #-}
+{-# LANGUAGE LambdaCase        #-}
+{-# LANGUAGE OverloadedStrings #-}
+{-# LANGUAGE RecordWildCards   #-}
+{-# LANGUAGE StrictData        #-}
+
+-- | Batch-at-a-time evaluation of 'ScalarExpr'.
+--
+-- The columns an expression refers to are decoded from a batch of objects
+-- (in one pass over each object) into typed columns: unboxed values with a
+-- validity mask for integers, floats and booleans. The arithmetic,
+-- comparison and logical operators then run as tight loops over whole
+-- columns. Any other operator, or operands of other types, falls back to
+-- 'binOpOnValue' / 'unaryOpOnValue' row by row on boxed values, and any other
+-- expression to 'scalarExprToFun', so the results (including NULLs and
+-- errors) are the same as those of evaluating the rows one by one.
+module HStream.SQL.Codegen.ColumnarNew
+#ifdef HStreamEnableSchema
+  ( Column
+  , columnLength
+  , columnValue
+  , evalColumns
+  , selectRows
+  , projectRows
+  )
+#endif
+  where
+
+#ifdef HStreamEnableSchema
+import qualified Data.HashMap.Strict           as HM
+import qualified Data.IntMap.Strict            as IntMap
+import qualified Data.List                     as L
+import qualified Data.Map.Strict               as Map
+import qualified Data.Set                      as Set
+import qualified Data.Text                     as T
+import qualified Data.Vector                   as V
+import qualified Data.Vector.Unboxed           as VU
+
+#ifdef HStreamUseV2Engine
+import           DiffFlow.Error
+#else
+import           HStream.Processing.Error
+#endif
+import           HStream.SQL.Binder
+import           HStream.SQL.Codegen.BinOp
+import           HStream.SQL.Codegen.CommonNew
+import           HStream.SQL.Codegen.UnaryOp
+import           HStream.SQL.PlannerNew.Types
+import           HStream.SQL.Rts
+
+#ifdef HStreamUseV2Engine
+#define ERROR_TYPE DiffFlowError
+#define ERR RunShardError
+#else
+#define ERROR_TYPE HStreamProcessingError
+#define ERR OperationError
+#endif
+
+-- | A column of a batch. The masks of the typed columns are 'False' at the
+-- rows whose values are NULL, the values at these rows are meaningless.
+data Column
+  = IntColumn   (VU.Vector Bool) (VU.Vector Int)
+  | FloatColumn (VU.Vector Bool) (VU.Vector Double)
+  | BoolColumn  (VU.Vector Bool) (VU.Vector Bool)
+  | BoxedColumn (V.Vector (Either ERROR_TYPE FlowValue))
+
+columnLength :: Column -> Int
+columnLength = \case
+  IntColumn   _ xs -> VU.length xs
+  FloatColumn _ xs -> VU.length xs
+  BoolColumn  _ xs -> VU.length xs
+  BoxedColumn xs   -> V.length xs
+
+columnValue :: Column -> Int -> Either ERROR_TYPE FlowValue
+columnValue col i = case col of
+  IntColumn   valid xs -> Right $ typedValue FlowInt valid xs
+  FloatColumn valid xs -> Right $ typedValue FlowFloat valid xs
+  BoolColumn  valid xs -> Right $ typedValue FlowBoolean valid xs
+  BoxedColumn xs       -> V.unsafeIndex xs i
+  where
+    typedValue :: VU.Unbox a => (a -> FlowValue) -> VU.Vector Bool -> VU.Vector a -> FlowValue
+    typedValue mk valid xs
+      | VU.unsafeIndex valid i = mk (VU.unsafeIndex xs i)
+      | otherwise              = FlowNull
+
+toBoxed :: Column -> V.Vector (Either ERROR_TYPE FlowValue)
+toBoxed (BoxedColumn xs) = xs
+toBoxed col = V.generate (columnLength col) (columnValue col)
+
+-- | Type a boxed column if all its values are of the same type (or NULL).
+fromBoxed :: V.Vector (Either ERROR_TYPE FlowValue) -> Column
+fromBoxed xs
+  | V.all (ofType isInt) xs   = IntColumn valid (unbox (\case FlowInt n -> n; _ -> 0))
+  | V.all (ofType isFloat) xs = FloatColumn valid (unbox (\case FlowFloat n -> n; _ -> 0))
+  | V.all (ofType isBool) xs  = BoolColumn valid (unbox (\case FlowBoolean b -> b; _ -> False))
+  | otherwise                 = BoxedColumn xs
+  where
+    ofType p = \case
+      Right FlowNull -> True
+      Right v        -> p v
+      Left _         -> False
+    isInt   = \case FlowInt _ -> True; _ -> False
+    isFloat = \case FlowFloat _ -> True; _ -> False
+    isBool  = \case FlowBoolean _ -> True; _ -> False
+    valid = V.convert $ V.map (\case Right FlowNull -> False; _ -> True) xs
+    unbox :: VU.Unbox a => (FlowValue -> a) -> VU.Vector a
+    unbox f = V.convert $ V.map (either (const (f FlowNull)) f) xs
+
+--------------------------------------------------------------------------------
+
+-- | Evaluate the expressions over a batch of objects, the columns they refer
+-- to are decoded only once for all of them.
+evalColumns :: [ScalarExpr] -> V.Vector FlowObject -> [Column]
+evalColumns scalars objs = L.map (evalColumn cols objs) scalars
+  where cols = decodeColumns (L.concatMap columnRefs scalars) objs
+
+-- | The selection vector of the filter: positions of the objects on which
+-- the predicate is TRUE, in ascending order.
+selectRows :: ScalarExpr -> V.Vector FlowObject -> VU.Vector Int
+selectRows scalar objs = case evalColumns [scalar] objs of
+  [BoolColumn valid xs] -> VU.findIndices id (VU.zipWith (&&) valid xs)
+  [BoxedColumn xs]      -> V.convert $ V.findIndices (\case Right (FlowBoolean True) -> True; _ -> False) xs
+  _                     -> VU.empty
+
+-- | Project a batch of objects, a column whose expression fails on a row is
+-- left out of the object of that row.
+projectRows :: [(ColumnCatalog, ScalarExpr)] -> V.Vector FlowObject -> V.Vector FlowObject
+projectRows tups objs = V.generate (V.length objs) $ \i ->
+  L.foldr (\(cata,col) acc ->
+             case columnValue col i of
+               Left _  -> acc
+               Right v -> HM.insert cata v acc
+          ) HM.empty (L.zip (L.map fst tups) cols)
+  where cols = evalColumns (L.map snd tups) objs
+
+-- | The column references which are evaluated column by column, i.e. which
+-- are not under an expression evaluated by 'scalarExprToFun'.
+columnRefs :: ScalarExpr -> [(Int,Int)]
+columnRefs = \case
+  ColumnRef si ci         -> [(si,ci)]
+  CallUnary _ scalar      -> columnRefs scalar
+  CallBinary _ sc1 sc2    -> columnRefs sc1 ++ columnRefs sc2
+  _                       -> []
+
+-- | Decode the referred columns of all objects in one pass over each object.
+-- Like 'getField', a column is missing in an object unless exactly one
+-- field of the object matches it.
+decodeColumns :: [(Int,Int)] -> V.Vector FlowObject -> Map.Map (Int,Int) Column
+decodeColumns [] _ = Map.empty
+decodeColumns refs objs =
+  Map.fromList [ (ref, fromBoxed (V.map (`V.unsafeIndex` j) rows))
+               | (j, ref) <- L.zip [0..] refs' ]
+  where
+    refs' = Set.toList (Set.fromList refs)
+    refIxs = Map.fromList (L.zip refs' [0 :: Int ..])
+    rows = V.map decodeRow objs
+    decodeRow o =
+      let found = HM.foldlWithKey'
+                    (\acc ColumnCatalog{..} v ->
+                       case Map.lookup (columnStreamId, columnId) refIxs of
+                         Nothing -> acc
+                         Just j  -> IntMap.insertWith (++) j [v] acc
+                    ) IntMap.empty o
+       in V.fromList [ case IntMap.lookup j found of
+                         Just [v] -> Right v
+                         _        -> Left . ERR $ "Can not get column: " <> T.pack (show si) <> "." <> T.pack (show ci) <> "in object: " <> T.pack (show o)
+                     | (j, (si,ci)) <- L.zip [0..] refs' ]
+
+evalColumn :: Map.Map (Int,Int) Column -> V.Vector FlowObject -> ScalarExpr -> Column
+evalColumn cols objs scalar = case scalar of
+  ColumnRef si ci -> cols Map.! (si,ci)
+  Literal constant -> fromBoxed $ V.replicate n (Right $ constantToFlowValue constant)
+  CallUnary op sc ->
+    let col = evalColumn cols objs sc
+     in case unaryKernel op col of
+          Just col' -> col'
+          Nothing   -> BoxedColumn $ V.map (>>= unaryOpOnValue op) (toBoxed col)
+  CallBinary op sc1 sc2 ->
+    let col1 = evalColumn cols objs sc1
+        col2 = evalColumn cols objs sc2
+     in case binaryKernel op col1 col2 of
+          Just col -> col
+          Nothing  -> BoxedColumn $ V.zipWith (\v1 v2 -> do
+                                                  x1 <- v1
+                                                  x2 <- v2
+                                                  binOpOnValue op x1 x2
+                                               ) (toBoxed col1) (toBoxed col2)
+  _ -> BoxedColumn $ V.map (scalarExprToFun scalar) objs
+  where n = V.length objs
+
+--------------------------------------------------------------------------------
+-- Kernels, with the same semantics as the operators in
+-- "HStream.SQL.Codegen.BinOp" and "HStream.SQL.Codegen.UnaryOp" on the
+-- values of the typed columns.
+
+unaryKernel :: UnaryOp -> Column -> Maybe Column
+unaryKernel OpNot (BoolColumn valid xs)  = Just $ BoolColumn valid (VU.map not xs)
+unaryKernel OpAbs (IntColumn valid xs)   = Just $ IntColumn valid (VU.map abs xs)
+unaryKernel OpAbs (FloatColumn valid xs) = Just $ FloatColumn valid (VU.map abs xs)
+unaryKernel _ _                          = Nothing
+
+binaryKernel :: BinaryOp -> Column -> Column -> Maybe Column
+binaryKernel op col1 col2 = case op of
+  OpAdd -> arith (+) (+)
+  OpSub -> arith (-) (-)
+  OpMul -> arith (*) (*)
+  OpAnd -> logic (&&)
+  OpOr  -> logic (||)
+  OpEQ  -> compareWith eqKernel (==) (==) (==)
+  OpNEQ -> compareWith neqKernel (/=) (/=) (/=)
+  OpLT  -> compareWith ordKernel (<) (<) (<)
+  OpGT  -> compareWith ordKernel (>) (>) (>)
+  OpLEQ -> compareWith ordEqKernel (<=) (<=) (<=)
+  OpGEQ -> compareWith ordEqKernel (>=) (>=) (>=)
+  _     -> Nothing
+  where
+    -- NULL if any operand is NULL
+    arith :: (Int -> Int -> Int) -> (Double -> Double -> Double) -> Maybe Column
+    arith fi ff = case (col1, col2) of
+      (IntColumn v1 xs, IntColumn v2 ys) -> Just $ IntColumn (VU.zipWith (&&) v1 v2) (VU.zipWith fi xs ys)
+      _ -> case (asFloat col1, asFloat col2) of
+        (Just (v1, xs), Just (v2, ys)) -> Just $ FloatColumn (VU.zipWith (&&) v1 v2) (VU.zipWith ff xs ys)
+        _                              -> Nothing
+    logic f = case (col1, col2) of
+      (BoolColumn v1 xs, BoolColumn v2 ys) -> Just $ BoolColumn (VU.zipWith (&&) v1 v2) (VU.zipWith f xs ys)
+      _                                    -> Nothing
+    compareWith kernel fi ff fb = case (col1, col2) of
+      (IntColumn v1 xs, IntColumn v2 ys)   -> Just $ kernel v1 v2 (VU.zipWith fi xs ys)
+      (BoolColumn v1 xs, BoolColumn v2 ys) -> Just $ kernel v1 v2 (VU.zipWith fb xs ys)
+      _ -> case (asFloat col1, asFloat col2) of
+        (Just (v1, xs), Just (v2, ys)) -> Just $ kernel v1 v2 (VU.zipWith ff xs ys)
+        _                              -> Nothing
+
+    -- NULL = NULL is TRUE, NULL = x is FALSE
+    eqKernel v1 v2 rs = BoolColumn (VU.map (const True) rs) (VU.zipWith3 (\a b r -> if a && b then r else not a && not b) v1 v2 rs)
+    -- NULL <> NULL is FALSE, NULL <> x is TRUE
+    neqKernel v1 v2 rs = BoolColumn (VU.map (const True) rs) (VU.zipWith3 (\a b r -> if a && b then r else a || b) v1 v2 rs)
+    -- NULL < NULL is FALSE, NULL < x is NULL
+    ordKernel v1 v2 rs = BoolColumn (VU.zipWith (==) v1 v2) (VU.zipWith3 (\a b r -> a && b && r) v1 v2 rs)
+    -- NULL <= NULL is TRUE, NULL <= x is NULL
+    ordEqKernel v1 v2 rs = BoolColumn (VU.zipWith (==) v1 v2) (VU.zipWith3 (\a b r -> if a && b then r else not a && not b) v1 v2 rs)
+
+    asFloat = \case
+      IntColumn valid xs   -> Just (valid, VU.map fromIntegral xs)
+      FloatColumn valid xs -> Just (valid, xs)
+      _                    -> Nothing
+#endif
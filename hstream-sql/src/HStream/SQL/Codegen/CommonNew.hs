@@ -41,50 +41,81 @@ import           HStream.SQL.Rts
 #define ERR OperationError
 #endif
 
+-- | Compile the expression into a closure on objects. The constructors and
+-- operators are dispatched on once here instead of on every object, and the
+-- sub-expressions without column references are evaluated once, so bind
+-- @scalarExprToFun scalar@ once per query and apply it to the objects.
 scalarExprToFun :: ScalarExpr -> FlowObject -> Either ERROR_TYPE FlowValue
-scalarExprToFun scalar o = case scalar of
-  ColumnRef si ci ->
+scalarExprToFun = snd . compileScalarExpr
+
+-- | The closure of the expression, and whether the expression is constant
+-- (has no column references), computed bottom-up in the same pass. A
+-- constant expression is evaluated once, on the first use of its closure.
+compileScalarExpr :: ScalarExpr -> (Bool, FlowObject -> Either ERROR_TYPE FlowValue)
+compileScalarExpr scalar = foldConstant $ case scalar of
+  ColumnRef si ci -> (False, \o ->
     case getField (si,ci) o of
       Nothing    -> Left . ERR $ "Can not get column: " <> T.pack (show si) <> "." <> T.pack (show ci) <> "in object: " <> T.pack (show o)
-      Just (_,v) -> Right v
-  Literal constant -> Right $ constantToFlowValue constant
-  CallUnary op scalar -> do
-    v1 <- scalarExprToFun scalar o
-    unaryOpOnValue op v1
-  CallBinary op scalar1 scalar2 -> do
-    v1 <- scalarExprToFun scalar1 o
-    v2 <- scalarExprToFun scalar2 o
-    binOpOnValue op v1 v2
-  CallTernary op scalar1 scalar2 scalar3 -> do
-    v1 <- scalarExprToFun scalar1 o
-    v2 <- scalarExprToFun scalar2 o
-    v3 <- scalarExprToFun scalar3 o
-    terOpOnValue op v1 v2 v3
-  CallCast scalar typ -> do
-    v1 <- scalarExprToFun scalar o
-    castOnValue typ v1
-  CallJson op scalar1 scalar2 -> do
-    v1 <- scalarExprToFun scalar1 o
-    v2 <- scalarExprToFun scalar2 o
-    jsonOpOnValue op v1 v2
-  ValueArray scalars -> do
-    values <- mapM (flip scalarExprToFun o) scalars
-    return $ FlowArray values
-  AccessArray scalar rhs -> do
-    v1 <- scalarExprToFun scalar o
-    case v1 of
-      FlowArray arr -> case rhs of
-        BoundArrayAccessRhsIndex n ->
-          if n >= 0 && n < L.length arr then
-            Right $ arr L.!! n else
-            Left . ERR $ "Access array operator: out of bound"
-        BoundArrayAccessRhsRange start_m end_m ->
-          let start = fromMaybe 0 start_m
-              end   = fromMaybe (maxBound :: Int) end_m
-           in if start >= 0 && end < L.length arr then
-                Right $ FlowArray (L.drop start (L.take (end+1) arr)) else
-                Left . ERR $ "Access array operator: out of bound"
-      _ -> Left . ERR $ "Can not perform AccessArray operator on value " <> T.pack (show v1)
+      Just (_,v) -> Right v)
+  Literal constant ->
+    let v = Right $ constantToFlowValue constant in (True, const v)
+  CallUnary op scalar1 ->
+    let (c1, f1) = compileScalarExpr scalar1
+        g        = unaryOpOnValue op
+     in (c1, \o -> f1 o >>= g)
+  CallBinary op scalar1 scalar2 ->
+    let (c1, f1) = compileScalarExpr scalar1
+        (c2, f2) = compileScalarExpr scalar2
+        g        = binOpOnValue op
+     in (c1 && c2, \o -> do
+          v1 <- f1 o
+          v2 <- f2 o
+          g v1 v2)
+  CallTernary op scalar1 scalar2 scalar3 ->
+    let (c1, f1) = compileScalarExpr scalar1
+        (c2, f2) = compileScalarExpr scalar2
+        (c3, f3) = compileScalarExpr scalar3
+        g        = terOpOnValue op
+     in (c1 && c2 && c3, \o -> do
+          v1 <- f1 o
+          v2 <- f2 o
+          v3 <- f3 o
+          g v1 v2 v3)
+  CallCast scalar1 typ ->
+    let (c1, f1) = compileScalarExpr scalar1
+        g        = castOnValue typ
+     in (c1, \o -> f1 o >>= g)
+  CallJson op scalar1 scalar2 ->
+    let (c1, f1) = compileScalarExpr scalar1
+        (c2, f2) = compileScalarExpr scalar2
+        g        = jsonOpOnValue op
+     in (c1 && c2, \o -> do
+          v1 <- f1 o
+          v2 <- f2 o
+          g v1 v2)
+  ValueArray scalars ->
+    let (cs, fs) = L.unzip (L.map compileScalarExpr scalars)
+     in (L.and cs, \o -> FlowArray <$> mapM ($ o) fs)
+  AccessArray scalar1 rhs ->
+    let (c1, f1) = compileScalarExpr scalar1
+        access = case rhs of
+          BoundArrayAccessRhsIndex n -> \arr ->
+            if n >= 0 && n < L.length arr then
+              Right $ arr L.!! n else
+              Left . ERR $ "Access array operator: out of bound"
+          BoundArrayAccessRhsRange start_m end_m ->
+            let start = fromMaybe 0 start_m
+                end   = fromMaybe (maxBound :: Int) end_m
+             in \arr ->
+                  if start >= 0 && end < L.length arr then
+                    Right $ FlowArray (L.drop start (L.take (end+1) arr)) else
+                    Left . ERR $ "Access array operator: out of bound"
+     in (c1, \o -> f1 o >>= \case
+          FlowArray arr -> access arr
+          v1            -> Left . ERR $ "Can not perform AccessArray operator on value " <> T.pack (show v1))
+  where
+    foldConstant (True, f) = let v = f HM.empty in (True, const v)
+    foldConstant compiled  = compiled
 
 --------------------------------------------------------------------------------
 -- Aggregate
@@ -150,10 +181,10 @@ genAggregateComponent agg cata = case agg of
   Unary uAgg expr ->
     AggregateComponent
     { aggregateInit = HM.singleton cata (unaryAggInitValue uAgg)
-    , aggregateF = \acc row ->
+    , aggregateF = let f = scalarExprToFun expr in \acc row ->
         case getField (0,columnId cata) acc of
           Just (k, acc_v) ->
-            case scalarExprToFun expr row of
+            case f row of
               Left e      -> Left (e, HM.fromList [(cata, FlowNull)])
               Right row_v ->
                 case unaryAggOpOnValue uAgg acc_v row_v of
@@ -177,13 +208,15 @@ genAggregateComponent agg cata = case agg of
   Binary bAgg exprV exprK ->
     AggregateComponent
     { aggregateInit = HM.singleton cata (binaryAggInitValue bAgg)
-    , aggregateF = \acc row ->
+    , aggregateF = let fK = scalarExprToFun exprK
+                       fV = scalarExprToFun exprV
+                    in \acc row ->
         case getField (0, columnId cata) acc of
           Just (key, acc_v) ->
-            case scalarExprToFun exprK row of
+            case fK row of
               Left e    -> Left (e, HM.fromList [(cata, FlowNull)])
               Right k_v ->
-                case scalarExprToFun exprV row of
+                case fV row of
                   Left e      ->
                     Left (e, HM.fromList [(cata, FlowNull)])
                   Right row_v ->
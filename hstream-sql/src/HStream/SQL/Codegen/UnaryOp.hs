@@ -31,51 +31,51 @@ import           HStream.SQL.Binder
 
 --------------------------------------------------------------------------------
 unaryOpOnValue :: UnaryOp -> FlowValue -> Either ERROR_TYPE FlowValue
-unaryOpOnValue OpSin   v    = op_sin v
-unaryOpOnValue OpSinh  v    = op_sinh v
-unaryOpOnValue OpAsin  v    = op_asin v
-unaryOpOnValue OpAsinh v    = op_asinh v
-unaryOpOnValue OpCos   v    = op_cos v
-unaryOpOnValue OpCosh  v    = op_cosh v
-unaryOpOnValue OpAcos  v    = op_acos v
-unaryOpOnValue OpAcosh v    = op_acosh v
-unaryOpOnValue OpTan   v    = op_tan v
-unaryOpOnValue OpTanh  v    = op_tanh v
-unaryOpOnValue OpAtan  v    = op_atan v
-unaryOpOnValue OpAtanh v    = op_atanh v
-unaryOpOnValue OpAbs   v    = op_abs v
-unaryOpOnValue OpCeil  v    = op_ceil v
-unaryOpOnValue OpFloor v    = op_floor v
-unaryOpOnValue OpRound v    = op_round v
-unaryOpOnValue OpSign  v    = op_sign v
-unaryOpOnValue OpSqrt  v    = op_sqrt v
-unaryOpOnValue OpLog   v    = op_log v
-unaryOpOnValue OpLog2  v    = op_log2 v
-unaryOpOnValue OpLog10 v    = op_log10 v
-unaryOpOnValue OpExp   v    = op_exp v
-unaryOpOnValue OpIsInt v    = op_isInt v
-unaryOpOnValue OpIsFloat v  = op_isFloat v
-unaryOpOnValue OpIsBool v   = op_isBool v
-unaryOpOnValue OpIsNum v    = op_isNum v
-unaryOpOnValue OpIsStr v    = op_isStr v
-unaryOpOnValue OpIsArr v    = op_isArr v
-unaryOpOnValue OpIsDate v   = op_isDate v
-unaryOpOnValue OpIsTime v   = op_isTime v
-unaryOpOnValue OpToStr v    = op_toStr v
-unaryOpOnValue OpToLower v  = op_toLower v
-unaryOpOnValue OpToUpper v  = op_toUpper v
-unaryOpOnValue OpTrim v     = op_trim v
-unaryOpOnValue OpLTrim v    = op_ltrim v
-unaryOpOnValue OpRTrim v    = op_rtrim v
-unaryOpOnValue OpReverse v  = op_reverse v
-unaryOpOnValue OpStrLen v   = op_strlen v
-unaryOpOnValue OpDistinct v = op_distinct v
-unaryOpOnValue OpArrJoin v  = op_arrJoin v
-unaryOpOnValue OpLength v   = op_length v
-unaryOpOnValue OpArrMax v   = op_arrMax v
-unaryOpOnValue OpArrMin v   = op_arrMin v
-unaryOpOnValue OpSort v     = op_sort v
-unaryOpOnValue OpNot v      = op_not v
+unaryOpOnValue OpSin       = op_sin
+unaryOpOnValue OpSinh      = op_sinh
+unaryOpOnValue OpAsin      = op_asin
+unaryOpOnValue OpAsinh     = op_asinh
+unaryOpOnValue OpCos       = op_cos
+unaryOpOnValue OpCosh      = op_cosh
+unaryOpOnValue OpAcos      = op_acos
+unaryOpOnValue OpAcosh     = op_acosh
+unaryOpOnValue OpTan       = op_tan
+unaryOpOnValue OpTanh      = op_tanh
+unaryOpOnValue OpAtan      = op_atan
+unaryOpOnValue OpAtanh     = op_atanh
+unaryOpOnValue OpAbs       = op_abs
+unaryOpOnValue OpCeil      = op_ceil
+unaryOpOnValue OpFloor     = op_floor
+unaryOpOnValue OpRound     = op_round
+unaryOpOnValue OpSign      = op_sign
+unaryOpOnValue OpSqrt      = op_sqrt
+unaryOpOnValue OpLog       = op_log
+unaryOpOnValue OpLog2      = op_log2
+unaryOpOnValue OpLog10     = op_log10
+unaryOpOnValue OpExp       = op_exp
+unaryOpOnValue OpIsInt     = op_isInt
+unaryOpOnValue OpIsFloat   = op_isFloat
+unaryOpOnValue OpIsBool    = op_isBool
+unaryOpOnValue OpIsNum     = op_isNum
+unaryOpOnValue OpIsStr     = op_isStr
+unaryOpOnValue OpIsArr     = op_isArr
+unaryOpOnValue OpIsDate    = op_isDate
+unaryOpOnValue OpIsTime    = op_isTime
+unaryOpOnValue OpToStr     = op_toStr
+unaryOpOnValue OpToLower   = op_toLower
+unaryOpOnValue OpToUpper   = op_toUpper
+unaryOpOnValue OpTrim      = op_trim
+unaryOpOnValue OpLTrim     = op_ltrim
+unaryOpOnValue OpRTrim     = op_rtrim
+unaryOpOnValue OpReverse   = op_reverse
+unaryOpOnValue OpStrLen    = op_strlen
+unaryOpOnValue OpDistinct  = op_distinct
+unaryOpOnValue OpArrJoin   = op_arrJoin
+unaryOpOnValue OpLength    = op_length
+unaryOpOnValue OpArrMax    = op_arrMax
+unaryOpOnValue OpArrMin    = op_arrMin
+unaryOpOnValue OpSort      = op_sort
+unaryOpOnValue OpNot       = op_not
 
 --------------------------------------------------------------------------------
 op_sin :: FlowValue -> Either ERROR_TYPE FlowValue
@@ -53,7 +53,7 @@ import           HStream.Processing.Stream                       (Materialized (
                                                                   StreamSourceConfig (..))
 import qualified HStream.Processing.Stream                       as HS
 import qualified HStream.Processing.Stream.GroupedStream         as HG
-import           HStream.Processing.Stream.JoinWindows           (JoinWindows (..))
+import           HStream.Processing.Stream.JoinWindows           (mkJoinWindows)
 import qualified HStream.Processing.Stream.SessionWindowedStream as HSW
 import           HStream.Processing.Stream.SessionWindows        (mkSessionWindows,
                                                                   sessionWindowKeySerde)
@@ -197,8 +197,8 @@ genStreamJoinedConfig = do
 genMaterialized :: Maybe WindowType -> IO (HS.Materialized K V V)
 genMaterialized win_m = do
   aggStore <- case win_m of
-    Just (Session _) -> mkInMemoryStateSessionStore
-    _                -> mkInMemoryStateKVStore
+    Nothing -> mkInMemoryStateKVStore
+    Just _  -> mkInMemoryStateSessionStore
   return $ HS.Materialized
            { mKeySerde   = flowObjectFlowObjectSerde
            , mValueSerde = flowObjectFlowObjectSerde
@@ -284,11 +284,7 @@ relationExprToGraph relation builder = case relation of
     let joiner = HM.union
         joinCond = \_ _ -> True
         newKeySelector = \_ _ -> HM.fromList [] -- Default key is empty. See HStream.Processing.Stream#joinStreamProcessor
-        joinWindows = JoinWindows
-                    { jwBeforeMs = t
-                    , jwAfterMs  = t
-                    , jwGraceMs  = 0
-                    }
+        joinWindows = mkJoinWindows t t
     (es1,srcs1,joins1,mats1) <- relationExprToGraph r1 builder
     (es2,srcs2,joins2,mats2) <- relationExprToGraph r2 builder
     -- FIXME: join timewindowed stream
@@ -305,11 +301,7 @@ relationExprToGraph relation builder = case relation of
             Left _  -> False -- FIXME: log error message
             Right v -> v == FlowBoolean True
         newKeySelector = \_ _ -> HM.fromList [] -- Default key is empty. See HStream.Processing.Stream#joinStreamProcessor
-        joinWindows = JoinWindows
-                    { jwBeforeMs = t
-                    , jwAfterMs  = t
-                    , jwGraceMs  = 0
-                    }
+        joinWindows = mkJoinWindows t t
     (es1,srcs1,joins1,mats1) <- relationExprToGraph r1 builder
     (es2,srcs2,joins2,mats2) <- relationExprToGraph r2 builder
     -- FIXME: join timewindowed stream
@@ -325,11 +317,7 @@ relationExprToGraph relation builder = case relation of
           HM.mapKeys (\(ColumnCatalog f _) -> ColumnCatalog f Nothing) (HM.filterWithKey (\(ColumnCatalog f s_m) _ -> isJust s_m && L.elem f cols) (recordValue record1)) ==
           HM.mapKeys (\(ColumnCatalog f _) -> ColumnCatalog f Nothing) (HM.filterWithKey (\(ColumnCatalog f s_m) _ -> isJust s_m && L.elem f cols) (recordValue record2))
         newKeySelector = \_ _ -> HM.fromList [] -- Default key is empty. See HStream.Processing.Stream#joinStreamProcessor
-        joinWindows = JoinWindows
-                    { jwBeforeMs = t
-                    , jwAfterMs  = t
-                    , jwGraceMs  = 0
-                    }
+        joinWindows = mkJoinWindows t t
     (es1,srcs1,joins1,mats1) <- relationExprToGraph r1 builder
     (es2,srcs2,joins2,mats2) <- relationExprToGraph r2 builder
     -- FIXME: join timewindowed stream
@@ -350,11 +338,7 @@ relationExprToGraph relation builder = case relation of
                                else False
                             ) True (recordValue record1)
         newKeySelector = \_ _ -> HM.fromList [] -- Default key is empty. See HStream.Processing.Stream#joinStreamProcessor
-        joinWindows = JoinWindows
-                    { jwBeforeMs = t
-                    , jwAfterMs  = t
-                    , jwGraceMs  = 0
-                    }
+        joinWindows = mkJoinWindows t t
     (es1,srcs1,joins1,mats1) <- relationExprToGraph r1 builder
     (es2,srcs2,joins2,mats2) <- relationExprToGraph r2 builder
     -- FIXME: join timewindowed stream
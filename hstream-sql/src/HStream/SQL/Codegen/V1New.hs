@@ -34,6 +34,8 @@ import           Data.Scientific                                 (fromFloatDigit
                                                                   scientific)
 import           Data.Text                                       (pack)
 import qualified Data.Text                                       as T
+import qualified Data.Vector                                     as V
+import qualified Data.Vector.Unboxed                             as VU
 import           Data.Text.Prettyprint.Doc                       as PP
 import           Data.Text.Prettyprint.Doc.Render.Text           as PP
 import           Data.Time                                       (diffTimeToPicoseconds,
@@ -59,7 +61,7 @@ import           HStream.Processing.Stream                       (Materialized (
                                                                   StreamSourceConfig (..))
 import qualified HStream.Processing.Stream                       as HS
 import qualified HStream.Processing.Stream.GroupedStream         as HG
-import           HStream.Processing.Stream.JoinWindows           (JoinWindows (..))
+import           HStream.Processing.Stream.JoinWindows           (mkJoinWindows)
 import qualified HStream.Processing.Stream.SessionWindowedStream as HSW
 import           HStream.Processing.Stream.SessionWindows        (mkSessionWindows,
                                                                   sessionWindowKeySerde)
@@ -73,6 +75,7 @@ import qualified HStream.Processing.Table                        as HT
 import qualified HStream.Processing.Type                         as HPT
 import           HStream.SQL.Binder
 import           HStream.SQL.Codegen.ColumnCatalogNew
+import           HStream.SQL.Codegen.ColumnarNew
 import           HStream.SQL.Codegen.CommonNew
 import           HStream.SQL.Codegen.Utils
 import           HStream.SQL.Codegen.V1New.Boilerplate
@@ -135,6 +138,17 @@ data HStreamPlan
 streamCodegen :: HasCallStack => Text -> (Text -> IO (Maybe Schema)) -> IO HStreamPlan
 streamCodegen input getSchema = parseAndBind input getSchema >>= (flip hstreamCodegen) getSchema
 
+-- | The pushdowns to the source streams of the query in a statement, see
+-- 'relationExprPushdowns'. A statement which does not run a query on
+-- streams has none.
+sourcePushdowns :: HasCallStack => Text -> (Text -> IO (Maybe Schema)) -> IO (HM.HashMap Text SourcePushdown)
+sourcePushdowns input getSchema = parseAndBind input getSchema >>= \bsql -> case bsql of
+  BoundQSelect{}                     -> relationExprPushdowns <$> planIO bsql getSchema
+  BoundQPushSelect{}                 -> relationExprPushdowns <$> planIO bsql getSchema
+  BoundQCreate (BoundCreateAs{})     -> relationExprPushdowns <$> planIO bsql getSchema
+  BoundQCreate (BoundCreateView{})   -> relationExprPushdowns <$> planIO bsql getSchema
+  _                                  -> return HM.empty
+
 hstreamCodegen :: HasCallStack => BoundSQL -> (Text -> IO (Maybe Schema)) -> IO HStreamPlan
 hstreamCodegen bsql getSchema = case bsql of
   BoundQSelect select -> do
@@ -216,8 +230,8 @@ genStreamJoinedConfig = do
 genMaterialized :: Maybe WindowType -> IO (HS.Materialized K V V)
 genMaterialized win_m = do
   aggStore <- case win_m of
-    Just (Session _) -> mkInMemoryStateSessionStore
-    _                -> mkInMemoryStateKVStore
+    Nothing -> mkInMemoryStateKVStore
+    Just _  -> mkInMemoryStateSessionStore
   return $ HS.Materialized
            { mKeySerde   = flowObjectFlowObjectSerde
            , mValueSerde = flowObjectFlowObjectSerde
@@ -248,23 +262,15 @@ withEStreamM (EStream2 ts) SK f1 f2 = do
   return $ EStream2 ts'
 withEStreamM (EStream2 ts) SKT f1 f2 = throwSQLException CodegenException Nothing "Applying a time window to a time-windowed stream is not supported"
 
-filterFilterR :: ScalarExpr -> Record k V -> Bool
-filterFilterR scalar =
-  \Record{..} ->
-    case scalarExprToFun scalar recordValue of
-      Left e  -> False -- FIXME: log error message
-      Right v -> v == FlowBoolean True
+filterFilterB :: ScalarExpr -> V.Vector (Record k V) -> VU.Vector Int
+filterFilterB scalar =
+  \records -> selectRows scalar (V.map recordValue records) -- FIXME: log error message
 
-projectMapR :: [(ColumnCatalog, ScalarExpr)] -> Record k V -> Record k V
-projectMapR tups =
-  \record@Record{..} ->
-    let recordValue' =
-          L.foldr (\(cata,scalar) acc ->
-                     case scalarExprToFun scalar recordValue of
-                       Left _  -> acc
-                       Right v -> HM.insert cata v acc
-                  ) HM.empty tups
-     in record{ recordValue = recordValue' }
+projectMapB :: [(ColumnCatalog, ScalarExpr)] -> V.Vector (Record k V) -> V.Vector (Record k V)
+projectMapB tups =
+  \records ->
+    V.zipWith (\record recordValue' -> record{ recordValue = recordValue' })
+              records (projectRows tups (V.map recordValue records))
 
 joinMapR :: Int -> Record k V -> Record k V
 joinMapR n =
@@ -287,16 +293,13 @@ relationExprToGraph relation builder = case relation of
     return (EStream1 s', [schemaOwner schema], [], [])
   LoopJoinOn schema r1 r2 expr typ t -> do
     let joiner = \o1 o2 -> setFlowObjectStreamId 0 (o1 <++> o2)
+        joinCondFun = scalarExprToFun expr
         joinCond = \record1 record2 ->
-          case scalarExprToFun expr (recordValue record1 `HM.union` recordValue record2) of
+          case joinCondFun (recordValue record1 `HM.union` recordValue record2) of
             Left e  -> False -- FIXME: log error message
             Right v -> v == FlowBoolean True
         newKeySelector = \_ _ -> HM.fromList [] -- Default key is empty. See HStream.Processing.Stream#joinStreamProcessor
-        joinWindows = JoinWindows
-                    { jwBeforeMs = t
-                    , jwAfterMs  = t
-                    , jwGraceMs  = 0
-                    }
+        joinWindows = mkJoinWindows t t
     (es1,srcs1,joins1,mats1) <- relationExprToGraph r1 builder
     (es2,srcs2,joins2,mats2) <- relationExprToGraph r2 builder
 
@@ -315,22 +318,23 @@ relationExprToGraph relation builder = case relation of
       _ -> throwSQLException CodegenException Nothing "Joining time-windowed and non-time-windowed streams is not supported"
   Planner.Filter schema r scalar -> do
     (es,srcs,joins,mats) <- relationExprToGraph r builder
-    es' <- withEStreamM es SK (HS.filter $ filterFilterR scalar)
-                              (HS.filter $ filterFilterR scalar)
+    es' <- withEStreamM es SK (HS.filterBatch $ filterFilterB scalar)
+                              (HS.filterBatch $ filterFilterB scalar)
     return (es',srcs,joins,mats)
   Project schema r scalars -> do
     (es,srcs,joins,mats) <- relationExprToGraph r builder
     let cataTups = IntMap.elems (schemaColumns schema) `zip` scalars
-    es' <- withEStreamM es SK (HS.map $ projectMapR cataTups)
-                              (HS.map $ projectMapR cataTups)
+    es' <- withEStreamM es SK (HS.mapBatch $ projectMapB cataTups)
+                              (HS.mapBatch $ projectMapB cataTups)
     return (es',srcs,joins,mats)
   Reduce schema r scalars aggs win_m -> do
-    let keygen = \Record{..} ->
-          L.foldr (\(cata,scalar) acc ->
-                      case scalarExprToFun scalar recordValue of
+    let keyFuns = IntMap.elems (schemaColumns schema) `zip` L.map scalarExprToFun scalars
+        keygen = \Record{..} ->
+          L.foldr (\(cata,f) acc ->
+                      case f recordValue of
                         Left _  -> HM.insert cata FlowNull acc
                         Right v -> HM.insert cata v acc
-                  ) HM.empty (IntMap.elems (schemaColumns schema) `zip` scalars)
+                  ) HM.empty keyFuns
     let aggComp@AggregateComponent{..} =
           composeAggs (L.map (\(cata,agg) ->
                                  genAggregateComponent agg
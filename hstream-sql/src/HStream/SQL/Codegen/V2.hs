@@ -201,11 +201,13 @@ relationExprToGraph relation startBuilder subgraph = case relation of
   LoopJoinUsing r1 r2 cols typ -> do
     (builder1, ins1, out1) <- relationExprToGraph r1 startBuilder subgraph
     (builder2, ins2, out2) <- relationExprToGraph r2 builder1 subgraph
-    let (builder3, node1_indexed) = addNode builder2 subgraph (IndexSpec (outNode out1))
-        (builder4, node2_indexed) = addNode builder3 subgraph (IndexSpec (outNode out2))
-    let joinCond = \o1 o2 ->
-          HM.mapKeys (\(ColumnCatalog f _) -> ColumnCatalog f Nothing) (HM.filterWithKey (\(ColumnCatalog f s_m) _ -> isJust s_m && L.elem f cols) o1) ==
-          HM.mapKeys (\(ColumnCatalog f _) -> ColumnCatalog f Nothing) (HM.filterWithKey (\(ColumnCatalog f s_m) _ -> isJust s_m && L.elem f cols) o2)
+    -- both sides are arranged by the USING columns, so an inner join only
+    -- looks up the rows of the same key
+    let usingKey o =
+          HM.mapKeys (\(ColumnCatalog f _) -> ColumnCatalog f Nothing) (HM.filterWithKey (\(ColumnCatalog f s_m) _ -> isJust s_m && L.elem f cols) o)
+        (builder3, node1_indexed) = addNode builder2 subgraph (ArrangeSpec (outNode out1) usingKey)
+        (builder4, node2_indexed) = addNode builder3 subgraph (ArrangeSpec (outNode out2) usingKey)
+    let joinCond = \o1 o2 -> usingKey o1 == usingKey o2
         joinType = case typ of
                      InnerJoin -> MergeJoinInner
                      LeftJoin  -> MergeJoinLeft
@@ -3,8 +3,11 @@
 module HStream.SQL.PlannerNew.Extra where
 
 import           Control.Applicative          ((<|>))
+import qualified Data.HashMap.Strict          as HM
 import           Data.Int                     (Int64)
 import qualified Data.IntMap                  as IntMap
+import           Data.IntSet                  (IntSet)
+import qualified Data.IntSet                  as IntSet
 import           Data.Text                    (Text)
 import qualified Data.Time                    as Time
 
@@ -55,3 +58,62 @@ scanRelationExpr p trans_m r = if p r then
     Union s r1 r2               -> let tup1 = scanRelationExpr p trans_m r1
                                        tup2 = scanRelationExpr p trans_m r2
                                     in (fst tup1 <|> fst tup2, Union s (snd tup1) (snd tup2))
+
+--------------------------------------------------------------------------------
+
+-- | What can be done by the reader of a source stream before its records
+-- enter the plan.
+data SourcePushdown = SourcePushdown
+  { -- | Ids of the columns the plan reads, 'Nothing' if it reads all of them
+    pushdownColumns   :: Maybe IntSet
+    -- | The records on which the predicate is not TRUE can be dropped
+  , pushdownPredicate :: Maybe ScalarExpr
+  } deriving Show
+
+-- | Ids of the columns an expression refers to.
+scalarExprColumnIds :: ScalarExpr -> IntSet
+scalarExprColumnIds scalar = case scalar of
+  ColumnRef _ ci        -> IntSet.singleton ci
+  Literal _             -> IntSet.empty
+  CallUnary _ e         -> scalarExprColumnIds e
+  CallBinary _ e1 e2    -> scalarExprColumnIds e1 <> scalarExprColumnIds e2
+  CallTernary _ e1 e2 e3 -> scalarExprColumnIds e1 <> scalarExprColumnIds e2 <> scalarExprColumnIds e3
+  CallCast e _          -> scalarExprColumnIds e
+  CallJson _ e1 e2      -> scalarExprColumnIds e1 <> scalarExprColumnIds e2
+  ValueArray es         -> IntSet.unions (scalarExprColumnIds <$> es)
+  AccessArray e _       -> scalarExprColumnIds e
+
+aggregateExprColumnIds :: AggregateExpr -> IntSet
+aggregateExprColumnIds agg = case agg of
+  Nullary _        -> IntSet.empty
+  Unary _ e        -> scalarExprColumnIds e
+  Binary _ e1 e2   -> scalarExprColumnIds e1 <> scalarExprColumnIds e2
+
+-- | The pushdowns to the source streams of a plan, by stream name.
+--
+-- The columns are pruned through the chains of 'Filter's, 'Project's and
+-- 'Reduce's above a 'StreamScan', and a 'Filter' right above it is pushed
+-- down as the predicate. The inputs of joins and unions, and streams which
+-- are scanned more than once, are read in full.
+relationExprPushdowns :: RelationExpr -> HM.HashMap Text SourcePushdown
+relationExprPushdowns = HM.fromListWith merge . go Nothing
+  where
+    go needed r = case r of
+      StreamScan schema       -> [(schemaOwner schema, SourcePushdown needed Nothing)]
+      Filter _ (StreamScan schema) e ->
+        [(schemaOwner schema, SourcePushdown (IntSet.union (scalarExprColumnIds e) <$> needed) (Just e))]
+      Filter _ r' e           -> go (IntSet.union (scalarExprColumnIds e) <$> needed) r'
+      Project _ r' es         -> go (Just $ IntSet.unions (scalarExprColumnIds <$> es)) r'
+      Reduce _ r' es aggs _   -> go (Just $ IntSet.unions (scalarExprColumnIds <$> es) <>
+                                            IntSet.unions (aggregateExprColumnIds <$> aggs)) r'
+      -- a distinct compares whole rows
+      Distinct _ r'           -> go Nothing r'
+      LoopJoinOn _ r1 r2 _ _ _ -> go Nothing r1 ++ go Nothing r2
+      Union _ r1 r2           -> go Nothing r1 ++ go Nothing r2
+    merge _ _ = SourcePushdown Nothing Nothing
+
+-- | Keep only the pushed-down columns of the schema of a source stream.
+pruneSchema :: SourcePushdown -> Schema -> Schema
+pruneSchema SourcePushdown{..} schema = case pushdownColumns of
+  Nothing  -> schema
+  Just ids -> schema { schemaColumns = IntMap.filter (\c -> columnId c `IntSet.member` ids) (schemaColumns schema) }
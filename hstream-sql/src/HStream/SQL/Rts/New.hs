@@ -237,6 +237,17 @@ jsonObjectToFlowObject schema object =
 jsonObjectToFlowObject' :: Aeson.Object -> FlowObject
 jsonObjectToFlowObject' json = jsonObjectToFlowObject (extractJsonObjectSchema json) json
 
+-- | Like 'jsonObjectToFlowObject', but only looks up and converts the fields
+-- of the columns in the schema, the other fields of the object are ignored
+-- (instead of being rejected). Used with a schema pruned to the columns a
+-- query reads.
+jsonObjectToFlowObjectOnly :: Schema -> Aeson.Object -> FlowObject
+jsonObjectToFlowObjectOnly schema object =
+  HM.fromList [ (cata, jsonValueToFlowValue (columnType cata, v))
+              | cata <- IntMap.elems (schemaColumns schema)
+              , Just v <- [HsAeson.lookup (HsAeson.fromText $ columnName cata) object]
+              ]
+
 -- | Normalize a 'FlowObject' by a 'Schema'.
 -- It is tricy! See `transKSrc` and `transVSrc`
 -- in 'ViewNew.hs'...
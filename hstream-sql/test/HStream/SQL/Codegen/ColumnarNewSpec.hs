@@ -0,0 +1,125 @@
+{-# LANGUAGE CPP               #-}
+{-# LANGUAGE OverloadedStrings #-}
+
+module HStream.SQL.Codegen.ColumnarNewSpec where
+
+import           Test.Hspec
+
+#ifdef HStreamEnableSchema
+import qualified Data.HashMap.Strict            as HM
+import qualified Data.Text                      as T
+import qualified Data.Vector                    as V
+import qualified Data.Vector.Unboxed            as VU
+import           Test.QuickCheck
+
+import           HStream.SQL.Binder             (BinaryOp (..),
+                                                 BoundDataType (..),
+                                                 ColumnCatalog (..),
+                                                 Constant (..), UnaryOp (..))
+import           HStream.SQL.Codegen.ColumnarNew
+import           HStream.SQL.Codegen.CommonNew  (scalarExprToFun)
+import           HStream.SQL.PlannerNew.Types   (ScalarExpr (..))
+import           HStream.SQL.Rts                (FlowObject, FlowValue (..))
+#endif
+
+spec :: Spec
+#ifdef HStreamEnableSchema
+spec = describe "Columnar evaluation" $ do
+  -- The errors are compared by their presence only, the messages of the
+  -- column and the row path may differ.
+  it "evaluates expressions the same as the row path" $
+    property $ \(Batch objs) (Expr e) ->
+      let col = head (evalColumns [e] objs)
+       in [ toMaybe (columnValue col i) | i <- [0 .. V.length objs - 1] ]
+            === [ toMaybe (scalarExprToFun e o) | o <- V.toList objs ]
+
+  it "selects the rows on which the predicate is TRUE" $
+    property $ \(Batch objs) (Expr e) ->
+      VU.toList (selectRows e objs)
+        === [ i | (i, o) <- zip [0 ..] (V.toList objs), isTrue (scalarExprToFun e o) ]
+
+  it "leaves the failed columns out of the projected rows" $
+    property $ \(Batch objs) (Expr e1) (Expr e2) ->
+      let tups = [(catalog 10, e1), (catalog 11, e2)]
+       in V.toList (projectRows tups objs)
+            === [ HM.fromList [ (cata, v) | (cata, e) <- tups, Right v <- [scalarExprToFun e o] ]
+                | o <- V.toList objs ]
+
+  it "evaluates NULLs and missing columns as the row path" $ do
+    let objs = V.fromList [ HM.fromList [(catalog 0, FlowNull), (catalog 1, FlowFloat 1.5)]
+                          , HM.fromList [(catalog 0, FlowInt 2)]
+                          , HM.fromList [(catalog 0, FlowNull), (catalog 1, FlowNull)]
+                          ]
+        exprs = [ CallBinary op (ColumnRef 0 0) (ColumnRef 0 1)
+                | op <- [OpAdd, OpEQ, OpNEQ, OpLT, OpLEQ] ]
+    mapM_ (\e -> let col = head (evalColumns [e] objs)
+                  in [ toMaybe (columnValue col i) | i <- [0 .. 2] ]
+                       `shouldBe` [ toMaybe (scalarExprToFun e o) | o <- V.toList objs ]
+          ) exprs
+
+toMaybe :: Either e FlowValue -> Maybe FlowValue
+toMaybe = either (const Nothing) Just
+
+isTrue :: Either e FlowValue -> Bool
+isTrue (Right (FlowBoolean True)) = True
+isTrue _                          = False
+
+catalog :: Int -> ColumnCatalog
+catalog i = ColumnCatalog i ("c" <> T.pack (show i)) 0 "s" BTypeInteger True False
+
+-- | Column 0 is of integers, 1 of floats, 2 of booleans and 3 of mixed
+-- types. All of them may be NULL or missing.
+newtype Batch = Batch (V.Vector FlowObject)
+  deriving Show
+
+instance Arbitrary Batch where
+  arbitrary = Batch . V.fromList <$> listOf genObject
+
+genObject :: Gen FlowObject
+genObject = HM.fromList . concat <$> mapM field [0 .. 3]
+  where
+    field i = frequency [ (1, pure [])
+                        , (10, (\v -> [(catalog i, v)]) <$> genValue i) ]
+
+genValue :: Int -> Gen FlowValue
+genValue i = frequency [(1, pure FlowNull), (6, typed)]
+  where
+    typed = case i of
+      0 -> FlowInt <$> arbitrary
+      1 -> FlowFloat <$> arbitrary
+      2 -> FlowBoolean <$> arbitrary
+      _ -> oneof [ FlowInt <$> arbitrary
+                 , FlowFloat <$> arbitrary
+                 , FlowText . T.pack <$> arbitrary ]
+
+newtype Expr = Expr ScalarExpr
+
+instance Show Expr where
+  show (Expr e) = show e
+
+instance Arbitrary Expr where
+  arbitrary = Expr <$> sized (genExpr . min 8)
+
+-- | Mostly the operators with kernels, and a few without.
+genExpr :: Int -> Gen ScalarExpr
+genExpr 0 = oneof [ ColumnRef 0 <$> choose (0, 3)
+                  , Literal <$> genConstant ]
+genExpr n = frequency
+  [ (2, genExpr 0)
+  , (2, CallUnary <$> elements [OpNot, OpAbs, OpCeil] <*> sub)
+  , (5, CallBinary <$> elements binOps <*> sub <*> sub)
+  , (1, CallCast <$> sub <*> pure BTypeFloat)
+  ]
+  where
+    sub = genExpr (n `div` 2)
+    binOps = [ OpAdd, OpSub, OpMul, OpAnd, OpOr
+             , OpEQ, OpNEQ, OpLT, OpGT, OpLEQ, OpGEQ, OpIfNull ]
+
+genConstant :: Gen Constant
+genConstant = oneof [ pure ConstantNull
+                    , ConstantInt <$> arbitrary
+                    , ConstantFloat <$> arbitrary
+                    , ConstantBoolean <$> arbitrary ]
+#else
+spec = pure ()
+#endif
@@ -0,0 +1,101 @@
+{-# LANGUAGE OverloadedStrings #-}
+{-# LANGUAGE RecordWildCards   #-}
+
+module HStream.SQL.PlannerNew.ExtraSpec where
+
+import qualified Data.HashMap.Strict          as HM
+import qualified Data.IntMap                  as IntMap
+import qualified Data.IntSet                  as IntSet
+import           Data.Text                    (Text)
+import qualified Data.Text                    as T
+import           Test.Hspec
+
+import           HStream.SQL.Binder           (Aggregate (..),
+                                               BinaryOp (..),
+                                               BoundDataType (..),
+                                               BoundJoinType (..),
+                                               ColumnCatalog (..),
+                                               Constant (..),
+                                               NullaryAggregate (..),
+                                               Schema (..),
+                                               UnaryAggregate (..))
+import           HStream.SQL.PlannerNew.Extra
+import           HStream.SQL.PlannerNew.Types
+
+spec :: Spec
+spec = describe "Source pushdowns" $ do
+  let s1 = scan "s1"
+      s2 = scan "s2"
+      p1 = CallBinary OpGT (col 1) (Literal $ ConstantInt 10)
+
+  it "pushes down a filter on a scan" $ do
+    pushdown "s1" (Filter (schemaOf "s1") s1 p1)
+      `shouldBe` Just (Nothing, Just $ show p1)
+    pushdown "s1" (Project (schemaOf "s1") (Filter (schemaOf "s1") s1 p1) [col 0])
+      `shouldBe` Just (Just [0, 1], Just $ show p1)
+
+  it "prunes the columns through projects and filters" $ do
+    pushdown "s1" s1 `shouldBe` Just (Nothing, Nothing)
+    pushdown "s1" (Project (schemaOf "s1") s1 [col 2, CallBinary OpAdd (col 0) (col 3)])
+      `shouldBe` Just (Just [0, 2, 3], Nothing)
+    -- the filter is not right above the scan, its columns are the ones of
+    -- the project
+    pushdown "s1" (Filter (schemaOf "s1") (Project (schemaOf "s1") s1 [col 3]) (col 0))
+      `shouldBe` Just (Just [3], Nothing)
+
+  it "prunes the columns through reduces" $ do
+    let aggs = [Unary AggSum (col 2), Nullary AggCountAll]
+    pushdown "s1" (Reduce (schemaOf "s1") s1 [col 1] aggs Nothing)
+      `shouldBe` Just (Just [1, 2], Nothing)
+    pushdown "s1" (Reduce (schemaOf "s1") (Filter (schemaOf "s1") s1 p1) [col 0] aggs Nothing)
+      `shouldBe` Just (Just [0, 1, 2], Just $ show p1)
+
+  it "prunes the columns of nested projects by the innermost one" $ do
+    pushdown "s1" (Project (schemaOf "s1") (Project (schemaOf "s1") s1 [col 1, col 3]) [col 0])
+      `shouldBe` Just (Just [1, 3], Nothing)
+
+  it "reads the inputs of a distinct in full" $
+    pushdown "s1" (Project (schemaOf "s1") (Distinct (schemaOf "s1") s1) [col 0])
+      `shouldBe` Just (Nothing, Nothing)
+
+  it "reads all the columns of the inputs of joins and unions" $ do
+    let join = LoopJoinOn (schemaOf "j") (Filter (schemaOf "s1") s1 p1) s2
+                          (Literal $ ConstantBoolean True) InnerJoin 1000
+    pushdown "s1" (Project (schemaOf "j") join [col 0]) `shouldBe` Just (Nothing, Just $ show p1)
+    pushdown "s2" (Project (schemaOf "j") join [col 0]) `shouldBe` Just (Nothing, Nothing)
+    let union = Union (schemaOf "u") s1 (Project (schemaOf "s2") s2 [col 0])
+    pushdown "s1" union `shouldBe` Just (Nothing, Nothing)
+    pushdown "s2" union `shouldBe` Just (Nothing, Nothing)
+
+  it "reads a stream scanned more than once in full" $ do
+    let self = Union (schemaOf "u") (Filter (schemaOf "s1") s1 p1)
+                                    (Project (schemaOf "s1") s1 [col 0])
+    pushdown "s1" self `shouldBe` Just (Nothing, Nothing)
+    HM.size (relationExprPushdowns self) `shouldBe` 1
+
+  it "prunes the schema" $ do
+    let schema = schemaOf "s1"
+        columnIds = IntMap.keys . schemaColumns
+    columnIds (pruneSchema (SourcePushdown Nothing Nothing) schema) `shouldBe` [0 .. 3]
+    columnIds (pruneSchema (SourcePushdown (Just $ IntSet.fromList [1, 3]) Nothing) schema) `shouldBe` [1, 3]
+
+-- The pruned columns and the predicate (shown, since there is no Eq) of a
+-- stream.
+pushdown :: Text -> RelationExpr -> Maybe (Maybe [Int], Maybe String)
+pushdown stream r = do
+  SourcePushdown{..} <- HM.lookup stream (relationExprPushdowns r)
+  pure (IntSet.toList <$> pushdownColumns, show <$> pushdownPredicate)
+
+col :: Int -> ScalarExpr
+col = ColumnRef 0
+
+scan :: Text -> RelationExpr
+scan = StreamScan . schemaOf
+
+schemaOf :: Text -> Schema
+schemaOf stream = Schema
+  { schemaOwner = stream
+  , schemaColumns = IntMap.fromList
+      [ (i, ColumnCatalog i ("c" <> T.pack (show i)) 0 stream BTypeInteger True False)
+      | i <- [0 .. 3] ]
+  }
@@ -14,11 +14,21 @@ module HStream.Store
   , setClientSettings
   , getClientSetting
   , getTailLSN
+  , getTailLSNs
+  , getTailLSNBatch
+  , LogTailAttributes (..)
+  , getLogTailAttrsBatch
+  , LogHeadAttributes (..)
+  , getLogHeadAttrsBatch
   , trim
+  , trimBatch
   , trimLast
   , trimLastBefore
   , findTime
   , findKey
+  , findTimes
+  , findTimeBatch
+  , findKeyBatch
   , logIdHasGroup
 
     -- * Stream
@@ -32,8 +42,9 @@ module HStream.Store
 import           Control.Monad                    (forM_)
 import           Data.Map.Strict                  (Map)
 import qualified Data.Map.Strict                  as Map
+import           Data.Int                         (Int64)
 import           Data.Word                        (Word64)
-import           GHC.Stack                        (HasCallStack)
+import           GHC.Stack                        (HasCallStack, callStack)
 import           Z.Data.CBytes                    (CBytes)
 
 import           HStream.Store.Exception
@@ -54,3 +65,17 @@ trimLastBefore offset client logid = do
   lsn <- getTailLSN client logid
   trim client logid (lsn - offset)
 {-# INLINABLE trimLastBefore #-}
+
+-- | Get the tail lsns of logs concurrently, throw if any of them failed.
+getTailLSNs :: HasCallStack => LDClient -> [C_LogID] -> IO [LSN]
+getTailLSNs client logids =
+  mapM (either (`throwStreamError` callStack) pure) =<< getTailLSNBatch client 0 logids
+
+-- | Find the lsns of (logid, timestamp) pairs concurrently, throw if any of
+-- them failed.
+findTimes
+  :: HasCallStack
+  => LDClient -> FindKeyAccuracy -> [(C_LogID, Int64)] -> IO [LSN]
+findTimes client accuracy reqs =
+  mapM (either (`throwStreamError` callStack) pure)
+    =<< findTimeBatch client 0 accuracy reqs
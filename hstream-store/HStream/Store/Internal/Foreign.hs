@@ -105,6 +105,25 @@ withAsyncPrimUnsafe3' a b c f g = mask_ $ do
       return e
   return (a_, b_, c_, e_)
 
+-- | Run an asynchronous ffi which writes its results into pinned buffers.
+--
+-- The first argument should touch all these buffers, so that they are kept
+-- alive until the callback fired, even if we are interrupted.
+withAsyncKeepAlive
+  :: IO ()
+  -> (StablePtr PrimMVar -> Int -> IO b)
+  -> (b -> IO c)
+  -> IO c
+withAsyncKeepAlive touchBufs f g = mask_ $ do
+  mvar <- newEmptyMVar
+  sp <- newStablePtrPrimMVar mvar
+  (cap, _) <- threadCapability =<< myThreadId
+  c <- g =<< f sp cap
+  takeMVar mvar `onException` forkIO (do takeMVar mvar; touchBufs)
+  touchBufs
+  return c
+{-# INLINE withAsyncKeepAlive #-}
+
 -- Similar to HStream.Foreign.PeekMapFun
 --
 -- TODO: Use HStream.Foreign.PeekMapFun instead
@@ -12,11 +12,21 @@ module HStream.Store.Internal.LogDevice
   , findTime
   , findKey
   , isLogEmpty
+    -- * Batch
+  , LogTailAttributes (..)
+  , LogHeadAttributes (..)
+  , getTailLSNBatch
+  , getLogTailAttrsBatch
+  , getLogHeadAttrsBatch
+  , trimBatch
+  , findTimeBatch
+  , findKeyBatch
 
   , module HStream.Store.Internal.LogDevice.Checkpoint
   , module HStream.Store.Internal.LogDevice.Configuration
   , module HStream.Store.Internal.LogDevice.LogAttributes
   , module HStream.Store.Internal.LogDevice.LogConfigTypes
+  , module HStream.Store.Internal.LogDevice.LogPathCache
   , module HStream.Store.Internal.LogDevice.Reader
   , module HStream.Store.Internal.LogDevice.VersionedConfigStore
   , module HStream.Store.Internal.LogDevice.Writer
@@ -24,6 +34,8 @@ module HStream.Store.Internal.LogDevice
   ) where
 
 import           Control.Monad
+import           Control.Monad.Primitive                               (RealWorld,
+                                                                        touch)
 import           Data.Int
 import           Data.Primitive
 import           Data.Word
@@ -38,6 +50,7 @@ import           Z.Data.Vector                                         (Bytes)
 import qualified Z.Foreign                                             as Z
 
 import           HStream.Foreign                                       (BA# (..),
+                                                                        BAArray# (..),
                                                                         MBA# (..))
 import qualified HStream.Store.Exception                               as E
 import           HStream.Store.Internal.Foreign
@@ -46,6 +59,7 @@ import           HStream.Store.Internal.LogDevice.Configuration
 import           HStream.Store.Internal.LogDevice.LDQuery
 import           HStream.Store.Internal.LogDevice.LogAttributes
 import           HStream.Store.Internal.LogDevice.LogConfigTypes
+import           HStream.Store.Internal.LogDevice.LogPathCache
 import           HStream.Store.Internal.LogDevice.Reader
 import           HStream.Store.Internal.LogDevice.VersionedConfigStore
 import           HStream.Store.Internal.LogDevice.Writer
@@ -280,6 +294,163 @@ isLogEmpty client logid =
     void $ E.throwStreamErrorIfNotOK' errno
     return . cbool2bool $ empty
 
+-------------------------------------------------------------------------------
+-- Batch
+
+data LogTailAttributes = LogTailAttributes
+  { tailLastReleasedRealLSN :: {-# UNPACK #-} !LSN
+  , tailLastTimestamp       :: {-# UNPACK #-} !C_Timestamp
+    -- ^ estimated timestamp of the record with last_released_real_lsn
+  , tailByteOffset          :: {-# UNPACK #-} !Word64
+    -- ^ amount of data in bytes written to the log
+  } deriving (Show, Eq)
+
+data LogHeadAttributes = LogHeadAttributes
+  { headTrimPoint          :: {-# UNPACK #-} !LSN
+    -- ^ LSN_INVALID if the log was never trimmed
+  , headTrimPointTimestamp :: {-# UNPACK #-} !C_Timestamp
+    -- ^ approximate timestamp of the next record after trim point
+  } deriving (Show, Eq)
+
+-- | Batch version of 'getTailLSN'.
+--
+-- All requests are issued asynchronously at once (at most 'concurrency'
+-- requests are in flight, non-positive means no limit), the results are in
+-- the same order as the logids.
+getTailLSNBatch
+  :: LDClient
+  -> Int
+  -- ^ concurrency
+  -> [C_LogID]
+  -> IO [Either ErrorCode LSN]
+getTailLSNBatch client concurrency logids =
+  withForeignPtr client $ \client' ->
+  Z.withPrimArrayUnsafe (primArrayFromList logids) $ \logids' len -> do
+    sts <- newPinnedPrimArray len
+    lsns <- newPinnedPrimArray len
+    let cfun = c_ld_client_get_tail_lsn_batch client' (BA# logids') len concurrency
+                 (mutablePrimArrayContents sts) (mutablePrimArrayContents lsns)
+    withAsyncKeepAlive (touch sts >> touch lsns) cfun pure
+    batchResults sts $ readPrimArray lsns
+
+-- | Batch version of 'getLogTailAttrs', see 'getTailLSNBatch'.
+getLogTailAttrsBatch
+  :: LDClient
+  -> Int
+  -- ^ concurrency
+  -> [C_LogID]
+  -> IO [Either ErrorCode LogTailAttributes]
+getLogTailAttrsBatch client concurrency logids =
+  withForeignPtr client $ \client' ->
+  Z.withPrimArrayUnsafe (primArrayFromList logids) $ \logids' len -> do
+    sts <- newPinnedPrimArray len
+    lsns <- newPinnedPrimArray len
+    tss <- newPinnedPrimArray len
+    offsets <- newPinnedPrimArray len
+    let cfun = c_ld_client_get_tail_attributes_batch client' (BA# logids') len concurrency
+                 (mutablePrimArrayContents sts) (mutablePrimArrayContents lsns)
+                 (mutablePrimArrayContents tss) (mutablePrimArrayContents offsets)
+    withAsyncKeepAlive (touch sts >> touch lsns >> touch tss >> touch offsets) cfun pure
+    batchResults sts $ \i ->
+      LogTailAttributes <$> readPrimArray lsns i
+                        <*> readPrimArray tss i
+                        <*> readPrimArray offsets i
+
+-- | Batch version of 'getLogHeadAttrs', see 'getTailLSNBatch'.
+getLogHeadAttrsBatch
+  :: LDClient
+  -> Int
+  -- ^ concurrency
+  -> [C_LogID]
+  -> IO [Either ErrorCode LogHeadAttributes]
+getLogHeadAttrsBatch client concurrency logids =
+  withForeignPtr client $ \client' ->
+  Z.withPrimArrayUnsafe (primArrayFromList logids) $ \logids' len -> do
+    sts <- newPinnedPrimArray len
+    points <- newPinnedPrimArray len
+    tss <- newPinnedPrimArray len
+    let cfun = c_ld_client_get_head_attributes_batch client' (BA# logids') len concurrency
+                 (mutablePrimArrayContents sts) (mutablePrimArrayContents points)
+                 (mutablePrimArrayContents tss)
+    withAsyncKeepAlive (touch sts >> touch points >> touch tss) cfun pure
+    batchResults sts $ \i ->
+      LogHeadAttributes <$> readPrimArray points i <*> readPrimArray tss i
+
+-- | Batch version of 'trim', see 'getTailLSNBatch'.
+trimBatch
+  :: LDClient
+  -> Int
+  -- ^ concurrency
+  -> [(C_LogID, LSN)]
+  -- ^ list of (logid, trim point)
+  -> IO [Either ErrorCode ()]
+trimBatch client concurrency reqs =
+  withForeignPtr client $ \client' ->
+  Z.withPrimArrayUnsafe (primArrayFromList $ map fst reqs) $ \logids' len ->
+  Z.withPrimArrayUnsafe (primArrayFromList $ map snd reqs) $ \lsns' _ -> do
+    sts <- newPinnedPrimArray len
+    let cfun = c_ld_client_trim_batch client' (BA# logids') (BA# lsns') len concurrency
+                 (mutablePrimArrayContents sts)
+    withAsyncKeepAlive (touch sts) cfun pure
+    batchResults sts $ const (pure ())
+
+-- | Batch version of 'findTime', see 'getTailLSNBatch'.
+--
+-- Using 'FindKeyApproximate' is much cheaper if the caller can tolerate the
+-- result being earlier than the accurate one by a few minutes.
+findTimeBatch
+  :: LDClient
+  -> Int
+  -- ^ concurrency
+  -> FindKeyAccuracy
+  -> [(C_LogID, Int64)]
+  -- ^ list of (logid, timestamp in milliseconds)
+  -> IO [Either ErrorCode LSN]
+findTimeBatch client concurrency accuracy reqs =
+  withForeignPtr client $ \client' ->
+  Z.withPrimArrayUnsafe (primArrayFromList $ map fst reqs) $ \logids' len ->
+  Z.withPrimArrayUnsafe (primArrayFromList $ map snd reqs) $ \tss' _ -> do
+    sts <- newPinnedPrimArray len
+    lsns <- newPinnedPrimArray len
+    let cfun = c_ld_client_find_time_batch client' (BA# logids') (BA# tss') len
+                 (unFindKeyAccuracy accuracy) concurrency
+                 (mutablePrimArrayContents sts) (mutablePrimArrayContents lsns)
+    withAsyncKeepAlive (touch sts >> touch lsns) cfun pure
+    batchResults sts $ readPrimArray lsns
+
+-- | Batch version of 'findKey', see 'getTailLSNBatch'.
+findKeyBatch
+  :: LDClient
+  -> Int
+  -- ^ concurrency
+  -> FindKeyAccuracy
+  -> [(C_LogID, CBytes)]
+  -> IO [Either ErrorCode (LSN, LSN)]
+findKeyBatch client concurrency accuracy reqs =
+  withForeignPtr client $ \client' ->
+  Z.withPrimArrayUnsafe (primArrayFromList $ map fst reqs) $ \logids' len ->
+  Z.withPrimArrayListUnsafe (map (CBytes.rawPrimArray . snd) reqs) $ \keys' _ -> do
+    sts <- newPinnedPrimArray len
+    los <- newPinnedPrimArray len
+    his <- newPinnedPrimArray len
+    let cfun = c_ld_client_find_key_batch client' (BA# logids') (BAArray# keys') len
+                 (unFindKeyAccuracy accuracy) concurrency
+                 (mutablePrimArrayContents sts) (mutablePrimArrayContents los)
+                 (mutablePrimArrayContents his)
+    withAsyncKeepAlive (touch sts >> touch los >> touch his) cfun pure
+    batchResults sts $ \i -> (,) <$> readPrimArray los i <*> readPrimArray his i
+
+batchResults
+  :: MutablePrimArray RealWorld ErrorCode
+  -> (Int -> IO a)
+  -> IO [Either ErrorCode a]
+batchResults sts f = do
+  len <- getSizeofMutablePrimArray sts
+  forM [0 .. len - 1] $ \i -> do
+    st <- readPrimArray sts i
+    if st == C_OK then Right <$> f i else pure (Left st)
+{-# INLINE batchResults #-}
+
 foreign import ccall unsafe "hs_logdevice.h new_logdevice_client"
   c_new_logdevice_client :: Z.BA# Word8
                          -> Z.MBA# (Ptr LogDeviceClient)
@@ -342,3 +513,51 @@ foreign import ccall unsafe "hs_logdevice.h ld_client_find_key"
     -> StablePtr PrimMVar -> Int
     -> MBA# ErrorCode -> MBA# LSN -> MBA# LSN
     -> IO Int
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_get_tail_lsn_batch"
+  c_ld_client_get_tail_lsn_batch
+    :: Ptr LogDeviceClient
+    -> BA# C_LogID -> Int -> Int
+    -> StablePtr PrimMVar -> Int
+    -> Ptr ErrorCode -> Ptr LSN
+    -> IO ()
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_get_tail_attributes_batch"
+  c_ld_client_get_tail_attributes_batch
+    :: Ptr LogDeviceClient
+    -> BA# C_LogID -> Int -> Int
+    -> StablePtr PrimMVar -> Int
+    -> Ptr ErrorCode -> Ptr LSN -> Ptr C_Timestamp -> Ptr Word64
+    -> IO ()
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_get_head_attributes_batch"
+  c_ld_client_get_head_attributes_batch
+    :: Ptr LogDeviceClient
+    -> BA# C_LogID -> Int -> Int
+    -> StablePtr PrimMVar -> Int
+    -> Ptr ErrorCode -> Ptr LSN -> Ptr C_Timestamp
+    -> IO ()
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_trim_batch"
+  c_ld_client_trim_batch
+    :: Ptr LogDeviceClient
+    -> BA# C_LogID -> BA# LSN -> Int -> Int
+    -> StablePtr PrimMVar -> Int
+    -> Ptr ErrorCode
+    -> IO ()
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_find_time_batch"
+  c_ld_client_find_time_batch
+    :: Ptr LogDeviceClient
+    -> BA# C_LogID -> BA# Int64 -> Int -> Int -> Int
+    -> StablePtr PrimMVar -> Int
+    -> Ptr ErrorCode -> Ptr LSN
+    -> IO ()
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_find_key_batch"
+  c_ld_client_find_key_batch
+    :: Ptr LogDeviceClient
+    -> BA# C_LogID -> BAArray# Word8 -> Int -> Int -> Int
+    -> StablePtr PrimMVar -> Int
+    -> Ptr ErrorCode -> Ptr LSN -> Ptr LSN
+    -> IO ()
@@ -43,8 +43,22 @@ newRSMBasedCheckpointStore
   -- ^ Timeout for the RSM to stop after calling shutdown, in milliseconds.
   -> IO LDCheckpointStore
 newRSMBasedCheckpointStore client log_id stop_timeout =
+  newCachedRSMBasedCheckpointStore client log_id stop_timeout (-1)
+
+-- | Same as 'newRSMBasedCheckpointStore', but the checkpoints read are cached
+-- locally (an expired value is still returned but refreshed in background).
+-- Only use it if the checkpoints are only updated through this store.
+newCachedRSMBasedCheckpointStore
+  :: LDClient
+  -> C_LogID
+  -> Int64
+  -- ^ Timeout for the RSM to stop after calling shutdown, in milliseconds.
+  -> Int64
+  -- ^ cache ttl in milliseconds, negative means disable the cache
+  -> IO LDCheckpointStore
+newCachedRSMBasedCheckpointStore client log_id stop_timeout cache_ttl =
   withForeignPtr client $ \client' -> do
-    i <- c_new_rsm_based_checkpoint_store client' log_id stop_timeout
+    i <- c_new_rsm_based_checkpoint_store client' log_id stop_timeout cache_ttl
     newForeignPtr c_free_checkpoint_store_fun i
 
 -- TODO: remove
@@ -138,6 +152,7 @@ foreign import ccall unsafe "hs_logdevice.h new_rsm_based_checkpoint_store"
     :: Ptr LogDeviceClient
     -> C_LogID
     -> Int64
+    -> Int64
     -> IO (Ptr LogDeviceCheckpointStore)
 
 foreign import ccall unsafe "hs_logdevice.h new_zookeeper_based_checkpoint_store"
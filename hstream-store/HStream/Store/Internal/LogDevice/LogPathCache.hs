@@ -0,0 +1,112 @@
+{-# LANGUAGE MagicHash #-}
+
+-- | A per-client cache from loggroup path to logid.
+--
+-- The cache lives in the cpp side (see cbits/logdevice/hs_log_path_cache.cpp),
+-- lookups are lock-free, and all entries are dropped once the client sees a
+-- new logsconfig version. So it is safe to use even if the loggroup is
+-- modified by another server.
+module HStream.Store.Internal.LogDevice.LogPathCache
+  ( LogPathCacheStats (..)
+  , getLogIdByPathCached
+  , lookupLogPathCache
+  , insertLogPathCache
+  , invalidateLogPathCache
+  , getLogPathCacheStats
+  ) where
+
+import           Data.Word
+import           Foreign.ForeignPtr
+import           Foreign.Ptr
+import           GHC.Stack                                       (HasCallStack)
+import qualified Z.Data.CBytes                                   as CBytes
+import           Z.Data.CBytes                                   (CBytes)
+import qualified Z.Foreign                                       as Z
+
+import           HStream.Foreign
+import           HStream.Store.Internal.LogDevice.LogConfigTypes
+import           HStream.Store.Internal.Types
+
+data LogPathCacheStats = LogPathCacheStats
+  { logPathCacheHits          :: !Word64
+  , logPathCacheMisses        :: !Word64
+  , logPathCacheInvalidations :: !Word64
+  , logPathCacheSize          :: !Int
+  } deriving (Show, Eq)
+
+-- | Get the logid of a loggroup, the result is cached.
+getLogIdByPathCached :: HasCallStack => LDClient -> CBytes -> IO C_LogID
+getLogIdByPathCached client path = do
+  r <- lookupLogPathCache client path
+  case r of
+    Right logid -> pure logid
+    Left epoch -> do
+      group <- getLogGroup client path
+      insertLogPathCache client path group epoch
+      fst <$> logGroupGetRange group
+
+-- | Lookup the cache, return the logid on hit or an epoch which should be
+-- passed to the following 'insertLogPathCache' on miss.
+lookupLogPathCache :: LDClient -> CBytes -> IO (Either Word64 C_LogID)
+lookupLogPathCache client path =
+  withForeignPtr client $ \client' ->
+  CBytes.withCBytesUnsafe path $ \path' -> do
+    (logid, (epoch, hit)) <-
+      Z.withPrimUnsafe C_LOGID_MIN_INVALID $ \logid' ->
+      Z.withPrimUnsafe 0 $ \epoch' ->
+        c_ld_client_log_path_cache_lookup client' (BA# path') (MBA# logid') (MBA# epoch')
+    pure $ if hit then Right logid else Left epoch
+
+insertLogPathCache :: LDClient -> CBytes -> LDLogGroup -> Word64 -> IO ()
+insertLogPathCache client path group epoch =
+  withForeignPtr client $ \client' ->
+  withForeignPtr group $ \group' ->
+  CBytes.withCBytesUnsafe path $ \path' ->
+    c_ld_client_log_path_cache_insert client' (BA# path') group' epoch
+
+-- | Drop the path and all paths under it.
+invalidateLogPathCache :: LDClient -> CBytes -> IO ()
+invalidateLogPathCache client path =
+  withForeignPtr client $ \client' ->
+  CBytes.withCBytesUnsafe path $ \path' ->
+    c_ld_client_log_path_cache_invalidate client' (BA# path')
+
+getLogPathCacheStats :: LDClient -> IO LogPathCacheStats
+getLogPathCacheStats client =
+  withForeignPtr client $ \client' -> do
+    (hits, (misses, (invalidations, (size, _)))) <-
+      Z.withPrimUnsafe 0 $ \hits' ->
+      Z.withPrimUnsafe 0 $ \misses' ->
+      Z.withPrimUnsafe 0 $ \invalidations' ->
+      Z.withPrimUnsafe 0 $ \size' ->
+        c_ld_client_log_path_cache_stats client' (MBA# hits') (MBA# misses')
+                                         (MBA# invalidations') (MBA# size')
+    pure $ LogPathCacheStats hits misses invalidations size
+
+-------------------------------------------------------------------------------
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_log_path_cache_lookup"
+  c_ld_client_log_path_cache_lookup
+    :: Ptr LogDeviceClient
+    -> BA# Word8
+    -> MBA# C_LogID
+    -> MBA# Word64
+    -> IO Bool
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_log_path_cache_insert"
+  c_ld_client_log_path_cache_insert
+    :: Ptr LogDeviceClient
+    -> BA# Word8
+    -> Ptr LogDeviceLogGroup
+    -> Word64
+    -> IO ()
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_log_path_cache_invalidate"
+  c_ld_client_log_path_cache_invalidate
+    :: Ptr LogDeviceClient -> BA# Word8 -> IO ()
+
+foreign import ccall unsafe "hs_logdevice.h ld_client_log_path_cache_stats"
+  c_ld_client_log_path_cache_stats
+    :: Ptr LogDeviceClient
+    -> MBA# Word64 -> MBA# Word64 -> MBA# Word64 -> MBA# Int
+    -> IO ()
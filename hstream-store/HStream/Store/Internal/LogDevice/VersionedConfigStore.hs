@@ -40,12 +40,41 @@ toCVcsConditionMode (VcsCondVersion ver) = (1, ver)
 toCVcsConditionMode VcsCondOverwrite     = (2, 0)
 toCVcsConditionMode VcsCondIfNotExists   = (3, 0)
 
-newRsmBasedVcs :: LDClient -> C_LogID -> Int64 -> IO LDVersionedConfigStore
-newRsmBasedVcs client logid stopTimeout =
+-- | Create a VersionedConfigStore based on the replicated state machine on
+-- the log.
+--
+-- Values read by 'vcsGetConfig' are cached locally, an expired (older than
+-- the cache ttl) value is still returned but refreshed in background. Use
+-- 'ldVcsGetLatestConfig' if the latest value is required.
+newRsmBasedVcs
+  :: LDClient
+  -> C_LogID
+  -> Int64
+  -- ^ stop timeout in milliseconds
+  -> Int64
+  -- ^ cache ttl in milliseconds, negative means disable the cache
+  -> IO LDVersionedConfigStore
+newRsmBasedVcs client logid stopTimeout cacheTtl =
   withForeignPtr client $ \clientPtr -> do
-    i <- c_new_rsm_based_vcs clientPtr logid stopTimeout
+    i <- c_new_rsm_based_vcs clientPtr logid stopTimeout cacheTtl
     newForeignPtr c_free_rsm_based_vcs_fun i
 
+data VcsCacheStats = VcsCacheStats
+  { vcsCacheHits      :: !Word64
+  , vcsCacheMisses    :: !Word64
+  , vcsCacheRefreshes :: !Word64
+  } deriving (Show, Eq)
+
+vcsGetCacheStats :: LDVersionedConfigStore -> IO VcsCacheStats
+vcsGetCacheStats vcs =
+  withForeignPtr vcs $ \vcs' -> do
+    (hits, (misses, (refreshes, _))) <-
+      Z.withPrimUnsafe 0 $ \hits' ->
+      Z.withPrimUnsafe 0 $ \misses' ->
+      Z.withPrimUnsafe 0 $ \refreshes' ->
+        c_logdevice_vcs_get_cache_stats vcs' (MBA# hits') (MBA# misses') (MBA# refreshes')
+    pure $ VcsCacheStats hits misses refreshes
+
 vcsGetConfig
   :: HasCallStack
   => LDVersionedConfigStore
@@ -174,6 +203,7 @@ foreign import ccall unsafe "hs_logdevice.h new_rsm_based_vcs"
     :: Ptr LogDeviceClient
     -> C_LogID
     -> Int64          -- ^ stop_timeout, milliseconds
+    -> Int64          -- ^ cache_ttl, milliseconds
     -> IO (Ptr LogDeviceVersionedConfigStore)
 
 foreign import ccall unsafe "hs_logdevice.h free_logdevice_vcs"
@@ -208,6 +238,12 @@ foreign import ccall unsafe "hs_logdevice.h logdevice_vcs_get_latest_config"
     -> Ptr VcsValueCallbackData
     -> IO ()
 
+foreign import ccall unsafe "hs_logdevice.h logdevice_vcs_get_cache_stats"
+  c_logdevice_vcs_get_cache_stats
+    :: Ptr LogDeviceVersionedConfigStore
+    -> MBA# Word64 -> MBA# Word64 -> MBA# Word64
+    -> IO ()
+
 foreign import ccall unsafe "hs_logdevice.h logdevice_vcs_update_config"
   c_logdevice_vcs_update_config
     :: Ptr LogDeviceVersionedConfigStore
@@ -43,6 +43,8 @@ module HStream.Store.Stream
     -- ** helpers
   , getUnderlyingLogId
   , getStreamIdFromLogId
+  , LD.LogPathCacheStats (..)
+  , LD.getLogPathCacheStats
 
     -- * Logdevice
   , FFI.LogID (..)
@@ -81,6 +83,7 @@ module HStream.Store.Stream
   , FFI.LDCheckpointStore
   , LD.newFileBasedCheckpointStore
   , LD.newRSMBasedCheckpointStore
+  , LD.newCachedRSMBasedCheckpointStore
   , LD.newZookeeperBasedCheckpointStore
   , LD.ckpStoreGetLSN
   , LD.ckpStoreGetAllCheckpoints
@@ -212,18 +215,6 @@ import qualified HStream.Store.Exception          as E
 import qualified HStream.Store.Internal.LogDevice as LD
 import qualified HStream.Store.Internal.Types     as FFI
 
--- Comment this to disable local cache
--- #define HSTREAM_USE_LOCAL_STREAM_CACHE
-
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-import           Control.Concurrent               (MVar, modifyMVar_, newMVar,
-                                                   readMVar)
-import           Control.Exception                (finally)
-import           Control.Monad                    (forM_)
-import qualified Data.Cache                       as Cache
-import           Data.Maybe                       (isJust)
-#endif
-
 -------------------------------------------------------------------------------
 
 data StreamSettings = StreamSettings
@@ -258,42 +249,10 @@ offsetCheckpointDir = "/hstream/offset/checkpoint"
 
 -------------------------------------------------------------------------------
 
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-
--- StreamId : { streamKey: logid }
-type StreamCache = Cache.Cache StreamId (Map CBytes FFI.C_LogID)
-
--- | Global logdir path to logid cache
---
--- Note: for a cluster version, to make the cache work properly, all operations
--- of one stream (e.g. create, delete, ...) must be processed by only one
--- specific server.
-gloLogPathCache :: MVar StreamCache
-gloLogPathCache = unsafePerformIO $ newMVar =<< Cache.newCache Nothing
-{-# NOINLINE gloLogPathCache #-}
-
-getGloLogPathCache :: StreamId -> CBytes -> IO (Maybe FFI.C_LogID)
-getGloLogPathCache streamid key = do
-  cache <- readMVar gloLogPathCache
-  m_v <- Cache.lookup' cache streamid
-  case m_v of
-    Nothing -> pure Nothing
-    Just mp -> pure $ Map.lookup key mp
-
-doesCacheExist :: StreamId -> IO Bool
-doesCacheExist streamid = do
-  cache <- readMVar gloLogPathCache
-  isJust <$> Cache.lookup' cache streamid
-
-updateGloLogPathCache :: StreamId -> CBytes -> FFI.C_LogID -> IO ()
-updateGloLogPathCache streamid key logid =
-  modifyMVar_ gloLogPathCache $ \c -> do
-    m_v <- Cache.lookup' c streamid
-    case m_v of
-      Nothing -> Cache.insert c streamid (Map.singleton key logid) >> pure c
-      Just mp -> Cache.insert c streamid (Map.insert key logid mp) >> pure c
-
-#endif
+-- NOTE: the logpath to logid cache is maintained by the cpp side of the
+-- client (see "HStream.Store.Internal.LogDevice.LogPathCache"). It is dropped
+-- whenever a new logsconfig version is observed, so it also works for a
+-- cluster where a stream may be modified by other servers.
 
 -------------------------------------------------------------------------------
 
@@ -407,21 +366,11 @@ createStreamPartition
   -> IO FFI.C_LogID
 createStreamPartition client streamid m_key attr = do
   stream_exist <- doesStreamExist client streamid
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-  if stream_exist
-     then do (log_path, key) <- getStreamLogPath streamid m_key
-             logid <- createRandomLogGroup client log_path def{LD.logAttrsExtras = attr}
-             updateGloLogPathCache streamid key logid
-             pure logid
-     else E.throwStoreError ("No such stream: " <> ZT.pack (showStreamName streamid))
-                            callStack
-#else
   if stream_exist
      then do (log_path, _key) <- getStreamLogPath streamid m_key
              createRandomLogGroup client log_path def{LD.logAttrsExtras = attr}
      else E.throwStoreError ("No such stream: " <> ZT.pack (showStreamName streamid))
                             callStack
-#endif
 
 renameStream
   :: HasCallStack
@@ -450,16 +399,9 @@ _renameStream_ :: HasCallStack => FFI.LDClient -> StreamId -> StreamId -> IO ()
 _renameStream_ client from to = do
   from' <- getStreamDirPath from
   to'   <- getStreamDirPath to
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-  modifyMVar_ gloLogPathCache $ \cache -> do
-    m_v <- Cache.lookup' cache from
-    finally (LD.syncLogsConfigVersion client =<< LD.renameLogGroup client from' to')
-            (Cache.delete cache from)
-    forM_ m_v $ Cache.insert cache to
-    pure cache
-#else
   LD.syncLogsConfigVersion client =<< LD.renameLogGroup client from' to'
-#endif
+  -- Do not wait for the config subscription to drop the old paths
+  LD.invalidateLogPathCache client from'
 {-# INLINABLE _renameStream_ #-}
 
 -- | Archive a stream, then you won't find it by 'findStreams'.
@@ -485,17 +427,11 @@ removeArchivedStream client (ArchivedStream name) =
   removeStream client $ StreamId StreamTypeStream name
 
 removeStream :: HasCallStack => FFI.LDClient -> StreamId -> IO ()
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-removeStream client streamid = modifyMVar_ gloLogPathCache $ \cache -> do
-  path <- getStreamDirPath streamid
-  finally (LD.syncLogsConfigVersion client =<< LD.removeLogDirectory client path True)
-          (Cache.delete cache streamid)
-  pure cache
-#else
 removeStream client streamid = do
   path <- getStreamDirPath streamid
   LD.syncLogsConfigVersion client =<< LD.removeLogDirectory client path True
-#endif
+  -- Do not wait for the config subscription to drop the removed paths
+  LD.invalidateLogPathCache client path
 
 -- | Find all active streams.
 findStreams
@@ -512,17 +448,11 @@ findStreams client streamType = do
 
 doesStreamExist :: HasCallStack => FFI.LDClient -> StreamId -> IO Bool
 doesStreamExist client streamid = do
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-  cacheExist <- doesCacheExist streamid
-  if cacheExist
-     then return True
-     else do
-#endif
-        path <- getStreamDirPath streamid
-        r <- try $ LD.getLogDirectory client path
-        case r of
-          Left (_ :: E.NOTFOUND) -> return False
-          Right _                -> return True
+  path <- getStreamDirPath streamid
+  r <- try $ LD.getLogDirectory client path
+  case r of
+    Left (_ :: E.NOTFOUND) -> return False
+    Right _                -> return True
 
 listStreamPartitions :: HasCallStack => FFI.LDClient -> StreamId -> IO (Map.Map CBytes FFI.C_LogID)
 listStreamPartitions client streamid = do
@@ -571,25 +501,17 @@ doesStreamPartitionExist
   -> Maybe CBytes
   -> IO Bool
 doesStreamPartitionExist client streamid m_key = do
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-  (logpath, key) <- getStreamLogPath streamid m_key
-  m_v <- getGloLogPathCache streamid key
+  (logpath, _key) <- getStreamLogPath streamid m_key
+  m_v <- LD.lookupLogPathCache client logpath
   case m_v of
-    Just _  -> return True
-    Nothing -> do
+    Right _    -> return True
+    Left epoch -> do
       r <- try $ LD.getLogGroup client logpath
       case r of
         Left (_ :: E.NOTFOUND) -> return False
         Right lg               -> do
-          updateGloLogPathCache streamid key . fst =<< LD.logGroupGetRange lg
+          LD.insertLogPathCache client logpath lg epoch
           return True
-#else
-  (logpath, _key) <- getStreamLogPath streamid m_key
-  r <- try $ LD.getLogGroup client logpath
-  case r of
-    Left (_ :: E.NOTFOUND) -> return False
-    Right _loggroup        -> return True
-#endif
 
 doesStreamPartitionValExist
   :: HasCallStack
@@ -670,19 +592,8 @@ getUnderlyingLogId
   -> Maybe CBytes
   -> IO FFI.C_LogID
 getUnderlyingLogId client streamid m_key = do
-#ifdef HSTREAM_USE_LOCAL_STREAM_CACHE
-  (log_path, key) <- getStreamLogPath streamid m_key
-  m_logid <- getGloLogPathCache streamid key
-  case m_logid of
-    Nothing -> do
-      logid <- fst <$> (LD.logGroupGetRange =<< LD.getLogGroup client log_path)
-      updateGloLogPathCache streamid key logid
-      pure logid
-    Just ld -> pure ld
-#else
   (log_path, _key) <- getStreamLogPath streamid m_key
-  fst <$> (LD.logGroupGetRange =<< LD.getLogGroup client log_path)
-#endif
+  LD.getLogIdByPathCached client log_path
 {-# INLINABLE getUnderlyingLogId #-}
 
 getStreamIdFromLogId
@@ -817,6 +728,10 @@ newLDRsmCkpReader
   -- ^ checkpointStore logid, this should be 'checkpointStoreLogID'.
   -> Int64
   -- ^ Timeout for the RSM to stop after calling shutdown, in milliseconds.
+  -> Int64
+  -- ^ ttl of the checkpoints cached by the reader, in milliseconds. Negative
+  -- means disable the cache. Only enable it if no other reader writes the
+  -- checkpoints of this one, see 'LD.newCachedRSMBasedCheckpointStore'.
   -> CSize
   -- ^ maximum number of logs that can be read from
   -- this Reader at the same time
@@ -824,8 +739,8 @@ newLDRsmCkpReader
   -- ^ specify the read buffer size for this client, fallback
   -- to the value in settings if it is Nothing.
   -> IO FFI.LDSyncCkpReader
-newLDRsmCkpReader client name logid timeout max_logs m_buffer_size = do
-  store <- LD.newRSMBasedCheckpointStore client logid timeout
+newLDRsmCkpReader client name logid timeout cache_ttl max_logs m_buffer_size = do
+  store <- LD.newCachedRSMBasedCheckpointStore client logid timeout cache_ttl
   reader <- LD.newLDReader client max_logs m_buffer_size
   LD.newLDSyncCkpReader name reader store
 
@@ -974,6 +889,3 @@ generateFromListM es f
       loop (0, es)
 {-# INLINE generateFromListM #-}
 
--------------------------------------------------------------------------------
-
-#undef HSTREAM_USE_LOCAL_STREAM_CACHE
@@ -30,6 +30,7 @@ new_logdevice_client(char* config_path, logdevice_client_t** client_ret) {
   if (client) {
     logdevice_client_t* result = new logdevice_client_t;
     result->rep = client;
+    result->log_path_cache = std::make_unique<LogPathCache>(client);
     *client_ret = result;
     return facebook::logdevice::E::OK;
   }
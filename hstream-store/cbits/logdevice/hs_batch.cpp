@@ -0,0 +1,247 @@
+#include "hs_logdevice.h"
+
+// ----------------------------------------------------------------------------
+// Batch requests
+//
+// Issue one asynchronous request per log with at most `concurrency` requests
+// in flight, and notify haskell (hs_try_putmvar) once all of them are done.
+// A batch then costs roughly the latency of the slowest request instead of
+// the sum of all of them.
+
+// Submit the request for the idx-th log, the `done` function must be called
+// exactly once after the result is written. Return 0 if the request was
+// successfully submitted, otherwise -1 and set err (the `done` function
+// must not be called in this case).
+using batch_issue_fn_t =
+    std::function<int(size_t idx, std::function<void()> done)>;
+
+struct BatchRequest : std::enable_shared_from_this<BatchRequest> {
+  BatchRequest(size_t len, batch_issue_fn_t issue, c_error_code_t* sts_out,
+               HsStablePtr mvar, HsInt cap)
+      : len(len), remaining(len), issue(std::move(issue)), sts_out(sts_out),
+        mvar(mvar), cap(cap) {}
+
+  void start(size_t concurrency) {
+    if (len == 0) {
+      hs_try_putmvar(cap, mvar);
+      return;
+    }
+    if (concurrency == 0 || concurrency > len) {
+      concurrency = len;
+    }
+    for (size_t i = 0; i < concurrency; ++i) {
+      next();
+    }
+  }
+
+private:
+  void next() {
+    while (true) {
+      size_t idx = next_idx.fetch_add(1);
+      if (idx >= len) {
+        return;
+      }
+      auto self = shared_from_this();
+      int rv = issue(idx, [self] { self->done(); });
+      if (rv == 0) {
+        return;
+      }
+      // Failed to submit, move on to the next one.
+      sts_out[idx] = static_cast<c_error_code_t>(facebook::logdevice::err);
+      if (remaining.fetch_sub(1) == 1) {
+        hs_try_putmvar(cap, mvar);
+        return;
+      }
+    }
+  }
+
+  void done() {
+    if (remaining.fetch_sub(1) == 1) {
+      hs_try_putmvar(cap, mvar);
+      return;
+    }
+    next();
+  }
+
+  const size_t len;
+  std::atomic<size_t> next_idx{0};
+  std::atomic<size_t> remaining;
+  batch_issue_fn_t issue;
+  c_error_code_t* sts_out;
+  HsStablePtr mvar;
+  HsInt cap;
+};
+
+static void run_batch(size_t len, HsInt concurrency, batch_issue_fn_t issue,
+                      c_error_code_t* sts_out, HsStablePtr mvar, HsInt cap) {
+  auto req = std::make_shared<BatchRequest>(len, std::move(issue), sts_out,
+                                            mvar, cap);
+  req->start(concurrency > 0 ? concurrency : 0);
+}
+
+extern "C" {
+// ----------------------------------------------------------------------------
+
+// All the following functions copy the logids before return, while the
+// output arrays (which have the same length as logids) must be kept alive
+// until the mvar is filled. A non-positive concurrency means no limit.
+
+void ld_client_get_tail_lsn_batch(logdevice_client_t* client,
+                                  const c_logid_t* logids, HsInt len,
+                                  HsInt concurrency, HsStablePtr mvar,
+                                  HsInt cap, c_error_code_t* sts_out,
+                                  c_lsn_t* lsns_out) {
+  auto client_ = client->rep;
+  std::vector<c_logid_t> logids_(logids, logids + len);
+  auto issue = [client_, logids_, sts_out, lsns_out](
+                   size_t idx, std::function<void()> done) {
+    auto cb = [idx, sts_out, lsns_out, done = std::move(done)](
+                  facebook::logdevice::Status st, c_lsn_t lsn) {
+      sts_out[idx] = static_cast<c_error_code_t>(st);
+      lsns_out[idx] = lsn;
+      done();
+    };
+    return client_->getTailLSN(logid_t(logids_[idx]), std::move(cb));
+  };
+  run_batch(len, concurrency, std::move(issue), sts_out, mvar, cap);
+}
+
+void ld_client_get_tail_attributes_batch(
+    logdevice_client_t* client, const c_logid_t* logids, HsInt len,
+    HsInt concurrency, HsStablePtr mvar, HsInt cap, c_error_code_t* sts_out,
+    c_lsn_t* lsns_out, c_timestamp_t* timestamps_out,
+    uint64_t* byte_offsets_out) {
+  auto client_ = client->rep;
+  std::vector<c_logid_t> logids_(logids, logids + len);
+  auto issue = [client_, logids_, sts_out, lsns_out, timestamps_out,
+                byte_offsets_out](size_t idx, std::function<void()> done) {
+    auto cb = [idx, sts_out, lsns_out, timestamps_out, byte_offsets_out,
+               done = std::move(done)](
+                  facebook::logdevice::Status st,
+                  std::unique_ptr<LogTailAttributes> tail_attr_ptr) {
+      sts_out[idx] = static_cast<c_error_code_t>(st);
+      if (tail_attr_ptr) {
+        lsns_out[idx] = tail_attr_ptr->last_released_real_lsn;
+        timestamps_out[idx] = tail_attr_ptr->last_timestamp.count();
+        byte_offsets_out[idx] =
+            tail_attr_ptr->offsets.getCounter(facebook::logdevice::BYTE_OFFSET);
+      } else {
+        lsns_out[idx] = C_LSN_INVALID;
+        timestamps_out[idx] = 0;
+        byte_offsets_out[idx] = facebook::logdevice::BYTE_OFFSET_INVALID;
+      }
+      done();
+    };
+    return client_->getTailAttributes(logid_t(logids_[idx]), std::move(cb));
+  };
+  run_batch(len, concurrency, std::move(issue), sts_out, mvar, cap);
+}
+
+void ld_client_get_head_attributes_batch(
+    logdevice_client_t* client, const c_logid_t* logids, HsInt len,
+    HsInt concurrency, HsStablePtr mvar, HsInt cap, c_error_code_t* sts_out,
+    c_lsn_t* trim_points_out, c_timestamp_t* trim_point_timestamps_out) {
+  auto client_ = client->rep;
+  std::vector<c_logid_t> logids_(logids, logids + len);
+  auto issue = [client_, logids_, sts_out, trim_points_out,
+                trim_point_timestamps_out](size_t idx,
+                                           std::function<void()> done) {
+    auto cb = [idx, sts_out, trim_points_out, trim_point_timestamps_out,
+               done = std::move(done)](
+                  facebook::logdevice::Status st,
+                  std::unique_ptr<LogHeadAttributes> head_attrs_ptr) {
+      sts_out[idx] = static_cast<c_error_code_t>(st);
+      if (head_attrs_ptr) {
+        trim_points_out[idx] = head_attrs_ptr->trim_point;
+        trim_point_timestamps_out[idx] =
+            head_attrs_ptr->trim_point_timestamp.count();
+      } else {
+        trim_points_out[idx] = C_LSN_INVALID;
+        trim_point_timestamps_out[idx] = MAX_MILLISECONDS;
+      }
+      done();
+    };
+    return client_->getHeadAttributes(logid_t(logids_[idx]), std::move(cb));
+  };
+  run_batch(len, concurrency, std::move(issue), sts_out, mvar, cap);
+}
+
+// Batch version of ld_client_trim, trim each log up to its own lsn.
+void ld_client_trim_batch(logdevice_client_t* client, const c_logid_t* logids,
+                          const c_lsn_t* lsns, HsInt len, HsInt concurrency,
+                          HsStablePtr mvar, HsInt cap,
+                          c_error_code_t* sts_out) {
+  auto client_ = client->rep;
+  std::vector<c_logid_t> logids_(logids, logids + len);
+  std::vector<c_lsn_t> lsns_(lsns, lsns + len);
+  auto issue = [client_, logids_, lsns_, sts_out](size_t idx,
+                                                  std::function<void()> done) {
+    auto cb = [idx, sts_out,
+               done = std::move(done)](facebook::logdevice::Status st) {
+      sts_out[idx] = static_cast<c_error_code_t>(st);
+      done();
+    };
+    return client_->trim(logid_t(logids_[idx]), lsns_[idx], std::move(cb));
+  };
+  run_batch(len, concurrency, std::move(issue), sts_out, mvar, cap);
+}
+
+// Batch version of ld_client_find_time, each log has its own timestamp.
+void ld_client_find_time_batch(logdevice_client_t* client,
+                               const c_logid_t* logids,
+                               const c_timestamp_t* timestamps, HsInt len,
+                               HsInt accuracy, HsInt concurrency,
+                               HsStablePtr mvar, HsInt cap,
+                               c_error_code_t* sts_out, c_lsn_t* lsns_out) {
+  auto client_ = client->rep;
+  std::vector<c_logid_t> logids_(logids, logids + len);
+  std::vector<c_timestamp_t> timestamps_(timestamps, timestamps + len);
+  auto accuracy_ = facebook::logdevice::FindKeyAccuracy(accuracy);
+  auto issue = [client_, logids_, timestamps_, accuracy_, sts_out, lsns_out](
+                   size_t idx, std::function<void()> done) {
+    auto cb = [idx, sts_out, lsns_out, done = std::move(done)](
+                  facebook::logdevice::Status st, c_lsn_t lsn) {
+      sts_out[idx] = static_cast<c_error_code_t>(st);
+      lsns_out[idx] = lsn;
+      done();
+    };
+    return client_->findTime(logid_t(logids_[idx]),
+                             std::chrono::milliseconds(timestamps_[idx]),
+                             std::move(cb), accuracy_);
+  };
+  run_batch(len, concurrency, std::move(issue), sts_out, mvar, cap);
+}
+
+// Batch version of ld_client_find_key, each log has its own key.
+void ld_client_find_key_batch(logdevice_client_t* client,
+                              const c_logid_t* logids, StgArrBytes** keys,
+                              HsInt len, HsInt accuracy, HsInt concurrency,
+                              HsStablePtr mvar, HsInt cap,
+                              c_error_code_t* sts_out, c_lsn_t* lo_lsns_out,
+                              c_lsn_t* hi_lsns_out) {
+  auto client_ = client->rep;
+  std::vector<c_logid_t> logids_(logids, logids + len);
+  std::vector<std::string> keys_;
+  keys_.reserve(len);
+  for (HsInt i = 0; i < len; ++i) {
+    keys_.emplace_back((char*)(keys[i]->payload));
+  }
+  auto accuracy_ = facebook::logdevice::FindKeyAccuracy(accuracy);
+  auto issue = [client_, logids_, keys_ = std::move(keys_), accuracy_, sts_out,
+                lo_lsns_out,
+                hi_lsns_out](size_t idx, std::function<void()> done) {
+    auto cb = [idx, sts_out, lo_lsns_out, hi_lsns_out, done = std::move(done)](
+                  facebook::logdevice::FindKeyResult result) {
+      sts_out[idx] = static_cast<c_error_code_t>(result.status);
+      lo_lsns_out[idx] = result.lo;
+      hi_lsns_out[idx] = result.hi;
+      done();
+    };
+    return client_->findKey(logid_t(logids_[idx]), keys_[idx], std::move(cb),
+                            accuracy_);
+  };
+  run_batch(len, concurrency, std::move(issue), sts_out, mvar, cap);
+}
+
+// ----------------------------------------------------------------------------
+} // end extern "C"
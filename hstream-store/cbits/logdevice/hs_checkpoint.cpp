@@ -25,18 +25,36 @@ new_file_based_checkpoint_store(const char* root_path) {
   return result;
 }
 
+// Reads of the checkpoints are served from a VcsReadCache unless cache_ttl
+// is negative. The cache is local, so it should only be enabled if the
+// checkpoints are only updated through this store. Updates always read the
+// latest value. (The shared checkpoint store does not support the cache.)
 logdevice_checkpoint_store_t*
 new_rsm_based_checkpoint_store(logdevice_client_t* client, c_logid_t log_id,
-                               int64_t stop_timeout) {
+                               int64_t stop_timeout, int64_t cache_ttl) {
   std::chrono::milliseconds ms(stop_timeout);
 #ifdef HSTREAM_USE_SHARED_CHECKPOINT_STORE
   std::shared_ptr<CheckpointStore> checkpoint_store =
       CheckpointStoreFactory().createSharedRSMBasedCheckpointStore(
           client->rep, logid_t(log_id), ms);
 #else
-  std::unique_ptr<CheckpointStore> checkpoint_store =
-      CheckpointStoreFactory().createRSMBasedCheckpointStore(
-          client->rep, logid_t(log_id), ms);
+  std::unique_ptr<CheckpointStore> checkpoint_store;
+  if (cache_ttl < 0) {
+    checkpoint_store = CheckpointStoreFactory().createRSMBasedCheckpointStore(
+        client->rep, logid_t(log_id), ms);
+  } else {
+    ClientImpl* client_impl = dynamic_cast<ClientImpl*>(client->rep.get());
+    ld_check(client_impl);
+    auto rsm_vcs = std::make_unique<RSMBasedVersionedConfigStore>(
+        logid_t(log_id), CheckpointStoreImpl::extractVersion,
+        &(client_impl->getProcessor()), ms);
+    auto cache =
+        std::make_shared<VcsReadCache>(std::chrono::milliseconds(cache_ttl));
+    checkpoint_store = std::make_unique<CheckpointStoreImpl>(
+        std::make_unique<CachedVersionedConfigStore>(
+            std::move(rsm_vcs), CheckpointStoreImpl::extractVersion,
+            std::move(cache)));
+  }
 #endif
   logdevice_checkpoint_store_t* result = new logdevice_checkpoint_store_t;
   result->rep = std::move(checkpoint_store);
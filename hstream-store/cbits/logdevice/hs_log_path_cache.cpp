@@ -0,0 +1,123 @@
+#include "hs_logdevice.h"
+
+// ----------------------------------------------------------------------------
+// LogPathCache
+
+LogPathCache::LogPathCache(std::shared_ptr<Client> client)
+    : client_(client),
+      config_handle_(
+          client->subscribeToConfigUpdates([this] { onConfigUpdate(); })) {
+  logsconfig_version_.store(currentLogsConfigVersion());
+}
+
+bool LogPathCache::lookup(const std::string& path,
+                          LogPathCacheEntry* entry_out, uint64_t* epoch_out) {
+  // Read the epoch before the map, so that an invalidation which happens
+  // in between makes the following insert a no-op.
+  *epoch_out = epoch_.load(std::memory_order_acquire);
+  auto it = map_.find(path);
+  if (it != map_.cend()) {
+    *entry_out = it->second;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void LogPathCache::insert(const std::string& path, LogPathCacheEntry entry,
+                          uint64_t epoch) {
+  if (epoch != epoch_.load(std::memory_order_acquire)) {
+    return;
+  }
+  map_.insert_or_assign(path, std::move(entry));
+  // An invalidation may have cleared the map between the check and the
+  // insertion above, the entry is then from an outdated config.
+  if (epoch != epoch_.load(std::memory_order_acquire)) {
+    map_.erase(path);
+  }
+}
+
+void LogPathCache::invalidatePrefix(const std::string& path) {
+  epoch_.fetch_add(1, std::memory_order_acq_rel);
+  invalidations_.fetch_add(1, std::memory_order_relaxed);
+  std::string dir = path;
+  if (dir.empty() || dir.back() != '/') {
+    dir.push_back('/');
+  }
+  for (auto it = map_.cbegin(); it != map_.cend(); ++it) {
+    const std::string& key = it->first;
+    if (key == path || key.compare(0, dir.size(), dir) == 0) {
+      map_.erase(key);
+    }
+  }
+}
+
+void LogPathCache::invalidateAll() {
+  epoch_.fetch_add(1, std::memory_order_acq_rel);
+  invalidations_.fetch_add(1, std::memory_order_relaxed);
+  map_.clear();
+}
+
+void LogPathCache::onConfigUpdate() {
+  uint64_t version = currentLogsConfigVersion();
+  uint64_t prev = logsconfig_version_.load(std::memory_order_acquire);
+  while (version != prev) {
+    if (logsconfig_version_.compare_exchange_weak(prev, version)) {
+      invalidateAll();
+      return;
+    }
+  }
+}
+
+uint64_t LogPathCache::currentLogsConfigVersion() {
+  auto client = client_.lock();
+  if (!client) {
+    return 0;
+  }
+  ClientImpl* client_impl = dynamic_cast<ClientImpl*>(client.get());
+  ld_check(client_impl);
+  auto logs_config = client_impl->getConfig()->getLogsConfig();
+  return logs_config ? logs_config->getVersion() : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+extern "C" {
+
+bool ld_client_log_path_cache_lookup(logdevice_client_t* client,
+                                     const char* path, c_logid_t* logid_out,
+                                     uint64_t* epoch_out) {
+  LogPathCacheEntry entry;
+  if (client->log_path_cache->lookup(path, &entry, epoch_out)) {
+    *logid_out = entry.logid.val();
+    return true;
+  }
+  return false;
+}
+
+void ld_client_log_path_cache_insert(logdevice_client_t* client,
+                                     const char* path,
+                                     logdevice_loggroup_t* group,
+                                     uint64_t epoch) {
+  LogPathCacheEntry entry{group->rep->range().first};
+  client->log_path_cache->insert(path, std::move(entry), epoch);
+}
+
+void ld_client_log_path_cache_invalidate(logdevice_client_t* client,
+                                         const char* path) {
+  client->log_path_cache->invalidatePrefix(path);
+}
+
+void ld_client_log_path_cache_stats(logdevice_client_t* client,
+                                    uint64_t* hits, uint64_t* misses,
+                                    uint64_t* invalidations, HsInt* size) {
+  auto& cache = client->log_path_cache;
+  *hits = cache->hits();
+  *misses = cache->misses();
+  *invalidations = cache->invalidations();
+  *size = cache->size();
+}
+
+// ----------------------------------------------------------------------------
+} // end extern "C"
@@ -1,4 +1,5 @@
 #include "hs_logdevice.h"
+#include "hs_tracing.h"
 
 extern "C" {
 // ----------------------------------------------------------------------------
@@ -151,7 +152,10 @@ WAIT_ONLY_WHEN_NO_DATA(ld_ckp_reader_wait_only_when_no_data,
     std::vector<std::unique_ptr<DataRecord>> data;                             \
     facebook::logdevice::GapRecord gap;                                        \
                                                                                \
+    hstream::tracing::Span span(hs_trace_begin(), 0, "ld.read");               \
     ssize_t nread = reader->rep->read(maxlen, &data, &gap);                    \
+    span.tag("nread", nread);                                                  \
+    span.finish();                                                             \
     *len_out = nread;                                                          \
     /* Copy data record  */                                                    \
     if (nread >= 0) {                                                          \
@@ -164,7 +168,7 @@ WAIT_ONLY_WHEN_NO_DATA(ld_ckp_reader_wait_only_when_no_data,
         data_out[i].lsn = attrs.lsn;                                           \
         data_out[i].timestamp = attrs.timestamp.count();                       \
         data_out[i].batch_offset = attrs.batch_offset;                         \
-        data_out[i].payload = copyString<ld::Payload>(payload);                \
+        data_out[i].payload = copyString<ld::Payload>(payload, HS_ARENA_READ); \
         data_out[i].payload_len = payload.size();                              \
         data_out[i].byte_offset =                                              \
             attrs.offsets.getCounter(facebook::logdevice::BYTE_OFFSET);        \
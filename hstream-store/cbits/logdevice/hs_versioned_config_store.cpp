@@ -2,6 +2,176 @@
 
 using facebook::logdevice::Status;
 
+// ----------------------------------------------------------------------------
+// VcsReadCache
+
+bool VcsReadCache::lookup(const std::string& key, VcsCacheEntry* entry_out,
+                          bool* need_refresh) {
+  *need_refresh = false;
+  {
+    auto state = state_.rlock();
+    auto it = state->entries.find(key);
+    if (it == state->entries.end()) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    *entry_out = it->second;
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  if (std::chrono::steady_clock::now() - entry_out->fetched_at >= ttl_) {
+    // Only one refresh for each key at the same time
+    *need_refresh = state_.wlock()->refreshing.insert(key).second;
+    if (*need_refresh) {
+      refreshes_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  return true;
+}
+
+void VcsReadCache::update(const std::string& key,
+                          vcs_config_version_t version, std::string value) {
+  auto state = state_.wlock();
+  auto it = state->entries.find(key);
+  if (it != state->entries.end() && it->second.version > version) {
+    return;
+  }
+  state->entries[key] =
+      VcsCacheEntry{version, std::make_shared<const std::string>(std::move(value)),
+                    std::chrono::steady_clock::now()};
+}
+
+void VcsReadCache::touch(const std::string& key) {
+  auto state = state_.wlock();
+  auto it = state->entries.find(key);
+  if (it != state->entries.end()) {
+    it->second.fetched_at = std::chrono::steady_clock::now();
+  }
+}
+
+void VcsReadCache::erase(const std::string& key) {
+  state_.wlock()->entries.erase(key);
+}
+
+void VcsReadCache::refreshDone(const std::string& key) {
+  state_.wlock()->refreshing.erase(key);
+}
+
+// ----------------------------------------------------------------------------
+// CachedVersionedConfigStore
+
+void CachedVersionedConfigStore::getConfig(
+    std::string key, value_callback_t cb,
+    folly::Optional<version_t> base_version) const {
+  auto cache = cache_;
+  auto extract = extract_;
+  VcsCacheEntry entry;
+  bool need_refresh = false;
+  if (cache->enabled() && cache->lookup(key, &entry, &need_refresh)) {
+    if (need_refresh) {
+      auto refresh_cb = [cache, extract, key](Status st, std::string val) {
+        if (st == Status::OK) {
+          auto version = extract(val);
+          if (version.hasValue()) {
+            cache->update(key, version.value(), std::move(val));
+          } else {
+            cache->erase(key);
+          }
+        } else if (st == Status::UPTODATE) {
+          cache->touch(key);
+        } else if (st == Status::NOTFOUND) {
+          cache->erase(key);
+        }
+        cache->refreshDone(key);
+      };
+      rep_->getConfig(key, std::move(refresh_cb), entry.version);
+    }
+    // Same as VersionedConfigStore::getConfig, UPTODATE if the value is not
+    // newer than the base version.
+    if (base_version.hasValue() && entry.version <= base_version.value()) {
+      cb(Status::UPTODATE, "");
+    } else {
+      cb(Status::OK, *entry.value);
+    }
+    return;
+  }
+
+  auto value_cb = [cache, extract, key, cb = std::move(cb)](
+                      Status st, std::string val) mutable {
+    if (st == Status::OK && cache->enabled()) {
+      auto version = extract(val);
+      if (version.hasValue()) {
+        cache->update(key, version.value(), val);
+      }
+    }
+    cb(st, std::move(val));
+  };
+  rep_->getConfig(key, std::move(value_cb), base_version);
+}
+
+// Always read the latest value (linearizable), the cache is updated with the
+// result.
+void CachedVersionedConfigStore::getLatestConfig(std::string key,
+                                                 value_callback_t cb) const {
+  auto cache = cache_;
+  auto extract = extract_;
+  auto value_cb = [cache, extract, key, cb = std::move(cb)](
+                      Status st, std::string val) mutable {
+    if (cache->enabled()) {
+      if (st == Status::OK) {
+        auto version = extract(val);
+        if (version.hasValue()) {
+          cache->update(key, version.value(), val);
+        }
+      } else if (st == Status::NOTFOUND) {
+        cache->erase(key);
+      }
+    }
+    cb(st, std::move(val));
+  };
+  rep_->getLatestConfig(key, std::move(value_cb));
+}
+
+void CachedVersionedConfigStore::updateConfig(std::string key,
+                                              std::string value,
+                                              Condition base_version,
+                                              write_callback_t cb) {
+  auto cache = cache_;
+  // Keep a copy for the cache, since the callback does not always carry the
+  // written value.
+  auto written = std::make_shared<std::string>(value);
+  auto write_cb = [cache, key, written, cb = std::move(cb)](
+                      Status st, version_t version, std::string val) mutable {
+    if (cache->enabled()) {
+      if (st == Status::OK) {
+        cache->update(key, version, *written);
+      } else if (st == Status::VERSION_MISMATCH && version != version_t(0)) {
+        cache->update(key, version, val);
+      }
+    }
+    if (cb) {
+      cb(st, version, std::move(val));
+    }
+  };
+  rep_->updateConfig(key, std::move(value), std::move(base_version),
+                     std::move(write_cb));
+}
+
+// ----------------------------------------------------------------------------
+
+static void fill_value_cb_data(vcs_value_callback_data_t* cb_data, Status st,
+                               const std::string& val) {
+  if (cb_data) {
+    cb_data->st = static_cast<c_error_code_t>(st);
+    // If status is OK, cb will be invoked with the value.
+    // Otherwise, the value parameter is meaningless (but
+    // default-constructed).
+    if (st == Status::OK) {
+      cb_data->val_len = val.size();
+      cb_data->value = copyString(val);
+    }
+  }
+}
+
 extern "C" {
 // ----------------------------------------------------------------------------
 
@@ -35,66 +205,57 @@ extract_function(folly::StringPiece s) {
   return folly::none;
 }
 
+// A negative cache_ttl disables the read cache.
 logdevice_vcs_t* new_rsm_based_vcs(logdevice_client_t* client, c_logid_t logid,
-                                   int64_t stop_timeout) {
+                                   int64_t stop_timeout, int64_t cache_ttl) {
   ClientImpl* client_impl = dynamic_cast<ClientImpl*>(client->rep.get());
   ld_check(client_impl);
-  auto vcs_ = std::make_unique<RSMBasedVersionedConfigStore>(
+  auto cache =
+      std::make_shared<VcsReadCache>(std::chrono::milliseconds(cache_ttl));
+  auto rsm_vcs = std::make_unique<RSMBasedVersionedConfigStore>(
       logid_t(logid), extract_function, &(client_impl->getProcessor()),
       std::chrono::milliseconds(stop_timeout));
   logdevice_vcs_t* vcs = new logdevice_vcs_t;
-  vcs->rep = std::move(vcs_);
+  vcs->rep = std::make_unique<CachedVersionedConfigStore>(
+      std::move(rsm_vcs), extract_function, cache);
+  vcs->cache = std::move(cache);
   return vcs;
 }
 
 void free_logdevice_vcs(logdevice_vcs_t* vcs) { delete vcs; }
 
+// Values are served from the cache if possible, see
+// CachedVersionedConfigStore.
 void logdevice_vcs_get_config(logdevice_vcs_t* vcs, const char* key,
                               c_vcs_config_version_t* base_version_,
                               HsStablePtr mvar, HsInt cap,
                               vcs_value_callback_data_t* cb_data) {
-  auto value_cb = [mvar, cap, cb_data](facebook::logdevice::Status st,
-                                       std::string val) {
-    if (cb_data) {
-      cb_data->st = static_cast<c_error_code_t>(st);
-      // If status is OK, cb will be invoked with the value.
-      // Otherwise, the value parameter is meaningless (but
-      // default-constructed).
-      if (st == facebook::logdevice::Status::OK) {
-        cb_data->val_len = val.size();
-        cb_data->value = copyString(val);
-      }
-    }
-    hs_try_putmvar(cap, mvar);
-  };
-
+  folly::Optional<VersionedConfigStore::version_t> base_version = folly::none;
   if (base_version_) {
-    vcs->rep->getConfig(std::string(key), value_cb,
-                        VersionedConfigStore::version_t(*base_version_));
-  } else {
-    vcs->rep->getConfig(std::string(key), value_cb, folly::none);
+    base_version = VersionedConfigStore::version_t(*base_version_);
   }
+  auto value_cb = [mvar, cap, cb_data](Status st, std::string val) {
+    fill_value_cb_data(cb_data, st, val);
+    hs_try_putmvar(cap, mvar);
+  };
+  vcs->rep->getConfig(std::string(key), std::move(value_cb), base_version);
 }
 
 void logdevice_vcs_get_latest_config(logdevice_vcs_t* vcs, const char* key,
                                      HsStablePtr mvar, HsInt cap,
                                      vcs_value_callback_data_t* cb_data) {
-  auto value_cb = [mvar, cap, cb_data](facebook::logdevice::Status st,
-                                       std::string val) {
-    if (cb_data) {
-      cb_data->st = static_cast<c_error_code_t>(st);
-      // If status is OK, cb will be invoked with the value.
-      // Otherwise, the value parameter is meaningless (but
-      // default-constructed).
-      if (st == facebook::logdevice::Status::OK) {
-        cb_data->val_len = val.size();
-        cb_data->value = copyString(val);
-      }
-    }
+  auto value_cb = [mvar, cap, cb_data](Status st, std::string val) {
+    fill_value_cb_data(cb_data, st, val);
     hs_try_putmvar(cap, mvar);
   };
+  vcs->rep->getLatestConfig(std::string(key), std::move(value_cb));
+}
 
-  vcs->rep->getLatestConfig(std::string(key), value_cb);
+void logdevice_vcs_get_cache_stats(logdevice_vcs_t* vcs, uint64_t* hits,
+                                   uint64_t* misses, uint64_t* refreshes) {
+  *hits = vcs->cache->hits();
+  *misses = vcs->cache->misses();
+  *refreshes = vcs->cache->refreshes();
 }
 
 /*
@@ -141,6 +302,8 @@ void logdevice_vcs_update_config(
     HsInt condition_mode, c_vcs_config_version_t version,
     // VersionedConfigStore::Condition END
     HsStablePtr mvar, HsInt cap, vcs_write_callback_data_t* cb_data) {
+  std::string key_(key);
+  std::string value_(value + offset, val_len);
   auto cb = [mvar, cap, cb_data](facebook::logdevice::Status st,
                                  vcs_config_version_t version,
                                  std::string val) {
@@ -155,16 +318,15 @@ void logdevice_vcs_update_config(
     hs_try_putmvar(cap, mvar);
   };
   if (condition_mode == 2) {
-    vcs->rep->updateConfig(std::string(key),
-                           std::string(value + offset, val_len),
+    vcs->rep->updateConfig(key_, std::move(value_),
                            VersionedConfigStore::Condition::overwrite(), cb);
   } else if (condition_mode == 3) {
     vcs->rep->updateConfig(
-        std::string(key), std::string(value + offset, val_len),
+        key_, std::move(value_),
         VersionedConfigStore::Condition::createIfNotExists(), cb);
   } else {
     vcs->rep->updateConfig(
-        std::string(key), std::string(value + offset, val_len),
+        key_, std::move(value_),
         VersionedConfigStore::Condition(vcs_config_version_t(version)), cb);
   }
 }
@@ -1,4 +1,21 @@
 #include "hs_logdevice.h"
+#include "hs_tracing.h"
+
+// The span of an append lives until its callback, so it is shared with the
+// callback. Nothing is allocated for appends which are not sampled.
+using AppendSpan = std::shared_ptr<hstream::tracing::Span>;
+
+static AppendSpan start_append_span(c_logid_t logid, int64_t bytes) {
+  uint64_t trace_id = hs_trace_begin();
+  if (!trace_id) {
+    return nullptr;
+  }
+  auto span =
+      std::make_shared<hstream::tracing::Span>(trace_id, 0, "ld.append");
+  span->tag("logid", logid);
+  span->tag("bytes", bytes);
+  return span;
+}
 
 facebook::logdevice::Status
 _append_payload_sync(logdevice_client_t* client,
@@ -33,8 +50,15 @@ facebook::logdevice::Status _append_payload_async(
     const char* payload, HsInt offset, HsInt length,
     // Payload End
     AppendAttributes&& attrs) {
-  auto cb = [cb_data, mvar, cap](facebook::logdevice::Status st,
-                                 const DataRecord& r) {
+  // LogDevice copies the payload on this thread
+  hstream::alloc::ArenaScope arena_scope(HS_ARENA_WRITE);
+  auto span = start_append_span(logid.val_, length);
+  auto cb = [cb_data, mvar, cap, span](facebook::logdevice::Status st,
+                                       const DataRecord& r) {
+    if (span) {
+      span->tag("status", static_cast<int64_t>(st));
+      span->finish();
+    }
     if (cb_data) {
       cb_data->st = static_cast<c_error_code_t>(st);
       cb_data->logid = r.logid.val_;
@@ -116,6 +140,8 @@ facebook::logdevice::Status logdevice_append_with_attrs_async(
 
 #define APPEND_BATCH(ExPayload, ExOffset, ExLen, total_len)                    \
   do {                                                                         \
+    /* The encoded blob is accounted to the write arena */                     \
+    hstream::alloc::ArenaScope arena_scope(HS_ARENA_WRITE);                    \
     BufferedWriteCodec::Estimator blob_size_estimator;                         \
     for (int i = 0; i < total_len; ++i) {                                      \
       auto iobuf =                                                             \
@@ -124,6 +150,8 @@ facebook::logdevice::Status logdevice_append_with_attrs_async(
     }                                                                          \
     const size_t total_blob_bytes =                                            \
         blob_size_estimator.calculateSize(/* checksum_bits */ 0);              \
+    /* The span also covers the encoding */                                    \
+    auto span = start_append_span(logid, total_blob_bytes);                    \
     BufferedWriteCodec::Encoder<BufferedWriteSinglePayloadsCodec::Encoder>     \
         encoder(/* checksum_bits */ 0, total_len, total_blob_bytes);           \
                                                                                \
@@ -139,8 +167,12 @@ facebook::logdevice::Status logdevice_append_with_attrs_async(
     PayloadHolder payload_holder;                                              \
     payload_holder = PayloadHolder(std::move(blob));                           \
                                                                                \
-    auto cb = [cb_data, mvar, cap](facebook::logdevice::Status st,             \
-                                   const DataRecord& r) {                      \
+    auto cb = [cb_data, mvar, cap, span](facebook::logdevice::Status st,       \
+                                         const DataRecord& r) {                \
+      if (span) {                                                              \
+        span->tag("status", static_cast<int64_t>(st));                         \
+        span->finish();                                                        \
+      }                                                                        \
       if (cb_data) {                                                           \
         cb_data->st = static_cast<c_error_code_t>(st);                         \
         cb_data->logid = r.logid.val_;                                         \
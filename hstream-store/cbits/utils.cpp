@@ -12,18 +12,19 @@ std::string* new_hs_std_string(std::string&& str) {
 //
 // Note that
 // 1. this will not append the "\0" to the end of the memory.
-// 2. you need to free the result manually.
+// 2. the memory is accounted to the given arena, so you need to free the
+//    result manually by hs_arena_free (not the plain free), see hs_alloc.h
 
 // Explicitly instantiate
-template char* copyString(const ld::Payload& payload);
-template char* copyString(const std::string& payload);
+template char* copyString(const ld::Payload& payload, hs_arena_t arena);
+template char* copyString(const std::string& payload, hs_arena_t arena);
 
-template <typename T> char* copyString(const T& payload) {
+template <typename T> char* copyString(const T& payload, hs_arena_t arena) {
   char* data_copy = nullptr;
   auto data_ = payload.data();
   auto size_ = payload.size();
   if (data_ && size_ > 0) {
-    data_copy = reinterpret_cast<char*>(malloc(size_));
+    data_copy = reinterpret_cast<char*>(hs_arena_malloc(arena, size_));
     if (!data_copy) {
       throw std::bad_alloc();
     }
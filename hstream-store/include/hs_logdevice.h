@@ -3,19 +3,24 @@
 // * --------------------------------------------------------------------------
 
 #include "ghc_ext.h"
+#include "hs_alloc.h"
 #include "hs_cpp_lib.h"
 
+#include <atomic>
 #include <iostream>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <folly/Conv.h>
 #include <folly/Optional.h>
 #include <folly/Singleton.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <folly/concurrency/ConcurrentHashMap.h>
 #include <folly/io/IOBuf.h>
 #include <folly/io/async/AsyncSocket.h>
 
@@ -34,6 +39,7 @@
 #include <logdevice/include/CheckpointedReaderFactory.h>
 #include <logdevice/include/Client.h>
 #include <logdevice/include/ClientSettings.h>
+#include <logdevice/include/ConfigSubscriptionHandle.h>
 #include <logdevice/include/Err.h>
 #include <logdevice/include/LogAttributes.h>
 #include <logdevice/include/LogHeadAttributes.h>
@@ -46,6 +52,7 @@
 #include <logdevice/include/debug.h>
 #include <logdevice/include/types.h>
 #include <logdevice/lib/ClientImpl.h>
+#include <logdevice/lib/checkpointing/CheckpointStoreImpl.h>
 
 namespace ld = facebook::logdevice;
 using facebook::logdevice::AppendAttributes;
@@ -55,11 +62,13 @@ using facebook::logdevice::CheckpointedReaderBase;
 using facebook::logdevice::CheckpointedReaderFactory;
 using facebook::logdevice::CheckpointStore;
 using facebook::logdevice::CheckpointStoreFactory;
+using facebook::logdevice::CheckpointStoreImpl;
 using facebook::logdevice::Client;
 using facebook::logdevice::ClientFactory;
 using facebook::logdevice::ClientImpl;
 using facebook::logdevice::ClientSettings;
 using facebook::logdevice::Compression;
+using facebook::logdevice::ConfigSubscriptionHandle;
 using facebook::logdevice::DataRecord;
 using facebook::logdevice::KeyType;
 using facebook::logdevice::LogHeadAttributes;
@@ -83,7 +92,145 @@ using facebook::logdevice::client::LogGroup;
 using LogDirectory = facebook::logdevice::client::Directory;
 
 std::string* new_hs_std_string(std::string&& str);
-template <typename T> char* copyString(const T& str);
+template <typename T>
+char* copyString(const T& str, hs_arena_t arena = HS_ARENA_DEFAULT);
+
+// ----------------------------------------------------------------------------
+// LogPathCache
+//
+// A concurrent map from the fully qualified log path to its logid. Reads are
+// lock-free. The whole cache is dropped whenever the client observes a new
+// logsconfig version through its config subscription.
+//
+// Since a lookup may race with an invalidation, each miss hands out the
+// current epoch, and an insert is ignored if the cache has been invalidated
+// since that epoch was read.
+
+struct LogPathCacheEntry {
+  logid_t logid;
+};
+
+class LogPathCache {
+public:
+  explicit LogPathCache(std::shared_ptr<Client> client);
+
+  // Return true on hit. On miss, epoch_out is set to the epoch which should
+  // be passed to the following insert.
+  bool lookup(const std::string& path, LogPathCacheEntry* entry_out,
+              uint64_t* epoch_out);
+  void insert(const std::string& path, LogPathCacheEntry entry,
+              uint64_t epoch);
+  // Drop path itself and all paths under it.
+  void invalidatePrefix(const std::string& path);
+  void invalidateAll();
+
+  uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+  uint64_t invalidations() const {
+    return invalidations_.load(std::memory_order_relaxed);
+  }
+  size_t size() const { return map_.size(); }
+
+private:
+  void onConfigUpdate();
+  uint64_t currentLogsConfigVersion();
+
+  std::weak_ptr<Client> client_;
+  folly::ConcurrentHashMap<std::string, LogPathCacheEntry> map_;
+  std::atomic<uint64_t> epoch_{0};
+  std::atomic<uint64_t> logsconfig_version_{0};
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> invalidations_{0};
+  // Must be the last member, so that it is unsubscribed before others are
+  // destroyed.
+  ConfigSubscriptionHandle config_handle_;
+};
+
+// ----------------------------------------------------------------------------
+// VcsReadCache
+//
+// A local cache of the values read from a VersionedConfigStore, keyed by
+// config key. A hit is served immediately, and if the entry is older than
+// the ttl, a version-conditional getConfig (which only returns the value if
+// the stored version is newer) is issued in background to refresh it.
+// Entries are only replaced by values with a greater or equal version, so a
+// slow refresh never overwrites a newer write.
+
+struct VcsCacheEntry {
+  vcs_config_version_t version;
+  std::shared_ptr<const std::string> value;
+  std::chrono::steady_clock::time_point fetched_at;
+};
+
+class VcsReadCache {
+public:
+  // A negative ttl disables the cache.
+  explicit VcsReadCache(std::chrono::milliseconds ttl) : ttl_(ttl) {}
+
+  bool enabled() const { return ttl_.count() >= 0; }
+
+  // Return true on hit. need_refresh is set if the entry is expired and the
+  // caller should refresh it, refreshDone must be called after that.
+  bool lookup(const std::string& key, VcsCacheEntry* entry_out,
+              bool* need_refresh);
+  void update(const std::string& key, vcs_config_version_t version,
+              std::string value);
+  // The entry is still up to date.
+  void touch(const std::string& key);
+  void erase(const std::string& key);
+  void refreshDone(const std::string& key);
+
+  uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+  uint64_t refreshes() const {
+    return refreshes_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct State {
+    std::unordered_map<std::string, VcsCacheEntry> entries;
+    std::unordered_set<std::string> refreshing;
+  };
+
+  const std::chrono::milliseconds ttl_;
+  folly::Synchronized<State> state_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> refreshes_{0};
+};
+
+// A VersionedConfigStore that serves getConfig from a VcsReadCache and keeps
+// it updated with the results of getLatestConfig and updateConfig of the
+// underlying store. readModifyWriteConfig is not overridden, so it always
+// reads the latest value.
+class CachedVersionedConfigStore : public VersionedConfigStore {
+public:
+  using extract_fn_t = folly::Optional<version_t> (*)(folly::StringPiece);
+
+  CachedVersionedConfigStore(std::unique_ptr<VersionedConfigStore> rep,
+                             extract_fn_t extract_fn,
+                             std::shared_ptr<VcsReadCache> cache)
+      : VersionedConfigStore(extract_fn),
+        rep_(std::move(rep)),
+        extract_(extract_fn),
+        cache_(std::move(cache)) {}
+
+  void getConfig(std::string key, value_callback_t cb,
+                 folly::Optional<version_t> base_version = {}) const override;
+  void getLatestConfig(std::string key, value_callback_t cb) const override;
+  void updateConfig(std::string key, std::string value, Condition base_version,
+                    write_callback_t cb = {}) override;
+  void shutdown() override { rep_->shutdown(); }
+
+private:
+  std::unique_ptr<VersionedConfigStore> rep_;
+  const extract_fn_t extract_;
+  // Shared with the in-flight callbacks, which may outlive the store.
+  std::shared_ptr<VcsReadCache> cache_;
+};
+
+// ----------------------------------------------------------------------------
 
 template <typename Container>
 std::vector<std::string>* getKeys(const Container& container) {
@@ -122,9 +269,14 @@ struct logdevice_logdirectory_t {
 };
 struct logdevice_client_t {
   std::shared_ptr<Client> rep;
+  // Declared after rep, so it is destroyed before the client.
+  std::unique_ptr<LogPathCache> log_path_cache;
 };
 struct logdevice_vcs_t {
+  // A CachedVersionedConfigStore
   std::unique_ptr<VersionedConfigStore> rep;
+  // For the stats
+  std::shared_ptr<VcsReadCache> cache;
 };
 
 struct logdevice_log_head_attributes_t {
@@ -386,6 +538,43 @@ HsInt ld_client_find_time(logdevice_client_t* client, c_logid_t logid,
                           HsStablePtr mvar, HsInt cap, c_error_code_t* st_out,
                           c_lsn_t* lsn_out);
 
+// Batch requests
+
+void ld_client_get_tail_lsn_batch(logdevice_client_t* client,
+                                  const c_logid_t* logids, HsInt len,
+                                  HsInt concurrency, HsStablePtr mvar,
+                                  HsInt cap, c_error_code_t* sts_out,
+                                  c_lsn_t* lsns_out);
+
+void ld_client_get_tail_attributes_batch(
+    logdevice_client_t* client, const c_logid_t* logids, HsInt len,
+    HsInt concurrency, HsStablePtr mvar, HsInt cap, c_error_code_t* sts_out,
+    c_lsn_t* lsns_out, c_timestamp_t* timestamps_out,
+    uint64_t* byte_offsets_out);
+
+void ld_client_get_head_attributes_batch(
+    logdevice_client_t* client, const c_logid_t* logids, HsInt len,
+    HsInt concurrency, HsStablePtr mvar, HsInt cap, c_error_code_t* sts_out,
+    c_lsn_t* trim_points_out, c_timestamp_t* trim_point_timestamps_out);
+
+void ld_client_trim_batch(logdevice_client_t* client, const c_logid_t* logids,
+                          const c_lsn_t* lsns, HsInt len, HsInt concurrency,
+                          HsStablePtr mvar, HsInt cap, c_error_code_t* sts_out);
+
+void ld_client_find_time_batch(logdevice_client_t* client,
+                               const c_logid_t* logids,
+                               const c_timestamp_t* timestamps, HsInt len,
+                               HsInt accuracy, HsInt concurrency,
+                               HsStablePtr mvar, HsInt cap,
+                               c_error_code_t* sts_out, c_lsn_t* lsns_out);
+
+void ld_client_find_key_batch(logdevice_client_t* client,
+                              const c_logid_t* logids, StgArrBytes** keys,
+                              HsInt len, HsInt accuracy, HsInt concurrency,
+                              HsStablePtr mvar, HsInt cap,
+                              c_error_code_t* sts_out, c_lsn_t* lo_lsns_out,
+                              c_lsn_t* hi_lsns_out);
+
 // ----------------------------------------------------------------------------
 // LogConfigType
 
@@ -456,6 +645,20 @@ ld_client_set_attributes(logdevice_client_t* client, const char* path,
                          LogAttributes* attrs, HsStablePtr mvar, HsInt cap,
                          logsconfig_status_cb_data_t* data);
 
+// LogPathCache
+bool ld_client_log_path_cache_lookup(logdevice_client_t* client,
+                                     const char* path, c_logid_t* logid_out,
+                                     uint64_t* epoch_out);
+void ld_client_log_path_cache_insert(logdevice_client_t* client,
+                                     const char* path,
+                                     logdevice_loggroup_t* group,
+                                     uint64_t epoch);
+void ld_client_log_path_cache_invalidate(logdevice_client_t* client,
+                                         const char* path);
+void ld_client_log_path_cache_stats(logdevice_client_t* client,
+                                    uint64_t* hits, uint64_t* misses,
+                                    uint64_t* invalidations, HsInt* size);
+
 //-----------------------------------------------------------------------------
 // Log Head Attributes
 
@@ -514,7 +717,7 @@ new_file_based_checkpoint_store(const char* root_path);
 
 logdevice_checkpoint_store_t*
 new_rsm_based_checkpoint_store(logdevice_client_t* client, c_logid_t log_id,
-                               int64_t stop_timeout);
+                               int64_t stop_timeout, int64_t cache_ttl);
 logdevice_checkpoint_store_t*
 new_zookeeper_based_checkpoint_store(logdevice_client_t* client);
 
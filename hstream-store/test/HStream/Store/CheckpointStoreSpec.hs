@@ -26,6 +26,9 @@ rsmBased = context "RSMBasedCheckpointedReader" $ do
   void $ runIO $ S.initCheckpointStoreLogID client attrs
   storeSpec $ S.newRSMBasedCheckpointStore client S.checkpointStoreLogID 5000
 
+  context "with read cache" $
+    storeSpec $ S.newCachedRSMBasedCheckpointStore client S.checkpointStoreLogID 5000 60000
+
 storeSpec :: IO S.LDCheckpointStore -> Spec
 storeSpec new_ckp_store = do
   let logid = 1
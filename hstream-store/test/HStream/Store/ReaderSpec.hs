@@ -127,7 +127,7 @@ rsmBased = context "RSMBasedCheckpointedReader" $ do
 
   readerSpec readerName
              logid
-             (S.newLDRsmCkpReader client readerName S.checkpointStoreLogID 5000 1 Nothing)
+             (S.newLDRsmCkpReader client readerName S.checkpointStoreLogID 5000 (-1) 1 Nothing)
              (S.newRSMBasedCheckpointStore client S.checkpointStoreLogID 5000)
 
   -- Now, we don't need to use shared_ptr, and we are using unique_ptr for
@@ -148,7 +148,8 @@ rsmBased = context "RSMBasedCheckpointedReader" $ do
     S.initSubscrCheckpointDir client S.def{S.logReplicationFactor = S.defAttr1 1}
     ckp_logid <- S.allocSubscrCheckpointId client "subid"
     S.getSubscrCheckpointId client "subid" `shouldReturn` ckp_logid
-    reader <- S.newLDRsmCkpReader client "subid" ckp_logid 5000 1 Nothing
+    -- the checkpoints the reader caches are still written to the store
+    reader <- S.newLDRsmCkpReader client "subid" ckp_logid 5000 5000 1 Nothing
     S.writeCheckpoints reader (Map.fromList [(100, 100)]) 10
     S.writeCheckpoints reader (Map.fromList [(101, 100)]) 10
     S.writeCheckpoints reader (Map.fromList [(102, 100)]) 10
@@ -85,6 +85,21 @@ base = describe "BaseSpec" $ do
 
     S.getUnderlyingLogId client stream2 key `shouldReturn` log_id
 
+  it "log path cache" $ do
+    stream <- S.mkStreamId S.StreamTypeStream <$> newRandomName 5
+    let attrs = S.def { S.logReplicationFactor = S.defAttr1 1 }
+    S.createStream client stream attrs
+    log_id <- S.createStreamPartition client stream Nothing Map.empty
+    stats0 <- S.getLogPathCacheStats client
+    S.getUnderlyingLogId client stream Nothing `shouldReturn` log_id
+    S.getUnderlyingLogId client stream Nothing `shouldReturn` log_id
+    stats1 <- S.getLogPathCacheStats client
+    S.logPathCacheHits stats1 `shouldSatisfy` (> S.logPathCacheHits stats0)
+
+    S.removeStream client stream
+    S.doesStreamPartitionExist client stream Nothing `shouldReturn` False
+    S.getUnderlyingLogId client stream Nothing `shouldThrow` S.isNOTFOUND
+
   it "create the same stream should throw EXISTS" $ do
     let attrs = S.def { S.logReplicationFactor = S.defAttr1 1
                       , S.logAttrsExtras = Map.fromList [ ("greet", "hi")
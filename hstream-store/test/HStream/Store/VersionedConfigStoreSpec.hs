@@ -0,0 +1,50 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+module HStream.Store.VersionedConfigStoreSpec (spec) where
+
+import           Control.Concurrent               (threadDelay)
+import           Control.Monad                    (void)
+import           Test.Hspec
+import           Z.Data.Vector                    (Bytes)
+
+import qualified HStream.Store                    as S
+import qualified HStream.Store.Internal.LogDevice as I
+import           HStream.Store.SpecUtils
+
+spec :: Spec
+spec = describe "VersionedConfigStore" $ do
+  let attrs = S.def { S.logReplicationFactor = S.defAttr1 1 }
+  void $ runIO $ S.initCheckpointStoreLogID client attrs
+
+  -- Values are "<version>:<data>", see extract_function.
+  it "serves reads from the cache" $ do
+    key <- newRandomName 10
+    vcs <- I.newRsmBasedVcs client S.checkpointStoreLogID 5000 60000
+    void $ I.ldVcsUpdateConfig vcs key "1:a" I.VcsCondIfNotExists 3
+    I.vcsGetConfig vcs key Nothing 3 `shouldReturn` "1:a"
+    I.vcsGetConfig vcs key Nothing 3 `shouldReturn` "1:a"
+    I.vcsGetCacheStats vcs `shouldReturn` I.VcsCacheStats 2 0 0
+
+  it "refreshes expired values in background" $ do
+    key <- newRandomName 10
+    vcs <- I.newRsmBasedVcs client S.checkpointStoreLogID 5000 0
+    other <- I.newRsmBasedVcs client S.checkpointStoreLogID 5000 (-1)
+    void $ I.ldVcsUpdateConfig vcs key "1:a" I.VcsCondIfNotExists 3
+    void $ I.ldVcsUpdateConfig other key "2:b" I.VcsCondOverwrite 3
+    -- the expired value is still returned, and refreshed
+    I.vcsGetConfig vcs key Nothing 3 `shouldReturn` "1:a"
+    I.vcsCacheRefreshes <$> I.vcsGetCacheStats vcs `shouldReturn` 1
+    let waitRefreshed :: Int -> IO Bytes
+        waitRefreshed n = do
+          val <- I.vcsGetConfig vcs key Nothing 3
+          if val == "2:b" || n <= 0
+             then pure val
+             else threadDelay 100000 >> waitRefreshed (n - 1)
+    waitRefreshed 50 `shouldReturn` "2:b"
+
+  it "reads the store if the cache is disabled" $ do
+    key <- newRandomName 10
+    vcs <- I.newRsmBasedVcs client S.checkpointStoreLogID 5000 (-1)
+    void $ I.ldVcsUpdateConfig vcs key "1:a" I.VcsCondIfNotExists 3
+    I.vcsGetConfig vcs key Nothing 3 `shouldReturn` "1:a"
+    I.vcsGetCacheStats vcs `shouldReturn` I.VcsCacheStats 0 0 0
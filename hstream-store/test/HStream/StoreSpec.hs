@@ -31,6 +31,17 @@ base = describe "Base" $ do
     seqNum1 <- S.getTailLSN client logid
     seqNum0 `shouldBe` seqNum1
 
+  it "get tail and head attributes in batch" $ do
+    sn0 <- S.appendCompLSN <$> S.append client logid "hello" Nothing
+    S.getTailLSNBatch client 1 [logid, logid] `shouldReturn` [Right sn0, Right sn0]
+    [Right tailAttrs] <- S.getLogTailAttrsBatch client 0 [logid]
+    S.tailLastReleasedRealLSN tailAttrs `shouldBe` sn0
+    [Right headAttrs] <- S.getLogHeadAttrsBatch client 0 [logid]
+    S.headTrimPoint headAttrs `shouldSatisfy` (< sn0)
+    -- logid 0 is invalid
+    [Left _, Right _] <- S.getTailLSNBatch client 0 [0, logid]
+    S.getTailLSNBatch client 0 [] `shouldReturn` []
+
   it "trim record" $ do
     sn0 <- S.appendCompLSN <$> S.append client logid "hello" Nothing
     sn1 <- S.appendCompLSN <$> S.append client logid "world" Nothing
@@ -96,11 +107,17 @@ base = describe "Base" $ do
       lo2 `shouldBe` sn1
       hi2 `shouldBe` sn2
 
+      S.findKeyBatch client 0 S.FindKeyStrict
+        [(randlogid, "00"), (randlogid, "01"), (randlogid, "02")]
+        `shouldReturn` [Right (lo0, hi0), Right (lo1, hi1), Right (lo2, hi2)]
+
   it "find time with a timestamp of 0" $ do
     headSn <- S.findTime client logid 0 S.FindKeyStrict
     S.trim client logid headSn
     sn <- S.findTime client logid 0 S.FindKeyStrict
     sn `shouldBe` headSn + 1
+    S.findTimeBatch client 0 S.FindKeyStrict [(logid, 0), (logid, 0)]
+      `shouldReturn` [Right sn, Right sn]
 
   -- FIXME: need to find correct way to test this
   --
@@ -56,6 +56,8 @@ import           HStream.Kafka.Server.Config       (AdvertisedListeners,
                                                     runServerConfig)
 import qualified HStream.Kafka.Server.Handler      as K
 import qualified HStream.Kafka.Server.MetaData     as M
+import           HStream.Kafka.Server.Retention    (newRetentionEnforcer,
+                                                    runRetentionEnforcer)
 import           HStream.Kafka.Server.Types        (ServerContext (..),
                                                     initServerContext)
 import qualified HStream.Logger                    as Log
@@ -148,6 +150,9 @@ app config@ServerOpts{..} = do
         -- start prometheus server to export metrics
         a2 <- Async.async $ startMetricsServer "*4" (fromIntegral _metricsPort)
         Async.link2Only (const True) a a2
+        -- start retention enforcer
+        a3 <- Async.async $ runRetentionEnforcer =<< newRetentionEnforcer serverContext
+        Async.link2Only (const True) a a3
         Async.wait a
 
 -- TODO: This server primarily serves as a demonstration, and there
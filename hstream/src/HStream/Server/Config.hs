@@ -40,6 +40,7 @@ import           Data.ByteString                  (ByteString)
 import qualified Data.ByteString.Char8            as BSC
 import           Data.Foldable                    (foldrM)
 import qualified Data.HashMap.Strict              as HM
+import           Data.Int                         (Int64)
 import           Data.Map.Strict                  (Map)
 import qualified Data.Map.Strict                  as Map
 import           Data.Maybe                       (fromJust, fromMaybe,
@@ -102,6 +103,7 @@ data ServerOpts = ServerOpts
   , _ldConfigPath                 :: !CBytes
   , _topicRepFactor               :: !Int
   , _ckpRepFactor                 :: !Int
+  , _ckpCacheTtl                  :: !Int64
   , _compression                  :: !Compression
   , _maxRecordSize                :: !Int
   , _tlsConfig                    :: !(Maybe TlsConfig)
@@ -124,6 +126,8 @@ data ServerOpts = ServerOpts
   , _ioOptions                    :: !IO.IOOptions
 
   , _querySnapshotPath            :: !FilePath
+  , _queryWorkers                 :: !Int
+  , _queryRocksDBStateStores     :: !Bool
   , experimentalFeatures          :: ![ExperimentalFeature]
 
 #ifndef HStreamUseGrpcHaskell
@@ -191,12 +195,16 @@ parseJSONToOptions CliOptions{..} obj = do
   probeInterval    <- clusterCfgObj .:? "probe-interval"    .!= probeInterval defaultGossipOpts
   roundtripTimeout <- clusterCfgObj .:? "roundtrip-timeout" .!= roundtripTimeout defaultGossipOpts
   joinWorkerConcurrency <- clusterCfgObj .:? "join-worker-concurrency" .!= joinWorkerConcurrency defaultGossipOpts
+  maxPiggybackBytes <- clusterCfgObj .:? "max-piggyback-bytes" .!= maxPiggybackBytes defaultGossipOpts
   let _gossipOpts = GossipOpts {..}
 
   -- Store Config
   storeCfgObj         <- obj .:? "hstore" .!= mempty
   storeLogLevel       <- readWithErrLog "store log-level" <$> storeCfgObj .:? "log-level" .!= "info"
   storeCkpReplica     <- storeCfgObj .:? "checkpoint-replication-factor" .!= 1
+  -- the subscriptions may move between the servers, so the checkpoints of
+  -- their readers are not cached unless it is configured
+  !_ckpCacheTtl       <- storeCfgObj .:? "checkpoint-cache-ttl" .!= (-1)
   sAdminCfgObj        <- storeCfgObj .:? "store-admin" .!= mempty
   storeAdminHost      <- BSC.pack <$> sAdminCfgObj .:? "host" .!= "127.0.0.1"
   storeAdminPort      <- sAdminCfgObj .:? "port" .!= 6440
@@ -260,6 +268,14 @@ parseJSONToOptions CliOptions{..} obj = do
   processingCfg <- nodeCfgObj .:? "hstream-processing" .!= mempty
   snapshotPath <- processingCfg .:? "query-snapshot-path" .!= "/data/query_snapshots"
   let !_querySnapshotPath = fromMaybe snapshotPath cliQuerySnapshotPath
+  -- the number of DiffFlow workers of a query
+  !_queryWorkers <- processingCfg .:? "query-workers" .!= 1
+  -- keep the state of the queries in the snapshot database, or in memory
+  stateStore <- processingCfg .:? "query-state-store" .!= ("memory" :: Text)
+  !_queryRocksDBStateStores <- case T.toLower stateStore of
+    "memory"  -> return False
+    "rocksdb" -> return True
+    _         -> fail "incorrect query state store"
 
   let experimentalFeatures = cliExperimentalFeatures
 
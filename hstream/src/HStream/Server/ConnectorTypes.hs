@@ -86,11 +86,14 @@ data SourceConnectorWithoutCkp = SourceConnectorWithoutCkp
                               -> IO ()
   }
 
-newtype SinkConnector = SinkConnector
-  { writeRecord :: (BL.ByteString -> Maybe BL.ByteString)
-                -> (BL.ByteString -> Maybe BL.ByteString)
-                -> SinkRecord
-                -> IO ()
+data SinkConnector = SinkConnector
+  { writeRecord  :: (BL.ByteString -> Maybe BL.ByteString)
+                 -> (BL.ByteString -> Maybe BL.ByteString)
+                 -> SinkRecord
+                 -> IO ()
+    -- | Wait until the records written so far are stored, throws if some
+    -- of them failed
+  , flushRecords :: IO ()
   }
 
 posixTimeToMilliSeconds :: POSIXTime -> Timestamp
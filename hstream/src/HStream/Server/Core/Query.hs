@@ -63,6 +63,7 @@ import qualified HStream.Utils.Aeson              as AesonComp
 #ifdef HStreamUseV2Engine
 import           DiffFlow.Types                   (DataChange (..),
                                                    DataChangeBatch (..),
+                                                   dcbChanges,
                                                    emptyDataChangeBatch)
 import           HStream.Server.ConnectorTypes    hiding (StreamName, Timestamp)
 import qualified HStream.SQL.Codegen.V2           as HSC
@@ -90,11 +91,11 @@ executeQuery sc@ServerContext{..} CommandQuery{..} = do
         True  -> do
           out_m <- newMVar emptyDataChangeBatch
           runImmTask sc (ins `zip` L.map fromJust roles_m) out out_m builder
-          dcb@DataChangeBatch{..} <- readMVar out_m
-          case dcbChanges of
+          dcb <- readMVar out_m
+          case dcbChanges dcb of
             [] -> sendResp mempty
-            _  -> do
-              sendResp $ V.map (flowObjectToJsonObject . dcRow) (V.fromList dcbChanges)
+            changes -> do
+              sendResp $ V.map (flowObjectToJsonObject . dcRow) (V.fromList changes)
     CreateViewPlan view ins out builder accumulation -> do
       validateNameAndThrow ResView view
       P.ViewInfo{viewQuery=P.QueryInfo{..}} <-
@@ -288,7 +289,7 @@ getQuery ServerContext{..} qid = do
     L.find (\P.QueryInfo{..} -> queryId == qid) queries
 
 deleteQuery :: HasCallStack => ServerContext -> DeleteQueryRequest -> IO ()
-deleteQuery ServerContext{..} DeleteQueryRequest{..} = do
+deleteQuery ctx@ServerContext{..} DeleteQueryRequest{..} = do
   getMeta @P.QueryStatus deleteQueryRequestId metaHandle >>= \case
     Nothing -> throwIO $ HE.QueryNotFound deleteQueryRequestId
     Just P.QueryStatus{..} -> when (queryState /= Terminated && queryState /= Aborted) $
@@ -300,6 +301,9 @@ deleteQuery ServerContext{..} DeleteQueryRequest{..} = do
       S.removeStream scLDClient (S.transToTempStreamName deleteQueryRequestId)
       P.deleteQueryInfo deleteQueryRequestId metaHandle
       Stats.connector_stat_erase scStatsHolder (textToCBytes deleteQueryRequestId)
+#ifndef HStreamUseV2Engine
+      deleteQueryStateStores ctx deleteQueryRequestId
+#endif
     Just P.QVRelation{..} -> throwIO $ HE.FoundAssociatedView qvRelationViewName
 
 ----
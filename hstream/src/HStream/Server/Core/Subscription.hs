@@ -42,6 +42,7 @@ import           HStream.Base.Timer            (startCompactedWorker,
 import qualified HStream.Exception             as HE
 import qualified HStream.Logger                as Log
 import qualified HStream.MetaStore.Types       as M
+import           HStream.Server.Config         (ServerOpts (..))
 import           HStream.Server.ConnectorTypes (getCurrentTimestamp)
 import           HStream.Server.Core.Common    as CC (decodeRecordBatch,
                                                       getCommitRecordId,
@@ -413,7 +414,7 @@ doSubInit ServerContext{..} subId = do
       Log.info $ "Alloc a checkpoint store reader for " <> Log.build subId
       ckpStoreId <- S.allocSubscrCheckpointId scLDClient readerName
       ldCkpReader <-
-        S.newLDRsmCkpReader scLDClient readerName ckpStoreId 5000 maxReadLogs
+        S.newLDRsmCkpReader scLDClient readerName ckpStoreId 5000 (_ckpCacheTtl serverOpts) maxReadLogs
                             (Just ldReaderBufferSize)
       -- Ideally, if the subscription has no data to deliver, ldCkpReader should block on the read call. However, in the current implementation,
       -- a subscription forcing deletion operation requires that the sendRecords loop should `not` be blocked, otherwise the forcing deletion
@@ -644,7 +645,7 @@ sendRecords ServerContext{..} subState subCtx@SubscribeContext {..} = do
           Enumerated (Right SpecialOffsetEARLIEST) ->
             return $ (, S.LSN_MIN) <$> newShards
           Enumerated (Right SpecialOffsetLATEST)   ->
-            mapM (\x -> S.getTailLSN scLDClient x <&> (x,) . (+1)) newShards
+            zipWith (\x lsn -> (x, lsn + 1)) newShards <$> S.getTailLSNs scLDClient newShards
           _                                        ->
             throwIO HE.InvalidSubscriptionOffset
 
@@ -8,17 +8,36 @@
 module HStream.Server.HStore
   ( hstoreSourceConnector
   , hstoreSourceConnectorWithoutCkp
-  , hstoreSinkConnector
+  , SinkBatchOptions (..)
+  , defaultSinkBatchOptions
+  , withHStoreSinkConnector
+    -- * Sink batcher
+  , SinkBatch (..)
+  , SinkBatcher
+  , newSinkBatcher
+  , addSinkRecord
+  , flushSinkBatcher
+  , closeSinkBatcher
   , memorySinkConnector
   , blackholeSinkConnector
   )
 where
 
-import           Control.Concurrent               (modifyMVar)
-import           Control.Concurrent.STM           (TVar)
-import           Control.Exception                (catch, throwIO)
+import           Control.Concurrent               (MVar, forkIO, modifyMVar_,
+                                                   newEmptyMVar, newMVar,
+                                                   putMVar, readMVar,
+                                                   threadDelay)
+import           Control.Concurrent.STM           (TVar, atomically, check,
+                                                   modifyTVar', newTVarIO,
+                                                   readTVar, readTVarIO,
+                                                   writeTVar)
+import           Control.Exception                (SomeException, bracket,
+                                                   catch, finally,
+                                                   fromException, throwIO,
+                                                   try)
 import           Control.Monad
 import qualified Data.Aeson                       as Aeson
+import qualified Data.ByteString                  as BS
 import qualified Data.ByteString.Lazy             as BL
 import           Data.Functor                     ((<&>))
 import qualified Data.HashMap.Strict              as HM
@@ -27,9 +46,11 @@ import           Data.IORef
 import qualified Data.Map.Strict                  as M
 import qualified Data.Map.Strict                  as Map
 import           Data.Maybe                       (catMaybes, fromJust,
-                                                   mapMaybe)
+                                                   isJust, mapMaybe)
+import qualified Data.Set                         as Set
 import           Data.Text                        (Text)
 import qualified Data.Text                        as T
+import           Data.Time.Clock.POSIX            (getPOSIXTime)
 import qualified Data.Vector                      as V
 import           Proto3.Suite                     (Enumerated (..))
 import qualified Proto3.Suite                     as PB
@@ -77,19 +98,28 @@ hstoreSourceConnectorWithoutCkp ctx consumerName consumerClosed = SourceConnecto
   connectorClosed = consumerClosed
 }
 
-hstoreSinkConnector :: ServerContext -> SinkConnector
-hstoreSinkConnector ctx = SinkConnector {
-  writeRecord = writeRecordToHStore ctx
-}
+-- | Run the action with a sink connector which writes to HStore in batches.
+-- 'flushRecords' waits until the records written so far are appended, the
+-- remaining records are also written (and waited for) when the action exits.
+withHStoreSinkConnector :: ServerContext -> SinkBatchOptions -> (SinkConnector -> IO a) -> IO a
+withHStoreSinkConnector ctx opts action =
+  bracket (newSinkBatcher opts (scMaxRecordSize ctx `div` 2) (appendSinkBatchToHStore ctx opts))
+          closeSinkBatcher $ \batcher ->
+    action SinkConnector {
+      writeRecord  = writeRecordToHStore batcher,
+      flushRecords = flushSinkBatcher batcher
+    }
 
 memorySinkConnector :: IORef [SinkRecord] -> SinkConnector
 memorySinkConnector ioRef = SinkConnector {
-  writeRecord = writeRecordToMemory ioRef
+  writeRecord  = writeRecordToMemory ioRef,
+  flushRecords = return ()
 }
 
 blackholeSinkConnector :: SinkConnector
 blackholeSinkConnector = SinkConnector {
-  writeRecord = writeRecordToBlackHole
+  writeRecord  = writeRecordToBlackHole,
+  flushRecords = return ()
 }
 
 --------------------------------------------------------------------------------
@@ -142,17 +172,16 @@ isSubscribedToHStoreStream' :: ServerContext
 isSubscribedToHStoreStream' ctx consumerName streamName =
   Core.checkSubscriptionExist ctx (hstoreSubscriptionPrefix <> streamName <> "_" <> consumerName)
 
-dataRecordToSourceRecord :: S.LDClient -> Payload -> IO SourceRecord
-dataRecordToSourceRecord ldclient Payload {..} = do
-  streamName <- S.streamName . fst <$> S.getStreamIdFromLogId ldclient pLogID
-  return SourceRecord
-    { srcStream = cBytesToText streamName
+dataRecordToSourceRecord :: Text -> Payload -> SourceRecord
+dataRecordToSourceRecord streamName Payload {..} =
+  SourceRecord
+    { srcStream = streamName
       -- A dummy key typed Aeson.Object, for avoiding errors while processing
       -- queries with JOIN clause only. It is not used and will be removed in
       -- the future.
     , srcKey = Just "{}"
     , srcValue = let Right struct = PB.fromByteString . bytesToByteString $ pValue
-                  in Aeson.encode . structToJsonObject $ struct
+                  in structToJsonBytes struct
       --BL.fromStrict . toByteString $ pValue
     , srcTimestamp = pTimeStamp
     , srcOffset = pLSN
@@ -185,7 +214,7 @@ receivedRecordToSourceRecord streamName = maybe [] convert
            , srcOffset = recordIdBatchId
            , srcTimestamp = timestamp
            , srcKey = Just "{}"
-           , srcValue = Aeson.encode . structToJsonObject $ struct
+           , srcValue = structToJsonBytes struct
            }
      else
        let lazyPayload = BL.fromStrict hstreamRecordPayload
@@ -204,8 +233,14 @@ readRecordsFromHStore :: S.LDClient -> S.LDSyncCkpReader -> Int -> IO [SourceRec
 readRecordsFromHStore ldclient reader maxlen = do
   S.ckpReaderSetTimeout reader 1000   -- 1000 milliseconds
   dataRecords <- S.ckpReaderRead reader maxlen
-  let payloads = concatMap getJsonFormatRecords dataRecords
-  mapM (dataRecordToSourceRecord ldclient) payloads
+  -- look up the stream of each log once per read instead of per record
+  let logIds = Set.toList . Set.fromList $ map S.recordLogID dataRecords
+  streamNames <- forM logIds $ \logId ->
+    (,) logId . cBytesToText . S.streamName . fst <$> S.getStreamIdFromLogId ldclient logId
+  let streamNameMap = M.fromList streamNames
+  return $ concatMap (\dr -> map (dataRecordToSourceRecord (streamNameMap M.! S.recordLogID dr))
+                                 (getJsonFormatRecords dr)
+                     ) dataRecords
 
 withReadRecordsFromHStore' :: ServerContext
                            -> T.Text
@@ -213,7 +248,7 @@ withReadRecordsFromHStore' :: ServerContext
                            -> (BL.ByteString -> Maybe BL.ByteString)
                            -> (BL.ByteString -> Maybe BL.ByteString)
                            -> TVar Bool
-                           -> ([SourceRecord] -> IO (IO (), IO ()))
+                           -> (Int -> [SourceRecord] -> IO (IO (), IO ()))
                            -> IO ()
 withReadRecordsFromHStore' ctx consumerName streamName transK transV consumerClosed actionGen = do
   let req = API.StreamingFetchRequest
@@ -233,7 +268,7 @@ withReadRecordsFromHStore' ctx consumerName streamName transK transV consumerClo
                                                             , srcValue = v
                                                             }
                                     ) sourceRecords
-      actionGen sourceRecords'
+      actionGen (length sourceRecords) sourceRecords'
 
 -- Note: It actually gets 'Payload'(defined in this file)s of all JSON format DataRecords.
 getJsonFormatRecords :: S.DataRecord Bytes -> [Payload]
@@ -256,25 +291,170 @@ commitCheckpointToHStore ldclient reader streamId offset = do
     Latest     -> throwIO $ WrongOffset "expect normal offset, but get Latest"
     Offset lsn -> S.writeCheckpoints reader (M.singleton logId lsn) 10{-retries-}
 
--- TODO performance: do not call getShardId every time, let others pass it.
-writeRecordToHStore :: ServerContext
+-- | Bounds of the batches the sink of a query appends to a stream.
+data SinkBatchOptions = SinkBatchOptions
+  { sinkBatchMaxRecords  :: Int
+  , sinkBatchMaxBytes    :: Int
+    -- | A batch is appended at the latest this long after its first record
+  , sinkBatchMaxDelayMs  :: Int
+  , sinkBatchCompression :: API.CompressionType
+    -- | Appends running at once (to different streams or one after another
+    -- to a stream, the batches of a stream are always appended in order)
+  , sinkBatchMaxInflight :: Int
+  }
+
+defaultSinkBatchOptions :: SinkBatchOptions
+defaultSinkBatchOptions = SinkBatchOptions
+  { sinkBatchMaxRecords  = 1000
+  , sinkBatchMaxBytes    = 512 * 1024
+  , sinkBatchMaxDelayMs  = 10
+  , sinkBatchCompression = API.CompressionTypeNone
+  , sinkBatchMaxInflight = 1
+  }
+
+-- | The records of a stream not appended yet, in reverse order.
+data SinkBatch = SinkBatch
+  { sinkBatchRecords :: [API.HStreamRecord]
+  , sinkBatchCount   :: Int
+  , sinkBatchBytes   :: Int
+  , sinkBatchStartMs :: Int64
+  }
+
+-- | The batches being filled, and for every stream the MVar filled when the
+-- last append scheduled for it is done.
+data SinkBatcherState = SinkBatcherState
+  { sbsBatches :: HM.HashMap Text SinkBatch
+  , sbsTails   :: HM.HashMap Text (MVar ())
+  }
+
+data SinkBatcher = SinkBatcher
+  { sbOptions  :: SinkBatchOptions
+    -- | The batches are also kept under this size
+  , sbMaxBytes :: Int
+  , sbAppend   :: Text -> SinkBatch -> IO ()
+  , sbState    :: MVar SinkBatcherState
+  , sbInflight :: TVar Int
+    -- | The first fatal failure of an append (the stream is not found),
+    -- thrown by the next write or flush
+  , sbError    :: IORef (Maybe SomeException)
+  , sbClosed   :: TVar Bool
+  , sbFlusher  :: MVar ()
+  }
+
+newSinkBatcher :: SinkBatchOptions -> Int -> (Text -> SinkBatch -> IO ()) -> IO SinkBatcher
+newSinkBatcher opts maxBytes append = do
+  batcher <- SinkBatcher opts maxBytes append
+    <$> newMVar (SinkBatcherState HM.empty HM.empty) <*> newTVarIO 0
+    <*> newIORef Nothing <*> newTVarIO False <*> newEmptyMVar
+  -- append the batches which are not filled in time
+  let loop = do
+        threadDelay (sinkBatchMaxDelayMs opts * 1000)
+        closed <- readTVarIO (sbClosed batcher)
+        unless closed $ do
+          now <- nowMs
+          scheduleSinkBatches batcher $
+            HM.partition (\b -> now - sinkBatchStartMs b < fromIntegral (sinkBatchMaxDelayMs opts))
+          loop
+  void . forkIO $ loop `finally` putMVar (sbFlusher batcher) ()
+  return batcher
+
+nowMs :: IO Int64
+nowMs = floor . (* 1000) <$> getPOSIXTime
+
+-- | Append the batches which are not kept by the given function. The appends
+-- are scheduled while the state is locked, so those of a stream run in the
+-- order they are scheduled, each one after the previous one is done.
+scheduleSinkBatches :: SinkBatcher
+                    -> (HM.HashMap Text SinkBatch -> (HM.HashMap Text SinkBatch, HM.HashMap Text SinkBatch))
+                    -> IO ()
+scheduleSinkBatches SinkBatcher{..} f = modifyMVar_ sbState $ \SinkBatcherState{..} -> do
+  let (kept, toAppend) = f sbsBatches
+  tails <- foldM schedule sbsTails (HM.toList toAppend)
+  return $ SinkBatcherState kept tails
+  where
+    schedule tails (stream, batch) = do
+      atomically $ do
+        n <- readTVar sbInflight
+        check (n < sinkBatchMaxInflight sbOptions)
+        modifyTVar' sbInflight (+ 1)
+      done <- newEmptyMVar
+      let prev = HM.lookup stream tails
+      void . forkIO $ do
+        mapM_ readMVar prev
+        -- after a fatal failure nothing is appended any more, the records
+        -- not appended are not acked
+        failed <- isJust <$> readIORef sbError
+        unless failed $ try (sbAppend stream batch) >>= \case
+          Right () -> return ()
+          Left (e :: SomeException) -> do
+            Log.warning $ "Append " <> Log.build (sinkBatchCount batch) <> " records of query sink to stream "
+                       <> Log.build stream <> " failed: " <> Log.buildString' e
+            -- like the failed writes of single records before the batching,
+            -- only a missing stream stops the query, the records of other
+            -- failures are dropped (and acked)
+            when (isJust (fromException e :: Maybe StreamNotFound)) $
+              atomicModifyIORef' sbError (\x -> (if isJust x then x else Just e, ()))
+        atomically $ modifyTVar' sbInflight (subtract 1)
+        putMVar done ()
+      return $ HM.insert stream done tails
+
+-- | Append all batches and wait for all appends, throw the first fatal
+-- failure of an append if any.
+flushSinkBatcher :: SinkBatcher -> IO ()
+flushSinkBatcher batcher@SinkBatcher{..} = do
+  scheduleSinkBatches batcher (\batches -> (HM.empty, batches))
+  atomically (readTVar sbInflight >>= check . (== 0))
+  readIORef sbError >>= maybe (return ()) throwIO
+
+closeSinkBatcher :: SinkBatcher -> IO ()
+closeSinkBatcher batcher@SinkBatcher{..} = do
+  atomically $ writeTVar sbClosed True
+  readMVar sbFlusher
+  flushSinkBatcher batcher
+
+-- | Add a record of the given encoded size to the batch of the stream, and
+-- append the batch if it is full.
+addSinkRecord :: SinkBatcher -> Text -> API.HStreamRecord -> Int -> IO ()
+addSinkRecord batcher@SinkBatcher{..} stream record size = do
+  readIORef sbError >>= maybe (return ()) throwIO
+  now <- nowMs
+  let add = \case
+        Nothing -> SinkBatch [record] 1 size now
+        Just b  -> b { sinkBatchRecords = record : sinkBatchRecords b
+                     , sinkBatchCount = sinkBatchCount b + 1
+                     , sinkBatchBytes = sinkBatchBytes b + size
+                     }
+      isFull b = sinkBatchCount b >= sinkBatchMaxRecords sbOptions
+              || sinkBatchBytes b >= min (sinkBatchMaxBytes sbOptions) sbMaxBytes
+  scheduleSinkBatches batcher $ \batches ->
+    let batches' = HM.alter (Just . add) stream batches
+     in if isFull (batches' HM.! stream)
+          then (HM.delete stream batches', HM.filterWithKey (\k _ -> k == stream) batches')
+          else (batches', HM.empty)
+
+-- | The values transV gives are the payloads of the records, i.e. encoded
+-- Structs.
+writeRecordToHStore :: SinkBatcher
                     -> (BL.ByteString -> Maybe BL.ByteString)
                     -> (BL.ByteString -> Maybe BL.ByteString)
                     -> SinkRecord
                     -> IO ()
-writeRecordToHStore ctx transK transV SinkRecord{..} = do
-  Log.debug $ "Start writeRecordToHStore..."
-
+writeRecordToHStore batcher transK transV SinkRecord{..} = do
   case transV snkValue of
     Nothing -> return () -- FIXME: error message
     Just v  -> do
-      timestamp <- getProtoTimestamp
-      shardId <- getShardId ctx snkStream
       let header  = buildRecordHeader API.HStreamRecordHeader_FlagJSON Map.empty clientDefaultKey
-          payload = BL.toStrict . PB.toLazyByteString . jsonObjectToStruct . fromJust $ Aeson.decode v
-          hsRecord = mkHStreamRecord header payload
-          record = mkBatchedRecord (PB.Enumerated (Right API.CompressionTypeNone)) (Just timestamp) 1 (V.singleton hsRecord)
-      void $ Core.appendStream ctx snkStream shardId record `catch` \(_:: S.NOTFOUND) -> throwIO $ StreamNotFound snkStream
+          payload = BL.toStrict v
+      addSinkRecord batcher snkStream (mkHStreamRecord header payload) (BS.length payload)
+
+appendSinkBatchToHStore :: ServerContext -> SinkBatchOptions -> Text -> SinkBatch -> IO ()
+appendSinkBatchToHStore ctx opts stream SinkBatch{..} = do
+  timestamp <- getProtoTimestamp
+  -- all records of a query go to the shard of the default key
+  shardId <- getShardId ctx stream
+  let record = mkBatchedRecord (PB.Enumerated (Right $ sinkBatchCompression opts)) (Just timestamp)
+                               (fromIntegral sinkBatchCount) (V.fromList $ reverse sinkBatchRecords)
+  void $ Core.appendStream ctx stream shardId record `catch` \(_:: S.NOTFOUND) -> throwIO $ StreamNotFound stream
 
 writeRecordToMemory :: IORef [SinkRecord]
                     -> (BL.ByteString -> Maybe BL.ByteString)
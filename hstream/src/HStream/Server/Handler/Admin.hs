@@ -39,6 +39,8 @@ import           Z.Data.CBytes                    (CBytes)
 import           Control.Exception                (throw)
 import qualified HStream.Admin.Server.Types       as AT
 import           HStream.Base                     (rmTrailingZeros)
+import qualified HStream.Base.Profiler            as Profiler
+import qualified HStream.Base.Tracing             as Tracing
 import qualified HStream.Exception                as HE
 import           HStream.Gossip                   (GossipContext (clusterReady),
                                                    getClusterStatus,
@@ -72,6 +74,7 @@ import           HStream.Server.MetaData          (QVRelation, QueryInfo,
                                                    renderViewInfosToTable)
 import           HStream.Server.Types
 import qualified HStream.Stats                    as Stats
+import qualified HStream.Store                    as S
 import           HStream.Utils                    (Interval (..), cBytesToText,
                                                    formatQueryType,
                                                    formatStatus, interval2ms,
@@ -119,7 +122,7 @@ runAdminCommand sc@ServerContext{..} cmd = do
   let args = words (Text.unpack cmd)
   adminCommand <- parseAdminCommand args
   case adminCommand of
-    AT.AdminStatsCommand c        -> runStats scStatsHolder c
+    AT.AdminStatsCommand c        -> runStats sc c
     AT.AdminResetStatsCommand     -> runResetStats scStatsHolder
     AT.AdminStreamCommand c       -> runStream sc c
     AT.AdminSubscriptionCommand c -> runSubscription sc c
@@ -131,6 +134,9 @@ runAdminCommand sc@ServerContext{..} cmd = do
     AT.AdminLookupCommand c       -> runLookup sc c
     AT.AdminConnectorCommand c    -> runConnector sc c
     AT.AdminMetaCommand c         -> runMeta sc c
+    AT.AdminProfileCommand c      -> runProfile c
+    AT.AdminTraceCommand c        -> runTrace c
+    AT.AdminMemoryCommand         -> runMemory
 
 handleParseResult :: O.ParserResult a -> IO a
 handleParseResult (O.Success a) = return a
@@ -144,8 +150,8 @@ handleParseResult (O.CompletionInvoked compl) = AT.throwParsingErr =<< O.execCom
 -- Admin Stats Command
 
 -- NOTE: the headers name must match defines in hstream-admin/server/cbits/query/tables
-runStats :: Stats.StatsHolder -> AT.StatsCommand -> IO Text
-runStats statsHolder AT.StatsCommand{..} = do
+runStats :: ServerContext -> AT.StatsCommand -> IO Text
+runStats ServerContext{scStatsHolder = statsHolder, ..} AT.StatsCommand{..} = do
   case statsCategory of
     AT.PerStreamStats            -> doStats Stats.stream_stat_getall "stream_name"
     AT.PerStreamTimeSeries       -> doPerStreamTimeSeries statsName statsIntervals
@@ -156,6 +162,7 @@ runStats statsHolder AT.StatsCommand{..} = do
     AT.PerQueryStats             -> doStats Stats.query_stat_getall "query_name"
     AT.PerViewStats              -> doStats Stats.view_stat_getall "view_name"
     AT.ServerHistogram           -> doServerHistogram statsName
+    AT.LogPathCacheStats         -> doLogPathCache
   where
     doStats getstats label = do
       m <- getstats statsHolder statsName
@@ -189,6 +196,15 @@ runStats statsHolder AT.StatsCommand{..} = do
           content = Aeson.object ["headers" .= headers, "rows" .= rows]
       return $ AT.tableResponse content
 
+    -- the cache of the store client, from loggroup path to logid
+    doLogPathCache = do
+      S.LogPathCacheStats{..} <- S.getLogPathCacheStats scLDClient
+      let headers = ["hits", "misses", "invalidations", "size"] :: [String]
+          rows = [[ show logPathCacheHits, show logPathCacheMisses
+                  , show logPathCacheInvalidations, show logPathCacheSize ]]
+          content = Aeson.object ["headers" .= headers, "rows" .= rows]
+      return $ AT.tableResponse content
+
 doTimeSeries
   :: CBytes
   -> CBytes
@@ -513,3 +529,49 @@ runCheckReady ServerContext{..} = do
   tryReadMVar (clusterReady gossipContext) >>= \case
     Just _  -> return $ AT.plainResponse "Cluster is ready"
     Nothing -> return $ AT.errorResponse "Cluster is not ready!"
+
+-------------------------------------------------------------------------------
+-- Admin Profile Command
+
+runProfile :: AT.ProfileCommand -> IO Text.Text
+runProfile AT.ProfileCommand{..} = do
+  Log.info $ "Start profiling for " <> Log.build profileSeconds <> " seconds"
+  Profiler.Profile{..} <- Profiler.profileFor profileSeconds profileFrequency
+  Log.info $ "Profiling done, samples: " <> Log.build profileSamples
+          <> ", dropped: " <> Log.build profileDropped
+  return $ AT.plainResponse $ cBytesToText profileFolded
+
+-------------------------------------------------------------------------------
+-- Admin Trace Command
+
+runTrace :: AT.TraceCommand -> IO Text.Text
+runTrace (AT.TraceStart n) = do
+  Tracing.clearTrace
+  Tracing.setTraceSampleEvery n
+  return $ AT.plainResponse $ "Tracing one in every " <> Text.pack (show n) <> " requests"
+runTrace AT.TraceStop = do
+  Tracing.setTraceSampleEvery 0
+  return $ AT.plainResponse "Tracing stopped"
+runTrace AT.TraceDump = AT.plainResponse . cBytesToText <$> Tracing.dumpChromeTrace
+
+-------------------------------------------------------------------------------
+-- Admin Memory Command
+
+runMemory :: IO Text.Text
+runMemory = do
+  rows <- forM [minBound .. maxBound] $ \arena -> do
+    Stats.ArenaStats{..} <- Stats.getArenaStats arena
+    pure [ arenaName arena
+         , maybe "-" show arenaAllocated
+         , maybe "-" show arenaResident
+         , show arenaNumAllocs
+         , show arenaAllocBytes
+         ]
+  let headers = ["arena", "allocated", "resident", "allocs", "alloc_bytes"] :: [String]
+      content = Aeson.object ["headers" .= headers, "rows" .= rows]
+  return $ AT.tableResponse content
+  where
+    arenaName Stats.DefaultArena  = "default"
+    arenaName Stats.ReadArena     = "read"
+    arenaName Stats.WriteArena    = "write"
+    arenaName Stats.KafkaNetArena = "kafka_net"
@@ -6,6 +6,7 @@
 {-# LANGUAGE OverloadedStrings   #-}
 {-# LANGUAGE RecordWildCards     #-}
 {-# LANGUAGE ScopedTypeVariables #-}
+{-# LANGUAGE TupleSections       #-}
 {-# LANGUAGE TypeApplications    #-}
 
 module HStream.Server.Handler.Common where
@@ -24,16 +25,19 @@ import qualified Data.ByteString.Lazy                  as BL
 import           Data.Default                          (def)
 import           Data.Foldable                         (foldlM)
 import           Data.Function                         (fix)
+import           Data.Functor                          ((<&>))
 import qualified Data.HashMap.Strict                   as HM
 import           Data.IORef
 import           Data.Maybe                            (fromJust)
 import           Data.Text                             (Text)
 import qualified Database.RocksDB                      as RocksDB
 import           GHC.Stack                             (HasCallStack)
+import qualified Proto3.Suite                          as PB
 
 import qualified HStream.Exception                     as HE
 import qualified HStream.Logger                        as Log
 import qualified HStream.MetaStore.Types               as M
+import           HStream.Server.Config                 (ServerOpts (..))
 import qualified HStream.Server.HStore                 as HStore
 import qualified HStream.Server.MetaData               as P
 import           HStream.Server.Types
@@ -42,14 +46,15 @@ import           HStream.SQL.Rts
 import qualified HStream.Store                         as S
 import           HStream.Utils                         (cBytesToText,
                                                         getPOSIXTime,
+                                                        jsonObjectToStruct,
                                                         lazyByteStringToBytes,
                                                         msecSince, textToCBytes)
 
 #ifdef HStreamUseV2Engine
 import qualified DiffFlow.Graph                        as DiffFlow
-import qualified DiffFlow.Shard                        as DiffFlow
 import qualified DiffFlow.Types                        as DiffFlow
 import qualified DiffFlow.Weird                        as DiffFlow
+import qualified DiffFlow.Workers                      as DiffFlow
 import           HStream.Server.ConnectorTypes         (SinkConnector (..),
                                                         SinkRecord (..),
                                                         SourceConnectorWithoutCkp (..),
@@ -58,19 +63,37 @@ import qualified HStream.Server.ConnectorTypes         as HCT
 import           HStream.SQL.Codegen.V2
 #else
 import qualified Data.ByteString                       as BS
+import           Data.Text.Encoding                    (encodeUtf8)
 import           HStream.Processing.Connector
+import           HStream.Processing.Encoding           (Deserializer (..),
+                                                        Serde (..),
+                                                        Serializer (..))
 import           HStream.Processing.Processor
 import           HStream.Processing.Processor.Snapshot
 import           HStream.Processing.Store
+import           HStream.Processing.Store.RocksDB      (clearRocksDBHandle,
+                                                        defaultRocksDBStoreOptions,
+                                                        deleteRocksDBPrefix,
+                                                        mkRocksDBHandle,
+                                                        mkRocksDBStateKVStore,
+                                                        mkRocksDBStateSessionStore,
+                                                        mkRocksDBStateTimestampedKVStore,
+                                                        readRange, writeBatch)
 import           HStream.SQL
+#ifdef HStreamEnableSchema
+import           HStream.SQL.Codegen.CommonNew         (scalarExprToFun)
+import           HStream.SQL.Codegen.V1New.Boilerplate (flowObjectSerde)
+#else
+import           HStream.SQL.Codegen.V1.Boilerplate    (flowObjectSerde)
+#endif
 import qualified HStream.Stats                         as Stats
 #endif
 
 --------------------------------------------------------------------------------
 #ifdef HStreamUseV2Engine
 --------------------------------------------------------------------------------
-applyTempFilter :: DiffFlow.Shard Row Int64 -> In -> DiffFlow.DataChange Row Int64 -> IO ()
-applyTempFilter shard In{..} dataChange = do
+applyTempFilter :: DiffFlow.Workers Row Int64 -> In -> DiffFlow.DataChange Row Int64 -> IO ()
+applyTempFilter workers In{..} dataChange = do
   let insert_ms = DiffFlow.timestampTime (DiffFlow.dcTimestamp dataChange)
   case inWindow of
     Nothing -> return ()
@@ -82,7 +105,7 @@ applyTempFilter shard In{..} dataChange = do
                               { DiffFlow.dcTimestamp = DiffFlow.Timestamp end_ms []
                               , DiffFlow.dcDiff = - (DiffFlow.dcDiff dataChange)
                               }
-      DiffFlow.pushInput shard inNode negatedDataChange -- negated update
+      DiffFlow.pushInput workers inNode negatedDataChange -- negated update
     Just (Hopping interval hop) -> do
       let interval_ms = calendarDiffTimeToMs interval
           hop_ms      = calendarDiffTimeToMs hop
@@ -93,7 +116,7 @@ applyTempFilter shard In{..} dataChange = do
                               { DiffFlow.dcTimestamp = DiffFlow.Timestamp end_ms []
                               , DiffFlow.dcDiff = - (DiffFlow.dcDiff dataChange)
                               }
-      DiffFlow.pushInput shard inNode negatedDataChange -- negated update
+      DiffFlow.pushInput workers inNode negatedDataChange -- negated update
     Just (Sliding interval) -> do
       let interval_ms = calendarDiffTimeToMs interval
       let _start_ms = insert_ms
@@ -102,7 +125,7 @@ applyTempFilter shard In{..} dataChange = do
                               { DiffFlow.dcTimestamp = DiffFlow.Timestamp end_ms []
                               , DiffFlow.dcDiff = - (DiffFlow.dcDiff dataChange)
                               }
-      DiffFlow.pushInput shard inNode negatedDataChange -- negated update
+      DiffFlow.pushInput workers inNode negatedDataChange -- negated update
     _ -> return ()
 
 runTask :: ServerContext
@@ -116,12 +139,12 @@ runTask ctx@ServerContext{..} taskName sink insWithRole outWithRole graphBuilder
   ------------------
   let consumerName = taskName
   let graph = DiffFlow.buildGraph graphBuilder
-  shard <- DiffFlow.buildShard graph
+  workers <- DiffFlow.buildWorkers (_queryWorkers serverOpts) graph
   stop_m <- newEmptyMVar
 
   ------------------
   -- the task itself
-  tid1 <- forkIO $ DiffFlow.run shard stop_m
+  void . forkIO $ DiffFlow.runWorkers workers stop_m
 
   ------------------
   -- In
@@ -147,10 +170,10 @@ runTask ctx@ServerContext{..} taskName sink insWithRole outWithRole graphBuilder
                     , dcDiff = 1
                     }
             Log.debug . Log.buildString $ "Get input: " <> show dataChange
-            DiffFlow.pushInput shard inNode dataChange -- original update
+            DiffFlow.pushInput workers inNode dataChange -- original update
             -- insert new negated updates to limit the valid range of this update
-            applyTempFilter shard in_ dataChange
-            DiffFlow.flushInput shard inNode
+            applyTempFilter workers in_ dataChange
+            DiffFlow.flushInput workers inNode
         return (Just tid)
       RoleView -> do
         viewStore_m <- readIORef P.groupbyStores >>= \hm -> return (hm HM.! inStream)
@@ -159,7 +182,7 @@ runTask ctx@ServerContext{..} taskName sink insWithRole outWithRole graphBuilder
           ts <- HCT.getCurrentTimestamp
           let thisChange = change { DiffFlow.dcTimestamp = DiffFlow.Timestamp ts [] }
           Log.debug . Log.buildString $ "Get input(from view): " <> show thisChange
-          DiffFlow.pushInput shard inNode thisChange
+          DiffFlow.pushInput workers inNode thisChange
         return Nothing
 
   ------------------
@@ -168,34 +191,35 @@ runTask ctx@ServerContext{..} taskName sink insWithRole outWithRole graphBuilder
     forM_ insWithRole $ \(In{..}, _) -> do
       ts <- HCT.getCurrentTimestamp
       -- Log.debug . Log.buildString $ "### Advance time to " <> show ts
-      DiffFlow.advanceInput shard inNode (DiffFlow.Timestamp ts [])
+      DiffFlow.advanceInput workers inNode (DiffFlow.Timestamp ts [])
     threadDelay 1000000
 
   -- third loop: push output from OUTPUT node to output stream
   let (out, outRole) = outWithRole
-  forever (do
-    DiffFlow.popOutput shard (outNode out) (threadDelay 100000) $ \dcb@DiffFlow.DataChangeBatch{..} -> do
+  HStore.withHStoreSinkConnector ctx HStore.defaultSinkBatchOptions (\SinkConnector{..} -> forever $ do
+    DiffFlow.popOutput workers (outNode out) (threadDelay 100000) $ \dcb -> do
       Log.debug . Log.buildString $ "~~~ POPOUT: " <> show dcb
       case outRole of
         RoleStream -> do
-          let SinkConnector{..} = HStore.hstoreSinkConnector ctx
-          forM_ dcbChanges $ \change -> do
+          forM_ (DiffFlow.dcbChanges dcb) $ \change -> do
             Log.debug . Log.buildString $ "<<< this change: " <> show change
             when (DiffFlow.dcDiff change > 0) $ do
               let sinkRecord = SinkRecord
                     { snkStream = sink
                     , snkKey = Nothing
-                    , snkValue = (Aeson.encode . flowObjectToJsonObject) (DiffFlow.dcRow change)
+                    , snkValue = flowObjectToRecordPayload (DiffFlow.dcRow change)
                     , snkTimestamp = DiffFlow.timestampTime (DiffFlow.dcTimestamp change)
                     }
               replicateM_ (DiffFlow.dcDiff change) $ writeRecord Just Just sinkRecord
         RoleView -> do
           viewStore_m <- readIORef P.groupbyStores >>= \hm -> return (hm HM.! sink)
           modifyMVar_ viewStore_m
-            (\old -> return $ DiffFlow.updateDataChangeBatch' old (\xs -> xs ++ dcbChanges))
+            (\old -> return $ DiffFlow.updateDataChangeBatch' old (\xs -> xs ++ DiffFlow.dcbChanges dcb))
           ) `onException` (do
-    let childrenThreads = tid1 : (catMaybes tids2_m) ++ [tid3]
+    let childrenThreads = (catMaybes tids2_m) ++ [tid3]
     mapM_ killThread childrenThreads
+    -- the workers run on threads of their own, they stop on the MVar
+    void $ tryPutMVar stop_m ()
     forM (insWithRole `zip` srcConnectors_m) $ \((in_@In{..}, role), srcConnector_m) -> do
       case srcConnector_m of
         Just sc -> unSubscribeToStreamWithoutCkp sc inStream
@@ -210,11 +234,11 @@ runImmTask :: ServerContext
            -> IO ()
 runImmTask ctx@ServerContext{..} insWithRole out out_m graphBuilder = do
   let graph = DiffFlow.buildGraph graphBuilder
-  shard <- DiffFlow.buildShard graph
+  workers <- DiffFlow.buildWorkers (_queryWorkers serverOpts) graph
   stop_m <- newEmptyMVar
 
-  -- run DiffFlow shard
-  task_async <- async $ DiffFlow.run shard stop_m
+  -- run DiffFlow workers
+  task_async <- async $ DiffFlow.runWorkers workers stop_m
 
   -- In
   forM_ insWithRole $ \(in_@In{..}, role) -> do
@@ -226,10 +250,10 @@ runImmTask ctx@ServerContext{..} insWithRole out out_m graphBuilder = do
           ts <- HCT.getCurrentTimestamp
           let thisChange = change { DiffFlow.dcTimestamp = DiffFlow.Timestamp ts [] }
           Log.debug . Log.buildString $ "Get input(from view): " <> show thisChange
-          DiffFlow.pushInput shard inNode thisChange
+          DiffFlow.pushInput workers inNode thisChange
           -- insert new negated updates to limit the valid range of this update
-          applyTempFilter shard in_ thisChange
-          DiffFlow.flushInput shard inNode
+          applyTempFilter workers in_ thisChange
+          DiffFlow.flushInput workers inNode
       RoleStream ->
         throwIO $ HE.InvalidSqlStatement "Can not perform non-pushing SELECT from streams. "
 
@@ -237,15 +261,15 @@ runImmTask ctx@ServerContext{..} insWithRole out out_m graphBuilder = do
   forM_ insWithRole $ \(In{..}, _) -> replicateM_ 10 $ do
     ts <- HCT.getCurrentTimestamp
     -- Log.debug . Log.buildString $ "### Advance time to " <> show ts
-    DiffFlow.advanceInput shard inNode (DiffFlow.Timestamp ts [])
+    DiffFlow.advanceInput workers inNode (DiffFlow.Timestamp ts [])
     threadDelay 1000
 
   -- push output from OUTPUT node
   replicateM_ 5 $ do
-    DiffFlow.popOutput shard (outNode out) (threadDelay 100000) $ \dcb@DiffFlow.DataChangeBatch{..} -> do
+    DiffFlow.popOutput workers (outNode out) (threadDelay 100000) $ \dcb -> do
       Log.debug . Log.buildString $ "~~~ POPOUT: " <> show dcb
       modifyMVar_ out_m
-        (\old -> return $ DiffFlow.updateDataChangeBatch' old (\xs -> xs ++ dcbChanges))
+        (\old -> return $ DiffFlow.updateDataChangeBatch' old (\xs -> xs ++ DiffFlow.dcbChanges dcb))
 
   -- stop DiffFlow.run
   putMVar stop_m ()
@@ -321,58 +345,90 @@ instance ChangeLogger (S.LDClient, S.C_LogID) where
 ---- store processing node states (snapshot)
 -- do nothing
 instance Snapshotter () where
-  snapshot () _ _ = return ()
+  snapshotGet () _ = return Nothing
+  snapshotRange () _ _ = return []
+  snapshotBatch () _ = return ()
 
 -- use rocksdb
 instance Snapshotter RocksDB.DB where
-  snapshot db = RocksDB.put db def
-
--- | Do snapshot for a task, then trim old changelogs for this task.
---   May throw exceptions.
-doSnapshot :: (ChangeLogger h1, Snapshotter h2) => h1 -> h2 -> Task -> IO ()
+  snapshotGet db = RocksDB.get db def
+  snapshotRange = readRange
+  snapshotBatch = writeBatch
+
+-- | Take the changes of the stores of a task since the previous snapshot,
+--   and return the action which writes them and then trims old changelogs
+--   for this task. Only the taking is done by the processing thread, the
+--   action may be run by another one. The action may throw exceptions.
+doSnapshot :: (ChangeLogger h1, Snapshotter h2) => h1 -> h2 -> Task -> IO (IO ())
 doSnapshot h1 h2 Task{..} = do
   changelogTail <- getChangelogProgress h1
-  forM_ (HM.toList taskStores) $ \(storeName, (ess,_)) -> do
+  changes <- forM (HM.toList taskStores) $ \(storeName, (ess,_)) -> do
     let key = StateStoreSnapshotKey
             { snapshotQueryId = taskName
             , snapshotStoreName = storeName
             }
-    value <- case ess of
-      EKVStateStore dekvs -> do
-        let ekvs = fromDEKVStoreToEKVStore @K @V dekvs
-        extData <- ksDump ekvs
-        return $ SnapshotKS changelogTail extData
-      ESessionStateStore desss -> do
-        let esss = fromDESessionStoreToESessionStore @K @V desss
-        extData <- ssDump esss
-        return $ SnapshotSS changelogTail extData
-      ETimestampedKVStateStore detkvs -> do
-        let etkvs = fromDETimestampedKVStoreToETimestampedKVStore @Ser @Ser detkvs
-        extData <- tksDump etkvs
-        return $ SnapshotTKS changelogTail extData
-    let keySer   = BL.toStrict $ Aeson.encode key
-        valueSer = BL.toStrict $ Aeson.encode value
-    snapshot h2 keySer valueSer
-  Log.debug $ "Query " <> Log.build taskName <> ": I have successfully done a snapshot!"
-  trimChangelog h1 changelogTail
-  Log.debug $ "Query " <> Log.build taskName <> ": I have successfully trimmed the old changelog!"
+    (key,) <$> takeSnapshotChanges @K @V @Ser ess
+  return $ do
+    writes <- forM changes $ \(key, c) ->
+      snapshotWrites h2 jsonEntryCodec jsonEntryCodec bytesEntryCodec key changelogTail c
+    snapshotBatch h2 (concat writes)
+    Log.debug $ "Query " <> Log.build taskName <> ": I have successfully done a snapshot!"
+    trimChangelog h1 changelogTail
+    Log.debug $ "Query " <> Log.build taskName <> ": I have successfully trimmed the old changelog!"
 
 --------------------------------------------------------------------------------
 
 -- This function may throw exceptions just like 'runTask'.
-runTaskWrapper :: ServerContext -> SourceConnectorWithoutCkp -> SinkConnector -> TaskBuilder -> Text -> S.C_LogID -> IO ()
-runTaskWrapper ServerContext{..} sourceConnector sinkConnector taskBuilder queryId logId = do
+runTaskWrapper :: ServerContext -> SourceConnectorWithoutCkp -> SinkConnector -> TaskBuilder -> Text -> S.C_LogID
+#ifdef HStreamEnableSchema
+               -> HM.HashMap Text SourcePushdown
+#endif
+               -> IO ()
+runTaskWrapper ServerContext{..} sourceConnector sinkConnector taskBuilder queryId logId
+#ifdef HStreamEnableSchema
+               pushdowns
+#endif
+               = do
   -- RUN TASK
+#ifdef HStreamEnableSchema
+  -- The source records are converted with the schema pruned to the columns
+  -- the query reads, and those on which the pushed-down predicate is not
+  -- TRUE are dropped before entering the task.
+  let getSchema stream = P.getSchema metaHandle stream <&> fmap (\schema ->
+        case HM.lookup stream pushdowns of
+          Nothing -> (schema, Nothing, const True)
+          Just pd@SourcePushdown{..} ->
+            ( schema
+            , pruneSchema pd schema <$ pushdownColumns
+            , case pushdownPredicate of
+                Nothing -> const True
+                Just p  -> let f = scalarExprToFun p
+                            in \o -> case f o of
+                                      Right (FlowBoolean True) -> True
+                                      _                        -> False
+            ))
+      transKSrc = \(s,_,_) bl -> case Aeson.decode bl of
+                          Nothing -> Nothing
+                          Just k  -> Just . Aeson.encode $
+                                     jsonObjectToFlowObject s k
+      transVSrc = \(s,pruned_m,predicate) bl -> case Aeson.decode bl of
+                          Nothing -> Nothing
+                          Just v  -> let o = maybe (jsonObjectToFlowObject s v)
+                                                   (`jsonObjectToFlowObjectOnly` v) pruned_m
+                                      in if predicate o then Just (Aeson.encode o) else Nothing
+#else
   let transKSrc = \s bl -> case Aeson.decode bl of
                           Nothing -> Nothing
                           Just k  -> Just . Aeson.encode $
                                      jsonObjectToFlowObject s k
       transVSrc = transKSrc
-      transKSnk = \bl -> case Aeson.decode bl of
+#endif
+  let transKSnk = \bl -> case Aeson.decode bl of
                              Nothing -> Nothing
                              Just k  -> Just . Aeson.encode $
                                         flowObjectToJsonObject k
-      transVSnk = transKSnk
+      -- the values are written to the sink stream as they are
+      transVSnk = fmap flowObjectToRecordPayload . Aeson.decode
   case querySnapshotter of
     Nothing -> do
       Log.warning "Snapshotting is not available. Only changelog is working..."
@@ -383,9 +439,9 @@ runTaskWrapper ServerContext{..} sourceConnector sinkConnector taskBuilder query
               queryId
               (scLDClient,logId)
               ()
-              (\_ -> return ())
+              (\_ -> return (return ()))
 #ifdef HStreamEnableSchema
-              (P.getSchema metaHandle)
+              getSchema
 #endif
               transKSrc
               transVSrc
@@ -401,7 +457,7 @@ runTaskWrapper ServerContext{..} sourceConnector sinkConnector taskBuilder query
               db
               (doSnapshot (scLDClient,logId) db)
 #ifdef HStreamEnableSchema
-              (P.getSchema metaHandle)
+              getSchema
 #endif
               transKSrc
               transVSrc
@@ -423,17 +479,57 @@ createQueryAndRun ctx@ServerContext{..} qRunner@QueryRunner{..} = do
               Left  err   -> P.deleteQueryInfo qRQueryName metaHandle
                           >> throwIO err
   -- update metadata & fork working thread
-  runQuery ctx qRunner logId
+  qRunner' <- withQueryStateStores ctx False qRunner
+  runQuery ctx qRunner' logId
 
 restoreStateAndRun :: ServerContext -> QueryRunner -> IO ()
-restoreStateAndRun ctx@ServerContext{..} qRunner@QueryRunner{..} = do
+restoreStateAndRun ctx@ServerContext{..} qRunner_0@QueryRunner{..} = do
   M.updateMeta qRQueryName P.QueryResuming Nothing metaHandle
+  qRunner <- withQueryStateStores ctx True qRunner_0
   (newBuilder, logId) <- try @SomeException (restoreState ctx qRunner) >>= \case
     Right x  -> return x
     Left err -> M.updateMeta qRQueryName P.QueryAborted Nothing metaHandle
              >> throwIO err
   runQuery ctx qRunner {qRTaskBuilder = newBuilder} logId
 
+-- | Keep the state stores of a query in the snapshot database instead of
+-- in memory, if the server is configured to. Each store owns the keys under
+-- the names of the query and the store (the length-framed prefixes do not
+-- clash with the snapshot keys, which are JSON objects). A new query starts
+-- from empty stores, a restored one from its snapshot and changelog as
+-- usual. Views keep their stores in memory, since they are read directly.
+withQueryStateStores :: ServerContext -> Bool -> QueryRunner -> IO QueryRunner
+withQueryStateStores ServerContext{..} restored qRunner@QueryRunner{..}
+  | not (_queryRocksDBStateStores serverOpts) || not qRWhetherToHStore = return qRunner
+  | otherwise = case querySnapshotter of
+      Nothing -> do
+        Log.warning "Snapshot database is not available. Keeping the state of the query in memory..."
+        return qRunner
+      Just db -> do
+        stores' <- flip HM.traverseWithKey (stores qRTaskBuilder) $ \storeName (ess, processors) -> do
+          h <- mkRocksDBHandle db $ defaultRocksDBStoreOptions [encodeUtf8 qRQueryName, encodeUtf8 storeName]
+          unless restored $ clearRocksDBHandle h
+          (, processors) <$> rocksDBStateStore h ess
+        return qRunner { qRTaskBuilder = qRTaskBuilder { stores = stores' } }
+  where
+    -- the aggregations keep flow objects, the joins serialized records
+    rocksDBStateStore h ess = case ess of
+      EKVStateStore _ ->
+        wrapStateStore @K @V <$> mkRocksDBStateKVStore h flowObjectSerde flowObjectSerde
+      ESessionStateStore _ ->
+        wrapStateStore @K @V <$> mkRocksDBStateSessionStore h flowObjectSerde flowObjectSerde
+      ETimestampedKVStateStore _ ->
+        wrapStateStore @Ser @Ser <$> mkRocksDBStateTimestampedKVStore h bytesSerde bytesSerde
+    bytesSerde = Serde (Serializer id) (Deserializer id)
+
+-- | Remove the state stores of a deleted query from the snapshot database,
+-- see 'withQueryStateStores'. They are removed whether or not the server is
+-- configured to keep them there now, since the query may have been created
+-- before.
+deleteQueryStateStores :: ServerContext -> Text -> IO ()
+deleteQueryStateStores ServerContext{..} qName =
+  forM_ querySnapshotter $ \db -> deleteRocksDBPrefix db [encodeUtf8 qName]
+
 restoreState :: ServerContext -> QueryRunner -> IO (TaskBuilder, S.C_LogID)
 restoreState ServerContext{..} QueryRunner{..} = do
   (builder_1, lsn_1) <- case querySnapshotter of
@@ -441,22 +537,25 @@ restoreState ServerContext{..} QueryRunner{..} = do
       Log.warning "Snapshot is not available. Roll back to changelog-based restoration..."
       return (qRTaskBuilder, S.LSN_MIN)
     Just db ->
-      foldlM (\(acc_builder,acc_lsn) storeName -> do
+      foldlM (\(acc_builder,acc_lsn) (storeName, (ess,_)) -> do
                  let key = StateStoreSnapshotKey
                          { snapshotQueryId = qRQueryName
                          , snapshotStoreName = storeName
                          }
                      keySer = BL.toStrict $ Aeson.encode key
-                 RocksDB.get db def keySer >>= \case
-                   Nothing       -> return (acc_builder,acc_lsn)
-                   Just valueSer -> do
-                     let (sv :: StateStoreSnapshotValue S.LSN K V Ser) =
-                           fromJust (Aeson.decode $ BL.fromStrict valueSer)
+                 -- an incremental snapshot, or a whole one written by an
+                 -- older version
+                 sv_m <- readSnapshot db jsonEntryCodec jsonEntryCodec bytesEntryCodec key ess >>= \case
+                   Just sv -> return (Just sv)
+                   Nothing -> fmap (fromJust . Aeson.decode . BL.fromStrict) <$> RocksDB.get db def keySer
+                 case sv_m of
+                   Nothing -> return (acc_builder,acc_lsn)
+                   Just (sv :: StateStoreSnapshotValue S.LSN K V Ser) -> do
                      (builder_m, i) <- applyStateStoreSnapshot acc_builder key sv
                      case builder_m of
                        Nothing       -> return (acc_builder,acc_lsn)
                        Just builder' -> return (builder',i)
-             ) (qRTaskBuilder, S.LSN_MIN) (HM.keys $ stores qRTaskBuilder)
+             ) (qRTaskBuilder, S.LSN_MIN) (HM.toList $ stores qRTaskBuilder)
   -- changelog
   Log.debug $ "Snapshot restoration for query with name" <> Log.build qRQueryName
            <> " completed, restoring the rest of the computation from changelog"
@@ -495,13 +594,26 @@ runQuery ctx@ServerContext{..} QueryRunner{..} logId = do
   modifyMVar_ runningQueries (return . HM.insert qRQueryName (tid, qRConsumerClosed))
   where
     msgPrefix = "createQueryAndRun (from CREATE AS SELECT or INSERT SELECT): query "
-    sinkConnector = if qRWhetherToHStore then HStore.hstoreSinkConnector ctx
-                                         else HStore.blackholeSinkConnector
+    withSinkConnector f = if qRWhetherToHStore
+      then HStore.withHStoreSinkConnector ctx HStore.defaultSinkBatchOptions f
+      else f HStore.blackholeSinkConnector
     sourceConnector = HStore.hstoreSourceConnectorWithoutCkp ctx qRQueryName qRConsumerClosed
-    action = do
+    action = withSinkConnector $ \sinkConnector -> do
       Log.debug $ "Start Query " <> Log.build qRQueryString
                 <> "with name: " <> Log.build qRQueryName
+#ifdef HStreamEnableSchema
+      -- the plan is derived again from the SQL, like when restoring a query
+      pushdowns <- try @SomeException (sourcePushdowns qRQueryString (P.getSchema metaHandle)) >>= \case
+        Right pds -> return pds
+        Left err  -> do
+          Log.warning $ "Query " <> Log.build qRQueryName
+                     <> ": reading the sources in full, failed to plan the pushdowns: "
+                     <> Log.buildString' err
+          return HM.empty
+      runTaskWrapper ctx sourceConnector sinkConnector qRTaskBuilder qRQueryName logId pushdowns
+#else
       runTaskWrapper ctx sourceConnector sinkConnector qRTaskBuilder qRQueryName logId
+#endif
     cleanup =
       [ Handler (\(e :: HE.StreamReadClose) -> do
                     Log.info . Log.buildString
@@ -542,3 +654,8 @@ amIStream ServerContext{..} name = S.doesStreamExist scLDClient (S.transToStream
 
 amIView :: ServerContext -> Text -> IO Bool
 amIView ServerContext{..} name = M.checkMetaExists @P.ViewInfo name metaHandle
+
+-- | The payload of a record the query writes to its sink stream, i.e. the
+-- encoded Struct of the row.
+flowObjectToRecordPayload :: FlowObject -> BL.ByteString
+flowObjectToRecordPayload = PB.toLazyByteString . jsonObjectToStruct . flowObjectToJsonObject
@@ -38,11 +38,7 @@ adminCommandStatsSpec = aroundAll provideHstreamApi $ describe "adminCommandStat
       payloads <- V.map (mkHStreamRecord header) <$> V.replicateM 10 (newRandomByteString 1024)
       forM_ streamNames $ \(name, shardId) -> replicateM_ 100 $ appendRequest api name shardId payloads
 
-      resp <- adminCommandStatsReq api
-      let Just (Just resultObj) =
-            A.decode @(Maybe A.Object) . TL.encodeUtf8 . TL.fromStrict . adminCommandResponseResult $ resp
-          Just (A.Object content) = Aeson.lookup "content" resultObj
-      let Just (A.Array rows) = Aeson.lookup "rows" content
+      rows <- responseRows <$> adminCommandStatsReq api
 
       forM_ rows $ \(A.Array row) -> do
         let (A.String name) = row V.! 0
@@ -51,9 +47,28 @@ adminCommandStatsSpec = aroundAll provideHstreamApi $ describe "adminCommandStat
           row V.! 1 `shouldSatisfy` (\(A.String x) -> read @Double (T.unpack x) > 0)
           row V.! 2 `shouldSatisfy` (\(A.String x) -> read @Double (T.unpack x) > 0)
 
+    it "stats log_path_cache" $ \(api, _) -> do
+      rows <- responseRows <$> adminCommandReq api "server stats log_path_cache all"
+      -- hits, misses, invalidations and size of the cache of the server
+      let [A.Array row] = V.toList rows
+      (\(A.String x) -> read @Int (T.unpack x)) <$> V.toList row
+        `shouldSatisfy` (\xs -> length xs == 4 && all (>= 0) xs)
+
 adminCommandStatsReq :: HStreamApi ClientRequest ClientResult -> IO AdminCommandResponse
-adminCommandStatsReq HStreamApi{..} = do
+adminCommandStatsReq api =
+  adminCommandReq api "server stats stream appends --intervals 1min --intervals 2min"
+
+adminCommandReq :: HStreamApi ClientRequest ClientResult -> T.Text -> IO AdminCommandResponse
+adminCommandReq HStreamApi{..} cmd = do
   let requestTimeout = 10
-      statReq = AdminCommandRequest "server stats stream appends --intervals 1min --intervals 2min"
-      req = ClientNormalRequest statReq requestTimeout $ MetadataMap Map.empty
+      req = ClientNormalRequest (AdminCommandRequest cmd) requestTimeout $ MetadataMap Map.empty
   getServerResp =<< hstreamApiSendAdminCommand req
+
+-- | The rows of the table of a response.
+responseRows :: AdminCommandResponse -> V.Vector A.Value
+responseRows resp =
+  let Just (Just resultObj) =
+        A.decode @(Maybe A.Object) . TL.encodeUtf8 . TL.fromStrict . adminCommandResponseResult $ resp
+      Just (A.Object content) = Aeson.lookup "content" resultObj
+      Just (A.Array rows) = Aeson.lookup "rows" content
+   in rows
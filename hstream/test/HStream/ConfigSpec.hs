@@ -103,6 +103,7 @@ defaultConfig = ServerOpts
   , _ldConfigPath              = "/data/store/logdevice.conf"
   , _topicRepFactor            = 1
   , _ckpRepFactor              = 1
+  , _ckpCacheTtl               = -1
   , _compression               = CompressionNone
   , _maxRecordSize             = 1024 * 1024 * 1024
   , _tlsConfig                 = Nothing
@@ -125,6 +126,8 @@ defaultConfig = ServerOpts
   , _gossipOpts                = defaultGossipOpts
   , _ioOptions                 = defaultIOOptions
   , _querySnapshotPath         = "/data/query_snapshots"
+  , _queryWorkers              = 1
+  , _queryRocksDBStateStores   = False
   , experimentalFeatures       = []
   , grpcChannelArgs            = []
   , serverTokens               = []
@@ -187,6 +190,7 @@ instance ToJSON GossipOpts where
     , "gossip-interval"   .= Number (fromIntegral gossipInterval)
     , "probe-interval"    .= Number (fromIntegral probeInterval)
     , "roundtrip-timeout" .= Number (fromIntegral roundtripTimeout)
+    , "max-piggyback-bytes" .= Number (fromIntegral maxPiggybackBytes)
     ]
 
 instance ToJSON IOOptions where
@@ -269,6 +273,7 @@ instance Arbitrary ServerOpts where
     let _ldConfigPath   = "/data/store/logdevice.conf"
     let _topicRepFactor = 1
     let _ckpRepFactor   = 1
+    let _ckpCacheTtl    = -1
     let _compression = CompressionNone
     _maxRecordSize             <- arbitrary
     _tlsConfig                 <- arbitrary
@@ -289,6 +294,8 @@ instance Arbitrary ServerOpts where
     _gossipOpts                <- arbitrary
     _ioOptions                 <- arbitrary
     let _querySnapshotPath = "/data/query_snapshots"
+    let _queryWorkers = 1
+    let _queryRocksDBStateStores = False
     _listenersSecurityProtocolMap <- M.fromList . zip listenersKeys . repeat <$> elements ["plaintext", "tls"]
     let _securityProtocolMap = M.fromList [("plaintext", Nothing), ("tls", _tlsConfig)]
     let experimentalFeatures = []
@@ -352,6 +359,7 @@ instance Arbitrary GossipOpts where
     gossipInterval   <- arbitrary
     probeInterval    <- arbitrary
     roundtripTimeout <- arbitrary
+    maxPiggybackBytes <- arbitrary
     let joinWorkerConcurrency = 10
     pure GossipOpts{..}
 
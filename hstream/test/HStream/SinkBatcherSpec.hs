@@ -0,0 +1,77 @@
+module HStream.SinkBatcherSpec (spec) where
+
+import           Control.Concurrent        (newEmptyMVar, putMVar,
+                                            readMVar, threadDelay)
+import           Control.Exception         (ErrorCall (..), throwIO)
+import           Control.Monad             (forM_, when)
+import qualified Data.ByteString.Char8     as BSC
+import           Data.IORef
+import qualified Data.Map.Strict           as Map
+import           System.Random             (randomRIO)
+import           Test.Hspec
+
+import           HStream.Exception         (StreamNotFound (..))
+import           HStream.Server.HStore
+import qualified HStream.Server.HStreamApi as API
+import           HStream.Utils             (buildRecordHeader, mkHStreamRecord)
+
+spec :: Spec
+spec = describe "HStream.SinkBatcherSpec" $ do
+  let opts = defaultSinkBatchOptions { sinkBatchMaxRecords  = 3
+                                     , sinkBatchMaxDelayMs  = 1
+                                     , sinkBatchMaxInflight = 4
+                                     }
+
+  it "appends the records of a stream in order" $ do
+    appended <- newIORef Map.empty
+    let append stream SinkBatch{..} = do
+          -- later appends may finish earlier if they are not serialized
+          randomRIO (0, 2000) >>= threadDelay
+          atomicModifyIORef' appended $ \m ->
+            (Map.insertWith (flip (++)) stream (reverse $ payloads sinkBatchRecords) m, ())
+    batcher <- newSinkBatcher opts maxBound append
+    forM_ [1 .. 100 :: Int] $ \i -> do
+      addSinkRecord batcher "s1" (record i) 1
+      addSinkRecord batcher "s2" (record (-i)) 1
+    flushSinkBatcher batcher
+    m <- readIORef appended
+    Map.lookup "s1" m `shouldBe` Just (show <$> [1 .. 100 :: Int])
+    Map.lookup "s2" m `shouldBe` Just (show . negate <$> [1 .. 100 :: Int])
+    closeSinkBatcher batcher
+
+  it "throws a missing stream on flush, write and close" $ do
+    appended <- newIORef (0 :: Int)
+    started <- newEmptyMVar
+    let append _ _ = do
+          readMVar started
+          n <- atomicModifyIORef' appended (\n -> (n + 1, n))
+          when (n == 1) $ throwIO (StreamNotFound "s")
+        notFound (StreamNotFound _) = True
+    batcher <- newSinkBatcher opts maxBound append
+    forM_ [1 .. 9 :: Int] $ \i -> addSinkRecord batcher "s" (record i) 1
+    putMVar started ()
+    flushSinkBatcher batcher `shouldThrow` notFound
+    -- the batches after the failed one are not appended
+    readIORef appended `shouldReturn` 2
+    addSinkRecord batcher "s" (record 10) 1 `shouldThrow` notFound
+    closeSinkBatcher batcher `shouldThrow` notFound
+
+  it "drops the batches of other failures" $ do
+    appended <- newIORef []
+    let append _ SinkBatch{..} = do
+          let ps = reverse $ payloads sinkBatchRecords
+          when ("4" `elem` ps) $ throwIO (ErrorCall "append failed")
+          atomicModifyIORef' appended (\xs -> (xs ++ ps, ()))
+    -- the batches are full before they are appended for their delay
+    batcher <- newSinkBatcher opts { sinkBatchMaxDelayMs = 1000 } maxBound append
+    forM_ [1 .. 9 :: Int] $ \i -> addSinkRecord batcher "s" (record i) 1
+    flushSinkBatcher batcher
+    readIORef appended `shouldReturn` (show <$> [1, 2, 3, 7, 8, 9 :: Int])
+    closeSinkBatcher batcher
+
+record :: Int -> API.HStreamRecord
+record i = mkHStreamRecord (buildRecordHeader API.HStreamRecordHeader_FlagRAW Map.empty "")
+                           (BSC.pack $ show i)
+
+payloads :: [API.HStreamRecord] -> [String]
+payloads = map (BSC.unpack . API.hstreamRecordPayload)
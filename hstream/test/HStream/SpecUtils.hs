@@ -250,7 +250,7 @@ runFetchSql sql = withGRPCClient clientConfig $ \client -> do
 --   let nameCB = textToCBytes name
 --   client <- S.newLDClient "/data/store/logdevice.conf"
 --   logId <- S.getUnderlyingLogId client (S.mkStreamId S.StreamTypeStream nameCB) Nothing
---   reader <- S.newLDRsmCkpReader client nameCB S.checkpointStoreLogID 5000 1 Nothing
+--   reader <- S.newLDRsmCkpReader client nameCB S.checkpointStoreLogID 5000 (-1) 1 Nothing
 --   S.startReadingFromCheckpointOrStart reader logId (Just S.LSN_MIN) S.LSN_MAX
 --   x <- S.ckpReaderRead reader 1000
 --   return $ hstreamRecordBatchBatch . decodeBatchRecord . S.recordPayload $ head x